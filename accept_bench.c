@@ -0,0 +1,272 @@
+/**
+ * @file accept_bench.c
+ * @brief Measure connection admission rate and its effect on live traffic.
+ *
+ * Starts ./chat_server and logs in two clients that exchange a message every
+ * millisecond. After a quiet baseline, a separate process opens a storm of
+ * simultaneous connections; each one logs in and hangs up. Reports how many
+ * connections per second were admitted or rejected and the one-way message
+ * latency between the two live clients before and during the storm.
+ *
+ * Usage:
+ * ./accept_bench [connections] [chat_server options...]
+ */
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TCP_PORT 8888
+#define MAX_BOTS 10000
+#define MAX_SAMPLES 100000
+#define PROMPT_LEN 16
+#define PING_INTERVAL_US 1000
+#define BASELINE_US 1000000
+#define PINGER_TAG 0xffffffffu
+#define STORM_TAG 0xfffffffeu
+
+enum { WAIT_USER_PROMPT, WAIT_PASS_PROMPT, FINISHED };
+
+typedef struct {
+    int fd;
+    int state;
+    size_t prompt_bytes;
+} bot_t;
+
+static pid_t server_pid = 0;
+static bot_t bots[MAX_BOTS];
+static double samples[2][MAX_SAMPLES];
+static int num_samples[2];
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void start_server(char **server_args) {
+    server_pid = fork();
+    if (server_pid == 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDOUT_FILENO);
+        execv("./chat_server", server_args);
+        perror("Failed to start server");
+        exit(1);
+    } else if (server_pid < 0) {
+        perror("Fork failed");
+        exit(1);
+    }
+    sleep(1);
+}
+
+static void stop_server(void) {
+    if (server_pid > 0) {
+        kill(server_pid, SIGINT);
+        waitpid(server_pid, NULL, 0);
+        server_pid = 0;
+    }
+}
+
+static int tcp_connect(int flags) {
+    struct sockaddr_in addr;
+    int sock = socket(AF_INET, SOCK_STREAM | flags, 0);
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(TCP_PORT);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS) {
+        perror("connect");
+        exit(1);
+    }
+    return sock;
+}
+
+static int tcp_login(const char *username) {
+    char buf[64];
+    int sock = tcp_connect(0);
+    recv(sock, buf, PROMPT_LEN, MSG_WAITALL);
+    send(sock, username, strlen(username), 0);
+    recv(sock, buf, PROMPT_LEN, MSG_WAITALL);
+    send(sock, "secret", 6, 0);
+    usleep(200000);
+    // Skip the presence snapshot
+    while (recv(sock, buf, sizeof(buf), MSG_DONTWAIT) > 0) {
+    }
+    return sock;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void report(const char *label, double *v, int n) {
+    if (n == 0) {
+        printf("%-8s no samples\n", label);
+        return;
+    }
+    qsort(v, n, sizeof(double), cmp_double);
+    printf("%-8s %6d msgs  p50 %7.0f us  p99 %7.0f us  max %7.0f us\n", label, n, v[n / 2], v[n * 99 / 100], v[n - 1]);
+}
+
+// Pull "ping <timestamp>" lines out of the receiver's stream
+static void read_pings(int fd, int phase) {
+    static char line[4096];
+    static size_t have = 0;
+    ssize_t r;
+    while ((r = recv(fd, line + have, sizeof(line) - have - 1, MSG_DONTWAIT)) > 0) {
+        have += r;
+        line[have] = '\0';
+        char *start = line, *nl;
+        double now = now_us();
+        while ((nl = strchr(start, '\n')) != NULL) {
+            *nl = '\0';
+            char *ping = strstr(start, "ping ");
+            if (ping && num_samples[phase] < MAX_SAMPLES) {
+                samples[phase][num_samples[phase]++] = now - atof(ping + 5);
+            }
+            start = nl + 1;
+        }
+        have = line + have - start;
+        memmove(line, start, have);
+    }
+}
+
+/*
+ * Run the storm in its own process so the live clients above keep their
+ * schedule. Launches every connection at once, answers the login prompts
+ * and hangs up; writes "<admitted> <rejected> <seconds>" to out_fd.
+ */
+static void run_storm(int num_bots, int out_fd) {
+    struct epoll_event events[256];
+    char buf[4096];
+    int epfd = epoll_create1(0);
+    int resolved = 0, admitted = 0, rejected = 0;
+    double start = now_us();
+    for (int i = 0; i < num_bots; i++) {
+        bots[i].fd = tcp_connect(SOCK_NONBLOCK);
+        bots[i].state = WAIT_USER_PROMPT;
+        bots[i].prompt_bytes = 0;
+        struct epoll_event ev = {.events = EPOLLIN, .data.u32 = i};
+        epoll_ctl(epfd, EPOLL_CTL_ADD, bots[i].fd, &ev);
+    }
+    while (resolved < num_bots && now_us() - start < 60e6) {
+        int n = epoll_wait(epfd, events, 256, 1000);
+        for (int k = 0; k < n; k++) {
+            bot_t *b = &bots[events[k].data.u32];
+            ssize_t r = recv(b->fd, buf, sizeof(buf), 0);
+            if (r < 0 && errno == EAGAIN) continue;
+            int done = 0;
+            if (r <= 0 || (b->prompt_bytes == 0 && strncmp(buf, "Enter", 5) != 0)) {
+                rejected++;
+                done = 1;
+            } else {
+                b->prompt_bytes += r;
+                if (b->state == WAIT_USER_PROMPT && b->prompt_bytes >= PROMPT_LEN) {
+                    char name[32];
+                    int len = snprintf(name, sizeof(name), "bot%d", (int)events[k].data.u32);
+                    send(b->fd, name, len, 0);
+                    b->state = WAIT_PASS_PROMPT;
+                }
+                if (b->state == WAIT_PASS_PROMPT && b->prompt_bytes >= 2 * PROMPT_LEN) {
+                    send(b->fd, "secret", 6, 0);
+                    admitted++;
+                    done = 1;
+                }
+            }
+            if (done) {
+                epoll_ctl(epfd, EPOLL_CTL_DEL, b->fd, NULL);
+                close(b->fd);
+                b->state = FINISHED;
+                resolved++;
+            }
+        }
+    }
+    if (resolved < num_bots) {
+        fprintf(stderr, "storm did not finish within 60 s (%d/%d resolved)\n", resolved, num_bots);
+    }
+    int len = snprintf(buf, sizeof(buf), "%d %d %f", admitted, rejected, (now_us() - start) / 1e6);
+    if (write(out_fd, buf, len) < 0) perror("write");
+}
+
+int main(int argc, char *argv[]) {
+    int num_bots = argc > 1 ? atoi(argv[1]) : 2000;
+    if (num_bots < 1) num_bots = 1;
+    if (num_bots > MAX_BOTS) num_bots = MAX_BOTS;
+    char *server_args[16] = {"chat_server"};
+    for (int i = 2; i < argc && i < 15; i++) server_args[i - 1] = argv[i];
+    signal(SIGPIPE, SIG_IGN);
+
+    start_server(server_args);
+    int sender = tcp_login("pinger");
+    int receiver = tcp_login("ponger");
+    int epfd = epoll_create1(0);
+    struct epoll_event ev = {.events = EPOLLIN, .data.u32 = PINGER_TAG};
+    epoll_ctl(epfd, EPOLL_CTL_ADD, receiver, &ev);
+
+    struct epoll_event events[16];
+    char buf[256];
+    int result_pipe[2] = {-1, -1};
+    pid_t storm_pid = 0;
+    double start = now_us(), next_ping = start, storm_end = 0;
+    int phase = 0;
+    while (phase < 2 || now_us() < storm_end + 200000) {
+        double now = now_us();
+        if (now >= next_ping) {
+            int len = snprintf(buf, sizeof(buf), "ping %.0f\n", now);
+            send(sender, buf, len, 0);
+            next_ping += PING_INTERVAL_US;
+        }
+        if (phase == 0 && now - start >= BASELINE_US) {
+            phase = 1;
+            if (pipe(result_pipe) < 0) {
+                perror("pipe");
+                exit(1);
+            }
+            storm_pid = fork();
+            if (storm_pid == 0) {
+                run_storm(num_bots, result_pipe[1]);
+                _exit(0);
+            }
+            ev.data.u32 = STORM_TAG;
+            epoll_ctl(epfd, EPOLL_CTL_ADD, result_pipe[0], &ev);
+        }
+        int timeout = (int)((next_ping - now_us()) / 1000);
+        int n = epoll_wait(epfd, events, 16, timeout > 0 ? timeout : 0);
+        for (int k = 0; k < n; k++) {
+            if (events[k].data.u32 == PINGER_TAG) {
+                read_pings(receiver, phase == 1 ? 1 : 0);
+            } else {
+                epoll_ctl(epfd, EPOLL_CTL_DEL, result_pipe[0], NULL);
+                storm_end = now_us();
+                phase = 2;
+            }
+        }
+    }
+
+    int admitted = 0, rejected = 0;
+    double secs = 0;
+    ssize_t len = read(result_pipe[0], buf, sizeof(buf) - 1);
+    buf[len > 0 ? len : 0] = '\0';
+    sscanf(buf, "%d %d %lf", &admitted, &rejected, &secs);
+    waitpid(storm_pid, NULL, 0);
+    printf("storm of %d connections: %.2f s, %d admitted (%.0f/s), %d rejected\n",
+           num_bots, secs, admitted, secs > 0 ? admitted / secs : 0, rejected);
+    report("idle", samples[0], num_samples[0]);
+    report("storm", samples[1], num_samples[1]);
+    close(sender);
+    close(receiver);
+    close(epfd);
+    stop_server();
+    return 0;
+}
@@ -3,8 +3,12 @@
  * @brief User authentication module implementation for chat server.
  */
 #include "auth.h"
+#include "zframe.h"
+#include <ctype.h>
+#include <errno.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/socket.h>
 #include <unistd.h>
 
 int authenticate_user(int sockfd, char *username) {
@@ -26,4 +30,46 @@ int authenticate_user(int sockfd, char *username) {
     buffer[len] = '\0';
     // For now, always succeed
     return 1;
+}
+
+int auth_session_begin(auth_session_t *session, int sockfd) {
+    const char *ask_user = "Enter username: ";
+    session->fd = sockfd;
+    session->awaiting_password = 0;
+    session->username[0] = '\0';
+    session->caps = 0;
+    // A fresh socket always has room for the prompt
+    return send(sockfd, ask_user, strlen(ask_user), MSG_NOSIGNAL) == (ssize_t)strlen(ask_user) ? 0 : -1;
+}
+
+void auth_set_username(auth_session_t *session, char *name) {
+    // Strip trailing " +option" tokens and record the ones understood
+    char *opt;
+    while ((opt = strrchr(name, '+')) && opt > name && isspace((unsigned char)opt[-1])) {
+        size_t len = strcspn(opt, " \t\r\n");
+        if (opt[len + strspn(opt + len, " \t\r\n")] != '\0') break;
+        if (len == strlen(ZFRAME_CAP_TOKEN) && memcmp(opt, ZFRAME_CAP_TOKEN, len) == 0) session->caps |= AUTH_CAP_ZLIB;
+        while (opt > name && isspace((unsigned char)opt[-1])) opt--;
+        *opt = '\0';
+    }
+    strncpy(session->username, name, USERNAME_MAX_LEN);
+    session->username[USERNAME_MAX_LEN - 1] = '\0';
+}
+
+int auth_session_step(auth_session_t *session) {
+    char buffer[USERNAME_MAX_LEN + PASSWORD_MAX_LEN + 32];
+    // Room for options after a name of full length
+    int len = recv(session->fd, buffer, session->awaiting_password ? PASSWORD_MAX_LEN : sizeof(buffer) - 1, MSG_DONTWAIT);
+    if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return AUTH_PENDING;
+    if (len <= 0) return AUTH_FAILED;
+    buffer[len] = '\0';
+    if (session->awaiting_password) {
+        // For now, always succeed
+        return AUTH_OK;
+    }
+    auth_set_username(session, buffer);
+    const char *ask_pass = "Enter password: ";
+    if (send(session->fd, ask_pass, strlen(ask_pass), MSG_NOSIGNAL) != (ssize_t)strlen(ask_pass)) return AUTH_FAILED;
+    session->awaiting_password = 1;
+    return AUTH_PENDING;
 } 
\ No newline at end of file
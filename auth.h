@@ -9,6 +9,7 @@
 
 #define USERNAME_MAX_LEN 32
 #define PASSWORD_MAX_LEN 32
+#define AUTH_CAP_ZLIB 1   // "<name> +zlib": the client inflates ZLIB frames (see zframe.h)
 
 /**
  * @brief Authenticate a user by username and password.
@@ -18,4 +19,50 @@
  */
 int authenticate_user(int sockfd, char *username);
 
+/**
+ * @brief Result of auth_session_step().
+ */
+enum { AUTH_PENDING, AUTH_OK, AUTH_FAILED };
+
+/**
+ * @brief Login handshake driven by readiness instead of blocking reads.
+ */
+typedef struct {
+    int fd;                            /**< Client socket (non-blocking). */
+    int awaiting_password;             /**< Username received, password prompt sent. */
+    char username[USERNAME_MAX_LEN];   /**< Username once received. */
+    int caps;                          /**< AUTH_CAP_* options the client asked for after its name. */
+} auth_session_t;
+
+/**
+ * @brief Start a login handshake by sending the username prompt.
+ * @param session Session to initialize.
+ * @param sockfd Non-blocking client socket.
+ * @return 0 on success, -1 if the prompt could not be sent.
+ */
+int auth_session_begin(auth_session_t *session, int sockfd);
+
+/**
+ * @brief Advance a handshake with whatever input the socket has.
+ *
+ * Same exchange as authenticate_user(), one prompt and one read per step.
+ * Options after the name ("alice +zlib") are moved from the username to caps.
+ *
+ * @param session Session from auth_session_begin().
+ * @return AUTH_PENDING if more input is needed, AUTH_OK once the password
+ *         was received, or AUTH_FAILED if the client hung up.
+ */
+int auth_session_step(auth_session_t *session);
+
+/**
+ * @brief Store a received username.
+ *
+ * Options after the name ("alice +zlib") are moved to caps before the name
+ * is cut to fit USERNAME_MAX_LEN, so a long name keeps its options.
+ *
+ * @param session Session being logged in.
+ * @param name Name as received, NUL-terminated; options are cut off in place.
+ */
+void auth_set_username(auth_session_t *session, char *name);
+
 #endif // AUTH_H 
\ No newline at end of file
@@ -0,0 +1,800 @@
+/**
+ * @file bench.c
+ * @brief In-process microbenchmarks for the chat server hot path.
+ *
+ * Runs the server's building blocks (address formatting, message framing,
+ * client table updates, fan-out and join/leave notices) against an in-memory
+ * transport, so no sockets or network noise are involved. Each benchmark
+ * reports nanoseconds and heap allocations per operation; the text scanner
+ * also reports throughput for each implementation the CPU supports, and the
+ * content filter reports the cost of one scan with 10 and 10,000 patterns. Mailbox
+ * benchmarks use a scratch directory under /tmp. The catch-up benchmarks send a
+ * mailbox batch and a 1024-message multicast repair to one client with and
+ * without zlib compression, and report the bytes each puts on the wire.
+ * The fan-out benchmark is the exception to the in-memory transport: it
+ * times one message to 10000 and 50000 recipients over real loopback TCP
+ * sockets, on the event loop alone and shared with the fan-out helpers.
+ *
+ * Allocations are counted by wrapping malloc/calloc/realloc/free at link time
+ * (see the chat_bench target in the Makefile), so only calls made by the
+ * server objects and this file are counted.
+ *
+ * Usage:
+ * ./chat_bench [iterations-scale]
+ */
+#include "chat.h"
+#include "fanout.h"
+#include "filter.h"
+#include "mailbox.h"
+#include "mcast.h"
+#include "msgtrace.h"
+#include "network_utils.h"
+#include "pool.h"
+#include "presence.h"
+#include "scan.h"
+#include "search.h"
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define FAKE_FD_BASE 1000
+
+static unsigned long alloc_count = 0;
+static size_t sink_bytes = 0;
+static unsigned long sink_calls = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+void *__wrap_malloc(size_t size) {
+    alloc_count++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size) {
+    alloc_count++;
+    return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    alloc_count++;
+    return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void *ptr) {
+    __real_free(ptr);
+}
+
+// In-memory transport: accounts for the bytes instead of writing them
+static ssize_t fake_send(int fd, const struct iovec *iov, int iovcnt) {
+    size_t len = 0;
+    for (int i = 0; i < iovcnt; i++) len += iov[i].iov_len;
+    sink_bytes += len;
+    sink_calls++;
+    return (ssize_t)len;
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+typedef void (*bench_fn)(void *arg);
+
+static double run_bench(const char *name, long iters, bench_fn fn, void *arg) {
+    for (long i = 0; i < iters / 10 + 1; i++) fn(arg);  // warm up
+    unsigned long allocs_before = alloc_count;
+    double start = now_ns();
+    for (long i = 0; i < iters; i++) fn(arg);
+    double elapsed = now_ns() - start;
+    printf("%-36s %10ld %12.1f %10.2f\n", name, iters, elapsed / iters,
+           (double)(alloc_count - allocs_before) / iters);
+    return elapsed / iters;
+}
+
+static void fill_table(client_table_t *table, int count) {
+    memset(table, 0, sizeof(*table));
+    for (int i = 0; i < count; i++) {
+        char name[USERNAME_MAX_LEN];
+        snprintf(name, sizeof(name), "user%d", i);
+        client_table_add(table, FAKE_FD_BASE + i, name);
+    }
+}
+
+/* --- Benchmarks --- */
+
+static void bench_format_address(void *arg) {
+    static char buf[32];
+    format_address((const struct sockaddr_in *)arg, buf);
+    sink_bytes += buf[0];
+}
+
+static const char sample_line[] = "hello everyone, the build on the lab machine is green again\n";
+
+static void bench_format_message(void *arg) {
+    char prefix[USERNAME_MAX_LEN + 4];
+    struct iovec payload = {(void *)sample_line, sizeof(sample_line) - 1};
+    struct iovec msg[3];
+    sink_bytes += chat_message_iov(msg, prefix, sizeof(prefix), "alice", &payload, 1);
+}
+
+static void bench_table_insert_remove(void *arg) {
+    client_table_t *table = arg;
+    int slot = client_table_add(table, FAKE_FD_BASE + MAX_CLIENTS, "newcomer");
+    client_table_remove(table, slot);
+}
+
+static void bench_broadcast(void *arg) {
+    client_table_t *table = arg;
+    chat_broadcast(table, 0, sample_line, sizeof(sample_line) - 1);
+}
+
+static client_table_t *big_table;
+
+static void bench_broadcast_big(void *arg) {
+    chat_broadcastv(big_table, 0, arg, 1);
+}
+
+// The same fan-out with the message sampled by msgtrace
+static void bench_broadcast_traced(void *arg) {
+    client_table_t *table = arg;
+    msgtrace_begin(msgtrace_recv_start());
+    msgtrace_stage(MSGTRACE_RECV, 0);
+    chat_broadcast(table, 0, sample_line, sizeof(sample_line) - 1);
+    msgtrace_stage(MSGTRACE_FANOUT, 0);
+    msgtrace_end();
+}
+
+static presence_t presence;
+
+// Worst case for presence: a flush after every single join and leave
+static void bench_join_leave(void *arg) {
+    client_table_t *table = arg;
+    int slot = client_table_add(table, FAKE_FD_BASE + MAX_CLIENTS, "newcomer");
+    presence_joined(&presence, &table->clients[slot]);
+    presence_flush(&presence, table, 0);
+    presence_left(&presence, &table->clients[slot]);
+    client_table_remove(table, slot);
+    presence_flush(&presence, table, 0);
+}
+
+/* --- Search index benchmarks --- */
+
+#define SEARCH_SAMPLE_MSGS 1024
+
+static char search_msgs[SEARCH_SAMPLE_MSGS][160];
+static long search_next = 0;
+
+// Messages of 12 words drawn from a 5000-word vocabulary, skewed to common words
+static void make_search_msgs(void) {
+    srand(42);
+    for (int i = 0; i < SEARCH_SAMPLE_MSGS; i++) {
+        size_t len = 0;
+        for (int w = 0; w < 12; w++) {
+            int word = rand() % (1 + rand() % 5000);
+            len += snprintf(search_msgs[i] + len, sizeof(search_msgs[i]) - len, "w%d ", word);
+        }
+    }
+}
+
+static void bench_search_add(void *arg) {
+    const char *msg = search_msgs[search_next++ % SEARCH_SAMPLE_MSGS];
+    search_index_add(arg, "alice", msg, strlen(msg), 0);
+}
+
+static void bench_search_query(void *arg) {
+    char out[8192];
+    search_index_query(arg, "w3 w17", out, sizeof(out));
+}
+
+static void bench_search_submit(void *arg) {
+    const char *msg = search_msgs[search_next++ % SEARCH_SAMPLE_MSGS];
+    struct iovec iov = {(void *)msg, strlen(msg)};
+    search_submit_message("alice", &iov, 1);
+}
+
+/* --- Allocator benchmarks --- */
+
+#define SCAN_BUF_SIZE 65536
+
+typedef struct {
+    const char *name;
+    char *data;
+    size_t len;
+} scan_input_t;
+
+static void bench_scan(void *arg) {
+    scan_input_t *in = arg;
+    struct iovec iov = {in->data, in->len};
+    sink_bytes += scan_message(&iov, 1);
+}
+
+// Fill buf with chat text; every other word is non-ASCII when utf8 is set
+static void make_scan_input(char *buf, size_t len, int utf8) {
+    static const char *ascii_words[] = {"hello", "build", "green", "lab", "machine", "again", "ok"};
+    static const char *utf8_words[] = {"héllo", "größe", "日本語", "привет", "✓", "😀", "naïve"};
+    size_t n = 0;
+    for (int w = 0; n < len; w++) {
+        const char *word = (utf8 && (w & 1)) ? utf8_words[w % 7] : ascii_words[w % 7];
+        size_t wl = strlen(word);
+        if (n + wl + 1 > len) break;
+        memcpy(buf + n, word, wl);
+        n += wl;
+        buf[n++] = (w % 12 == 11) ? '\n' : ' ';
+    }
+    memset(buf + n, ' ', len - n);
+}
+
+// Compare every implementation against known answers and against each other
+static void scan_selfcheck(void) {
+    static const struct {
+        const char *text;
+        int ok;
+    } known[] = {
+        {"plain text\n", 1}, {"tab\tand\r\n", 1}, {"h\xc3\xa9llo \xe2\x9c\x93 \xf0\x9f\x98\x80", 1},
+        {"bell\x07", 0}, {"esc\x1b[2J", 0}, {"del\x7f", 0}, {"c1 \xc2\x85", 0},
+        {"overlong \xc0\xaf", 0}, {"overlong \xe0\x80\xaf", 0}, {"surrogate \xed\xa0\x80", 0},
+        {"too large \xf4\x90\x80\x80", 0}, {"truncated \xe2\x9c", 0}, {"stray \x80", 0},
+        {"bad lead \xff", 0},
+    };
+    const char *impls[] = {"scalar", "sse2", "avx2"};
+    char buf[256];
+    int cases = 0, mismatches = 0;
+    srand(42);
+    for (int round = 0; round < 20000; round++) {
+        size_t len;
+        int expect = -1;
+        if (round < (int)(sizeof(known) / sizeof(known[0]))) {
+            // Place each known case at a varying offset so vector blocks split it differently
+            size_t pad = round * 7 % 40;
+            memset(buf, 'a', pad);
+            len = pad + strlen(known[round].text);
+            memcpy(buf + pad, known[round].text, strlen(known[round].text));
+            expect = known[round].ok;
+        } else {
+            make_scan_input(buf, sizeof(buf), 1);
+            len = 1 + rand() % sizeof(buf);
+            for (int k = rand() % 3; k > 0; k--) buf[rand() % len] = (char)(rand() % 256);
+        }
+        size_t split = rand() % (len + 1);
+        struct iovec iov[2] = {{buf, split}, {buf + split, len - split}};
+        int answers[3];
+        for (int i = 0; i < 3; i++) {
+            answers[i] = -1;
+            if (scan_select(impls[i]) < 0) continue;
+            answers[i] = scan_message(iov, 2);
+            if (expect >= 0 && answers[i] != expect) mismatches++;
+            if (answers[0] >= 0 && answers[i] != answers[0]) mismatches++;
+        }
+        cases++;
+    }
+    scan_select(NULL);
+    printf("scan_selfcheck: %d cases, %d mismatches\n", cases, mismatches);
+}
+
+static void run_scan_benches(long scale) {
+    static char ascii_buf[SCAN_BUF_SIZE], utf8_buf[SCAN_BUF_SIZE];
+    make_scan_input(ascii_buf, sizeof(ascii_buf), 0);
+    make_scan_input(utf8_buf, sizeof(utf8_buf), 1);
+    scan_input_t inputs[] = {
+        {"ascii/64k", ascii_buf, SCAN_BUF_SIZE},
+        {"utf8/64k", utf8_buf, SCAN_BUF_SIZE},
+        {"ascii/64", ascii_buf, 64},
+    };
+    const char *impls[] = {"scalar", "sse2", "avx2"};
+    scan_selfcheck();
+    for (int i = 0; i < 3; i++) {
+        if (scan_select(impls[i]) < 0) continue;
+        for (int k = 0; k < 3; k++) {
+            char name[64];
+            long iters = 2000000 * scale / (inputs[k].len / 64 + 1) + 100;
+            snprintf(name, sizeof(name), "scan/%s/%s", impls[i], inputs[k].name);
+            double ns = run_bench(name, iters, bench_scan, &inputs[k]);
+            printf("  %.2f GB/s\n", inputs[k].len / ns);
+        }
+    }
+    scan_select(NULL);
+}
+
+static filter_t *bench_filter;
+
+static void bench_filter_scan(void *arg) {
+    scan_input_t *in = arg;
+    struct iovec iov = {in->data, in->len};
+    sink_bytes += filter_scan(bench_filter, &iov, 1);
+}
+
+// Case-insensitive search for every pattern, the slow obvious way
+static int filter_reference(const char **patterns, const int *actions, int count, char *buf, size_t len) {
+    int result = FILTER_PASS;
+    char masked[256];
+    memcpy(masked, buf, len);
+    for (int p = 0; p < count; p++) {
+        size_t pl = strlen(patterns[p]);
+        for (size_t i = 0; i + pl <= len; i++) {
+            if (strncasecmp(buf + i, patterns[p], pl) != 0) continue;
+            if (actions[p] > result) result = actions[p];
+            if (actions[p] == FILTER_MASK) memset(masked + i, '*', pl);
+        }
+    }
+    if (result != FILTER_DROP) memcpy(buf, masked, len);
+    return result;
+}
+
+// Compare the automaton against the reference on random text split over two buffers
+static void filter_selfcheck(void) {
+    static const char *patterns[] = {"he", "she", "his", "hers", "Ushe", "ab", "bab", "abcab", "c", "xyzzy"};
+    static const int actions[] = {FILTER_FLAG, FILTER_MASK, FILTER_FLAG, FILTER_MASK, FILTER_MASK,
+                                  FILTER_FLAG, FILTER_MASK, FILTER_DROP, FILTER_FLAG, FILTER_DROP};
+    char text[512];
+    size_t n = 0;
+    static const char *names[] = {"", "flag ", "mask ", "drop "};
+    for (int p = 0; p < 10; p++) n += snprintf(text + n, sizeof(text) - n, "%s%s\n", names[actions[p]], patterns[p]);
+    filter_t *f = filter_compile(text, n);
+    int cases = 0, mismatches = 0;
+    srand(7);
+    for (int round = 0; round < 20000; round++) {
+        static const char alphabet[] = "abcehrsuxyzHSU ";
+        char a[256], b[256];
+        size_t len = 1 + rand() % sizeof(a);
+        for (size_t i = 0; i < len; i++) a[i] = alphabet[rand() % (sizeof(alphabet) - 1)];
+        memcpy(b, a, len);
+        size_t split = rand() % (len + 1);
+        struct iovec iov[2] = {{a, split}, {a + split, len - split}};
+        int got = filter_scan(f, iov, 2);
+        int want = filter_reference(patterns, actions, 10, b, len);
+        if (got != want || (got != FILTER_DROP && memcmp(a, b, len) != 0)) mismatches++;
+        cases++;
+    }
+    filter_free(f);
+    printf("filter_selfcheck: %d cases, %d mismatches\n", cases, mismatches);
+}
+
+// Pattern file with count entries: mostly made-up words, every eighth a spam URL
+static char *make_filter_patterns(int count, size_t *len) {
+    char *text = malloc((size_t)count * 48);
+    size_t n = 0;
+    srand(count);
+    for (int p = 0; p < count; p++) {
+        if (p % 8 == 7) {
+            n += sprintf(text + n, "drop http://spam%d.example/\n", p);
+            continue;
+        }
+        n += sprintf(text + n, "%s", p % 3 ? "mask " : "flag ");
+        for (int k = 5 + rand() % 8; k > 0; k--) text[n++] = 'a' + rand() % 26;
+        text[n++] = '\n';
+    }
+    *len = n;
+    return text;
+}
+
+static void run_filter_benches(long scale) {
+    static char message[1024];
+    static char line[] = "hello everyone, the build on the lab machine is green again\n";
+    make_scan_input(message, sizeof(message), 0);
+    scan_input_t inputs[] = {
+        {"line", line, sizeof(line) - 1},
+        {"1k", message, sizeof(message)},
+    };
+    int counts[] = {10, 10000};
+    filter_selfcheck();
+    for (int c = 0; c < 2; c++) {
+        size_t len;
+        char *text = make_filter_patterns(counts[c], &len);
+        double start = now_ns();
+        bench_filter = filter_compile(text, len);
+        printf("filter_compile/%d: %.2f ms, ", counts[c], (now_ns() - start) / 1e6);
+        filter_print_info(bench_filter, stdout);
+        printf("\n");
+        for (int k = 0; k < 2; k++) {
+            char name[64];
+            snprintf(name, sizeof(name), "filter_scan/%d_patterns/%s", counts[c], inputs[k].name);
+            double ns = run_bench(name, 2000000 * scale / (inputs[k].len / 64 + 1) + 100, bench_filter_scan, &inputs[k]);
+            printf("  %.2f GB/s\n", inputs[k].len / ns);
+        }
+        filter_free(bench_filter);
+        free(text);
+    }
+}
+
+#define MAIL_USERS 20000
+
+static mailbox_store_t mail;
+static long mail_next = 0;
+
+static void bench_mailbox_put(void *arg) {
+    char to[32];
+    snprintf(to, sizeof(to), "user%ld", mail_next++ % MAIL_USERS);
+    mailbox_put(&mail, to, "alice", sample_line, sizeof(sample_line) - 2, time(NULL));
+}
+
+static void bench_mailbox_take(void *arg) {
+    char to[32], *batch;
+    snprintf(to, sizeof(to), "user%ld", mail_next++ % MAIL_USERS);
+    if (mailbox_take(&mail, to, time(NULL), &batch) > 0) free(batch);
+}
+
+// Store and deliver mail for MAIL_USERS users in a scratch directory
+static void run_mailbox_benches(void) {
+    char dir[] = "/tmp/chat_bench_mailXXXXXX";
+    if (!mkdtemp(dir) || mailbox_open(&mail, dir, MAILBOX_TTL_SECS, MAILBOX_MAX_BYTES) < 0) {
+        perror("mailbox directory");
+        return;
+    }
+    run_bench("mailbox_put/20000_users", MAIL_USERS * 2, bench_mailbox_put, NULL);
+    mail_next = 0;
+    run_bench("mailbox_take/20000_users", MAIL_USERS, bench_mailbox_take, NULL);
+    for (int b = 0; b < MAILBOX_BUCKETS; b++) mailbox_sweep(&mail, time(NULL) + 2 * MAILBOX_TTL_SECS);
+    for (int b = 0; b < MAILBOX_BUCKETS; b++) {
+        char sub[64];
+        snprintf(sub, sizeof(sub), "%s/%02x", dir, b);
+        rmdir(sub);
+    }
+    rmdir(dir);
+}
+
+/* --- Compressed catch-up benchmarks --- */
+
+#define CATCHUP_MAIL 300
+#define CATCHUP_REPAIR 1024
+
+static const char *chat_words[] = {
+    "the", "build", "is", "green", "again", "on", "lab", "machine", "deploy", "window", "moves", "to", "Thursday",
+    "can", "someone", "review", "my", "patch", "for", "login", "timeout", "I", "think", "cache", "was", "cold",
+    "tests", "pass", "locally", "but", "fail", "in", "CI", "who", "owns", "release", "notes", "meeting", "at",
+    "ten", "lunch", "anyone", "ok", "thanks", "see", "runbook", "rollback", "done", "server", "restarted",
+    "latency", "looks", "fine", "now", "ticket", "filed", "please", "check", "logs", "from", "last", "night",
+};
+
+static mcast_sender_t catchup_mcast;
+static char catchup_mail[CATCHUP_MAIL * 160];
+static size_t catchup_mail_len;
+
+// One chat line of 6 to 17 words from a small vocabulary, as people write them
+static size_t make_chat_text(char *out, size_t cap) {
+    size_t len = 0;
+    int words = 6 + rand() % 12;
+    for (int w = 0; w < words && len < cap; w++) {
+        len += snprintf(out + len, cap - len, "%s%s", w ? " " : "", chat_words[rand() % (sizeof(chat_words) / sizeof(chat_words[0]))]);
+    }
+    return len < cap ? len : cap - 1;
+}
+
+// A mailbox batch as mailbox_take() formats it, and a repair history with no multicast socket
+static void make_catchup_data(void) {
+    char text[128];
+    srand(7);
+    catchup_mail_len = snprintf(catchup_mail, sizeof(catchup_mail), "MAIL %d\n", CATCHUP_MAIL);
+    for (int i = 0; i < CATCHUP_MAIL; i++) {
+        size_t n = make_chat_text(text, sizeof(text));
+        catchup_mail_len += snprintf(catchup_mail + catchup_mail_len, sizeof(catchup_mail) - catchup_mail_len,
+                                     "[2026-10-18 %02d:%02d] DM user%d: %.*s\n", 9 + i / 60, i % 60, rand() % 20, (int)n, text);
+    }
+    memset(&catchup_mcast, 0, sizeof(catchup_mcast));
+    catchup_mcast.sock = -1;
+    catchup_mcast.next_seq = catchup_mcast.oldest = 1;
+    for (int i = 0; i < CATCHUP_REPAIR; i++) {
+        char line[160];
+        int n = snprintf(line, sizeof(line), "user%d: ", rand() % 50);
+        n += make_chat_text(line + n, sizeof(line) - n);
+        struct iovec iov = {line, n};
+        mcast_send(&catchup_mcast, 1 + rand() % 50, &iov, 1);
+    }
+}
+
+static void bench_catchup_mail(void *arg) {
+    client_send_lane(arg, OUTQ_BULK, catchup_mail, catchup_mail_len);
+}
+
+static void bench_catchup_repair(void *arg) {
+    mcast_repair(&catchup_mcast, arg, 1, CATCHUP_REPAIR);
+}
+
+static void bench_catchup_repair_uncached(void *arg) {
+    zframe_cache_clear(&catchup_mcast.repair_cache);
+    mcast_repair(&catchup_mcast, arg, 1, CATCHUP_REPAIR);
+}
+
+static char catchup_frame[CATCHUP_MAIL * 160];
+static size_t catchup_frame_len;
+
+static void bench_inflate_mail(void *arg) {
+    static char out[sizeof(catchup_mail)];
+    uLongf len = sizeof(out);
+    if (uncompress((Bytef *)out, &len, (const Bytef *)catchup_frame, catchup_frame_len) == Z_OK) sink_bytes += out[0];
+}
+
+// Also report the bytes the fake transport took per call of fn, warm-up calls included
+static void run_catchup_bench(const char *name, long iters, bench_fn fn, void *arg) {
+    size_t before = sink_bytes;
+    run_bench(name, iters, fn, arg);
+    printf("  %zu bytes on the wire per op\n", (sink_bytes - before) / (iters + iters / 10 + 1));
+}
+
+static void run_zframe_benches(client_table_t *table, long scale) {
+    make_catchup_data();
+    client_t *c = &table->clients[0];
+    c->zlib = 0;
+    run_catchup_bench("catchup_mail/plain", 20000 * scale, bench_catchup_mail, c);
+    run_catchup_bench("catchup_repair_1024/plain", 2000 * scale, bench_catchup_repair, c);
+    c->zlib = 1;
+    run_catchup_bench("catchup_mail/zlib", 2000 * scale, bench_catchup_mail, c);
+    run_catchup_bench("catchup_repair_1024/zlib_every_time", 500 * scale, bench_catchup_repair_uncached, c);
+    run_catchup_bench("catchup_repair_1024/zlib_cached", 20000 * scale, bench_catchup_repair, c);
+    c->zlib = 0;
+
+    zframe_t z;
+    struct iovec iov = {catchup_mail, catchup_mail_len};
+    if (zframe_build(&z, &iov, 1) == 0) {
+        char *body = memchr(z.data, '\n', z.len) + 1;
+        catchup_frame_len = z.len - (body - z.data);
+        memcpy(catchup_frame, body, catchup_frame_len);
+        printf("  mail batch: %zu -> %zu bytes (%.1fx)\n", catchup_mail_len, z.len, (double)catchup_mail_len / z.len);
+        zframe_free(&z);
+        run_bench("inflate_mail_batch", 5000 * scale, bench_inflate_mail, NULL);
+    }
+
+    // A large room message, every other recipient compressed: one deflate per broadcast
+    static char big[ZFRAME_LIVE_MIN * 2];
+    size_t big_len = 0;
+    while (big_len + 160 < sizeof(big)) {
+        big_len += make_chat_text(big + big_len, sizeof(big) - big_len);
+        big[big_len++] = '\n';
+    }
+    fill_table(table, 100);
+    run_catchup_bench("broadcast/100_8k_plain", 20000 * scale, bench_broadcast_big, (void *)&(struct iovec){big, big_len});
+    for (int i = 0; i < 100; i += 2) table->clients[i].zlib = 1;
+    run_catchup_bench("broadcast/100_8k_half_zlib", 5000 * scale, bench_broadcast_big, (void *)&(struct iovec){big, big_len});
+    for (int i = 0; i < 100; i += 2) table->clients[i].zlib = 0;
+    zframe_cache_clear(&catchup_mcast.repair_cache);
+    zframe_print_stats(stdout);
+}
+
+/* --- Parallel fan-out benchmark --- */
+
+#define FANOUT_SOCKETS 1024
+#define FANOUT_ROUNDS 15
+
+static int fanout_tx[FANOUT_SOCKETS], fanout_rx[FANOUT_SOCKETS];
+
+// Loopback connections; recipients share them round-robin to stay within the descriptor limit
+static int open_fanout_sockets(void) {
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    socklen_t len = sizeof(addr);
+    int lsock = socket(AF_INET, SOCK_STREAM, 0);
+    if (lsock < 0 || bind(lsock, (struct sockaddr *)&addr, len) < 0 || listen(lsock, FANOUT_SOCKETS) < 0 ||
+        getsockname(lsock, (struct sockaddr *)&addr, &len) < 0) {
+        perror("fanout listener");
+        return -1;
+    }
+    for (int i = 0; i < FANOUT_SOCKETS; i++) {
+        fanout_rx[i] = socket(AF_INET, SOCK_STREAM, 0);
+        if (fanout_rx[i] < 0 || connect(fanout_rx[i], (struct sockaddr *)&addr, len) < 0 ||
+            (fanout_tx[i] = accept(lsock, NULL, NULL)) < 0) {
+            perror("fanout sockets");
+            close(lsock);
+            return -1;
+        }
+        fcntl(fanout_rx[i], F_SETFL, O_NONBLOCK);
+        fcntl(fanout_tx[i], F_SETFL, O_NONBLOCK);
+    }
+    close(lsock);
+    return 0;
+}
+
+static void drain_fanout_sockets(void) {
+    static char buf[65536];
+    for (int i = 0; i < FANOUT_SOCKETS; i++) {
+        while (recv(fanout_rx[i], buf, sizeof(buf), 0) > 0) {
+        }
+    }
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Median time for one room message to reach every recipient's socket
+static double time_fanout(client_table_t *table, long rounds) {
+    double times[FANOUT_ROUNDS * 10];
+    if (rounds > (long)(sizeof(times) / sizeof(times[0]))) rounds = sizeof(times) / sizeof(times[0]);
+    for (long r = 0; r < rounds; r++) {
+        drain_fanout_sockets();
+        double start = now_ns();
+        chat_broadcast(table, -1, sample_line, sizeof(sample_line) - 1);
+        times[r] = now_ns() - start;
+    }
+    drain_fanout_sockets();
+    qsort(times, rounds, sizeof(times[0]), compare_double);
+    return times[rounds / 2];
+}
+
+static void run_fanout_benches(client_table_t *table, long scale) {
+    if (open_fanout_sockets() < 0) return;
+    // Helpers on an idle core each; three anyway on a single CPU, to show what the pool costs there
+    int helpers = fanout_default_helpers() > 0 ? fanout_default_helpers() : 3;
+    fanout_start(helpers);
+    printf("fanout: %ld CPUs, %d helpers, %d loopback sockets shared by the recipients\n",
+           sysconf(_SC_NPROCESSORS_ONLN), fanout_helpers(), FANOUT_SOCKETS);
+    chat_set_send_fn(NULL);
+    int sizes[] = {10000, 50000};
+    for (int k = 0; k < 2; k++) {
+        fill_table(table, sizes[k]);
+        for (int i = 0; i < sizes[k]; i++) table->clients[i].fd = fanout_tx[i % FANOUT_SOCKETS];
+        chat_set_fanout_min(0);
+        double single = time_fanout(table, FANOUT_ROUNDS * scale);
+        chat_set_fanout_min(FANOUT_MIN_RECIPIENTS);
+        double pooled = time_fanout(table, FANOUT_ROUNDS * scale);
+        printf("fanout/%d: event loop alone %.2f ms (%.2f us/recipient), with %d helpers %.2f ms (%.2fx)\n", sizes[k],
+               single / 1e6, single / 1e3 / sizes[k], fanout_helpers(), pooled / 1e6, single / pooled);
+        for (int i = 0; i < sizes[k]; i++) table->clients[i].fd = 0;
+    }
+    fanout_print_stats(stdout);
+    chat_set_send_fn(fake_send);
+    for (int i = 0; i < FANOUT_SOCKETS; i++) {
+        close(fanout_tx[i]);
+        close(fanout_rx[i]);
+    }
+}
+
+static size_t alloc_size = 64;
+
+static void *volatile alloc_sink;
+
+static void bench_malloc_free(void *arg) {
+    alloc_sink = malloc(alloc_size);
+    free(alloc_sink);
+}
+
+static void bench_pool_alloc_free(void *arg) {
+    alloc_sink = pool_alloc(alloc_size);
+    pool_free(alloc_sink, alloc_size);
+}
+
+static void bench_chain_64k(void *arg) {
+    static char payload[MAX_MESSAGE_SIZE];
+    buf_chain_t chain = {0};
+    buf_chain_append(&chain, payload, sizeof(payload));
+    sink_bytes += chain.nsegs;
+    buf_chain_free(&chain);
+}
+
+static long rss_kb(void) {
+    long pages = 0, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f) {
+        if (fscanf(f, "%ld %ld", &pages, &resident) != 2) resident = 0;
+        fclose(f);
+    }
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+#define CHURN_LIVE 20000
+#define CHURN_ROUNDS 2000000
+
+/*
+ * Message-buffer churn: a working set of CHURN_LIVE buffers of mixed sizes is
+ * continuously replaced, then everything but every 64th buffer is released.
+ * Reports time per alloc/free pair and RSS growth over the run.
+ */
+static void churn(const char *name, int use_pool) {
+    static void *live[CHURN_LIVE];
+    static size_t sizes[CHURN_LIVE];
+    static const size_t mix[] = {48, 200, 900, 3000, 12000, 40000};
+    unsigned seed = 12345;
+    long rss_before = rss_kb();
+    double start = now_ns();
+    for (long i = 0; i < CHURN_ROUNDS + CHURN_LIVE; i++) {
+        int k = i % CHURN_LIVE;
+        if (live[k]) {
+            if (use_pool) pool_free(live[k], sizes[k]); else free(live[k]);
+        }
+        seed = seed * 1103515245 + 12345;
+        sizes[k] = mix[(seed >> 16) % 6] - (seed >> 8) % 32;
+        live[k] = use_pool ? pool_alloc(sizes[k]) : malloc(sizes[k]);
+        memset(live[k], 1, 16);
+    }
+    double elapsed = now_ns() - start;
+    for (int k = 0; k < CHURN_LIVE; k++) {
+        if (k % 64 == 0) continue;
+        if (use_pool) pool_free(live[k], sizes[k]); else free(live[k]);
+        live[k] = NULL;
+    }
+    long rss_peak_to_idle = rss_kb() - rss_before;
+    printf("%-36s %10d %12.1f %10s  rss after drain: +%ld KB\n", name, CHURN_ROUNDS,
+           elapsed / (CHURN_ROUNDS + CHURN_LIVE), "-", rss_peak_to_idle);
+    for (int k = 0; k < CHURN_LIVE; k += 64) {
+        if (use_pool) pool_free(live[k], sizes[k]); else free(live[k]);
+        live[k] = NULL;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    long scale = 1;
+    if (argc > 1) {
+        scale = atol(argv[1]);
+        if (scale < 1) scale = 1;
+    }
+    chat_set_send_fn(fake_send);
+
+    static client_table_t table;
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(54321);
+    addr.sin_addr.s_addr = inet_addr("192.168.1.42");
+
+    printf("%-36s %10s %12s %10s\n", "benchmark", "iters", "ns/op", "allocs/op");
+    run_bench("format_address", 1000000 * scale, bench_format_address, &addr);
+    run_bench("format_message", 1000000 * scale, bench_format_message, NULL);
+
+    int sizes[] = {1, 10, 100, 1000, 10000};
+    for (size_t k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++) {
+        char name[64];
+        fill_table(&table, sizes[k]);
+        snprintf(name, sizeof(name), "table_insert_remove/%d", sizes[k]);
+        run_bench(name, 1000000 * scale, bench_table_insert_remove, &table);
+        snprintf(name, sizeof(name), "broadcast/%d", sizes[k]);
+        run_bench(name, 2000000 * scale / sizes[k] + 100, bench_broadcast, &table);
+        snprintf(name, sizeof(name), "join_leave/%d", sizes[k]);
+        run_bench(name, 1000000 * scale / sizes[k] + 100, bench_join_leave, &table);
+    }
+    fill_table(&table, 100);
+    msgtrace_set_rate(1);
+    run_bench("broadcast/100+msgtrace_every_msg", 20000 * scale + 100, bench_broadcast_traced, &table);
+    msgtrace_set_rate(0);
+    run_bench("broadcast/100+msgtrace_off", 20000 * scale + 100, bench_broadcast_traced, &table);
+    // Every other recipient on WebSocket: one frame header for all of them
+    static ws_conn_t ws_state;
+    for (int i = 0; i < 100; i += 2) table.clients[i].ws = &ws_state;
+    run_bench("broadcast/100_half_websocket", 20000 * scale + 100, bench_broadcast, &table);
+    for (int i = 0; i < 100; i += 2) table.clients[i].ws = NULL;
+
+    run_scan_benches(scale);
+    run_filter_benches(scale);
+    run_mailbox_benches();
+    big_table = &table;
+    run_zframe_benches(&table, scale);
+
+    make_search_msgs();
+    search_index_t *idx = search_index_create(SEARCH_HISTORY_MSGS, SEARCH_HISTORY_BYTES);
+    run_bench("search_index_add", 200000 * scale, bench_search_add, idx);
+    run_bench("search_query/2_terms", 2000 * scale, bench_search_query, idx);
+    search_stats_t stats;
+    search_index_stats(idx, &stats);
+    printf("  index: %llu msgs, %llu text bytes, %llu terms, %llu posting bytes\n",
+           (unsigned long long)stats.messages, (unsigned long long)stats.history_bytes,
+           (unsigned long long)stats.terms, (unsigned long long)stats.posting_bytes);
+    search_index_destroy(idx);
+    search_start();
+    run_bench("search_submit_message", 200000 * scale, bench_search_submit, NULL);
+
+    size_t alloc_sizes[] = {64, 1024, 16384};
+    for (size_t k = 0; k < sizeof(alloc_sizes) / sizeof(alloc_sizes[0]); k++) {
+        char name[64];
+        alloc_size = alloc_sizes[k];
+        snprintf(name, sizeof(name), "malloc_free/%zu", alloc_size);
+        run_bench(name, 5000000 * scale, bench_malloc_free, NULL);
+        snprintf(name, sizeof(name), "pool_alloc_free/%zu", alloc_size);
+        run_bench(name, 5000000 * scale, bench_pool_alloc_free, NULL);
+    }
+    run_bench("buf_chain_append_64k", 20000 * scale, bench_chain_64k, NULL);
+    churn("churn/malloc", 0);
+    churn("churn/pool", 1);
+    run_fanout_benches(&table, scale);
+
+    printf("\n(fake transport: %lu sends, %zu bytes)\n", sink_calls, sink_bytes);
+    pool_print_stats(stdout);
+    return 0;
+}
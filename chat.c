@@ -3,11 +3,14 @@
  * @brief Chat logic and client management implementation for chat server.
  */
 #include "chat.h"
-#include "network_utils.h"
+#include "fanout.h"
+#include "msgtrace.h"
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 
@@ -29,7 +32,7 @@ int setup_tcp_server(struct sockaddr_in *address) {
         perror("TCP bind failed");
         exit(EXIT_FAILURE);
     }
-    if (listen(master_socket, MAX_CLIENTS) < 0) {
+    if (listen(master_socket, LISTEN_BACKLOG) < 0) {
         perror("listen");
         exit(EXIT_FAILURE);
     }
@@ -37,67 +40,299 @@ int setup_tcp_server(struct sockaddr_in *address) {
     return master_socket;
 }
 
-int accept_new_client(int master_socket, struct sockaddr_in *address, int *client_socket, int *num_clients) {
-    int addrlen = sizeof(*address);
-    int new_socket = accept(master_socket, (struct sockaddr *)address, (socklen_t *)&addrlen);
-    if (new_socket < 0) {
-        perror("accept");
-        return -1;
-    }
-    char client_addr_str[30];
-    get_client_address(new_socket, client_addr_str);
-    printf("Server: Received a new connection from client %s\n", client_addr_str);
-    if (*num_clients < MAX_CLIENTS) {
-        for (int i = 0; i < MAX_CLIENTS; i++) {
-            if (client_socket[i] == 0) {
-                client_socket[i] = new_socket;
-                (*num_clients)++;
-                break;
+static chat_send_fn chat_send = writev;
+static chat_backlog_fn chat_backlog = NULL;
+static int fanout_min = FANOUT_MIN_RECIPIENTS;
+
+// Room for a chat line's buffers plus a WebSocket frame header
+#define FRAMED_IOV (MESSAGE_MAX_IOV + 4)
+
+static int frame_message(struct iovec *framed, unsigned char *hdr, const struct iovec *iov, int iovcnt) {
+    if (iovcnt > FRAMED_IOV - 1) iovcnt = FRAMED_IOV - 1;
+    return ws_frame_iov(framed, hdr, iov, iovcnt);
+}
+
+void chat_set_send_fn(chat_send_fn fn) {
+    chat_send = fn ? fn : writev;
+}
+
+void chat_set_backlog_fn(chat_backlog_fn fn) {
+    chat_backlog = fn;
+}
+
+void chat_set_fanout_min(int recipients) {
+    fanout_min = recipients;
+}
+
+int client_table_add(client_table_t *table, int fd, const char *username) {
+    if (table->num_clients >= MAX_CLIENTS) return -1;
+    for (int i = table->first_free; i < MAX_CLIENTS; i++) {
+        client_t *c = &table->clients[i];
+        if (c->fd == 0) {
+            c->fd = fd;
+            c->id = ++table->next_id;
+            c->shm = NULL;
+            c->ws = NULL;
+            c->outq = NULL;
+            c->partial = NULL;
+            c->rate_tat = 0;
+            c->in_transfer = 0;
+            c->presence_synced = 0;
+            c->multicast = 0;
+            c->zlib = 0;
+            c->lines = 0;
+            if (username) {
+                strncpy(c->username, username, USERNAME_MAX_LEN - 1);
+                c->username[USERNAME_MAX_LEN - 1] = '\0';
+            } else {
+                c->username[0] = '\0';
             }
+            table->num_clients++;
+            table->first_free = i + 1;
+            if (i >= table->end) table->end = i + 1;
+            return i;
         }
-    } else {
-        printf("Max clients reached. Connection from %s rejected.\n", client_addr_str);
-        send(new_socket, "Server is full. Try again later.\n", 33, 0);
-        close(new_socket);
-    }
-    return new_socket;
-}
-
-void handle_client_messages(int *client_socket, int *num_clients) {
-    char buffer[BUFFER_SIZE + 1];
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        int sd = client_socket[i];
-        if (sd > 0) {
-            int valread = recv(sd, buffer, BUFFER_SIZE, MSG_DONTWAIT);
-            if (valread == 0) {
-                char client_addr[30];
-                get_client_address(sd, client_addr);
-                printf("Client %s disconnected\n", client_addr);
-                close(sd);
-                client_socket[i] = 0;
-                (*num_clients)--;
-            } else if (valread > 0) {
-                buffer[valread] = '\0';
-                char sender_addr[30];
-                get_client_address(sd, sender_addr);
-                if (buffer[strlen(buffer) - 1] == '\n') buffer[strlen(buffer) - 1] = '\0';
-                printf("Server: Received message \"%s\" from client %s\n", buffer, sender_addr);
-                if (*num_clients < 2) {
-                    printf("Server: Insufficient clients, \"%s\" from client %s dropped\n", buffer, sender_addr);
-                } else {
-                    char broadcast_msg[BUFFER_SIZE + 50];
-                    snprintf(broadcast_msg, sizeof(broadcast_msg), "%s %s", sender_addr, buffer);
-                    for (int j = 0; j < MAX_CLIENTS; j++) {
-                        int dest_sd = client_socket[j];
-                        if (dest_sd > 0 && dest_sd != sd) {
-                            send(dest_sd, broadcast_msg, strlen(broadcast_msg), 0);
-                            char recipient_addr[30];
-                            get_client_address(dest_sd, recipient_addr);
-                            printf("Server: Send message \"%s\" from client %s to %s\n", buffer, sender_addr, recipient_addr);
-                        }
-                    }
-                }
+    }
+    return -1;
+}
+
+void client_table_remove(client_table_t *table, int slot) {
+    client_t *c = &table->clients[slot];
+    if (c->fd == 0) return;
+    c->fd = 0;
+    c->username[0] = '\0';
+    c->shm = NULL;
+    c->ws = NULL;
+    outq_free(c->outq);
+    c->outq = NULL;
+    if (c->partial) {
+        buf_chain_free(c->partial);
+        pool_free(c->partial, sizeof(buf_chain_t));
+        c->partial = NULL;
+    }
+    table->num_clients--;
+    if (slot < table->first_free) table->first_free = slot;
+    while (table->end > 0 && table->clients[table->end - 1].fd == 0) table->end--;
+}
+
+static size_t iov_total(const struct iovec *iov, int iovcnt) {
+    size_t len = 0;
+    for (int i = 0; i < iovcnt; i++) len += iov[i].iov_len;
+    return len;
+}
+
+// Write straight to the socket while nothing is queued; queue whatever it does not take
+static ssize_t queue_sendv(client_t *client, int lane, const struct iovec *iov, int iovcnt) {
+    size_t len = iov_total(iov, iovcnt);
+    if (client->outq) {
+        int overflowed = client->outq->overflow;
+        if (outq_push(client->outq, lane, iov, iovcnt, 0) < 0) {
+            if (!overflowed && client->outq->overflow && chat_backlog) chat_backlog(client);
+            return -1;
+        }
+        return (ssize_t)len;
+    }
+    ssize_t n = chat_send(client->fd, iov, iovcnt);
+    if (n == (ssize_t)len) return n;
+    if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+    if (n < 0) n = 0;
+    if (!(client->outq = outq_create())) return -1;
+    if (outq_push(client->outq, lane, iov, iovcnt, n) < 0) {
+        if (n == 0) {
+            outq_free(client->outq);
+            client->outq = NULL;
+            return -1;
+        }
+        // Part of the frame is out and the rest is lost: the stream is broken
+        client->outq->overflow = 1;
+    }
+    if (chat_backlog) chat_backlog(client);
+    return client->outq->overflow ? -1 : (ssize_t)len;
+}
+
+ssize_t client_send(client_t *client, const void *buf, size_t len) {
+    return client_send_lane(client, OUTQ_CHAT, buf, len);
+}
+
+ssize_t client_sendv(client_t *client, const struct iovec *iov, int iovcnt) {
+    return client_sendv_lane(client, OUTQ_CHAT, iov, iovcnt);
+}
+
+ssize_t client_send_lane(client_t *client, int lane, const void *buf, size_t len) {
+    struct iovec iov = {(void *)buf, len};
+    return client_sendv_lane(client, lane, &iov, 1);
+}
+
+ssize_t client_send_zframe(client_t *client, int lane, const zframe_t *z) {
+    struct iovec iov = {z->data, z->len};
+    ssize_t n = queue_sendv(client, lane, &iov, 1);
+    if (n < 0) return n;
+    zframe_sent(z);
+    return (ssize_t)z->raw_len;
+}
+
+ssize_t client_sendv_lane(client_t *client, int lane, const struct iovec *iov, int iovcnt) {
+    if (lane == OUTQ_BULK && client->zlib && iov_total(iov, iovcnt) >= ZFRAME_MIN_BYTES) {
+        zframe_t z;
+        if (zframe_build(&z, iov, iovcnt) == 0) {
+            ssize_t n = client_send_zframe(client, lane, &z);
+            zframe_free(&z);
+            return n;
+        }
+    }
+    if (client->shm) {
+        // A full ring is a slow consumer: the frame is lost, so have it disconnected
+        ssize_t n = shm_conn_sendv(client->shm, iov, iovcnt);
+        if (n < 0 && client->shm->dropped == 1 && chat_backlog) chat_backlog(client);
+        return n;
+    }
+    if (client->ws) {
+        unsigned char hdr[WS_HEADER_MAX];
+        struct iovec framed[FRAMED_IOV];
+        return queue_sendv(client, lane, framed, frame_message(framed, hdr, iov, iovcnt));
+    }
+    return queue_sendv(client, lane, iov, iovcnt);
+}
+
+int client_flush(client_t *client) {
+    outq_t *q = client->outq;
+    if (!q) return 1;
+    if (outq_flush(q, client->fd, chat_send) < 0) return -1;
+    if (q->bytes > 0) return 0;
+    outq_free(q);
+    client->outq = NULL;
+    return 1;
+}
+
+// Control frames of a logged-in WebSocket client arrive here already framed
+static void ws_control(void *owner, const struct iovec *iov, int iovcnt) {
+    queue_sendv(owner, OUTQ_CONTROL, iov, iovcnt);
+}
+
+void client_attach_ws(client_t *client, ws_conn_t *ws) {
+    client->ws = ws;
+    if (ws) {
+        ws->owner = client;
+        ws_set_control_fn(ws_control);
+    }
+}
+
+void client_disconnect(client_table_t *table, int slot) {
+    client_t *c = &table->clients[slot];
+    if (c->outq) client_flush(c);
+    if (c->shm) {
+        shm_conn_close(c->shm);  // also closes the Unix socket in c->fd
+    } else if (c->fd > 0) {
+        close(c->fd);
+    }
+    ws_conn_free(c->ws);
+    client_table_remove(table, slot);
+}
+
+const char *client_display_name(const client_t *client) {
+    return client->username[0] ? client->username : "client";
+}
+
+int chat_message_iov(struct iovec *iov, char *prefix, size_t prefix_len, const char *sender,
+                     const struct iovec *payload, int payload_cnt) {
+    int n = snprintf(prefix, prefix_len, "%s: ", sender);
+    if (n < 0) n = 0;
+    if ((size_t)n >= prefix_len) n = prefix_len - 1;
+    int cnt = 0;
+    iov[cnt].iov_base = prefix;
+    iov[cnt++].iov_len = n;
+    for (int i = 0; i < payload_cnt; i++) {
+        if (payload[i].iov_len > 0) iov[cnt++] = payload[i];
+    }
+    if (cnt > 1) {
+        struct iovec *last = &iov[cnt - 1];
+        if (((char *)last->iov_base)[last->iov_len - 1] == '\n') last->iov_len--;
+    }
+    iov[cnt].iov_base = "\n";
+    iov[cnt++].iov_len = 1;
+    return cnt;
+}
+
+size_t chat_format_presence(char *out, size_t out_len, const char *username, int joined) {
+    int n = snprintf(out, out_len, "User '%s' has %s the chat.\n", username, joined ? "joined" : "left");
+    if (n < 0) return 0;
+    return (size_t)n < out_len ? (size_t)n : out_len - 1;
+}
+
+int chat_broadcast(client_table_t *table, int except_slot, const char *msg, size_t len) {
+    struct iovec iov = {(void *)msg, len};
+    return chat_broadcastv(table, except_slot, &iov, 1);
+}
+
+// One message on its way to a range of the table; shared by the fan-out helpers
+typedef struct {
+    client_table_t *table;
+    int except_slot;
+    const struct iovec *iov;
+    int iovcnt;
+    uint64_t trace_id;                    // msgtrace_ctx is per thread
+    unsigned char hdr[WS_HEADER_MAX];
+    struct iovec framed[FRAMED_IOV];
+    int framed_cnt;
+    zframe_t z;
+    int z_state;                          // 0 until a zlib recipient is met, then 1 built or -1 not worth it
+    int sent[FANOUT_MAX_THREADS];
+} broadcast_t;
+
+// The WebSocket frame and the zlib frame are built on first use, unless fanned out
+static void broadcast_range(void *arg, int worker, int begin, int end) {
+    broadcast_t *b = arg;
+    // Each traced send starts where the previous one ended, so one clock read per recipient
+    int64_t start = b->trace_id ? msgtrace_now() : 0;
+    for (int j = begin; j < end; j++) {
+        client_t *c = &b->table->clients[j];
+        if (c->fd > 0 && j != b->except_slot && !c->in_transfer && !c->multicast) {
+            if (start) {
+                msgtrace_ctx.send_id = b->trace_id;
+                msgtrace_ctx.send_slot = j;
+            }
+            if (c->zlib && b->z_state == 0) b->z_state = zframe_build(&b->z, b->iov, b->iovcnt) == 0 ? 1 : -1;
+            if (c->ws) {
+                if (!b->framed_cnt) b->framed_cnt = frame_message(b->framed, b->hdr, b->iov, b->iovcnt);
+                queue_sendv(c, OUTQ_CHAT, b->framed, b->framed_cnt);
+            } else if (c->zlib && b->z_state == 1) {
+                client_send_zframe(c, OUTQ_CHAT, &b->z);
+            } else {
+                client_sendv(c, b->iov, b->iovcnt);
             }
+            if (start) {
+                int64_t now = msgtrace_now();
+                msgtrace_span(b->trace_id, MSGTRACE_SEND, start, now, j);
+                msgtrace_ctx.send_id = 0;
+                start = now;
+            }
+            b->sent[worker]++;
         }
     }
-} 
\ No newline at end of file
+}
+
+int chat_broadcastv(client_table_t *table, int except_slot, const struct iovec *iov, int iovcnt) {
+    broadcast_t b;
+    b.table = table;
+    b.except_slot = except_slot;
+    b.iov = iov;
+    b.iovcnt = iovcnt;
+    b.trace_id = msgtrace_ctx.id;
+    b.framed_cnt = 0;
+    memset(&b.z, 0, sizeof(b.z));
+    // Large messages are compressed once, on the first zlib recipient
+    b.z_state = iov_total(iov, iovcnt) >= ZFRAME_LIVE_MIN ? 0 : -1;
+    memset(b.sent, 0, sizeof(b.sent));
+    if (fanout_min > 0 && table->num_clients >= fanout_min && fanout_helpers() > 0) {
+        // Helpers only read the shared frames: build them now
+        b.framed_cnt = frame_message(b.framed, b.hdr, iov, iovcnt);
+        if (b.z_state == 0) b.z_state = zframe_build(&b.z, iov, iovcnt) == 0 ? 1 : -1;
+        fanout_run(table->end, broadcast_range, &b);
+    } else {
+        broadcast_range(&b, 0, 0, table->end);
+    }
+    zframe_free(&b.z);
+    int sent = 0;
+    for (int w = 0; w < FANOUT_MAX_THREADS; w++) sent += b.sent[w];
+    return sent;
+}
@@ -8,9 +8,76 @@
 #define CHAT_H
 
 #include <netinet/in.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "auth.h"
+#include "outq.h"
+#include "pool.h"
+#include "shm_transport.h"
+#include "ws.h"
+#include "zframe.h"
 
-#define MAX_CLIENTS 500
+#define MAX_CLIENTS 131072
 #define BUFFER_SIZE 1024
+#define MAX_MESSAGE_SIZE 65536
+#define MESSAGE_MAX_IOV (MAX_MESSAGE_SIZE / 4000 + 4)
+#define LISTEN_BACKLOG 4096
+#define PING_CMD "/ping"   // answered with "PONG <token>" in the control lane
+
+/**
+ * @brief A connected client as tracked by the server.
+ *
+ * This is all the server keeps for an idle connection: receive buffers and
+ * the outbound queue are borrowed from the pools only while data is in flight.
+ */
+typedef struct {
+    int fd;                            /**< Client socket, 0 when the slot is free. */
+    uint8_t in_transfer : 1;           /**< Socket is owned by a file transfer relay. */
+    uint8_t presence_synced : 1;       /**< Has received a presence snapshot. */
+    uint8_t multicast : 1;             /**< Gets room messages from the multicast group instead. */
+    uint8_t zlib : 1;                  /**< Asked for compressed bulk output at login, see zframe.h. */
+    uint8_t lines : 1;                 /**< Has sent a newline: input is taken a whole line at a time. */
+    uint64_t id;                       /**< Connection number, unique for the server's lifetime. */
+    int64_t rate_tat;                  /**< Rate limiter state, see rate_limit_wait(). */
+    shm_conn_t *shm;                   /**< Shared-memory session for local clients, NULL for TCP. */
+    ws_conn_t *ws;                     /**< WebSocket state for browser clients, NULL otherwise. */
+    outq_t *outq;                      /**< Output the socket has not taken yet, NULL when there is none. */
+    buf_chain_t *partial;              /**< Unfinished input line (pooled), NULL when there is none. */
+    char username[USERNAME_MAX_LEN];   /**< Authenticated username, empty if unknown. */
+} client_t;
+
+/**
+ * @brief Fixed-size table of connected clients.
+ *
+ * Slots are handed out lowest first, so the occupied ones stay packed at
+ * the front and loops over the table stop at end instead of MAX_CLIENTS.
+ * Slots past end have never been touched and cost no memory.
+ */
+typedef struct {
+    client_t clients[MAX_CLIENTS];     /**< Client slots, indexed by slot number. */
+    int num_clients;                   /**< Number of occupied slots. */
+    int end;                           /**< One past the highest occupied slot. */
+    int first_free;                    /**< No free slot below this one. */
+    uint64_t next_id;                  /**< Last connection number handed out. */
+} client_table_t;
+
+/**
+ * @brief Signature of the function used to write bytes to a client.
+ *
+ * Matches writev(2) so the default transport is the socket itself; tests and
+ * benchmarks can install an in-memory replacement.
+ */
+typedef ssize_t (*chat_send_fn)(int fd, const struct iovec *iov, int iovcnt);
+
+/**
+ * @brief Signature of the function told when a client's output starts backing up.
+ *
+ * Called when a client's outbound queue is created, so the caller can watch
+ * the socket for writability, and again if the queue overflows.
+ */
+typedef void (*chat_backlog_fn)(client_t *client);
 
 /**
  * @brief Set up the TCP server socket.
@@ -20,20 +87,188 @@
 int setup_tcp_server(struct sockaddr_in *address);
 
 /**
- * @brief Accept a new TCP client connection.
- * @param master_socket TCP server socket file descriptor.
- * @param address Pointer to sockaddr_in struct for client address.
- * @param client_socket Array of client socket file descriptors.
- * @param num_clients Pointer to number of connected clients.
- * @return New client socket file descriptor.
+ * @brief Replace the function used to deliver bytes to clients.
+ * @param fn New send function, or NULL to restore writev(2).
+ */
+void chat_set_send_fn(chat_send_fn fn);
+
+/**
+ * @brief Set the function told when a client's output starts backing up.
+ * @param fn Callback, or NULL for none.
+ */
+void chat_set_backlog_fn(chat_backlog_fn fn);
+
+/**
+ * @brief Set the number of connected clients from which broadcasts are shared with the fan-out helpers.
+ *
+ * While a broadcast is fanned out, the send and backlog functions are
+ * called from the helper threads as well, each time for a different client.
+ * @param recipients Client count (FANOUT_MIN_RECIPIENTS by default), or 0 to always fan out on the caller.
+ */
+void chat_set_fanout_min(int recipients);
+
+/**
+ * @brief Insert a client into the first free slot of the table.
+ * @param table Client table.
+ * @param fd Client socket file descriptor.
+ * @param username Authenticated username (may be NULL).
+ * @return Slot index, or -1 if the table is full.
+ */
+int client_table_add(client_table_t *table, int fd, const char *username);
+
+/**
+ * @brief Release a slot in the client table. Does not close the socket.
+ * @param table Client table.
+ * @param slot Slot index returned by client_table_add().
+ */
+void client_table_remove(client_table_t *table, int slot);
+
+/**
+ * @brief Name to show for a client in chat lines and notices.
+ * @param client Client record.
+ * @return The username, or "client" if none is set.
+ */
+const char *client_display_name(const client_t *client);
+
+/**
+ * @brief Describe a "name: text\n" chat line as an iovec without copying the text.
+ *
+ * A single trailing newline in the payload is dropped and a newline is always
+ * appended, so the result is the same whether or not the client sent one.
+ *
+ * @param iov Output vector with room for payload_cnt + 2 entries.
+ * @param prefix Scratch buffer for the "name: " prefix.
+ * @param prefix_len Size of the scratch buffer.
+ * @param sender Display name of the sender.
+ * @param payload Received bytes, possibly spread over several buffers.
+ * @param payload_cnt Number of payload buffers.
+ * @return Number of iovec entries used.
+ */
+int chat_message_iov(struct iovec *iov, char *prefix, size_t prefix_len, const char *sender,
+                     const struct iovec *payload, int payload_cnt);
+
+/**
+ * @brief Format a join or leave notice for a user.
+ * @param out Output buffer.
+ * @param out_len Size of the output buffer.
+ * @param username Display name of the user.
+ * @param joined Non-zero for a join notice, zero for a leave notice.
+ * @return Length of the formatted notice, truncated to out_len - 1.
+ */
+size_t chat_format_presence(char *out, size_t out_len, const char *username, int joined);
+
+/**
+ * @brief Deliver bytes to one client over whatever transport it uses, in the chat lane.
+ * @param client Client record.
+ * @param buf Bytes to send.
+ * @param len Number of bytes.
+ * @return Number of bytes accepted, or -1 on error.
+ */
+ssize_t client_send(client_t *client, const void *buf, size_t len);
+
+/**
+ * @brief Deliver a message made of several buffers to one client, in the chat lane.
+ * @param client Client record.
+ * @param iov Buffers to send, in order.
+ * @param iovcnt Number of buffers.
+ * @return Number of bytes accepted, or -1 on error.
+ */
+ssize_t client_sendv(client_t *client, const struct iovec *iov, int iovcnt);
+
+/**
+ * @brief Deliver bytes to one client in a given priority lane.
+ *
+ * Bytes the socket does not take at once are queued in the lane and written
+ * by client_flush(). Shared-memory clients have no lanes; their ring is
+ * written directly.
+ *
+ * @param client Client record.
+ * @param lane OUTQ_CONTROL, OUTQ_CHAT or OUTQ_BULK.
+ * @param buf Bytes to send.
+ * @param len Number of bytes.
+ * @return Number of bytes accepted (sent or queued), or -1 on error or a full queue.
+ */
+ssize_t client_send_lane(client_t *client, int lane, const void *buf, size_t len);
+
+/**
+ * @brief Deliver a message made of several buffers to one client in a given priority lane.
+ * @param client Client record.
+ * @param lane OUTQ_CONTROL, OUTQ_CHAT or OUTQ_BULK.
+ * @param iov Buffers to send, in order.
+ * @param iovcnt Number of buffers.
+ * @return Number of bytes accepted (sent or queued), or -1 on error or a full queue.
  */
-int accept_new_client(int master_socket, struct sockaddr_in *address, int *client_socket, int *num_clients);
+ssize_t client_sendv_lane(client_t *client, int lane, const struct iovec *iov, int iovcnt);
 
 /**
- * @brief Handle TCP messages from clients.
- * @param client_socket Array of client socket file descriptors.
- * @param num_clients Pointer to number of connected clients.
+ * @brief Send an already compressed frame to a zlib client.
+ *
+ * Bulk sends to zlib clients are compressed by client_sendv_lane() itself;
+ * this is for frames built once and shared, such as cached repair batches.
+ * @param client Client record with zlib set.
+ * @param lane OUTQ_CONTROL, OUTQ_CHAT or OUTQ_BULK.
+ * @param z Frame to send.
+ * @return Number of uncompressed bytes the frame stands for, or -1 on error or a full queue.
+ */
+ssize_t client_send_zframe(client_t *client, int lane, const zframe_t *z);
+
+/**
+ * @brief Write a client's queued output, highest lane first.
+ * @param client Client record.
+ * @return 1 once nothing is left (the queue is released), 0 if the socket is
+ *         full again, -1 on a socket error.
+ */
+int client_flush(client_t *client);
+
+/**
+ * @brief Hand a logged-in WebSocket connection to a client.
+ *
+ * Pongs and close frames for the connection then go through the client's
+ * control lane, so they never land inside a queued frame.
+ *
+ * @param client Client record.
+ * @param ws WebSocket state, owned by the client from now on.
+ */
+void client_attach_ws(client_t *client, ws_conn_t *ws);
+
+/**
+ * @brief Close a client's transport and free its slot.
+ *
+ * Queued output is written first as far as the socket takes it without waiting.
+ *
+ * @param table Client table.
+ * @param slot Slot index.
+ */
+void client_disconnect(client_table_t *table, int slot);
+
+/**
+ * @brief Send a message to every connected client except one slot.
+ *
+ * Clients whose socket is busy with a file transfer are skipped.
+ *
+ * @param table Client table.
+ * @param except_slot Slot to skip (usually the sender), or -1 for none.
+ * @param msg Message bytes.
+ * @param len Message length.
+ * @return Number of clients the message was sent to.
+ */
+int chat_broadcast(client_table_t *table, int except_slot, const char *msg, size_t len);
+
+/**
+ * @brief Send a message made of several buffers to every client except one slot.
+ *
+ * Clients that opted into multicast delivery are skipped as well. The
+ * WebSocket frame is encoded once and shared by every WebSocket recipient.
+ * With many clients connected and fan-out helpers running (see fanout.h),
+ * the table is split into ranges sent in parallel; the call still returns
+ * only once every recipient has the message.
+ *
+ * @param table Client table.
+ * @param except_slot Slot to skip (usually the sender), or -1 for none.
+ * @param iov Message buffers.
+ * @param iovcnt Number of buffers.
+ * @return Number of clients the message was sent to.
  */
-void handle_client_messages(int *client_socket, int *num_clients);
+int chat_broadcastv(client_table_t *table, int except_slot, const struct iovec *iov, int iovcnt);
 
-#endif // CHAT_H 
\ No newline at end of file
+#endif // CHAT_H 
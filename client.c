@@ -7,24 +7,81 @@
  * server. Once the server is found, it extracts its IP address and connects
  * to the chat service via TCP.
  *
+ * With -b it runs as a bot instead: it logs in as -u/-p, sends every line of
+ * stdin (or -f <file>) as fast as the server takes it, writes everything it
+ * receives to stdout (or -o <file>) in large batches, and reports its send
+ * and receive rates on stderr. The server splits its input into lines, so
+ * each line is relayed as its own message, even when it reaches the server
+ * in pieces. With -z the bot asks
+ * for zlib compression at login and inflates ZLIB frames as they arrive
+ * (see zframe.h); its report then also shows the bytes on the wire.
+ *
  * Compilation:
- * gcc client_discovery.c -o client_discovery
+ * gcc client_discovery.c -o client_discovery -lz
  *
  * Usage:
- * ./client_discovery
+ * ./client_discovery [-s server_ip]
+ * ./client_discovery -b -u user [-p password] [-s server_ip] [-f input] [-o output] [-w linger_secs] [-v] [-z]
  */
 #include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/select.h>
 #include <sys/socket.h>
+#include <time.h>
 #include <unistd.h>
+#include <zlib.h>
 
 #define TCP_PORT 8888
 #define DISCOVERY_PORT 8889
 #define BUFFER_SIZE 1024
 #define DISCOVERY_MSG "CHAT_SERVER_HERE"
+#define RX_BUFFER_SIZE (256 * 1024)
+#define TX_BUFFER_SIZE (256 * 1024)
+#define OUT_BUFFER_SIZE (256 * 1024)
+#define PROMPT_USER "Enter username: "
+#define PROMPT_PASS "Enter password: "
+#define ZLIB_CAP " +zlib"
+#define ZLIB_RAW_MAX (64 * 1024 * 1024)
+
+/**
+ * @brief Incremental parser for what the server sends.
+ *
+ * Splits the byte stream into lines, whatever the read boundaries. After a
+ * "REPAIR <seq> <sender> <len>" or "FILE <id> <from> <len> <name>" line the
+ * next len bytes are passed through as payload instead of being split. A
+ * "ZLIB <raw_len> <zlib_len>" frame is collected, inflated and parsed in
+ * place of itself.
+ */
+typedef struct {
+    char buf[RX_BUFFER_SIZE];   /**< Bytes of the line in progress. */
+    size_t len;                 /**< Bytes in buf. */
+    size_t payload_left;        /**< Payload bytes still to come after a framed header. */
+    char *zbuf;                 /**< Compressed frame being collected, NULL outside one. */
+    size_t zlen;                /**< Compressed bytes the frame holds. */
+    size_t zhave;               /**< Compressed bytes received so far. */
+    size_t zraw;                /**< Bytes the frame inflates to. */
+} rx_parser_t;
+
+typedef void (*line_fn)(const char *line, size_t len, void *ctx);
+typedef void (*payload_fn)(const char *data, size_t len, void *ctx);
+
+/**
+ * @brief Counters and output of bot mode.
+ */
+typedef struct {
+    FILE *out;                  /**< Where received data goes, fully buffered. */
+    unsigned long long lines_sent, bytes_sent;
+    unsigned long long lines_received, bytes_received;
+    unsigned long long bytes_wire;   /**< Bytes read from the socket, before inflating. */
+    int zlib;                        /**< Asked for compression at login. */
+} bot_stats_t;
+
+static FILE *status_out = NULL;   // connection progress; stderr in bot mode so output stays clean
 
 // Utility: Get local socket address as string
 void get_my_address(int sock, char *buf) {
@@ -43,7 +100,7 @@ int discover_server(char *server_ip, size_t ip_len) {
     int discovery_sock;
     struct sockaddr_in serv_addr, broadcast_addr;
     char buffer[BUFFER_SIZE + 1] = {0};
-    printf("Searching for chat server on the local network...\n");
+    fprintf(status_out, "Searching for chat server on the local network...\n");
     if ((discovery_sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
         perror("UDP socket creation error");
         return -1;
@@ -73,11 +130,11 @@ int discover_server(char *server_ip, size_t ip_len) {
     buffer[len] = '\0';
     if (strcmp(buffer, DISCOVERY_MSG) == 0) {
         inet_ntop(AF_INET, &serv_addr.sin_addr, server_ip, ip_len);
-        printf("Server found at %s. Connecting to chat...\n", server_ip);
+        fprintf(status_out, "Server found at %s. Connecting to chat...\n", server_ip);
         close(discovery_sock);
         return 0;
     } else {
-        printf("Received unknown broadcast. Exiting.\n");
+        fprintf(status_out, "Received unknown broadcast. Exiting.\n");
         close(discovery_sock);
         return -1;
     }
@@ -88,30 +145,159 @@ int connect_to_server(const char *server_ip) {
     int sock;
     struct sockaddr_in serv_addr;
     if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-        printf("\nTCP Socket creation error \n");
+        fprintf(status_out, "\nTCP Socket creation error \n");
         return -1;
     }
     serv_addr.sin_family = AF_INET;
     serv_addr.sin_port = htons(TCP_PORT);
     if (inet_pton(AF_INET, server_ip, &serv_addr.sin_addr) <= 0) {
-        printf("\nInvalid address/Address not supported \n");
+        fprintf(status_out, "\nInvalid address/Address not supported \n");
         close(sock);
         return -1;
     }
     if (connect(sock, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) {
-        printf("\nTCP Connection Failed \n");
+        fprintf(status_out, "\nTCP Connection Failed \n");
         close(sock);
         return -1;
     }
-    printf("Connected successfully! You can start typing now.\n");
+    fprintf(status_out, "Connected successfully! You can start typing now.\n");
     return sock;
 }
 
+// Payload length announced by a REPAIR or FILE line, 0 for any other line
+static size_t framed_payload(const char *line, size_t len) {
+    char head[128];
+    unsigned long long a, b;
+    size_t n = 0;
+    int id;
+    if (len < 5 || len >= sizeof(head)) return 0;
+    memcpy(head, line, len);
+    head[len] = '\0';
+    if (sscanf(head, "REPAIR %llu %llu %zu", &a, &b, &n) == 3) return n;
+    if (sscanf(head, "FILE %d %*s %zu", &id, &n) == 2) return n;
+    return 0;
+}
+
+static void rx_feed(rx_parser_t *p, const char *data, size_t len, line_fn on_line, payload_fn on_payload, void *ctx);
+
+// A complete line: start collecting a ZLIB frame, or pass the line on
+static void rx_line(rx_parser_t *p, const char *line, size_t len, line_fn on_line, void *ctx) {
+    char head[64];
+    size_t raw, zlen;
+    if (len > 5 && len < sizeof(head) && memcmp(line, "ZLIB ", 5) == 0) {
+        memcpy(head, line, len);
+        head[len] = '\0';
+        if (sscanf(head, "ZLIB %zu %zu", &raw, &zlen) == 2 && raw <= ZLIB_RAW_MAX && zlen <= ZLIB_RAW_MAX &&
+            (p->zbuf = malloc(zlen ? zlen : 1)) != NULL) {
+            p->zlen = zlen;
+            p->zhave = 0;
+            p->zraw = raw;
+            return;
+        }
+    }
+    on_line(line, len, ctx);
+    p->payload_left = framed_payload(line, len);
+}
+
+// The whole compressed frame is in: inflate it and parse what it stood for
+static void rx_inflate(rx_parser_t *p, line_fn on_line, payload_fn on_payload, void *ctx) {
+    char *zbuf = p->zbuf;
+    uLongf raw = p->zraw;
+    char *out = malloc(raw ? raw : 1);
+    p->zbuf = NULL;
+    if (out && uncompress((Bytef *)out, &raw, (const Bytef *)zbuf, p->zhave) == Z_OK) {
+        rx_feed(p, out, raw, on_line, on_payload, ctx);
+    } else {
+        fprintf(stderr, "Could not inflate a %zu byte ZLIB frame\n", p->zhave);
+    }
+    free(out);
+    free(zbuf);
+}
+
+/**
+ * @brief Feed newly received bytes to the parser.
+ *
+ * Calls on_line for every complete line (newline included) and on_payload
+ * for framed payload bytes. A line longer than the buffer is passed on in
+ * pieces.
+ */
+static void rx_feed(rx_parser_t *p, const char *data, size_t len, line_fn on_line, payload_fn on_payload, void *ctx) {
+    while (len > 0) {
+        if (p->zbuf) {
+            size_t n = len < p->zlen - p->zhave ? len : p->zlen - p->zhave;
+            memcpy(p->zbuf + p->zhave, data, n);
+            p->zhave += n;
+            data += n;
+            len -= n;
+            if (p->zhave == p->zlen) rx_inflate(p, on_line, on_payload, ctx);
+            continue;
+        }
+        if (p->payload_left > 0) {
+            size_t n = len < p->payload_left ? len : p->payload_left;
+            on_payload(data, n, ctx);
+            p->payload_left -= n;
+            data += n;
+            len -= n;
+            continue;
+        }
+        const char *nl = memchr(data, '\n', len);
+        size_t take = nl ? (size_t)(nl - data) + 1 : len;
+        // Whole lines straight from the read buffer; only a line split by a read is copied
+        if (p->len == 0 && nl) {
+            rx_line(p, data, take, on_line, ctx);
+        } else {
+            if (take > sizeof(p->buf) - p->len) {
+                on_line(p->buf, p->len, ctx);
+                p->len = 0;
+                if (take > sizeof(p->buf)) take = sizeof(p->buf);
+            }
+            memcpy(p->buf + p->len, data, take);
+            p->len += take;
+            if (p->buf[p->len - 1] == '\n') {
+                rx_line(p, p->buf, p->len, on_line, ctx);
+                p->len = 0;
+            }
+        }
+        data += take;
+        len -= take;
+    }
+}
+
+/**
+ * @brief Pass on a line that is still incomplete, such as a login prompt.
+ */
+static void rx_flush_partial(rx_parser_t *p, line_fn on_line, void *ctx) {
+    if (p->len > 0 && p->payload_left == 0) {
+        on_line(p->buf, p->len, ctx);
+        p->len = 0;
+    }
+}
+
+static void print_line(const char *line, size_t len, void *ctx) {
+    (void)ctx;
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) len--;
+    const char *space = memchr(line, ' ', len);
+    if (space != NULL) {
+        printf("Client: Received Message \"%.*s\" from <%.*s>\n", (int)(len - (space + 1 - line)), space + 1,
+               (int)(space - line), line);
+    } else {
+        printf("Server broadcast: %.*s\n", (int)len, line);
+    }
+}
+
+static void print_payload(const char *data, size_t len, void *ctx) {
+    (void)ctx;
+    fwrite(data, 1, len, stdout);
+}
+
 // Chat loop: Handle user input and server messages
 void chat_loop(int sock) {
     fd_set readfds;
     char input_buffer[BUFFER_SIZE] = {0};
-    char buffer[BUFFER_SIZE + 1] = {0};
+    static char buffer[RX_BUFFER_SIZE];
+    static rx_parser_t parser;
+    char my_addr_str[30];
+    get_my_address(sock, my_addr_str);
     while (1) {
         FD_ZERO(&readfds);
         FD_SET(STDIN_FILENO, &readfds);
@@ -126,26 +312,18 @@ void chat_loop(int sock) {
                     input_buffer[n] = '\0';
                 if (strlen(input_buffer) == 0) continue;
                 send(sock, input_buffer, strlen(input_buffer), 0);
-                char my_addr_str[30];
-                get_my_address(sock, my_addr_str);
                 printf("Client <%s>: Message \"%s\" sent to server\n", my_addr_str, input_buffer);
                 memset(input_buffer, 0, sizeof(input_buffer));
             }
         }
         if (FD_ISSET(sock, &readfds)) {
-            int valread = read(sock, buffer, BUFFER_SIZE);
+            int valread = read(sock, buffer, sizeof(buffer));
             if (valread > 0) {
-                buffer[valread] = '\0';
-                char *sender_info = buffer;
-                char *message = strchr(buffer, ' ');
-                if (message != NULL) {
-                    *message = '\0';
-                    message++;
-                    printf("Client: Received Message \"%s\" from <%s>\n", message, sender_info);
-                } else {
-                    printf("Server broadcast: %s\n", buffer);
-                }
-                memset(buffer, 0, sizeof(buffer));
+                rx_feed(&parser, buffer, valread, print_line, print_payload, NULL);
+                // The login prompts end without a newline: show them once the server goes quiet
+                char peek;
+                if (recv(sock, &peek, 1, MSG_PEEK | MSG_DONTWAIT) < 0) rx_flush_partial(&parser, print_line, NULL);
+                fflush(stdout);
             } else if (valread == 0) {
                 printf("Server disconnected.\n");
                 close(sock);
@@ -155,16 +333,259 @@ void chat_loop(int sock) {
     }
 }
 
-int main(int argc, char const *argv[]) {
-    char server_ip[INET_ADDRSTRLEN];
-    if (discover_server(server_ip, sizeof(server_ip)) != 0) {
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bot_line(const char *line, size_t len, void *ctx) {
+    bot_stats_t *s = ctx;
+    fwrite(line, 1, len, s->out);
+    s->lines_received++;
+    s->bytes_received += len;
+}
+
+static void bot_payload(const char *data, size_t len, void *ctx) {
+    bot_stats_t *s = ctx;
+    fwrite(data, 1, len, s->out);
+    s->bytes_received += len;
+}
+
+/**
+ * @brief Answer the login prompts, leaving whatever followed them in the parser.
+ */
+static int bot_login(int sock, const char *user, const char *pass, rx_parser_t *parser, bot_stats_t *stats) {
+    const char *prompts[2] = {PROMPT_USER, PROMPT_PASS};
+    const char *answers[2] = {user, pass};
+    char buf[BUFFER_SIZE];
+    size_t have = 0;
+    for (int i = 0; i < 2; i++) {
+        size_t want = strlen(prompts[i]);
+        while (have < want) {
+            ssize_t n = recv(sock, buf + have, sizeof(buf) - have, 0);
+            if (n <= 0) return -1;
+            have += n;
+        }
+        if (memcmp(buf, prompts[i], want) != 0) {
+            fprintf(stderr, "Unexpected login prompt: %.*s\n", (int)have, buf);
+            return -1;
+        }
+        have -= want;
+        memmove(buf, buf + want, have);
+        if (send(sock, answers[i], strlen(answers[i]), 0) < 0) return -1;
+    }
+    // The server reads each login answer in one read, so nothing may follow
+    // the password until it has been taken: wait for the ONLINE snapshot
+    if (have == 0) {
+        ssize_t n = recv(sock, buf, sizeof(buf), 0);
+        if (n <= 0) return -1;
+        have = n;
+    }
+    stats->bytes_wire += have;
+    rx_feed(parser, buf, have, bot_line, bot_payload, stats);
+    return 0;
+}
+
+// Count the newlines in a range of sent bytes
+static unsigned long long count_lines(const char *data, size_t len) {
+    unsigned long long lines = 0;
+    for (const char *end = data + len; (data = memchr(data, '\n', end - data)) != NULL; data++) lines++;
+    return lines;
+}
+
+static void bot_report(const char *what, const bot_stats_t *s, double secs) {
+    fprintf(stderr, "%s: sent %llu lines (%.0f/s, %.2f MB/s), received %llu lines (%.0f/s, %.2f MB/s) in %.2f s", what,
+            s->lines_sent, s->lines_sent / secs, s->bytes_sent / secs / 1e6, s->lines_received,
+            s->lines_received / secs, s->bytes_received / secs / 1e6, secs);
+    if (s->zlib) {
+        fprintf(stderr, ", %.2f MB on the wire for %.2f MB received (%.1fx)", s->bytes_wire / 1e6, s->bytes_received / 1e6,
+                s->bytes_wire ? (double)s->bytes_received / s->bytes_wire : 0.0);
+    }
+    fputc('\n', stderr);
+}
+
+/**
+ * @brief Bot mode: pipeline input lines to the server and record everything received.
+ *
+ * Input is read in large blocks and empty lines are dropped; only whole
+ * lines are written to the socket, as many per write as it takes. Output
+ * is written through a large stdio buffer that is flushed whenever the
+ * loop would otherwise wait. After the input ends the bot keeps receiving
+ * for linger_secs, then prints its rates and exits.
+ */
+static int bot_loop(int sock, int in_fd, bot_stats_t *stats, rx_parser_t *parser, double linger_secs, int verbose) {
+    static char tx[TX_BUFFER_SIZE], in[TX_BUFFER_SIZE / 2], rx[RX_BUFFER_SIZE];
+    size_t tx_len = 0, tx_sent = 0, tx_lines = 0;  // tx_lines: end of the last complete line
+    int in_open = 1, at_line_start = 1;
+    double start = now_sec(), last_report = start, done_at = 0, last_active = start;
+    bot_stats_t last = *stats;
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+    while (1) {
+        double now = now_sec();
+        if (!in_open && tx_sent == tx_len) {
+            if (done_at == 0) done_at = now;
+            if (now - done_at >= linger_secs) break;
+        }
+        if (verbose && now - last_report >= 1.0) {
+            bot_stats_t delta = {NULL, stats->lines_sent - last.lines_sent, stats->bytes_sent - last.bytes_sent,
+                                 stats->lines_received - last.lines_received, stats->bytes_received - last.bytes_received,
+                                 stats->bytes_wire - last.bytes_wire, stats->zlib};
+            fflush(stats->out);
+            bot_report("rate", &delta, now - last_report);
+            last = *stats;
+            last_report = now;
+        }
+        struct pollfd pfd[2] = {{sock, POLLIN, 0}, {in_fd, POLLIN, 0}};
+        if (tx_sent < tx_lines) pfd[0].events |= POLLOUT;
+        int nfds = in_open && tx_len + sizeof(in) <= sizeof(tx) ? 2 : 1;
+        int ready = poll(pfd, nfds, 0);
+        if (ready == 0) {
+            // Nothing to do right now: write out what was received, then wait
+            fflush(stats->out);
+            int timeout_ms = done_at > 0 ? (int)((linger_secs - (now - done_at)) * 1000) + 1 : 1000;
+            ready = poll(pfd, nfds, timeout_ms);
+        }
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            return -1;
+        }
+        if (pfd[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            ssize_t n;
+            while ((n = recv(sock, rx, sizeof(rx), 0)) > 0) {
+                stats->bytes_wire += n;
+                rx_feed(parser, rx, n, bot_line, bot_payload, stats);
+                last_active = now_sec();
+                if ((size_t)n < sizeof(rx)) break;
+            }
+            if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                fprintf(stderr, "Server disconnected.\n");
+                break;
+            }
+        }
+        if (nfds == 2 && (pfd[1].revents & (POLLIN | POLLHUP))) {
+            ssize_t n = read(in_fd, in, sizeof(in));
+            if (n <= 0) {
+                in_open = 0;
+                if (!at_line_start) tx[tx_len++] = '\n';
+                tx_lines = tx_len;
+            }
+            // Copy the input, dropping empty lines
+            for (ssize_t i = 0; i < n; i++) {
+                if (in[i] == '\n' && at_line_start) continue;
+                tx[tx_len++] = in[i];
+                at_line_start = in[i] == '\n';
+                if (at_line_start) tx_lines = tx_len;
+            }
+        }
+        // Only whole lines go out
+        if (tx_lines > tx_sent) {
+            ssize_t n = send(sock, tx + tx_sent, tx_lines - tx_sent, MSG_NOSIGNAL);
+            if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                perror("send");
+                break;
+            }
+            if (n > 0) {
+                stats->lines_sent += count_lines(tx + tx_sent, n);
+                stats->bytes_sent += n;
+                tx_sent += n;
+                last_active = now_sec();
+            }
+        }
+        if (tx_sent == tx_len) {
+            tx_len = tx_sent = tx_lines = 0;
+        } else if (tx_sent > 0 && tx_len + sizeof(in) > sizeof(tx)) {
+            memmove(tx, tx + tx_sent, tx_len - tx_sent);
+            tx_len -= tx_sent;
+            tx_lines -= tx_sent;
+            tx_sent = 0;
+        } else if (tx_sent == 0 && tx_lines == 0 && tx_len + sizeof(in) > sizeof(tx)) {
+            // A line longer than the buffer: send it in pieces
+            tx_lines = tx_len;
+        }
+    }
+    fflush(stats->out);
+    // Rates over the time traffic flowed, not the linger at the end
+    bot_report("total", stats, last_active > start ? last_active - start : 1e-6);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    char server_ip[INET_ADDRSTRLEN] = {0};
+    const char *user = NULL, *pass = "secret", *in_path = NULL, *out_path = NULL;
+    double linger_secs = 1.0;
+    int bot = 0, verbose = 0, zlib = 0, opt;
+    while ((opt = getopt(argc, argv, "bs:u:p:f:o:w:vz")) != -1) {
+        switch (opt) {
+        case 'b':
+            bot = 1;
+            break;
+        case 's':
+            snprintf(server_ip, sizeof(server_ip), "%s", optarg);
+            break;
+        case 'u':
+            user = optarg;
+            break;
+        case 'p':
+            pass = optarg;
+            break;
+        case 'f':
+            in_path = optarg;
+            break;
+        case 'o':
+            out_path = optarg;
+            break;
+        case 'w':
+            linger_secs = atof(optarg);
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        case 'z':
+            zlib = 1;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-s server_ip]\n"
+                            "       %s -b -u user [-p password] [-s server_ip] [-f input] [-o output] [-w linger_secs] [-v] [-z]\n",
+                    argv[0], argv[0]);
+            return 1;
+        }
+    }
+    status_out = bot ? stderr : stdout;
+    if (bot && !user) {
+        fprintf(stderr, "Bot mode needs a username (-u)\n");
+        return 1;
+    }
+    if (!server_ip[0] && discover_server(server_ip, sizeof(server_ip)) != 0) {
         return -1;
     }
     int sock = connect_to_server(server_ip);
     if (sock < 0) {
         return -1;
     }
-    chat_loop(sock);
+    if (!bot) {
+        chat_loop(sock);
+        close(sock);
+        return 0;
+    }
+    int in_fd = in_path ? open(in_path, O_RDONLY) : STDIN_FILENO;
+    FILE *out = out_path ? fopen(out_path, "w") : stdout;
+    if (in_fd < 0 || !out) {
+        perror(in_fd < 0 ? in_path : out_path);
+        return 1;
+    }
+    setvbuf(out, NULL, _IOFBF, OUT_BUFFER_SIZE);
+    static rx_parser_t parser;
+    bot_stats_t stats = {out, 0, 0, 0, 0, 0, zlib};
+    char login_name[256];
+    snprintf(login_name, sizeof(login_name), "%s%s", user, zlib ? ZLIB_CAP : "");
+    if (bot_login(sock, login_name, pass, &parser, &stats) < 0) {
+        fprintf(stderr, "Login failed\n");
+        return 1;
+    }
+    int rc = bot_loop(sock, in_fd, &stats, &parser, linger_secs, verbose);
     close(sock);
-    return 0;
+    if (out != stdout) fclose(out);
+    return rc < 0 ? 1 : 0;
 }
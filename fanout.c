@@ -0,0 +1,128 @@
+/**
+ * @file fanout.c
+ * @brief Fan-out helper pool implementation.
+ */
+#include "fanout.h"
+#include "sched.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// One span per thread, each on its own cache line: owners and thieves claim chunks with fetch_add
+typedef struct {
+    _Atomic int next;   /**< First slot not yet claimed. */
+    int end;            /**< One past the span's last slot. */
+} __attribute__((aligned(64))) span_t;
+
+static span_t spans[FANOUT_MAX_THREADS];
+static int num_helpers = 0;
+
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static uint64_t generation = 0;   // bumped for every job
+static int job_workers = 0;       // spans in the current job
+static int busy_helpers = 0;      // helpers that have not finished the current job
+static fanout_fn job_fn = NULL;
+static void *job_ctx = NULL;
+
+static uint64_t runs = 0;
+static _Atomic uint64_t chunks = 0, stolen = 0;
+
+// Own span first, then the others' in turn
+static void work(int self, int workers) {
+    uint64_t done = 0, taken = 0;
+    for (int i = 0; i < workers; i++) {
+        span_t *s = &spans[(self + i) % workers];
+        int begin;
+        while ((begin = atomic_fetch_add_explicit(&s->next, FANOUT_CHUNK, memory_order_relaxed)) < s->end) {
+            job_fn(job_ctx, self, begin, begin + FANOUT_CHUNK < s->end ? begin + FANOUT_CHUNK : s->end);
+            done++;
+            if (i > 0) taken++;
+        }
+    }
+    atomic_fetch_add_explicit(&chunks, done, memory_order_relaxed);
+    if (taken) atomic_fetch_add_explicit(&stolen, taken, memory_order_relaxed);
+}
+
+static void *helper(void *arg) {
+    int self = (int)(intptr_t)arg;
+    uint64_t seen = 0;
+    for (;;) {
+        pthread_mutex_lock(&job_lock);
+        while (generation == seen) pthread_cond_wait(&job_cond, &job_lock);
+        seen = generation;
+        int workers = job_workers;
+        pthread_mutex_unlock(&job_lock);
+
+        work(self, workers);
+
+        pthread_mutex_lock(&job_lock);
+        if (--busy_helpers == 0) pthread_cond_signal(&done_cond);
+        pthread_mutex_unlock(&job_lock);
+    }
+    return NULL;
+}
+
+void fanout_start(int helpers) {
+    if (helpers > FANOUT_MAX_THREADS - 1) helpers = FANOUT_MAX_THREADS - 1;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    sched_helper_attr(&attr);
+    for (; num_helpers < helpers; num_helpers++) {
+        pthread_t tid;
+        if (pthread_create(&tid, &attr, helper, (void *)(intptr_t)(num_helpers + 1)) != 0) {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+    }
+    pthread_attr_destroy(&attr);
+}
+
+int fanout_default_helpers(void) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 2) return 0;
+    return cpus - 1 < FANOUT_MAX_THREADS - 1 ? (int)cpus - 1 : FANOUT_MAX_THREADS - 1;
+}
+
+int fanout_helpers(void) {
+    return num_helpers;
+}
+
+void fanout_run(int count, fanout_fn fn, void *ctx) {
+    int workers = num_helpers + 1;
+    if (workers == 1 || count < 2 * FANOUT_CHUNK) {
+        fn(ctx, 0, 0, count);
+        return;
+    }
+    int per = (count + workers - 1) / workers;
+    for (int w = 0; w < workers; w++) {
+        int begin = w * per < count ? w * per : count;
+        spans[w].end = begin + per < count ? begin + per : count;
+        atomic_store_explicit(&spans[w].next, begin, memory_order_relaxed);
+    }
+    pthread_mutex_lock(&job_lock);
+    job_fn = fn;
+    job_ctx = ctx;
+    job_workers = workers;
+    busy_helpers = num_helpers;
+    generation++;
+    pthread_cond_broadcast(&job_cond);
+    pthread_mutex_unlock(&job_lock);
+
+    work(0, workers);
+
+    // Helpers may still be finishing a chunk, and must all see this job before the next one
+    pthread_mutex_lock(&job_lock);
+    while (busy_helpers > 0) pthread_cond_wait(&done_cond, &job_lock);
+    pthread_mutex_unlock(&job_lock);
+    runs++;
+}
+
+void fanout_print_stats(FILE *out) {
+    fprintf(out, "fanout: %d helpers, %llu parallel fan-outs, %llu chunks, %llu stolen\n", num_helpers,
+            (unsigned long long)runs, (unsigned long long)atomic_load(&chunks), (unsigned long long)atomic_load(&stolen));
+}
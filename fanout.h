@@ -0,0 +1,66 @@
+/**
+ * @file fanout.h
+ * @brief Helper threads that share out one large fan-out by recipient range.
+ *
+ * fanout_run() cuts a range of client slots into one span per thread, the
+ * calling thread included. Each thread works through its own span in chunks
+ * of FANOUT_CHUNK slots, then steals chunks from the spans of the others, so
+ * a thread held up by slow sockets or by the scheduler does not hold up the
+ * whole fan-out. fanout_run() returns only once every chunk is done: a
+ * message reaches all its recipients before the next one is sent, so every
+ * sender's messages keep their order.
+ */
+#ifndef FANOUT_H
+#define FANOUT_H
+
+#include <stdio.h>
+
+#define FANOUT_MAX_THREADS 16
+#define FANOUT_CHUNK 256
+#define FANOUT_MIN_RECIPIENTS 4096
+
+/**
+ * @brief Work on the slots [begin, end).
+ * @param ctx Caller's context.
+ * @param worker 0 for the calling thread, 1..helpers for the helpers.
+ * @param begin First slot.
+ * @param end One past the last slot.
+ */
+typedef void (*fanout_fn)(void *ctx, int worker, int begin, int end);
+
+/**
+ * @brief Start the helper threads. Exits the process if a thread cannot be created.
+ * @param helpers Number of helpers, at most FANOUT_MAX_THREADS - 1; 0 leaves fan-out on the caller.
+ */
+void fanout_start(int helpers);
+
+/**
+ * @brief Number of helpers to use by default: one per online CPU besides the event loop's.
+ * @return Helper count, 0 on a single CPU.
+ */
+int fanout_default_helpers(void);
+
+/**
+ * @brief Number of helper threads running.
+ * @return Helper count.
+ */
+int fanout_helpers(void);
+
+/**
+ * @brief Call fn over [0, count) on the caller and the helpers, and wait until it is done.
+ *
+ * Runs fn(ctx, 0, 0, count) directly when there are no helpers or fewer
+ * than two chunks. fn must only touch state of the slots it is given.
+ * @param count Number of slots.
+ * @param fn Work function.
+ * @param ctx Passed to fn.
+ */
+void fanout_run(int count, fanout_fn fn, void *ctx);
+
+/**
+ * @brief Print the pool's counters: helpers, parallel runs, chunks and chunks stolen.
+ * @param out Output stream.
+ */
+void fanout_print_stats(FILE *out);
+
+#endif // FANOUT_H
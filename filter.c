@@ -0,0 +1,397 @@
+/**
+ * @file filter.c
+ * @brief Content filter implementation.
+ */
+#include "filter.h"
+#include "sched.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#define LINEAR_EDGES 8
+#define FILE_MAX (64 * 1024 * 1024)
+
+/**
+ * @brief One automaton state.
+ */
+typedef struct {
+    uint32_t first_edge;   /**< Index of its first edge in labels/targets. */
+    uint32_t fail;         /**< Longest proper suffix that is also a state. */
+    uint32_t out;          /**< Nearest state on the fail chain that ends a pattern, 0 if none. */
+    uint16_t num_edges;    /**< Number of edges, sorted by label. */
+    uint8_t action;        /**< FILTER_* of the pattern ending here, FILTER_PASS if none. */
+    uint8_t unused;
+} ac_state_t;
+
+struct filter {
+    uint32_t root[256];    /**< Transitions from the root for every byte. */
+    ac_state_t *states;    /**< States in breadth-first order; 0 is the root. */
+    uint8_t *labels;       /**< Edge labels, grouped by state. */
+    uint32_t *targets;     /**< Edge targets, parallel to labels. */
+    uint16_t *depth;       /**< Length of the pattern ending at each state. */
+    uint32_t num_states;
+    uint32_t num_edges;
+    uint32_t num_patterns;
+};
+
+// Build-time trie node; children form a singly linked sibling list
+typedef struct {
+    uint32_t child;
+    uint32_t sibling;
+    uint8_t label;
+    uint8_t action;
+    uint16_t depth;
+} trie_node_t;
+
+typedef struct {
+    trie_node_t *nodes;
+    uint32_t count;
+    uint32_t cap;
+    uint32_t root_child[256];
+} trie_t;
+
+static inline unsigned char fold(unsigned char c) {
+    return (unsigned char)(c - 'A') < 26 ? c + 32 : c;
+}
+
+static uint32_t trie_child(const trie_t *t, uint32_t node, unsigned char c) {
+    if (node == 0) return t->root_child[c];
+    for (uint32_t k = t->nodes[node].child; k; k = t->nodes[k].sibling) {
+        if (t->nodes[k].label == c) return k;
+    }
+    return 0;
+}
+
+static int trie_insert(trie_t *t, const char *pattern, size_t len, int action) {
+    uint32_t node = 0;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = fold((unsigned char)pattern[i]);
+        uint32_t next = trie_child(t, node, c);
+        if (!next) {
+            if (t->count == t->cap) {
+                uint32_t cap = t->cap * 2;
+                trie_node_t *nodes = realloc(t->nodes, cap * sizeof(trie_node_t));
+                if (!nodes) return -1;
+                t->nodes = nodes;
+                t->cap = cap;
+            }
+            next = t->count++;
+            t->nodes[next] = (trie_node_t){0, 0, c, FILTER_PASS, (uint16_t)(i + 1)};
+            if (node == 0) {
+                t->root_child[c] = next;
+            } else {
+                t->nodes[next].sibling = t->nodes[node].child;
+                t->nodes[node].child = next;
+            }
+        }
+        node = next;
+    }
+    if (action > t->nodes[node].action) t->nodes[node].action = action;
+    return 0;
+}
+
+// Add every pattern line of a pattern file to the trie; returns the number added or -1
+static long parse_patterns(trie_t *t, const char *text, size_t len) {
+    static const struct {
+        const char *word;
+        int action;
+    } keywords[] = {{"drop ", FILTER_DROP}, {"mask ", FILTER_MASK}, {"flag ", FILTER_FLAG}};
+    long added = 0;
+    const char *end = text + len;
+    while (text < end) {
+        const char *nl = memchr(text, '\n', end - text);
+        const char *line = text, *stop = nl ? nl : end;
+        text = nl ? nl + 1 : end;
+        while (line < stop && (*line == ' ' || *line == '\t')) line++;
+        while (stop > line && (stop[-1] == ' ' || stop[-1] == '\t' || stop[-1] == '\r')) stop--;
+        if (line == stop || *line == '#') continue;
+        int action = FILTER_MASK;
+        for (size_t k = 0; k < sizeof(keywords) / sizeof(keywords[0]); k++) {
+            size_t n = strlen(keywords[k].word);
+            if ((size_t)(stop - line) > n && memcmp(line, keywords[k].word, n) == 0) {
+                action = keywords[k].action;
+                line += n;
+                while (line < stop && (*line == ' ' || *line == '\t')) line++;
+                break;
+            }
+        }
+        if (stop - line > FILTER_MAX_PATTERN) continue;
+        if (trie_insert(t, line, stop - line, action) < 0) return -1;
+        added++;
+    }
+    return added;
+}
+
+static int cmp_label(const void *a, const void *b) {
+    return (int)((const trie_node_t *)a)->label - (int)((const trie_node_t *)b)->label;
+}
+
+filter_t *filter_compile(const char *text, size_t len) {
+    trie_t t;
+    memset(&t, 0, sizeof(t));
+    t.cap = 1024;
+    t.count = 1;  // node 0 is the root
+    t.nodes = calloc(t.cap, sizeof(trie_node_t));
+    filter_t *f = calloc(1, sizeof(filter_t));
+    long patterns = t.nodes && f ? parse_patterns(&t, text, len) : -1;
+    uint32_t n = t.count;
+    uint32_t *order = malloc(n * sizeof(uint32_t));      // breadth-first order of trie nodes
+    uint32_t *renum = malloc(n * sizeof(uint32_t));      // trie node -> state
+    uint32_t *fail = calloc(n, sizeof(uint32_t));        // by trie node
+    trie_node_t *kids = malloc(257 * sizeof(trie_node_t));
+    if (patterns < 0 || !order || !renum || !fail || !kids) goto fail;
+
+    // Breadth-first numbering, so shallow states (the busy ones) sit together
+    uint32_t head = 0, tail = 0;
+    order[tail++] = 0;
+    while (head < tail) {
+        uint32_t u = order[head++];
+        renum[u] = head - 1;
+        if (u == 0) {
+            for (int c = 0; c < 256; c++) {
+                if (t.root_child[c]) order[tail++] = t.root_child[c];
+            }
+        } else {
+            for (uint32_t k = t.nodes[u].child; k; k = t.nodes[k].sibling) order[tail++] = k;
+        }
+    }
+    f->num_states = n;
+    f->num_edges = n - 1;
+    f->num_patterns = (uint32_t)patterns;
+    f->states = calloc(n, sizeof(ac_state_t));
+    f->labels = malloc(n);
+    f->targets = malloc(n * sizeof(uint32_t));
+    f->depth = calloc(n, sizeof(uint16_t));
+    if (!f->states || !f->labels || !f->targets || !f->depth) goto fail;
+
+    // Failure links in breadth-first order: a node's suffix is always shallower
+    uint32_t edge = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t u = order[i];
+        ac_state_t *st = &f->states[i];
+        st->fail = renum[fail[u]];
+        st->action = t.nodes[u].action;
+        f->depth[i] = t.nodes[u].depth;
+        if (i > 0) {
+            const ac_state_t *fs = &f->states[st->fail];
+            st->out = fs->action ? st->fail : fs->out;
+        }
+        int nk = 0;
+        if (u == 0) {
+            for (int c = 0; c < 256; c++) {
+                if (t.root_child[c]) kids[nk++] = t.nodes[t.root_child[c]];
+            }
+        } else {
+            for (uint32_t k = t.nodes[u].child; k; k = t.nodes[k].sibling) kids[nk++] = t.nodes[k];
+            qsort(kids, nk, sizeof(trie_node_t), cmp_label);
+        }
+        st->first_edge = edge;
+        st->num_edges = u == 0 ? 0 : nk;  // the root uses its dense table instead
+        for (int k = 0; k < nk; k++) {
+            uint32_t v = trie_child(&t, u, kids[k].label);
+            if (u != 0) {
+                f->labels[edge] = kids[k].label;
+                f->targets[edge++] = renum[v];
+            }
+            uint32_t w = 0;
+            if (u != 0) {
+                for (uint32_t s = fail[u];; s = fail[s]) {
+                    if ((w = trie_child(&t, s, kids[k].label)) || s == 0) break;
+                }
+            }
+            fail[v] = w;
+        }
+    }
+    for (int c = 0; c < 256; c++) f->root[c] = t.root_child[c] ? renum[t.root_child[c]] : 0;
+    f->num_edges = edge;
+    free(order);
+    free(renum);
+    free(fail);
+    free(kids);
+    free(t.nodes);
+    return f;
+fail:
+    free(order);
+    free(renum);
+    free(fail);
+    free(kids);
+    free(t.nodes);
+    filter_free(f);
+    errno = ENOMEM;
+    return NULL;
+}
+
+filter_t *filter_load(const char *path) {
+    FILE *in = fopen(path, "rb");
+    if (!in) return NULL;
+    size_t cap = 65536, len = 0, n;
+    char *text = malloc(cap);
+    while (text && (n = fread(text + len, 1, cap - len, in)) > 0) {
+        len += n;
+        if (len == cap) {
+            char *bigger = cap < FILE_MAX ? realloc(text, cap * 2) : NULL;
+            if (!bigger) {
+                free(text);
+                text = NULL;
+                errno = EFBIG;
+                break;
+            }
+            text = bigger;
+            cap *= 2;
+        }
+    }
+    int failed = !text || ferror(in);
+    fclose(in);
+    filter_t *f = failed ? NULL : filter_compile(text, len);
+    free(text);
+    return f;
+}
+
+void filter_free(filter_t *f) {
+    if (!f) return;
+    free(f->states);
+    free(f->labels);
+    free(f->targets);
+    free(f->depth);
+    free(f);
+}
+
+static inline uint32_t find_edge(const filter_t *f, const ac_state_t *st, unsigned char c) {
+    const uint8_t *labels = f->labels + st->first_edge;
+    uint32_t lo = 0, hi = st->num_edges;
+    if (hi <= LINEAR_EDGES) {
+        for (uint32_t i = 0; i < hi; i++) {
+            if (labels[i] == c) return f->targets[st->first_edge + i];
+        }
+        return 0;
+    }
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (labels[mid] < c) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo < st->num_edges && labels[lo] == c ? f->targets[st->first_edge + lo] : 0;
+}
+
+static inline uint32_t next_state(const filter_t *f, uint32_t s, unsigned char c) {
+    while (s) {
+        const ac_state_t *st = &f->states[s];
+        uint32_t t = find_edge(f, st, c);
+        if (t) return t;
+        s = st->fail;
+    }
+    return f->root[c];
+}
+
+// Overwrite len bytes ending just before offset end with '*'
+static void mask_bytes(const struct iovec *iov, int iovcnt, size_t end, size_t len) {
+    size_t start = end - len, off = 0;
+    for (int i = 0; i < iovcnt && off < end; off += iov[i++].iov_len) {
+        size_t from = start > off ? start - off : 0;
+        size_t to = end - off < iov[i].iov_len ? end - off : iov[i].iov_len;
+        if (from < to) memset((char *)iov[i].iov_base + from, '*', to - from);
+    }
+}
+
+int filter_scan(const filter_t *f, const struct iovec *iov, int iovcnt) {
+    uint32_t s = 0;
+    size_t pos = 0;
+    int result = FILTER_PASS;
+    for (int i = 0; i < iovcnt; i++) {
+        const unsigned char *p = iov[i].iov_base;
+        for (size_t j = 0; j < iov[i].iov_len; j++) {
+            s = next_state(f, s, fold(p[j]));
+            pos++;
+            const ac_state_t *st = &f->states[s];
+            if (!st->action && !st->out) continue;
+            for (uint32_t m = st->action ? s : st->out; m; m = f->states[m].out) {
+                int action = f->states[m].action;
+                if (action == FILTER_MASK) mask_bytes(iov, iovcnt, pos, f->depth[m]);
+                if (action > result) result = action;
+            }
+            if (result == FILTER_DROP) return result;
+        }
+    }
+    return result;
+}
+
+void filter_print_info(const filter_t *f, FILE *out) {
+    size_t bytes = sizeof(filter_t) + f->num_states * (sizeof(ac_state_t) + sizeof(uint16_t)) +
+                   f->num_edges * (sizeof(uint8_t) + sizeof(uint32_t));
+    fprintf(out, "%u patterns, %u states, %zu KB", f->num_patterns, f->num_states, bytes / 1024);
+}
+
+/* --- Background reloads --- */
+
+static int done_efd = -1;
+static pthread_mutex_t reload_lock = PTHREAD_MUTEX_INITIALIZER;
+static int reload_running = 0;
+static filter_t *reloaded = NULL;
+static int reload_err = 0;
+
+int filter_init(void) {
+    done_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (done_efd < 0) {
+        perror("eventfd");
+        exit(EXIT_FAILURE);
+    }
+    return done_efd;
+}
+
+static void *reload_thread(void *arg) {
+    filter_t *f = filter_load(arg);
+    int err = f ? 0 : errno;
+    pthread_mutex_lock(&reload_lock);
+    filter_free(reloaded);
+    reloaded = f;
+    reload_err = err;
+    reload_running = 0;
+    pthread_mutex_unlock(&reload_lock);
+    uint64_t one = 1;
+    if (write(done_efd, &one, sizeof(one)) < 0) {
+        perror("eventfd write");
+    }
+    return NULL;
+}
+
+int filter_reload(const char *path) {
+    pthread_mutex_lock(&reload_lock);
+    int busy = reload_running;
+    reload_running = 1;
+    pthread_mutex_unlock(&reload_lock);
+    if (busy) return 0;
+    pthread_t tid;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    sched_helper_attr(&attr);
+    int rc = pthread_create(&tid, &attr, reload_thread, (void *)path);
+    pthread_attr_destroy(&attr);
+    if (rc != 0) {
+        pthread_mutex_lock(&reload_lock);
+        reload_running = 0;
+        pthread_mutex_unlock(&reload_lock);
+        return -1;
+    }
+    return 1;
+}
+
+filter_t *filter_reap(int *err) {
+    uint64_t count;
+    if (read(done_efd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        perror("eventfd read");
+    }
+    pthread_mutex_lock(&reload_lock);
+    filter_t *f = reloaded;
+    *err = reload_err;
+    reloaded = NULL;
+    reload_err = 0;
+    pthread_mutex_unlock(&reload_lock);
+    return f;
+}
@@ -0,0 +1,105 @@
+/**
+ * @file filter.h
+ * @brief Content filter: banned terms and URL patterns matched in one pass.
+ *
+ * The pattern file has one pattern per line, optionally preceded by what to
+ * do when a message contains it:
+ *
+ *     drop casino-bonus.example     refuse the message
+ *     mask badword                  replace the matched bytes with '*'
+ *     flag refund                   deliver it, but log it for moderators
+ *     spammy phrase                 no keyword: mask
+ *
+ * Blank lines and lines starting with '#' are ignored. Patterns are literal
+ * byte strings; ASCII letters match case-insensitively. When a message
+ * matches several patterns the strongest action wins (drop, then mask,
+ * then flag).
+ *
+ * All patterns are compiled into one Aho-Corasick automaton, so a message
+ * is scanned once no matter how many patterns there are. States are
+ * numbered breadth-first and stored as 16-byte records with their edges
+ * packed into sorted label and target arrays; the root, where most bytes
+ * of clean text land, has a full 256-entry table.
+ *
+ * Reloads compile the new list on a helper thread and hand the automaton
+ * back through an eventfd, so the event loop never waits for a compile.
+ */
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/uio.h>
+
+#define FILTER_MAX_PATTERN 1024
+
+enum { FILTER_PASS, FILTER_FLAG, FILTER_MASK, FILTER_DROP };
+
+/**
+ * @brief A compiled, read-only pattern set.
+ */
+typedef struct filter filter_t;
+
+/**
+ * @brief Compile a pattern list.
+ * @param text Pattern file contents.
+ * @param len Length of text.
+ * @return New filter, or NULL if out of memory.
+ */
+filter_t *filter_compile(const char *text, size_t len);
+
+/**
+ * @brief Read and compile a pattern file.
+ * @param path Pattern file.
+ * @return New filter, or NULL on error (errno set).
+ */
+filter_t *filter_load(const char *path);
+
+/**
+ * @brief Release a filter.
+ * @param f Filter (NULL is ignored).
+ */
+void filter_free(filter_t *f);
+
+/**
+ * @brief Scan a message once, masking matches of "mask" patterns in place.
+ * @param f Filter.
+ * @param iov Message buffers, possibly spread over several; must be writable.
+ * @param iovcnt Number of buffers.
+ * @return Strongest action of the patterns found, FILTER_PASS if none.
+ */
+int filter_scan(const filter_t *f, const struct iovec *iov, int iovcnt);
+
+/**
+ * @brief Print pattern, state and memory counts.
+ * @param f Filter.
+ * @param out Output stream.
+ */
+void filter_print_info(const filter_t *f, FILE *out);
+
+/**
+ * @brief Set up background reloads.
+ * @return Eventfd that becomes readable when a reload has finished.
+ */
+int filter_init(void);
+
+/**
+ * @brief Compile a pattern file on a helper thread.
+ *
+ * Does nothing if a reload is already running.
+ *
+ * @param path Pattern file; must stay valid until the reload is reaped.
+ * @return 1 if a reload was started, 0 if one was already running, -1 if the
+ *         thread could not be started.
+ */
+int filter_reload(const char *path);
+
+/**
+ * @brief Collect the result of a finished reload.
+ * @param err Set to the errno of a failed reload, 0 otherwise.
+ * @return The new filter, or NULL if the reload failed or none finished.
+ */
+filter_t *filter_reap(int *err);
+
+#endif // FILTER_H
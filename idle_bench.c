@@ -0,0 +1,253 @@
+/**
+ * @file idle_bench.c
+ * @brief Measure the server memory held by idle logged-in connections.
+ *
+ * Starts ./chat_server, logs in a large number of clients that then stay
+ * silent, and compares the server's resident set size before and after.
+ * Reports bytes per idle connection and checks them against a budget. The
+ * kernel's TCP memory is reported alongside, since socket buffers are not
+ * part of the server's RSS.
+ *
+ * Connections are spread over the source addresses 127.0.0.1, 127.0.0.2, ...
+ * so that more connections than one address has ephemeral ports can be made.
+ * Both this program and the server need a file descriptor per connection;
+ * the count is lowered to fit RLIMIT_NOFILE.
+ *
+ * Usage:
+ * ./idle_bench [connections] [budget_bytes_per_connection] [chat_server options...]
+ */
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TCP_PORT 8888
+#define MAX_BOTS 200000
+#define PROMPT_LEN 16
+#define LOGINS_IN_FLIGHT 512
+#define CONNS_PER_SOURCE 20000
+#define LOGIN_TIMEOUT_US 300000000.0
+#define QUIET_US 1000000.0
+#define DEFAULT_BUDGET 512
+
+enum { WAIT_USER_PROMPT, WAIT_PASS_PROMPT, WAIT_ONLINE, IDLE, FAILED };
+
+typedef struct {
+    int fd;
+    uint8_t state;
+    uint8_t prompt_bytes;
+} bot_t;
+
+static pid_t server_pid = 0;
+static bot_t bots[MAX_BOTS];
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void start_server(char **server_args) {
+    server_pid = fork();
+    if (server_pid == 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDOUT_FILENO);
+        execv("./chat_server", server_args);
+        perror("Failed to start server");
+        exit(1);
+    } else if (server_pid < 0) {
+        perror("Fork failed");
+        exit(1);
+    }
+    sleep(1);
+}
+
+static void stop_server(void) {
+    if (server_pid > 0) {
+        kill(server_pid, SIGINT);
+        waitpid(server_pid, NULL, 0);
+        server_pid = 0;
+    }
+}
+
+// Resident set size of a process in KB, from /proc/<pid>/status
+static long rss_kb(pid_t pid) {
+    char path[64], line[256];
+    long kb = -1;
+    snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "VmRSS: %ld", &kb) == 1) break;
+    }
+    fclose(f);
+    return kb;
+}
+
+// Pages of kernel memory charged to TCP sockets, from /proc/net/sockstat
+static long tcp_mem_pages(void) {
+    char line[256];
+    long inuse, orphan, tw, alloc, mem = -1;
+    FILE *f = fopen("/proc/net/sockstat", "r");
+    if (!f) return -1;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "TCP: inuse %ld orphan %ld tw %ld alloc %ld mem %ld", &inuse, &orphan, &tw, &alloc, &mem) == 5) break;
+    }
+    fclose(f);
+    return mem;
+}
+
+static int raise_fd_limit(void) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) < 0) return 1024;
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+    getrlimit(RLIMIT_NOFILE, &rl);
+    return rl.rlim_cur > MAX_BOTS * 2 ? MAX_BOTS * 2 : (int)rl.rlim_cur;
+}
+
+static int bot_connect(int i) {
+    struct sockaddr_in src = {0}, addr = {0};
+    int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (sock < 0) return -1;
+    src.sin_family = AF_INET;
+    src.sin_addr.s_addr = htonl(INADDR_LOOPBACK + i / CONNS_PER_SOURCE);
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(TCP_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(sock, (struct sockaddr *)&src, sizeof(src)) < 0 ||
+        (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS)) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+// Read whatever a bot has been sent and advance its login
+static void bot_input(int epfd, int i) {
+    static char buf[65536];
+    bot_t *b = &bots[i];
+    ssize_t r;
+    while ((r = recv(b->fd, buf, sizeof(buf), 0)) > 0) {
+        if (b->state == IDLE) continue;
+        if (b->state == WAIT_ONLINE) {
+            b->state = IDLE;
+            continue;
+        }
+        if (b->prompt_bytes == 0 && strncmp(buf, "Enter", 5) != 0) {
+            r = 0;
+            break;
+        }
+        b->prompt_bytes += r;
+        if (b->state == WAIT_USER_PROMPT && b->prompt_bytes >= PROMPT_LEN) {
+            char name[32];
+            int len = snprintf(name, sizeof(name), "idle%d", i);
+            send(b->fd, name, len, 0);
+            b->state = WAIT_PASS_PROMPT;
+        }
+        if (b->state == WAIT_PASS_PROMPT && b->prompt_bytes >= 2 * PROMPT_LEN) {
+            send(b->fd, "secret", 6, 0);
+            b->state = WAIT_ONLINE;
+        }
+    }
+    if (r == 0 || (r < 0 && errno != EAGAIN)) {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, b->fd, NULL);
+        close(b->fd);
+        b->fd = -1;
+        b->state = FAILED;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int num_bots = argc > 1 ? atoi(argv[1]) : 100000;
+    long budget = argc > 2 ? atol(argv[2]) : DEFAULT_BUDGET;
+    char *server_args[24] = {"chat_server", "-p", "64", "-H", "1024"};
+    for (int i = 3; i < argc && i < 21; i++) server_args[i + 2] = argv[i];
+    signal(SIGPIPE, SIG_IGN);
+
+    // The server inherits this limit; leave room for its listeners and ours
+    int fd_limit = raise_fd_limit() - 64;
+    if (num_bots > MAX_BOTS) num_bots = MAX_BOTS;
+    if (num_bots > fd_limit) {
+        printf("RLIMIT_NOFILE allows %d connections, not %d\n", fd_limit, num_bots);
+        num_bots = fd_limit;
+    }
+    if (num_bots < 1) num_bots = 1;
+
+    start_server(server_args);
+    long rss_before = rss_kb(server_pid);
+    long tcp_before = tcp_mem_pages();
+    int epfd = epoll_create1(0);
+    struct epoll_event events[256];
+    int started = 0, in_flight = 0, idle = 0, failed = 0;
+    double start = now_us(), last_input = start;
+    while (idle + failed < num_bots && now_us() - start < LOGIN_TIMEOUT_US) {
+        while (started < num_bots && in_flight < LOGINS_IN_FLIGHT) {
+            bot_t *b = &bots[started];
+            b->fd = bot_connect(started);
+            b->prompt_bytes = 0;
+            if (b->fd < 0) {
+                b->state = FAILED;
+                failed++;
+            } else {
+                b->state = WAIT_USER_PROMPT;
+                struct epoll_event ev = {.events = EPOLLIN, .data.u32 = started};
+                epoll_ctl(epfd, EPOLL_CTL_ADD, b->fd, &ev);
+                in_flight++;
+            }
+            started++;
+        }
+        int n = epoll_wait(epfd, events, 256, 1000);
+        for (int k = 0; k < n; k++) {
+            int i = (int)events[k].data.u32;
+            int was = bots[i].state;
+            bot_input(epfd, i);
+            if (was < IDLE && bots[i].state >= IDLE) {
+                in_flight--;
+                if (bots[i].state == IDLE) idle++;
+                if (bots[i].state == FAILED) failed++;
+            }
+        }
+    }
+    double login_secs = (now_us() - start) / 1e6;
+    // Drain snapshots still arriving, then let the server settle
+    while (now_us() - last_input < QUIET_US) {
+        int n = epoll_wait(epfd, events, 256, 100);
+        for (int k = 0; k < n; k++) bot_input(epfd, (int)events[k].data.u32);
+        if (n > 0) last_input = now_us();
+    }
+    sleep(1);
+    long rss_after = rss_kb(server_pid);
+    long tcp_after = tcp_mem_pages();
+
+    long per_conn = idle > 0 ? (rss_after - rss_before) * 1024 / idle : 0;
+    printf("%d idle connections logged in in %.1f s (%.0f/s), %d failed\n", idle, login_secs,
+           idle / login_secs, failed);
+    printf("server RSS: %ld KB before, %ld KB after: %ld bytes per idle connection (budget %ld)\n",
+           rss_before, rss_after, per_conn, budget);
+    if (tcp_before >= 0 && tcp_after >= 0 && idle > 0) {
+        long page = sysconf(_SC_PAGESIZE);
+        printf("kernel TCP buffers: %ld KB, %ld bytes per connection (both ends)\n",
+               (tcp_after - tcp_before) * page / 1024, (tcp_after - tcp_before) * page / idle);
+    }
+    printf("at 100000 connections: about %ld MB of server RSS\n", per_conn * 100000 / (1024 * 1024));
+    stop_server();
+    for (int i = 0; i < started; i++) {
+        if (bots[i].fd >= 0) close(bots[i].fd);
+    }
+    close(epfd);
+    int ok = idle == num_bots && per_conn <= budget;
+    printf("%s\n", ok ? "within budget" : "OVER BUDGET");
+    return ok ? 0 : 1;
+}
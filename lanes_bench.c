@@ -0,0 +1,205 @@
+/**
+ * @file lanes_bench.c
+ * @brief Measure how long a heartbeat waits behind bulk output to a slow reader.
+ *
+ * Starts ./chat_server with multicast enabled, fills its repair history with
+ * large messages, then logs in a receiver with a small receive buffer that
+ * reads at a fixed rate. The receiver keeps several megabytes of "/nack"
+ * repairs (bulk lane) outstanding and sends "/ping <time>" every few
+ * milliseconds; the time until its "PONG" arrives is the heartbeat latency.
+ *
+ * The run is repeated with -L, where every lane shares one FIFO, so the
+ * heartbeat waits behind the whole backlog.
+ *
+ * Usage:
+ * ./lanes_bench [seconds] [read_rate_mb_per_sec]
+ */
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TCP_PORT 8888
+#define HISTORY_MSGS 1024
+#define MSG_BYTES 4000
+#define REPAIR_BYTES ((size_t)HISTORY_MSGS * (MSG_BYTES + 48))
+#define OUTSTANDING_BYTES (8 * 1024 * 1024)
+#define PING_INTERVAL_US 10000.0
+#define RCVBUF 16384
+#define MAX_SAMPLES 100000
+
+static pid_t server_pid = 0;
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void start_server(int fifo) {
+    server_pid = fork();
+    if (server_pid == 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDOUT_FILENO);
+        execl("./chat_server", "chat_server", "-g", "239.255.88.1", "-i", "127.0.0.1", fifo ? "-L" : NULL, (char *)NULL);
+        perror("Failed to start server");
+        exit(1);
+    } else if (server_pid < 0) {
+        perror("Fork failed");
+        exit(1);
+    }
+    sleep(1);
+}
+
+static void stop_server(void) {
+    if (server_pid > 0) {
+        kill(server_pid, SIGINT);
+        waitpid(server_pid, NULL, 0);
+        server_pid = 0;
+    }
+}
+
+static int login(const char *name, int rcvbuf) {
+    struct sockaddr_in addr = {0};
+    char prompt[64];
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (rcvbuf > 0) setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(TCP_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("connect");
+        exit(1);
+    }
+    recv(sock, prompt, 16, MSG_WAITALL);
+    send(sock, name, strlen(name), 0);
+    recv(sock, prompt, 16, MSG_WAITALL);
+    send(sock, "secret", 6, 0);
+    return sock;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * @brief One run: returns the number of heartbeats answered, samples in rtt.
+ */
+static int run(int fifo, double seconds, double rate, double *rtt, int *unanswered, double *mbps) {
+    start_server(fifo);
+    int filler = login("filler", 0);
+    static char line[MSG_BYTES + 1];
+    memset(line, 'x', MSG_BYTES - 1);
+    line[MSG_BYTES - 1] = '\n';
+    for (int i = 0; i < HISTORY_MSGS; i++) {
+        send(filler, line, MSG_BYTES, 0);
+        usleep(200);
+    }
+    sleep(1);
+
+    int sock = login("receiver", RCVBUF);
+    usleep(200000);
+    fcntl(sock, F_SETFL, O_NONBLOCK);
+    char cmd[64], buf[65536];
+    size_t requested = 0, received = 0;
+    int samples = 0, pings = 0, at_line_start = 1;
+    char pong[32];
+    int pong_len = -1;
+    double start = now_us(), last_ping = 0;
+    while (now_us() - start < seconds * 1e6) {
+        double t = now_us();
+        if (t - last_ping >= PING_INTERVAL_US) {
+            int n = snprintf(cmd, sizeof(cmd), "/ping %.0f\n", t);
+            send(sock, cmd, n, MSG_NOSIGNAL);
+            pings++;
+            last_ping = t;
+            // Keep the bulk lane busy without overflowing the server's queue. The
+            // server reads a message per read, so the two commands go out apart.
+            if (requested < received + OUTSTANDING_BYTES) {
+                usleep(2000);
+                n = snprintf(cmd, sizeof(cmd), "/nack 1 %d\n", HISTORY_MSGS);
+                send(sock, cmd, n, MSG_NOSIGNAL);
+                requested += REPAIR_BYTES;
+            }
+        }
+        size_t allowed = (size_t)((t - start) / 1e6 * rate) - received;
+        if (allowed == 0 || allowed > (size_t)-1 / 2) {
+            usleep(500);
+            continue;
+        }
+        if (allowed > sizeof(buf)) allowed = sizeof(buf);
+        ssize_t r = recv(sock, buf, allowed, 0);
+        if (r == 0 || (r < 0 && errno != EAGAIN)) {
+            printf("receiver was disconnected\n");
+            break;
+        }
+        if (r < 0) {
+            struct pollfd pfd = {sock, POLLIN, 0};
+            poll(&pfd, 1, 1);
+            continue;
+        }
+        received += r;
+        double arrived = now_us();
+        for (ssize_t i = 0; i < r; i++) {
+            char ch = buf[i];
+            if (pong_len >= 0) {
+                if (ch == '\n') {
+                    pong[pong_len] = '\0';
+                    if (samples < MAX_SAMPLES) rtt[samples++] = arrived - atof(pong + 5);
+                    pong_len = -1;
+                } else if (pong_len < (int)sizeof(pong) - 1) {
+                    pong[pong_len++] = ch;
+                }
+            } else if (at_line_start && ch == 'P') {
+                pong_len = 0;
+                pong[pong_len++] = ch;
+            }
+            // "PONG" lines are the only lines starting with 'P'; anything else is skipped
+            if (pong_len > 0 && pong_len <= 5 && memcmp(pong, "PONG ", pong_len) != 0) pong_len = -1;
+            at_line_start = ch == '\n';
+        }
+    }
+    *mbps = received / ((now_us() - start) / 1e6) / 1e6;
+    *unanswered = pings - samples;
+    close(sock);
+    close(filler);
+    stop_server();
+    return samples;
+}
+
+static void report(const char *mode, double *rtt, int n, int unanswered, double mbps) {
+    if (n == 0) {
+        printf("%-6s no heartbeat answered (%d sent)\n", mode, unanswered);
+        return;
+    }
+    qsort(rtt, n, sizeof(double), cmp_double);
+    printf("%-6s heartbeat p50 %9.2f ms  p99 %9.2f ms  max %9.2f ms  (%d answered, %d still queued), bulk %.1f MB/s\n",
+           mode, rtt[n / 2] / 1000, rtt[n * 99 / 100] / 1000, rtt[n - 1] / 1000, n, unanswered, mbps);
+}
+
+int main(int argc, char *argv[]) {
+    double seconds = argc > 1 ? atof(argv[1]) : 5;
+    double rate = (argc > 2 ? atof(argv[2]) : 4) * 1e6;
+    static double rtt[MAX_SAMPLES];
+    int unanswered;
+    double mbps;
+    signal(SIGPIPE, SIG_IGN);
+    printf("receiver reads %.1f MB/s with a %d-byte receive buffer, %.1f MB of repairs outstanding\n",
+           rate / 1e6, RCVBUF, OUTSTANDING_BYTES / 1e6);
+    int n = run(0, seconds, rate, rtt, &unanswered, &mbps);
+    report("lanes", rtt, n, unanswered, mbps);
+    n = run(1, seconds, rate, rtt, &unanswered, &mbps);
+    report("fifo", rtt, n, unanswered, mbps);
+    return 0;
+}
@@ -0,0 +1,176 @@
+/**
+ * @file latency_bench.c
+ * @brief Compare loopback delivery latency with and without busy polling.
+ *
+ * Runs ./chat_server twice, once in the default mode and once with the given
+ * busy-poll options, logs in a sender and a receiver, and sends one timed
+ * message at a fixed interval, waiting for each to arrive before the next.
+ * Reports one-way latency percentiles and the server's CPU time per message
+ * and per wall-clock second, which shows what spinning costs.
+ *
+ * Usage:
+ * ./latency_bench [messages] [interval_us] [busy-poll chat_server options...]
+ *
+ * The busy-poll options default to "-S 1000", plus "-C 1" when there is
+ * more than one CPU (the benchmark itself then stays on CPU 0).
+ */
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TCP_PORT 8888
+#define PROMPT_LEN 16
+#define MAX_ARGS 16
+
+static pid_t server_pid = 0;
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// CPU seconds used so far by a process, from /proc/<pid>/stat
+static double process_cpu(pid_t pid) {
+    char path[64], buf[1024];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE *f = fopen(path, "r");
+    if (!f) return 0;
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+    char *p = strrchr(buf, ')');
+    unsigned long utime = 0, stime = 0;
+    if (p) sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime);
+    return (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+static void start_server(char **server_args) {
+    server_pid = fork();
+    if (server_pid == 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDOUT_FILENO);
+        execv("./chat_server", server_args);
+        perror("Failed to start server");
+        exit(1);
+    } else if (server_pid < 0) {
+        perror("Fork failed");
+        exit(1);
+    }
+    sleep(1);
+}
+
+static void stop_server(void) {
+    if (server_pid > 0) {
+        kill(server_pid, SIGINT);
+        waitpid(server_pid, NULL, 0);
+        server_pid = 0;
+    }
+}
+
+static int tcp_login(const char *username) {
+    struct sockaddr_in addr;
+    char buf[64];
+    int one = 1;
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(TCP_PORT);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("connect");
+        exit(1);
+    }
+    recv(sock, buf, PROMPT_LEN, MSG_WAITALL);
+    send(sock, username, strlen(username), 0);
+    recv(sock, buf, PROMPT_LEN, MSG_WAITALL);
+    send(sock, "secret", 6, 0);
+    usleep(300000);
+    // Skip the presence snapshot
+    while (recv(sock, buf, sizeof(buf), MSG_DONTWAIT) > 0) {
+    }
+    return sock;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Send timed messages one at a time and collect their one-way latency
+static void run(const char *label, char **server_args, int count, int interval_us, double *samples) {
+    char buf[256];
+    start_server(server_args);
+    int sender = tcp_login("lat_tx");
+    int receiver = tcp_login("lat_rx");
+    double cpu_start = process_cpu(server_pid), wall_start = now_us();
+    int n = 0;
+    for (int i = 0; i < count; i++) {
+        double sent = now_us();
+        int len = snprintf(buf, sizeof(buf), "ping %d\n", i);
+        send(sender, buf, len, 0);
+        struct pollfd pfd = {receiver, POLLIN, 0};
+        if (poll(&pfd, 1, 1000) <= 0) continue;
+        double arrived = now_us();
+        while (recv(receiver, buf, sizeof(buf), MSG_DONTWAIT) > 0) {
+        }
+        samples[n++] = arrived - sent;
+        while (now_us() < sent + interval_us) usleep(interval_us > 100 ? 50 : 0);
+    }
+    double cpu = process_cpu(server_pid) - cpu_start, wall = (now_us() - wall_start) / 1e6;
+    close(sender);
+    close(receiver);
+    stop_server();
+    if (n == 0) {
+        printf("%-9s no messages arrived\n", label);
+        return;
+    }
+    qsort(samples, n, sizeof(double), cmp_double);
+    printf("%-9s p50 %7.1f us  p99 %7.1f us  max %8.1f us  server cpu %6.2f us/msg (%3.0f%% of a core)\n", label,
+           samples[n / 2], samples[n * 99 / 100], samples[n - 1], cpu * 1e6 / n, 100 * cpu / wall);
+}
+
+int main(int argc, char *argv[]) {
+    int count = argc > 1 ? atoi(argv[1]) : 5000;
+    int interval_us = argc > 2 ? atoi(argv[2]) : 200;
+    if (count < 1) count = 1;
+    char *default_args[] = {"chat_server", NULL};
+    char *busy_args[MAX_ARGS] = {"chat_server"};
+    int nargs = 1;
+    if (argc > 3) {
+        for (int i = 3; i < argc && nargs < MAX_ARGS - 1; i++) busy_args[nargs++] = argv[i];
+    } else {
+        busy_args[nargs++] = "-S";
+        busy_args[nargs++] = "1000";
+        if (sysconf(_SC_NPROCESSORS_ONLN) > 1) {
+            busy_args[nargs++] = "-C";
+            busy_args[nargs++] = "1";
+            cpu_set_t self;
+            CPU_ZERO(&self);
+            CPU_SET(0, &self);
+            sched_setaffinity(0, sizeof(self), &self);
+        }
+    }
+    busy_args[nargs] = NULL;
+    signal(SIGPIPE, SIG_IGN);
+
+    double *samples = malloc(count * sizeof(double));
+    printf("%d messages, one every %d us; busy-poll options:", count, interval_us);
+    for (int i = 1; i < nargs; i++) printf(" %s", busy_args[i]);
+    printf("\n");
+    run("default", default_args, count, interval_us, samples);
+    run("busy-poll", busy_args, count, interval_us, samples);
+    free(samples);
+    return 0;
+}
@@ -0,0 +1,172 @@
+/**
+ * @file mailbox.c
+ * @brief Offline mailbox implementation.
+ */
+#include "mailbox.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define RECORD_HEADER 7
+#define NAME_MAX_BYTES 255
+
+static uint32_t name_hash(const char *name) {
+    uint32_t h = 2166136261u;
+    for (; *name; name++) h = (h ^ (uint8_t)*name) * 16777619u;
+    return h;
+}
+
+// Path of a user's mailbox; the bucket directory path is the same minus the last component
+static void mailbox_path(const mailbox_store_t *st, const char *user, char *path, size_t path_len, size_t *dir_len) {
+    int n = snprintf(path, path_len, "%s/%02x", st->dir, name_hash(user) & (MAILBOX_BUCKETS - 1));
+    if (dir_len) *dir_len = n;
+    path[n++] = '/';
+    for (size_t i = 0; user[i] && i < NAME_MAX_BYTES / 2 && (size_t)n + 3 < path_len; i++) {
+        n += snprintf(path + n, path_len - n, "%02x", (uint8_t)user[i]);
+    }
+    path[n] = '\0';
+}
+
+int mailbox_open(mailbox_store_t *st, const char *dir, time_t ttl, size_t max_bytes) {
+    memset(st, 0, sizeof(*st));
+    snprintf(st->dir, sizeof(st->dir), "%s", dir);
+    st->ttl = ttl;
+    st->max_bytes = max_bytes;
+    if (mkdir(dir, 0700) < 0 && errno != EEXIST) return -1;
+    return 0;
+}
+
+int mailbox_put(mailbox_store_t *st, const char *to, const char *from, const char *text, size_t len, time_t now) {
+    char path[1024];
+    size_t dir_len;
+    mailbox_path(st, to, path, sizeof(path), &dir_len);
+    size_t from_len = strlen(from);
+    if (from_len > NAME_MAX_BYTES) from_len = NAME_MAX_BYTES;
+    if (len > MAILBOX_TEXT_MAX) len = MAILBOX_TEXT_MAX;
+
+    int fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0600);
+    if (fd < 0 && errno == ENOENT) {
+        path[dir_len] = '\0';
+        mkdir(path, 0700);
+        path[dir_len] = '/';
+        fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0600);
+    }
+    if (fd < 0) return MAIL_ERROR;
+    struct stat sb;
+    if (fstat(fd, &sb) == 0 && sb.st_size > 0 && sb.st_mtime + st->ttl < now) {
+        // Everything in it has expired
+        if (ftruncate(fd, 0) == 0) {
+            sb.st_size = 0;
+            st->expired++;
+        }
+    }
+    size_t rec_len = RECORD_HEADER + from_len + len;
+    if ((size_t)sb.st_size + rec_len > st->max_bytes) {
+        close(fd);
+        st->refused++;
+        return MAIL_FULL;
+    }
+    uint8_t rec[RECORD_HEADER + NAME_MAX_BYTES + MAILBOX_TEXT_MAX];
+    uint32_t when = (uint32_t)now;
+    rec[0] = when;
+    rec[1] = when >> 8;
+    rec[2] = when >> 16;
+    rec[3] = when >> 24;
+    rec[4] = (uint8_t)from_len;
+    rec[5] = len;
+    rec[6] = len >> 8;
+    memcpy(rec + RECORD_HEADER, from, from_len);
+    memcpy(rec + RECORD_HEADER + from_len, text, len);
+    // One write per record, so O_APPEND keeps records whole
+    ssize_t w = write(fd, rec, rec_len);
+    close(fd);
+    if (w != (ssize_t)rec_len) return MAIL_ERROR;
+    st->stored++;
+    return MAIL_OK;
+}
+
+size_t mailbox_take(mailbox_store_t *st, const char *user, time_t now, char **out) {
+    char path[1024];
+    *out = NULL;
+    mailbox_path(st, user, path, sizeof(path), NULL);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    struct stat sb;
+    uint8_t *data = NULL;
+    size_t size = 0;
+    if (fstat(fd, &sb) == 0 && sb.st_size > 0) {
+        data = malloc(sb.st_size);
+        while (data && size < (size_t)sb.st_size) {
+            ssize_t r = read(fd, data + size, sb.st_size - size);
+            if (r <= 0) break;
+            size += r;
+        }
+    }
+    close(fd);
+    unlink(path);
+    if (!data) return 0;
+
+    // Formatting adds at most the date, "DM " and punctuation to each record
+    size_t cap = 32 + size + size / RECORD_HEADER * 24;
+    char *buf = malloc(cap);
+    size_t len = 0, count = 0;
+    for (size_t off = 0; buf && off + RECORD_HEADER <= size;) {
+        const uint8_t *rec = data + off;
+        time_t when = (time_t)((uint32_t)rec[0] | (uint32_t)rec[1] << 8 | (uint32_t)rec[2] << 16 | (uint32_t)rec[3] << 24);
+        size_t from_len = rec[4];
+        size_t text_len = rec[5] | (size_t)rec[6] << 8;
+        if (off + RECORD_HEADER + from_len + text_len > size) break;
+        off += RECORD_HEADER + from_len + text_len;
+        if (when + st->ttl < now) {
+            st->expired++;
+            continue;
+        }
+        char date[32];
+        struct tm tm;
+        localtime_r(&when, &tm);
+        strftime(date, sizeof(date), "%Y-%m-%d %H:%M", &tm);
+        len += snprintf(buf + len, cap - len, "[%s] DM %.*s: %.*s\n", date, (int)from_len,
+                        (const char *)rec + RECORD_HEADER, (int)text_len, (const char *)rec + RECORD_HEADER + from_len);
+        count++;
+    }
+    free(data);
+    if (count == 0) {
+        free(buf);
+        return 0;
+    }
+    // Prepend the header line
+    char header[32];
+    int hlen = snprintf(header, sizeof(header), "MAIL %zu\n", count);
+    memmove(buf + hlen, buf, len);
+    memcpy(buf, header, hlen);
+    st->delivered += count;
+    *out = buf;
+    return len + hlen;
+}
+
+void mailbox_sweep(mailbox_store_t *st, time_t now) {
+    char path[1024];
+    int n = snprintf(path, sizeof(path), "%s/%02x", st->dir, st->next_bucket);
+    st->next_bucket = (st->next_bucket + 1) % MAILBOX_BUCKETS;
+    DIR *d = opendir(path);
+    if (!d) return;
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+        if (e->d_name[0] == '.') continue;
+        snprintf(path + n, sizeof(path) - n, "/%s", e->d_name);
+        struct stat sb;
+        if (stat(path, &sb) == 0 && sb.st_mtime + st->ttl < now && unlink(path) == 0) {
+            st->expired++;
+        }
+    }
+    closedir(d);
+}
+
+void mailbox_print_stats(const mailbox_store_t *st, FILE *out) {
+    fprintf(out, "mail: stored %llu delivered %llu expired %llu refused %llu\n", (unsigned long long)st->stored,
+            (unsigned long long)st->delivered, (unsigned long long)st->expired, (unsigned long long)st->refused);
+}
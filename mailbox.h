@@ -0,0 +1,96 @@
+/**
+ * @file mailbox.h
+ * @brief On-disk mailboxes for direct messages to offline users.
+ *
+ * Each user's mail is one append-only file, found by name without any
+ * directory scan:
+ *
+ *     <dir>/<hash byte>/<hex of username>
+ *
+ * Records are packed as a 4-byte send time, 1-byte sender length, 2-byte
+ * text length (little endian), then the sender name and text. A mailbox
+ * holds at most max_bytes; mail older than the expiry age is dropped on
+ * delivery, and whole mailboxes that have not been written to for that long
+ * are deleted by an incremental sweep that visits one hash directory per call.
+ */
+#ifndef MAILBOX_H
+#define MAILBOX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#define MSG_CMD "/msg"
+#define MAILBOX_MAX_BYTES (64 * 1024)
+#define MAILBOX_TEXT_MAX 2048
+#define MAILBOX_TTL_SECS (7 * 24 * 3600)
+#define MAILBOX_BUCKETS 256
+
+enum { MAIL_OK, MAIL_FULL, MAIL_ERROR };
+
+/**
+ * @brief A mailbox directory and its counters.
+ */
+typedef struct {
+    char dir[256];             /**< Root directory. */
+    time_t ttl;                /**< Mail older than this many seconds expires. */
+    size_t max_bytes;          /**< Size limit of one mailbox file. */
+    int next_bucket;           /**< Hash directory visited by the next sweep. */
+    uint64_t stored;           /**< Messages written. */
+    uint64_t delivered;        /**< Messages delivered on login. */
+    uint64_t expired;          /**< Messages dropped for age, counting whole deleted mailboxes as one. */
+    uint64_t refused;          /**< Messages refused because a mailbox was full. */
+} mailbox_store_t;
+
+/**
+ * @brief Open (creating if needed) a mailbox directory.
+ * @param st Store to initialize.
+ * @param dir Root directory.
+ * @param ttl Expiry age in seconds.
+ * @param max_bytes Size limit of one mailbox.
+ * @return 0 on success, -1 on error (errno set).
+ */
+int mailbox_open(mailbox_store_t *st, const char *dir, time_t ttl, size_t max_bytes);
+
+/**
+ * @brief Append a message to a user's mailbox.
+ * @param st Store.
+ * @param to Recipient's username.
+ * @param from Sender's username.
+ * @param text Message text.
+ * @param len Text length, cut to MAILBOX_TEXT_MAX.
+ * @param now Current time.
+ * @return MAIL_OK, MAIL_FULL, or MAIL_ERROR.
+ */
+int mailbox_put(mailbox_store_t *st, const char *to, const char *from, const char *text, size_t len, time_t now);
+
+/**
+ * @brief Remove a user's mailbox and format its unexpired mail.
+ *
+ * The result is a "MAIL <n>" line followed by one
+ * "[YYYY-MM-DD HH:MM] DM <from>: <text>" line per message.
+ *
+ * @param st Store.
+ * @param user Username that logged in.
+ * @param now Current time.
+ * @param out Receives a malloc'd buffer to pass to free(), or NULL.
+ * @return Length of *out, 0 if there was no mail.
+ */
+size_t mailbox_take(mailbox_store_t *st, const char *user, time_t now, char **out);
+
+/**
+ * @brief Delete expired mailboxes in the next hash directory.
+ * @param st Store.
+ * @param now Current time.
+ */
+void mailbox_sweep(mailbox_store_t *st, time_t now);
+
+/**
+ * @brief Print the store's counters.
+ * @param st Store.
+ * @param out Output stream.
+ */
+void mailbox_print_stats(const mailbox_store_t *st, FILE *out);
+
+#endif // MAILBOX_H
@@ -2,143 +2,1490 @@
  * @file main.c
  * @brief Entry point for the modularized multi-client chat server with UDP discovery and authentication.
  */
+#define _GNU_SOURCE
 #include "discovery.h"
 #include "chat.h"
+#include "fanout.h"
+#include "filter.h"
 #include "network_utils.h"
 #include "auth.h"
+#include "mailbox.h"
+#include "mcast.h"
+#include "msgtrace.h"
+#include "pool.h"
+#include "presence.h"
+#include "scan.h"
+#include "sched.h"
+#include "search.h"
+#include "trace.h"
+#include "transfer.h"
+#include "ws.h"
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <netinet/in.h>
+#include <sched.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
-#define MAX_CLIENTS 500
-#define USERNAME_MAX_LEN 32
+#define MAX_EVENTS 64
+#define DISCOVERY_INTERVAL_US 5000000LL
+#define HANDSHAKE_TIMEOUT_US 10000000LL
+#define MAX_HANDSHAKES 4096
+#define NOTSENT_LOWAT (64 * 1024)  // unsent bytes a client socket holds before it stops taking more
+#define SHUTDOWN_FLUSH_US 2000000   // how long backed-up clients get to take the goodbye
 
-static int client_socket[MAX_CLIENTS] = {0};
-static char client_usernames[MAX_CLIENTS][USERNAME_MAX_LEN] = {{0}};
-static int num_clients = 0;
-static int running = 1;
+// epoll_event.data.u64 carries (kind << 32) | slot
+enum { EV_TCP_LISTENER, EV_LOCAL_LISTENER, EV_WS_LISTENER, EV_CLIENT, EV_CLIENT_RING, EV_TRANSFER_DONE, EV_HANDSHAKE, EV_SEARCH_DONE, EV_FILTER_DONE };
+
+enum { SERVE_DONE, SERVE_MORE, SERVE_THROTTLED };
+
+/**
+ * @brief A connection that has been accepted but has not logged in yet.
+ */
+typedef struct {
+    auth_session_t auth;   /**< Login state; auth.fd is 0 when the entry is free. */
+    int local;             /**< Came in on the shared-memory listener. */
+    ws_conn_t *ws;         /**< WebSocket state if it came in on the WebSocket listener. */
+    int64_t deadline;      /**< Login must complete before this time. */
+} handshake_t;
+
+/**
+ * @brief Connection admission counters, printed on SIGUSR1.
+ */
+typedef struct {
+    uint64_t accepted;     /**< Connections taken off the listen backlog. */
+    uint64_t admitted;     /**< Logins completed. */
+    uint64_t shed;         /**< Rejected at once because no client slot was left. */
+    uint64_t timed_out;    /**< Did not log in within HANDSHAKE_TIMEOUT_US. */
+    uint64_t failed;       /**< Hung up during login. */
+} admission_stats_t;
+
+static client_table_t clients;
+static ready_queue_t ready;
+static presence_t presence;
+static handshake_t handshakes[MAX_HANDSHAKES];
+static int free_handshakes[MAX_HANDSHAKES];
+static int num_free_handshakes = 0;
+static int listeners[3] = {-1, -1, -1};  // TCP, shared-memory and WebSocket listeners, by EV_*_LISTENER
+static int listeners_paused = 0;
+static admission_stats_t admission;
+static uint64_t rejected_messages = 0;   // failed the UTF-8 / control character scan
+static mailbox_store_t mail;
+static int mail_enabled = 0;             // offline mailboxes, on with -m
+static mcast_sender_t mcast = {.sock = -1};  // multicast room delivery, on with -g
+static filter_t *content_filter = NULL;  // banned terms and URLs, on with -f
+static const char *filter_path = NULL;
+static struct timespec filter_mtime;     // pattern file version the last reload started from
+static int filter_pending = 0;           // a forced reload came in while another was running
+static uint64_t filter_counts[FILTER_DROP + 1];  // messages by filter action
+static uint64_t filter_reloads = 0;
+static int epoll_fd = -1;
+static int rate_limit = 0;   // messages per second per client, 0 = unlimited
+static int rate_burst = 20;
+static int presence_max_fanout = 0;  // skip presence deltas above this many clients, 0 = never
+static int accept_batch = 64;        // connections accepted per listener wakeup
+static int max_handshakes = 128;     // logins in progress before new connections are shed
+static int defer_accept = 0;         // TCP_DEFER_ACCEPT seconds, 0 = off
+static int busy_poll_us = 0;         // spin on epoll this long before sleeping, 0 = off
+static uint64_t spin_hits = 0;       // waits that found events while spinning
+static uint64_t spin_sleeps = 0;     // waits that spun for nothing and then slept
+static long startup_rss_kb = 0;      // before any client connected
+static int fifo_lanes = 0;           // one FIFO instead of priority lanes, with -L
+static atomic_int slow_consumers = 0;   // some client's outbound queue overflowed, maybe on a fan-out helper
+static uint64_t slow_kicks = 0;      // clients disconnected for it
+static volatile sig_atomic_t running = 1;
+static volatile sig_atomic_t stats_requested = 0;
+static volatile sig_atomic_t msgtrace_requested = 0;
+static volatile sig_atomic_t reload_requested = 0;
 
 /**
- * @brief Signal handler for SIGINT to cleanly announce server shutdown.
+ * @brief Signal handler for SIGINT: stop the main loop, which then says goodbye to the clients.
  */
 void handle_sigint(int sig) {
-    printf("\nServer shutting down. Notifying clients...\n");
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (client_socket[i] > 0) {
-            char msg[128];
-            snprintf(msg, sizeof(msg), "Server is shutting down. Goodbye, %s!\n", client_usernames[i][0] ? client_usernames[i] : "client");
-            send(client_socket[i], msg, strlen(msg), 0);
-            close(client_socket[i]);
+    running = 0;
+}
+
+/**
+ * @brief Signal handler for SIGUSR1: print allocator statistics from the main loop.
+ */
+static void handle_sigusr1(int sig) {
+    stats_requested = 1;
+}
+
+/**
+ * @brief Signal handler for SIGUSR2: dump sampled message traces from the main loop.
+ */
+static void handle_sigusr2(int sig) {
+    msgtrace_requested = 1;
+}
+
+/**
+ * @brief Signal handler for SIGHUP: reload the content filter from the main loop.
+ */
+static void handle_sighup(int sig) {
+    reload_requested = 1;
+}
+
+/**
+ * @brief Log a join or leave and queue it for the next presence flush.
+ */
+static void announce_presence(int slot, int joined) {
+    char notice[128];
+    chat_format_presence(notice, sizeof(notice), client_display_name(&clients.clients[slot]), joined);
+    printf("%s", notice);
+    if (joined) {
+        presence_joined(&presence, &clients.clients[slot]);
+    } else {
+        presence_left(&presence, &clients.clients[slot]);
+    }
+}
+
+/**
+ * @brief Check whether a message starts with a command word.
+ * @return Length of the command if it matches and is followed by whitespace
+ *         (or, when has_args is 0, by nothing), 0 otherwise.
+ */
+static size_t match_command(const struct iovec *payload, int payload_cnt, const char *cmd, int has_args) {
+    size_t cmd_len = strlen(cmd);
+    if (payload_cnt < 1 || payload[0].iov_len < cmd_len || memcmp(payload[0].iov_base, cmd, cmd_len) != 0) return 0;
+    if (payload[0].iov_len == cmd_len) return has_args ? 0 : cmd_len;
+    return isspace(((unsigned char *)payload[0].iov_base)[cmd_len]) ? cmd_len : 0;
+}
+
+/**
+ * @brief Hand a "/search" query to the search worker; the answer arrives later.
+ */
+static void handle_search(int slot, const char *query, size_t len) {
+    client_t *c = &clients.clients[slot];
+    if (len > 256) len = 256;
+    while (len > 0 && isspace((unsigned char)query[len - 1])) len--;
+    while (len > 0 && isspace((unsigned char)*query)) {
+        query++;
+        len--;
+    }
+    if (search_submit_query(slot, c->id, query, len) < 0) {
+        const char *busy = "SEARCH busy, try again later\n";
+        client_send(c, busy, strlen(busy));
+    }
+}
+
+/**
+ * @brief Deliver "/msg <user> <text>" now, or store it if the user is offline or could not take it.
+ */
+static void handle_direct_message(int slot, const char *args, size_t len) {
+    client_t *c = &clients.clients[slot];
+    char to[USERNAME_MAX_LEN];
+    char reply[128];
+    size_t i = 0, n = 0;
+    while (i < len && isspace((unsigned char)args[i])) i++;
+    while (i < len && !isspace((unsigned char)args[i]) && n < sizeof(to) - 1) to[n++] = args[i++];
+    to[n] = '\0';
+    while (i < len && isspace((unsigned char)args[i])) i++;
+    while (len > i && isspace((unsigned char)args[len - 1])) len--;
+    if (n == 0 || i == len) {
+        const char *usage = "ERROR usage: /msg <user> <text>\n";
+        client_send_lane(c, OUTQ_CONTROL, usage, strlen(usage));
+        return;
+    }
+    const char *from = client_display_name(c);
+    char head[USERNAME_MAX_LEN + 8];
+    int head_len = snprintf(head, sizeof(head), "DM %s: ", from);
+    struct iovec msg[3] = {{head, head_len}, {(void *)(args + i), len - i}, {"\n", 1}};
+    int online = 0, receiving = 0, delivered = 0;
+    for (int j = 0; j < clients.end; j++) {
+        client_t *r = &clients.clients[j];
+        if (r->fd <= 0 || strcmp(r->username, to) != 0) continue;
+        online++;
+        if (r->in_transfer) {
+            receiving++;
+        } else if (client_sendv(r, msg, 3) >= 0) {
+            delivered++;
         }
     }
-    running = 0;
+    // A recipient whose send failed (too far behind, out of memory) gets it from the mailbox instead
+    if (delivered > 0) {
+        snprintf(reply, sizeof(reply), "MSG sent to %s\n", to);
+    } else if (receiving > 0) {
+        snprintf(reply, sizeof(reply), "ERROR %s is receiving a file, try again later\n", to);
+    } else if (!mail_enabled) {
+        snprintf(reply, sizeof(reply), online > 0 ? "ERROR could not deliver to %s\n" : "ERROR %s is offline\n", to);
+    } else {
+        int rc = mailbox_put(&mail, to, from, args + i, len - i, time(NULL));
+        if (rc == MAIL_OK) {
+            snprintf(reply, sizeof(reply), "MSG stored for %s\n", to);
+        } else if (rc == MAIL_FULL) {
+            snprintf(reply, sizeof(reply), "ERROR mailbox of %s is full\n", to);
+        } else {
+            snprintf(reply, sizeof(reply), "ERROR could not store message for %s\n", to);
+        }
+    }
+    client_send(c, reply, strlen(reply));
+}
+
+/**
+ * @brief Switch a client between TCP and multicast room delivery with "/multicast on|off".
+ *
+ * The reply to "on" tells the client where to listen, the first sequence
+ * number it will be responsible for, and its own connection number, so it
+ * can ignore its own messages.
+ */
+static void handle_multicast(int slot, const char *args, size_t len) {
+    client_t *c = &clients.clients[slot];
+    char reply[128];
+    while (len > 0 && isspace((unsigned char)args[len - 1])) len--;
+    while (len > 0 && isspace((unsigned char)*args)) {
+        args++;
+        len--;
+    }
+    if (mcast.sock < 0) {
+        snprintf(reply, sizeof(reply), "ERROR multicast is not enabled\n");
+    } else if (len == 2 && memcmp(args, "on", 2) == 0) {
+        char group[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &mcast.group.sin_addr, group, sizeof(group));
+        snprintf(reply, sizeof(reply), "MCAST %s %d %llu %llu\n", group, ntohs(mcast.group.sin_port),
+                 (unsigned long long)mcast.next_seq, (unsigned long long)c->id);
+        c->multicast = 1;
+    } else if (len == 3 && memcmp(args, "off", 3) == 0) {
+        snprintf(reply, sizeof(reply), "MCAST off\n");
+        c->multicast = 0;
+    } else {
+        snprintf(reply, sizeof(reply), "ERROR usage: /multicast on|off\n");
+    }
+    client_send(c, reply, strlen(reply));
+}
+
+/**
+ * @brief Resend the room messages named by "/nack <first> <last>".
+ *
+ * Several ranges may arrive in one read when a receiver sends NACKs back to
+ * back, so every "<first> <last>" pair in the message is answered.
+ */
+static void handle_nack(int slot, const char *args, size_t len) {
+    client_t *c = &clients.clients[slot];
+    char buf[1024];
+    if (mcast.sock < 0) {
+        const char *off = "ERROR multicast is not enabled\n";
+        client_send_lane(c, OUTQ_CONTROL, off, strlen(off));
+        return;
+    }
+    if (len >= sizeof(buf)) len = sizeof(buf) - 1;
+    memcpy(buf, args, len);
+    buf[len] = '\0';
+    int ranges = 0;
+    char *save, *tok = strtok_r(buf, " \t\r\n", &save);
+    while (tok) {
+        char *end;
+        unsigned long long first = strtoull(tok, &end, 10), last;
+        if (strcmp(tok, NACK_CMD) == 0) {
+            tok = strtok_r(NULL, " \t\r\n", &save);
+            continue;
+        }
+        if (*end || !(tok = strtok_r(NULL, " \t\r\n", &save))) break;
+        last = strtoull(tok, &end, 10);
+        if (*end || last < first) break;
+        mcast_repair(&mcast, c, first, last);
+        ranges++;
+        tok = strtok_r(NULL, " \t\r\n", &save);
+    }
+    if (ranges == 0) {
+        const char *usage = "ERROR usage: /nack <first> <last>\n";
+        client_send_lane(c, OUTQ_CONTROL, usage, strlen(usage));
+    }
+}
+
+/**
+ * @brief Answer "/ping <token>" with "PONG <token>" ahead of any queued chat or bulk output.
+ *
+ * One reply per line: the token is the rest of the line, trimmed and cut to
+ * 64 bytes. A bare "/ping" is answered with "PONG".
+ */
+static void handle_ping(int slot, const char *token, size_t len) {
+    char reply[80];
+    while (len > 0 && isspace((unsigned char)token[len - 1])) len--;
+    while (len > 0 && isspace((unsigned char)*token)) {
+        token++;
+        len--;
+    }
+    if (len > 64) len = 64;
+    int n = snprintf(reply, sizeof(reply), len ? "PONG %.*s\n" : "PONG\n", (int)len, token);
+    client_send_lane(&clients.clients[slot], OUTQ_CONTROL, reply, n);
+}
+
+/**
+ * @brief Send a client that just logged in the mail that waited for it.
+ */
+static void deliver_mail(int slot) {
+    client_t *c = &clients.clients[slot];
+    char *batch;
+    size_t len = mailbox_take(&mail, c->username, time(NULL), &batch);
+    if (len > 0) {
+        client_send_lane(c, OUTQ_BULK, batch, len);
+        free(batch);
+    }
+}
+
+/**
+ * @brief Add an inbound message to the traffic trace, if one is being recorded.
+ */
+static void trace_message(int slot, int kind, const struct iovec *payload, int payload_cnt) {
+    if (!trace_enabled()) return;
+    size_t len = 0;
+    for (int i = 0; i < payload_cnt; i++) len += payload[i].iov_len;
+    trace_record(kind, sched_now_us(), clients.clients[slot].id, len);
+}
+
+/**
+ * @brief Relay one message received from a client to everyone else.
+ *
+ * Messages that are not valid UTF-8 or carry control characters are refused
+ * with an error to the sender. Relayed messages are also queued for the
+ * search index; "/search" queries go to the search worker and "/msg" goes to
+ * one user instead of the room. With multicast on, each relayed message is
+ * also sent once to the group for clients that opted in with "/multicast".
+ * With a content filter loaded, messages matching a "drop" pattern are
+ * refused, "mask" matches are starred out and "flag" matches are logged.
+ *
+ * @param slot Sender's slot.
+ * @param payload Message bytes, possibly spread over several buffers.
+ * @param payload_cnt Number of buffers.
+ */
+static void handle_client_data(int slot, const struct iovec *payload, int payload_cnt) {
+    if (!scan_message(payload, payload_cnt)) {
+        const char *err = "ERROR message rejected: invalid UTF-8 or control characters\n";
+        client_send_lane(&clients.clients[slot], OUTQ_CONTROL, err, strlen(err));
+        rejected_messages++;
+        return;
+    }
+    if (content_filter) {
+        int action = filter_scan(content_filter, payload, payload_cnt);
+        filter_counts[action]++;
+        if (action == FILTER_DROP) {
+            const char *err = "ERROR message blocked by the content filter\n";
+            client_send_lane(&clients.clients[slot], OUTQ_CONTROL, err, strlen(err));
+            return;
+        }
+        if (action == FILTER_FLAG) printf("Flagged message from %s\n", client_display_name(&clients.clients[slot]));
+    }
+    const char *first = payload_cnt > 0 ? payload[0].iov_base : "";
+    size_t cmd_len;
+    if ((cmd_len = match_command(payload, payload_cnt, SEARCH_CMD, 0))) {
+        trace_message(slot, TRACE_SEARCH, payload, payload_cnt);
+        handle_search(slot, first + cmd_len, payload[0].iov_len - cmd_len);
+        return;
+    }
+    if ((cmd_len = match_command(payload, payload_cnt, MSG_CMD, 1))) {
+        trace_message(slot, TRACE_DIRECT, payload, payload_cnt);
+        handle_direct_message(slot, first + cmd_len, payload[0].iov_len - cmd_len);
+        return;
+    }
+    if ((cmd_len = match_command(payload, payload_cnt, MCAST_CMD, 0))) {
+        handle_multicast(slot, first + cmd_len, payload[0].iov_len - cmd_len);
+        return;
+    }
+    if ((cmd_len = match_command(payload, payload_cnt, NACK_CMD, 1))) {
+        handle_nack(slot, first + cmd_len, payload[0].iov_len - cmd_len);
+        return;
+    }
+    if ((cmd_len = match_command(payload, payload_cnt, PING_CMD, 0))) {
+        handle_ping(slot, first + cmd_len, payload[0].iov_len - cmd_len);
+        return;
+    }
+    trace_message(slot, TRACE_MESSAGE, payload, payload_cnt);
+    char prefix[USERNAME_MAX_LEN + 4];
+    struct iovec msg[MESSAGE_MAX_IOV + 2];
+    int cnt = chat_message_iov(msg, prefix, sizeof(prefix), client_display_name(&clients.clients[slot]), payload, payload_cnt);
+    msgtrace_stage(MSGTRACE_PARSE, slot);
+    chat_broadcastv(&clients, slot, msg, cnt);
+    if (mcast.sock >= 0) mcast_send(&mcast, clients.clients[slot].id, msg, cnt);
+    msgtrace_stage(MSGTRACE_FANOUT, slot);
+    search_submit_message(client_display_name(&clients.clients[slot]), payload, payload_cnt);
+    for (int i = 0; i < cnt; i++) {
+        fwrite(msg[i].iov_base, 1, msg[i].iov_len, stdout);
+    }
+}
+
+/**
+ * @brief Read what a TCP client sent into pooled segments, after any bytes already in the chain.
+ *
+ * Keeps reading while each read fills the space offered, up to
+ * MAX_MESSAGE_SIZE in the chain, so a large write arrives in one piece.
+ *
+ * @return Bytes read, 0 on orderly shutdown, -1 on error (errno set).
+ */
+static ssize_t recv_message(int fd, buf_chain_t *chain) {
+    size_t got = 0;
+    while (chain->len < MAX_MESSAGE_SIZE) {
+        size_t avail;
+        char *dst = buf_chain_reserve(chain, &avail);
+        if (!dst) return got > 0 ? (ssize_t)got : -1;
+        if (avail > MAX_MESSAGE_SIZE - chain->len) avail = MAX_MESSAGE_SIZE - chain->len;
+        ssize_t n = recv(fd, dst, avail, MSG_DONTWAIT);
+        if (n <= 0) return got > 0 ? (ssize_t)got : n;
+        buf_chain_commit(chain, n);
+        got += n;
+        if ((size_t)n < avail) break;
+    }
+    return got;
+}
+
+/**
+ * @brief Length of a chain up to and including its last newline, 0 if it has none.
+ */
+static size_t chain_line_end(const buf_chain_t *chain) {
+    size_t end = 0, off = 0;
+    for (buf_seg_t *seg = chain->head; seg; seg = seg->next) {
+        char *nl = memrchr(seg->data, '\n', seg->len);
+        if (nl) end = off + (size_t)(nl - seg->data) + 1;
+        off += seg->len;
+    }
+    return end;
+}
+
+/**
+ * @brief Hold on to the start of an unfinished line until the rest arrives.
+ *
+ * Releases the chain instead if it is empty or the client is gone.
+ */
+static void keep_partial(client_t *c, buf_chain_t *chain) {
+    if (chain->len > 0 && c->fd > 0 && (c->partial = pool_alloc(sizeof(buf_chain_t)))) {
+        *c->partial = *chain;
+        return;
+    }
+    buf_chain_free(chain);
+}
+
+/**
+ * @brief Handle each line of a TCP read as its own message.
+ *
+ * Every line is charged to the sender's rate limit. Blank lines are skipped
+ * unless they are the whole read.
+ *
+ * @param slot Sender's slot.
+ * @param chain Input from recv_message().
+ * @param recv_start Trace timestamp taken before the read.
+ * @param now Current time in microseconds.
+ * @return Number of lines handled.
+ */
+static int handle_client_lines(int slot, const buf_chain_t *chain, int64_t recv_start, int64_t now) {
+    client_t *c = &clients.clients[slot];
+    struct iovec line[MESSAGE_MAX_IOV];
+    int nline = 0, handled = 0;
+    size_t line_len = 0;
+    for (buf_seg_t *seg = chain->head; seg; seg = seg->next) {
+        size_t off = 0;
+        while (off < seg->len) {
+            char *nl = memchr(seg->data + off, '\n', seg->len - off);
+            size_t end = nl ? (size_t)(nl - seg->data) + 1 : seg->len;
+            if (nline < MESSAGE_MAX_IOV) {
+                line[nline].iov_base = seg->data + off;
+                line[nline++].iov_len = end - off;
+            }
+            line_len += end - off;
+            off = end;
+            // A line without a newline ends only with the input
+            if (!nl && seg->next) continue;
+            int blank = line_len == 1 || (line_len == 2 && *(char *)line[0].iov_base == '\r');
+            if (!blank || line_len == chain->len) {
+                msgtrace_begin(handled == 0 ? recv_start : msgtrace_recv_start());
+                msgtrace_stage(MSGTRACE_RECV, slot);
+                rate_limit_charge(&c->rate_tat, now, rate_limit);
+                handle_client_data(slot, line, nline);
+                msgtrace_end();
+                handled++;
+                if (c->fd <= 0) return handled;
+            }
+            nline = 0;
+            line_len = 0;
+        }
+    }
+    return handled;
+}
+
+/**
+ * @brief Remove a client that went away and tell the others.
+ */
+static void drop_client(int slot) {
+    trace_record(TRACE_DISCONNECT, sched_now_us(), clients.clients[slot].id, 0);
+    announce_presence(slot, 0);
+    client_disconnect(&clients, slot);
+}
+
+/**
+ * @brief Hand sockets back to the event loop after a relay thread finished.
+ *
+ * Recipients the relay cut off are disconnected, since their byte stream no
+ * longer lines up with the protocol.
+ */
+static void finish_transfer(transfer_t *t) {
+    int delivered = 0;
+    for (int i = 0; i < t->num_peers; i++) {
+        transfer_peer_t *p = &t->peers[i];
+        clients.clients[p->slot].in_transfer = 0;
+        if (p->dropped) {
+            drop_client(p->slot);
+        } else {
+            delivered++;
+            ready_queue_push(&ready, p->slot);
+        }
+    }
+    client_t *c = &clients.clients[t->sender_slot];
+    c->in_transfer = 0;
+    if (t->sender_failed) {
+        printf("Transfer %d failed: sender stopped after %zu of %zu bytes\n", t->id, t->relayed, t->size);
+        drop_client(t->sender_slot);
+    } else {
+        char reply[80];
+        int total = t->num_peers + t->skipped;
+        if (t->skipped > 0) {
+            snprintf(reply, sizeof(reply), "DONE %d %d/%d, %d skipped\n", t->id, delivered, total, t->skipped);
+        } else {
+            snprintf(reply, sizeof(reply), "DONE %d %d/%d\n", t->id, delivered, total);
+        }
+        client_send(c, reply, strlen(reply));
+        printf("Transfer %d complete: %zu bytes to %d/%d clients, %d skipped\n", t->id, t->size, delivered, total,
+               t->skipped);
+        ready_queue_push(&ready, t->sender_slot);
+    }
+    transfer_free(t);
+}
+
+/**
+ * @brief Turn down a "/sendfile" that cannot be relayed.
+ *
+ * The sender is about to write the payload, which must not be read as chat,
+ * so it is told why and disconnected.
+ */
+static void refuse_transfer(int slot, const char *why) {
+    char err[128];
+    int n = snprintf(err, sizeof(err), "ERROR file transfer failed: %s, disconnecting\n", why);
+    printf("Transfer from %s refused: %s\n", client_display_name(&clients.clients[slot]), why);
+    client_send_lane(&clients.clients[slot], OUTQ_CONTROL, err, n);
+    drop_client(slot);
+}
+
+/**
+ * @brief Start relaying a file announced with "/sendfile <bytes> <name>".
+ *
+ * Every other TCP client that is not already part of a transfer becomes a
+ * recipient, up to TRANSFER_MAX_RECIPIENTS; the rest are counted as skipped
+ * and reported with DONE. Payload bytes that arrived together with the
+ * command are forwarded by the relay before it starts splicing.
+ *
+ * @param slot Sender's slot.
+ * @param chain Received bytes, starting with the command line.
+ * @param cmd_len Length of the command line.
+ * @param size Announced payload size.
+ * @param name Announced file name.
+ */
+static void start_transfer(int slot, buf_chain_t *chain, size_t cmd_len, size_t size, const char *name) {
+    client_t *c = &clients.clients[slot];
+    transfer_t *t = transfer_create(c->fd, slot, client_display_name(c), name, size);
+    if (!t) {
+        refuse_transfer(slot, "out of memory");
+        return;
+    }
+    for (int j = 0; j < clients.end; j++) {
+        client_t *r = &clients.clients[j];
+        if (j != slot && r->fd > 0 && !r->shm && !r->ws && !r->in_transfer && !r->outq) {
+            if (transfer_add_peer(t, r->fd, j) < 0) t->skipped++;
+        }
+    }
+    size_t extra = chain->len - cmd_len;
+    if (extra > size) extra = size;
+    if (extra > 0) {
+        t->leftover = pool_alloc(extra);
+        if (!t->leftover) {
+            transfer_free(t);
+            refuse_transfer(slot, "out of memory");
+            return;
+        }
+        t->leftover_len = extra;
+        size_t off = 0, skip = cmd_len;
+        for (buf_seg_t *seg = chain->head; seg && off < extra; seg = seg->next) {
+            size_t from = skip < seg->len ? skip : seg->len;
+            size_t n = seg->len - from;
+            if (n > extra - off) n = extra - off;
+            memcpy(t->leftover + off, seg->data + from, n);
+            off += n;
+            skip -= from;
+        }
+    }
+    if (t->skipped > 0) printf("Transfer %d: %d recipients skipped\n", t->id, t->skipped);
+    char reply[64];
+    snprintf(reply, sizeof(reply), "READY %d\n", t->id);
+    client_send(c, reply, strlen(reply));
+    c->in_transfer = 1;
+    for (int i = 0; i < t->num_peers; i++) clients.clients[t->peers[i].slot].in_transfer = 1;
+    printf("Transfer %d: %s is sending '%s' (%zu bytes) to %d clients\n", t->id, client_display_name(c), name, size, t->num_peers);
+    if (transfer_start(t) < 0) {
+        perror("pthread_create");
+        const char *err = "ERROR file transfer failed: relay not started, disconnecting\n";
+        client_send_lane(c, OUTQ_CONTROL, err, strlen(err));
+        t->sender_failed = 1;
+        finish_transfer(t);
+    }
+}
+
+/**
+ * @brief Serve one client within its read budget.
+ *
+ * Reads at most READ_BUDGET_MSGS chunks / READ_BUDGET_BYTES bytes, stopping
+ * early when the client has no more input or is over its rate limit.
+ *
+ * @param slot Client slot.
+ * @param now Current time in microseconds.
+ * @param retry_us Lowered to the client's rate-limit delay if it is throttled.
+ * @return SERVE_DONE, SERVE_MORE if the budget ran out, or SERVE_THROTTLED.
+ */
+static int serve_client(int slot, int64_t now, int64_t *retry_us) {
+    client_t *c = &clients.clients[slot];
+    int msgs = 0;
+    size_t bytes = 0;
+    while (msgs < READ_BUDGET_MSGS && bytes < READ_BUDGET_BYTES) {
+        // A client in a transfer is re-queued when the relay hands it back
+        if (c->fd <= 0 || c->in_transfer) return SERVE_DONE;
+        int64_t wait = rate_limit_wait(c->rate_tat, now, rate_limit, rate_burst);
+        if (wait > 0) {
+            if (wait < *retry_us) *retry_us = wait;
+            return SERVE_THROTTLED;
+        }
+        struct iovec payload[MESSAGE_MAX_IOV];
+        int npayload = 0;
+        size_t len;
+        int64_t recv_start = msgtrace_recv_start();
+        if (c->shm) {
+            char *frame = pool_alloc(MAX_MESSAGE_SIZE);
+            ssize_t n = frame ? shm_conn_recv(c->shm, frame, MAX_MESSAGE_SIZE) : 0;
+            if (n < 0) {
+                // The client wrote a frame header its ring cannot hold
+                printf("Disconnecting %s: corrupt shared-memory ring\n", client_display_name(c));
+                pool_free(frame, MAX_MESSAGE_SIZE);
+                drop_client(slot);
+                return SERVE_DONE;
+            }
+            len = n;
+            if (len == 0) {
+                pool_free(frame, MAX_MESSAGE_SIZE);
+                if (shm_conn_prepare_wait(c->shm)) return SERVE_DONE;
+                continue;
+            }
+            payload[npayload].iov_base = frame;
+            payload[npayload++].iov_len = len;
+            msgtrace_begin(recv_start);
+            msgtrace_stage(MSGTRACE_RECV, slot);
+            rate_limit_charge(&c->rate_tat, now, rate_limit);
+            if (len >= strlen(TRANSFER_CMD) && memcmp(frame, TRANSFER_CMD, strlen(TRANSFER_CMD)) == 0) {
+                const char *err = "ERROR file transfer needs a TCP connection\n";
+                client_send_lane(c, OUTQ_CONTROL, err, strlen(err));
+            } else {
+                handle_client_data(slot, payload, npayload);
+            }
+            msgtrace_end();
+            pool_free(frame, MAX_MESSAGE_SIZE);
+        } else if (c->ws) {
+            char *frame = pool_alloc(MAX_MESSAGE_SIZE);
+            int rc = frame ? ws_recv(c->ws, c->fd, frame, MAX_MESSAGE_SIZE, &len) : WS_AGAIN;
+            if (rc == WS_CONTROL) {
+                // A ping or pong costs a message of the budget and the rate limit
+                pool_free(frame, MAX_MESSAGE_SIZE);
+                rate_limit_charge(&c->rate_tat, now, rate_limit);
+                msgs++;
+                continue;
+            }
+            if (rc != WS_MESSAGE) {
+                pool_free(frame, MAX_MESSAGE_SIZE);
+                if (rc == WS_CLOSED) drop_client(slot);
+                return SERVE_DONE;
+            }
+            payload[npayload].iov_base = frame;
+            payload[npayload++].iov_len = len;
+            msgtrace_begin(recv_start);
+            msgtrace_stage(MSGTRACE_RECV, slot);
+            rate_limit_charge(&c->rate_tat, now, rate_limit);
+            if (len >= strlen(TRANSFER_CMD) && memcmp(frame, TRANSFER_CMD, strlen(TRANSFER_CMD)) == 0) {
+                const char *err = "ERROR file transfer needs a raw TCP connection\n";
+                client_send_lane(c, OUTQ_CONTROL, err, strlen(err));
+            } else {
+                handle_client_data(slot, payload, npayload);
+            }
+            msgtrace_end();
+            pool_free(frame, MAX_MESSAGE_SIZE);
+        } else {
+            // The start of an unfinished line comes first
+            buf_chain_t chain = {0};
+            if (c->partial) {
+                chain = *c->partial;
+                pool_free(c->partial, sizeof(buf_chain_t));
+                c->partial = NULL;
+            }
+            ssize_t valread = recv_message(c->fd, &chain);
+            if (valread < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+                keep_partial(c, &chain);
+                return SERVE_DONE;
+            }
+            if (valread <= 0) {
+                // Client disconnected
+                buf_chain_free(&chain);
+                drop_client(slot);
+                return SERVE_DONE;
+            }
+            len = valread;
+            size_t file_size;
+            char file_name[64];
+            int cmd_len = transfer_parse_command(chain.head->data, chain.head->len, &file_size, file_name, sizeof(file_name));
+            if (cmd_len > 0) {
+                msgtrace_begin(recv_start);
+                msgtrace_stage(MSGTRACE_RECV, slot);
+                rate_limit_charge(&c->rate_tat, now, rate_limit);
+                start_transfer(slot, &chain, cmd_len, file_size, file_name);
+                msgtrace_end();
+                buf_chain_free(&chain);
+            } else {
+                // Once a client has ended a line, input without a newline is the start of the next one
+                size_t whole = chain_line_end(&chain);
+                if (whole > 0) c->lines = 1;
+                if (whole == 0 && c->lines && chain.len < MAX_MESSAGE_SIZE) {
+                    keep_partial(c, &chain);
+                    return SERVE_DONE;
+                }
+                buf_chain_t rest = {0};
+                if (whole > 0 && whole < chain.len && buf_chain_split(&chain, whole, &rest) < 0) {
+                    buf_chain_free(&chain);
+                    drop_client(slot);
+                    return SERVE_DONE;
+                }
+                // Count every line against the budget, not just the read
+                msgs += handle_client_lines(slot, &chain, recv_start, now) - 1;
+                buf_chain_free(&chain);
+                keep_partial(c, &rest);
+            }
+        }
+        msgs++;
+        bytes += len;
+    }
+    return SERVE_MORE;
+}
+
+/**
+ * @brief Check a shared-memory client's Unix socket, which only carries hangups.
+ */
+static void poll_shm_socket(int slot) {
+    char buffer[64];
+    ssize_t n;
+    while ((n = recv(clients.clients[slot].fd, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
+    }
+    if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+        drop_client(slot);
+    }
+}
+
+static void epoll_add(int fd, uint32_t events, int kind, int slot) {
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.u64 = ((uint64_t)kind << 32) | (uint32_t)slot;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        perror("epoll_ctl");
+    }
+}
+
+static void epoll_mod(int fd, uint32_t events, int kind, int slot) {
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.u64 = ((uint64_t)kind << 32) | (uint32_t)slot;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+        perror("epoll_ctl");
+    }
+}
+
+static void set_nonblocking(int fd, int on) {
+    int flags = fcntl(fd, F_GETFL);
+    fcntl(fd, F_SETFL, on ? flags | O_NONBLOCK : flags & ~O_NONBLOCK);
+}
+
+/**
+ * @brief Called by chat.c when a client's output backs up.
+ *
+ * Watches the socket for writability so the queue drains. A client whose
+ * queue overflowed, or whose shared-memory ring was full, is disconnected
+ * after the current round of sends, not from inside it.
+ */
+static void on_backlog(client_t *c) {
+    if ((c->outq && c->outq->overflow) || (c->shm && c->shm->dropped)) {
+        slow_consumers = 1;
+        return;
+    }
+    epoll_mod(c->fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, EV_CLIENT, (int)(c - clients.clients));
+}
+
+/**
+ * @brief Write a client's queued output once its socket is writable again.
+ */
+static void flush_client(int slot) {
+    client_t *c = &clients.clients[slot];
+    if (c->fd <= 0 || c->shm || !c->outq) return;
+    int rc = client_flush(c);
+    if (rc < 0) {
+        drop_client(slot);
+    } else if (rc > 0) {
+        epoll_mod(c->fd, EPOLLIN | EPOLLRDHUP | EPOLLET, EV_CLIENT, slot);
+    }
+}
+
+/**
+ * @brief Disconnect the clients whose output queue overflowed or that lost a frame to a full ring.
+ */
+static void kick_slow_consumers(void) {
+    const char *why = "ERROR you are too far behind, disconnecting\n";
+    slow_consumers = 0;
+    for (int i = 0; i < clients.end; i++) {
+        client_t *c = &clients.clients[i];
+        if (c->fd > 0 && c->shm && c->shm->dropped) {
+            printf("Disconnecting %s: %llu frames dropped on a full ring\n", client_display_name(c),
+                   (unsigned long long)c->shm->dropped);
+        } else if (c->fd > 0 && c->outq && c->outq->overflow) {
+            printf("Disconnecting %s: %zu bytes of output queued\n", client_display_name(c), c->outq->bytes);
+        } else {
+            continue;
+        }
+        client_send_lane(c, OUTQ_CONTROL, why, strlen(why));
+        drop_client(i);
+        slow_kicks++;
+    }
+}
+
+/**
+ * @brief Turn a connection away without waiting on it.
+ */
+static void reject_connection(int sock, const char *why) {
+    send(sock, why, strlen(why), MSG_DONTWAIT | MSG_NOSIGNAL);
+    close(sock);
+}
+
+/**
+ * @brief Stop or resume watching the listeners.
+ *
+ * While every login slot is busy, new connections wait in the kernel's
+ * listen backlog instead of being accepted and turned away.
+ */
+static void pause_listeners(int pause) {
+    listeners_paused = pause;
+    for (int i = 0; i < 3; i++) {
+        if (listeners[i] >= 0) epoll_mod(listeners[i], pause ? 0 : EPOLLIN, i, 0);
+    }
+}
+
+static void end_handshake(int h) {
+    handshakes[h].auth.fd = 0;
+    ws_conn_free(handshakes[h].ws);
+    handshakes[h].ws = NULL;
+    free_handshakes[num_free_handshakes++] = h;
+    if (listeners_paused) pause_listeners(0);
+}
+
+/**
+ * @brief Move a connection that finished logging in into the client table.
+ */
+static void admit_client(int h) {
+    handshake_t *hs = &handshakes[h];
+    // end_handshake() hands the slot back, so keep what is needed after it
+    int sock = hs->auth.fd;
+    int local = hs->local;
+    int caps = hs->auth.caps;
+    int slot = client_table_add(&clients, sock, hs->auth.username);
+    if (slot >= 0 && local) {
+        clients.clients[slot].shm = shm_conn_offer(sock);
+        if (!clients.clients[slot].shm) {
+            client_table_remove(&clients, slot);
+            slot = -1;
+        }
+    }
+    if (slot >= 0) {
+        client_attach_ws(&clients.clients[slot], hs->ws);
+        hs->ws = NULL;
+    }
+    end_handshake(h);
+    if (slot < 0) {
+        admission.failed++;
+        reject_connection(sock, "Authentication failed or server full. Connection closed.\n");
+        return;
+    }
+    admission.admitted++;
+    if (!local) {
+        // Keep the backlog in the outbound queue, where control frames can still overtake it
+        int lowat = NOTSENT_LOWAT;
+        setsockopt(sock, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowat, sizeof(lowat));
+    }
+    if (busy_poll_us > 0 && !local) {
+        static int warned = 0;
+        if (setsockopt(sock, SOL_SOCKET, SO_BUSY_POLL, &busy_poll_us, sizeof(busy_poll_us)) < 0 && !warned) {
+            perror("SO_BUSY_POLL");
+            warned = 1;
+        }
+    }
+    client_t *c = &clients.clients[slot];
+    epoll_mod(sock, EPOLLIN | EPOLLRDHUP | EPOLLET, EV_CLIENT, slot);
+    if (c->shm) {
+        epoll_add(c->shm->rx_efd, EPOLLIN | EPOLLET, EV_CLIENT_RING, slot);
+    }
+    trace_record(TRACE_CONNECT, sched_now_us(), c->id, 0);
+    announce_presence(slot, 1);
+    // Only plain TCP: shm rings are local and WebSocket frames have their own extension for this
+    if ((caps & AUTH_CAP_ZLIB) && !c->shm && !c->ws) {
+        c->zlib = 1;
+        client_send_lane(c, OUTQ_CONTROL, ZFRAME_ACK, strlen(ZFRAME_ACK));
+    }
+    if (mail_enabled) deliver_mail(slot);
+    ready_queue_push(&ready, slot);
+}
+
+static void continue_handshake(int h) {
+    if (handshakes[h].auth.fd <= 0) return;
+    handshake_t *hs = &handshakes[h];
+    int rc = hs->ws ? ws_session_step(&hs->auth, hs->ws) : auth_session_step(&hs->auth);
+    if (rc == AUTH_OK) {
+        admit_client(h);
+    } else if (rc == AUTH_FAILED) {
+        admission.failed++;
+        close(handshakes[h].auth.fd);
+        end_handshake(h);
+    }
+}
+
+/**
+ * @brief Close logins that did not complete in time.
+ */
+static void expire_handshakes(int64_t now) {
+    for (int h = 0; h < max_handshakes; h++) {
+        if (handshakes[h].auth.fd > 0 && now >= handshakes[h].deadline) {
+            admission.timed_out++;
+            reject_connection(handshakes[h].auth.fd, "Login timed out. Connection closed.\n");
+            end_handshake(h);
+        }
+    }
+}
+
+/**
+ * @brief Start recompiling the content filter if asked to, or if its pattern file changed.
+ *
+ * The file's version is only recorded once a reload starts from it; while
+ * another reload runs, the check is repeated when that one finishes.
+ *
+ * @param force Reload even if the file looks unchanged.
+ */
+static void check_filter_file(int force) {
+    struct stat st;
+    if (stat(filter_path, &st) < 0) return;
+    if (!force && st.st_mtim.tv_sec == filter_mtime.tv_sec && st.st_mtim.tv_nsec == filter_mtime.tv_nsec) return;
+    int rc = filter_reload(filter_path);
+    if (rc < 0) {
+        perror("Content filter reload");
+    } else if (rc == 0) {
+        filter_pending |= force;
+    } else {
+        filter_mtime = st.st_mtim;
+    }
+}
+
+/**
+ * @brief Swap in a content filter compiled by a finished reload.
+ *
+ * Then starts another if the pattern file changed, or a reload was asked
+ * for, while this one was compiling.
+ */
+static void finish_filter_reload(void) {
+    int err;
+    filter_t *f = filter_reap(&err);
+    if (!f) {
+        if (err) fprintf(stderr, "Content filter reload: %s\n", strerror(err));
+    } else {
+        filter_free(content_filter);
+        content_filter = f;
+        filter_reloads++;
+        printf("Content filter reloaded: ");
+        filter_print_info(f, stdout);
+        printf("\n");
+    }
+    int force = filter_pending;
+    filter_pending = 0;
+    check_filter_file(force);
+}
+
+/**
+ * @brief Accept up to accept_batch connections and start their logins.
+ *
+ * Listeners are level-triggered, so connections left in the backlog are
+ * picked up on the next pass, after the ready clients have been served.
+ * When max_handshakes logins are in progress the listeners are paused.
+ * When every free client slot is already taken or promised to a login in
+ * progress, new connections are rejected at once.
+ */
+static void accept_clients(int listener, int kind, int64_t now) {
+    for (int i = 0; i < accept_batch; i++) {
+        if (num_free_handshakes == 0) {
+            pause_listeners(1);
+            return;
+        }
+        int sock = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (sock < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED) {
+                perror("accept4");
+            }
+            return;
+        }
+        admission.accepted++;
+        int pending = max_handshakes - num_free_handshakes;
+        if (clients.num_clients + pending >= MAX_CLIENTS) {
+            admission.shed++;
+            reject_connection(sock, kind == EV_WS_LISTENER ? "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\n\r\n"
+                                                           : "Server busy. Try again later.\n");
+            continue;
+        }
+        int h = free_handshakes[--num_free_handshakes];
+        handshake_t *hs = &handshakes[h];
+        if (kind == EV_WS_LISTENER ? !(hs->ws = ws_session_begin(&hs->auth, sock)) : auth_session_begin(&hs->auth, sock) < 0) {
+            admission.failed++;
+            close(sock);
+            end_handshake(h);
+            continue;
+        }
+        hs->local = kind == EV_LOCAL_LISTENER;
+        hs->deadline = now + HANDSHAKE_TIMEOUT_US;
+        epoll_add(sock, EPOLLIN | EPOLLRDHUP, EV_HANDSHAKE, h);
+    }
+}
+
+/**
+ * @brief Make a listener non-blocking so it can be drained in batches.
+ */
+static void setup_listener(int listener, int tcp) {
+    set_nonblocking(listener, 1);
+    if (tcp && defer_accept > 0 &&
+        setsockopt(listener, IPPROTO_TCP, TCP_DEFER_ACCEPT, &defer_accept, sizeof(defer_accept)) < 0) {
+        perror("TCP_DEFER_ACCEPT");
+    }
+}
+
+/**
+ * @brief Wait for events, spinning for up to busy_poll_us first when busy polling is on.
+ *
+ * Spinning trades a CPU for skipping the wake-up from a blocking wait.
+ */
+static int wait_events(struct epoll_event *events, int timeout_ms) {
+    if (busy_poll_us > 0 && timeout_ms != 0) {
+        int64_t until = sched_now_us() + busy_poll_us;
+        if (timeout_ms > 0 && timeout_ms * 1000LL < busy_poll_us) until = sched_now_us() + timeout_ms * 1000LL;
+        do {
+            int n = epoll_wait(epoll_fd, events, MAX_EVENTS, 0);
+            if (n != 0) {
+                spin_hits++;
+                return n;
+            }
+            // Lets a client or helper sharing this CPU run; returns at once on a dedicated core
+            sched_yield();
+        } while (sched_now_us() < until);
+        spin_sleeps++;
+    }
+    return epoll_wait(epoll_fd, events, MAX_EVENTS, timeout_ms);
+}
+
+/**
+ * @brief Resident set size of the server in KB.
+ */
+static long rss_kb(void) {
+    long pages = 0, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f) {
+        if (fscanf(f, "%ld %ld", &pages, &resident) != 2) resident = 0;
+        fclose(f);
+    }
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
 }
 
 /**
  * @brief Main server loop: handles new connections, authentication, chat, and discovery.
+ *
+ * Readiness from epoll (edge-triggered for clients) puts a client on the
+ * ready queue; each pass serves the queued clients once, in order, within
+ * their read budget, and re-queues those that still have input.
  */
-void server_loop(int master_socket, int discovery_socket, struct sockaddr_in *address, struct sockaddr_in *broadcast_addr) {
-    fd_set readfds;
-    struct timeval timeout;
+void server_loop(int master_socket, int local_socket, int ws_socket, int discovery_socket, struct sockaddr_in *address, struct sockaddr_in *broadcast_addr) {
+    struct epoll_event events[MAX_EVENTS];
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        perror("epoll_create1");
+        exit(EXIT_FAILURE);
+    }
+    for (int h = max_handshakes - 1; h >= 0; h--) free_handshakes[num_free_handshakes++] = h;
+    setup_listener(master_socket, 1);
+    epoll_add(master_socket, EPOLLIN, EV_TCP_LISTENER, 0);
+    listeners[EV_TCP_LISTENER] = master_socket;
+    listeners[EV_LOCAL_LISTENER] = local_socket;
+    listeners[EV_WS_LISTENER] = ws_socket;
+    if (local_socket >= 0) {
+        setup_listener(local_socket, 0);
+        epoll_add(local_socket, EPOLLIN, EV_LOCAL_LISTENER, 0);
+    }
+    if (ws_socket >= 0) {
+        setup_listener(ws_socket, 1);
+        epoll_add(ws_socket, EPOLLIN, EV_WS_LISTENER, 0);
+    }
+    chat_set_backlog_fn(on_backlog);
+    epoll_add(transfer_init(), EPOLLIN | EPOLLET, EV_TRANSFER_DONE, 0);
+    epoll_add(search_start(), EPOLLIN | EPOLLET, EV_SEARCH_DONE, 0);
+    if (filter_path) epoll_add(filter_init(), EPOLLIN | EPOLLET, EV_FILTER_DONE, 0);
+    int64_t last_discovery = sched_now_us();
+    int64_t last_presence = last_discovery;
+    startup_rss_kb = rss_kb();
+    int64_t retry_us = INT64_MAX;
     puts("Waiting for connections ...");
     while (running) {
-        FD_ZERO(&readfds);
-        FD_SET(master_socket, &readfds);
-        int max_sd = master_socket;
-        for (int i = 0; i < MAX_CLIENTS; i++) {
-            if (client_socket[i] > 0) {
-                FD_SET(client_socket[i], &readfds);
-                if (client_socket[i] > max_sd) {
-                    max_sd = client_socket[i];
-                }
-            }
+        int64_t now = sched_now_us();
+        int timeout_ms = (int)((last_discovery + DISCOVERY_INTERVAL_US - now) / 1000);
+        if (ready.count > 0) {
+            int retry_ms = retry_us == INT64_MAX ? 0 : (int)((retry_us + 999) / 1000);
+            if (retry_ms < timeout_ms) timeout_ms = retry_ms;
+        }
+        if (presence_pending(&presence)) {
+            int presence_ms = (int)((last_presence + PRESENCE_TICK_US - now) / 1000);
+            if (presence_ms < timeout_ms) timeout_ms = presence_ms;
+        }
+        if (timeout_ms < 0) timeout_ms = 0;
+        int n = wait_events(events, timeout_ms);
+        if (n < 0 && errno != EINTR) {
+            printf("epoll_wait error\n");
         }
-        timeout.tv_sec = 5;
-        timeout.tv_usec = 0;
-        int activity = select(max_sd + 1, &readfds, NULL, NULL, &timeout);
-        if ((activity < 0) && (errno != EINTR)) {
-            printf("select error\n");
-        }
-        if (FD_ISSET(master_socket, &readfds)) {
-            int addrlen = sizeof(*address);
-            int new_socket = accept(master_socket, (struct sockaddr *)address, (socklen_t *)&addrlen);
-            if (new_socket >= 0) {
-                char username[USERNAME_MAX_LEN] = {0};
-                if (num_clients < MAX_CLIENTS && authenticate_user(new_socket, username)) {
-                    for (int i = 0; i < MAX_CLIENTS; i++) {
-                        if (client_socket[i] == 0) {
-                            client_socket[i] = new_socket;
-                            strncpy(client_usernames[i], username, USERNAME_MAX_LEN);
-                            num_clients++;
-                            char join_msg[128];
-                            snprintf(join_msg, sizeof(join_msg), "User '%s' has joined the chat.\n", username);
-                            printf("%s", join_msg);
-                            // Notify all other clients
-                            for (int j = 0; j < MAX_CLIENTS; j++) {
-                                if (client_socket[j] > 0 && j != i) {
-                                    send(client_socket[j], join_msg, strlen(join_msg), 0);
-                                }
-                            }
-                            break;
-                        }
+        for (int i = 0; i < n; i++) {
+            int kind = (int)(events[i].data.u64 >> 32);
+            int slot = (int)(uint32_t)events[i].data.u64;
+            switch (kind) {
+            case EV_TCP_LISTENER:
+            case EV_LOCAL_LISTENER:
+            case EV_WS_LISTENER:
+                accept_clients(listeners[kind], kind, now);
+                break;
+            case EV_HANDSHAKE:
+                continue_handshake(slot);
+                break;
+            case EV_SEARCH_DONE:
+                for (search_result_t *r = search_reap(), *next; r; r = next) {
+                    next = r->next;
+                    client_t *c = &clients.clients[r->slot];
+                    // The asker may have left, or be busy with a transfer
+                    if (c->fd > 0 && c->id == r->client_id && !c->in_transfer) {
+                        client_send_lane(c, OUTQ_BULK, r->text, r->len);
                     }
+                    search_result_free(r);
+                }
+                break;
+            case EV_CLIENT:
+                if (events[i].events & EPOLLOUT) flush_client(slot);
+                if (!(events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) break;
+                if (clients.clients[slot].shm) {
+                    poll_shm_socket(slot);
                 } else {
-                    const char *fail_msg = "Authentication failed or server full. Connection closed.\n";
-                    send(new_socket, fail_msg, strlen(fail_msg), 0);
-                    close(new_socket);
+                    ready_queue_push(&ready, slot);
+                }
+                break;
+            case EV_CLIENT_RING:
+                ready_queue_push(&ready, slot);
+                break;
+            case EV_TRANSFER_DONE:
+                for (transfer_t *t = transfer_reap(), *next; t; t = next) {
+                    next = t->next;
+                    finish_transfer(t);
                 }
+                break;
+            case EV_FILTER_DONE:
+                finish_filter_reload();
+                break;
             }
         }
-        for (int i = 0; i < MAX_CLIENTS; i++) {
-            int sd = client_socket[i];
-            if (sd > 0 && FD_ISSET(sd, &readfds)) {
-                char buffer[BUFFER_SIZE + 1];
-                int valread = recv(sd, buffer, BUFFER_SIZE, MSG_DONTWAIT);
-                if (valread == 0) {
-                    // Client disconnected
-                    char leave_msg[128];
-                    snprintf(leave_msg, sizeof(leave_msg), "User '%s' has left the chat.\n", client_usernames[i][0] ? client_usernames[i] : "client");
-                    printf("%s", leave_msg);
-                    // Notify all other clients
-                    for (int j = 0; j < MAX_CLIENTS; j++) {
-                        if (client_socket[j] > 0 && j != i) {
-                            send(client_socket[j], leave_msg, strlen(leave_msg), 0);
-                        }
-                    }
-                    close(sd);
-                    client_socket[i] = 0;
-                    client_usernames[i][0] = '\0';
-                    num_clients--;
-                } else if (valread > 0) {
-                    buffer[valread] = '\0';
-                    if (buffer[strlen(buffer) - 1] == '\n') buffer[strlen(buffer) - 1] = '\0';
-                    char msg[BUFFER_SIZE + USERNAME_MAX_LEN + 16];
-                    snprintf(msg, sizeof(msg), "%s: %s\n", client_usernames[i][0] ? client_usernames[i] : "client", buffer);
-                    // Broadcast to all other clients
-                    for (int j = 0; j < MAX_CLIENTS; j++) {
-                        if (client_socket[j] > 0 && j != i) {
-                            send(client_socket[j], msg, strlen(msg), 0);
-                        }
-                    }
-                    printf("%s", msg);
+        now = sched_now_us();
+        retry_us = INT64_MAX;
+        int pending = ready.count;
+        int throttled = 0;
+        for (int i = 0; i < pending; i++) {
+            int slot = ready_queue_pop(&ready);
+            int rc = serve_client(slot, now, &retry_us);
+            if (rc != SERVE_DONE) {
+                ready_queue_push(&ready, slot);
+                if (rc == SERVE_THROTTLED) throttled++;
+            }
+        }
+        // Only sleep on the rate limit if every queued client is throttled
+        if (throttled < ready.count) retry_us = INT64_MAX;
+        // Joins and leaves of one tick go out together as a single delta
+        if (now - last_presence >= PRESENCE_TICK_US) {
+            if (presence_pending(&presence)) presence_flush(&presence, &clients, presence_max_fanout);
+            last_presence = now;
+        }
+        if (slow_consumers) kick_slow_consumers();
+        if (stats_requested) {
+            stats_requested = 0;
+            pool_print_stats(stdout);
+            printf("admission: accepted %llu admitted %llu shed %llu timed_out %llu failed %llu pending %d\n",
+                   (unsigned long long)admission.accepted, (unsigned long long)admission.admitted,
+                   (unsigned long long)admission.shed, (unsigned long long)admission.timed_out,
+                   (unsigned long long)admission.failed, max_handshakes - num_free_handshakes);
+            long rss = rss_kb();
+            printf("memory: rss %ld KB, %d clients, %ld bytes per client since startup, %zu bytes of client state\n",
+                   rss, clients.num_clients, clients.num_clients ? (rss - startup_rss_kb) * 1024 / clients.num_clients : 0,
+                   sizeof(client_t));
+            int backed_up = 0;
+            size_t queued = 0;
+            for (int i = 0; i < clients.end; i++) {
+                if (clients.clients[i].fd > 0 && clients.clients[i].outq) {
+                    backed_up++;
+                    queued += clients.clients[i].outq->bytes;
                 }
             }
+            printf("outq: %s, %d clients backed up, %zu bytes queued, %llu slow clients disconnected\n",
+                   fifo_lanes ? "fifo" : "lanes", backed_up, queued, (unsigned long long)slow_kicks);
+            search_print_stats(stdout);
+            printf("scan: %s, %llu messages rejected\n", scan_impl_name(), (unsigned long long)rejected_messages);
+            if (mail_enabled) mailbox_print_stats(&mail, stdout);
+            if (mcast.sock >= 0) mcast_print_stats(&mcast, stdout);
+            zframe_print_stats(stdout);
+            fanout_print_stats(stdout);
+            if (content_filter) {
+                printf("filter: ");
+                filter_print_info(content_filter, stdout);
+                printf(", %llu reloads, passed %llu flagged %llu masked %llu dropped %llu\n",
+                       (unsigned long long)filter_reloads, (unsigned long long)filter_counts[FILTER_PASS],
+                       (unsigned long long)filter_counts[FILTER_FLAG], (unsigned long long)filter_counts[FILTER_MASK],
+                       (unsigned long long)filter_counts[FILTER_DROP]);
+            }
+            if (busy_poll_us > 0) {
+                printf("busy poll: %llu waits answered while spinning, %llu slept\n",
+                       (unsigned long long)spin_hits, (unsigned long long)spin_sleeps);
+            }
+            trace_flush();
+            fflush(stdout);
         }
-        if (activity == 0) {
+        if (msgtrace_requested) {
+            char path[64];
+            msgtrace_requested = 0;
+            snprintf(path, sizeof(path), "msgtrace-%d.json", (int)getpid());
+            long n = msgtrace_dump(path);
+            if (n < 0) {
+                perror("msgtrace dump");
+            } else {
+                printf("msgtrace: wrote %ld spans to %s\n", n, path);
+            }
+            fflush(stdout);
+        }
+        if (reload_requested && filter_path) {
+            reload_requested = 0;
+            check_filter_file(1);
+        }
+        if (now - last_discovery >= DISCOVERY_INTERVAL_US) {
             broadcast_discovery(discovery_socket, broadcast_addr);
+            expire_handshakes(now);
+            if (mail_enabled) mailbox_sweep(&mail, time(NULL));
+            if (filter_path) check_filter_file(0);
+            last_discovery = now;
         }
     }
 }
 
+/**
+ * @brief Allow as many open sockets as the hard limit permits.
+ */
+static void raise_fd_limit(void) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &rl) < 0) perror("setrlimit");
+    }
+}
+
+/**
+ * @brief Tell every client the server is going away, give backed-up sockets a moment to take it, then disconnect.
+ */
+static void shutdown_clients(void) {
+    printf("\nServer shutting down. Notifying clients...\n");
+    pause_listeners(1);
+    for (int i = 0; i < clients.end; i++) {
+        client_t *c = &clients.clients[i];
+        if (c->fd > 0 && !c->in_transfer) {
+            char msg[128];
+            snprintf(msg, sizeof(msg), "Server is shutting down. Goodbye, %s!\n", client_display_name(c));
+            client_send_lane(c, OUTQ_CONTROL, msg, strlen(msg));
+        }
+    }
+    int64_t deadline = sched_now_us() + SHUTDOWN_FLUSH_US;
+    for (;;) {
+        int backed_up = 0;
+        for (int i = 0; i < clients.end; i++) {
+            client_t *c = &clients.clients[i];
+            if (c->fd > 0 && c->outq && !c->shm && client_flush(c) == 0) backed_up++;
+        }
+        int64_t left = deadline - sched_now_us();
+        if (backed_up == 0 || left <= 0) break;
+        // Woken by EPOLLOUT on a backed-up socket, or at the deadline
+        struct epoll_event events[MAX_EVENTS];
+        epoll_wait(epoll_fd, events, MAX_EVENTS, (int)(left / 1000) + 1);
+    }
+    for (int i = 0; i < clients.end; i++) {
+        if (clients.clients[i].fd > 0) client_disconnect(&clients, i);
+    }
+}
+
 int main(int argc, char *argv[]) {
+    const char *local_path = NULL;
+    const char *mail_dir = NULL;
+    const char *trace_path = NULL;
+    const char *mcast_group = NULL;
+    const char *mcast_iface = NULL;
+    int ws_port = 0;
+    int reactor_cpu = -1;
+    int mail_days = MAILBOX_TTL_SECS / (24 * 3600);
+    int fanout_threads = fanout_default_helpers();
+    int opt;
+    while ((opt = getopt(argc, argv, "u:r:b:p:A:H:d:m:M:t:T:S:C:g:i:w:f:LF:")) != -1) {
+        switch (opt) {
+        case 'u':
+            local_path = optarg;
+            break;
+        case 'r':
+            rate_limit = atoi(optarg);
+            break;
+        case 'b':
+            rate_burst = atoi(optarg);
+            break;
+        case 'p':
+            presence_max_fanout = atoi(optarg);
+            break;
+        case 'A':
+            accept_batch = atoi(optarg);
+            break;
+        case 'H':
+            max_handshakes = atoi(optarg);
+            break;
+        case 'd':
+            defer_accept = atoi(optarg);
+            break;
+        case 'm':
+            mail_dir = optarg;
+            break;
+        case 'M':
+            mail_days = atoi(optarg);
+            break;
+        case 't':
+            trace_path = optarg;
+            break;
+        case 'T':
+            msgtrace_set_rate(atoi(optarg));
+            break;
+        case 'S':
+            busy_poll_us = atoi(optarg);
+            break;
+        case 'C': {
+            char *end;
+            long cpu = strtol(optarg, &end, 10);
+            if (end == optarg || *end || cpu < 0 || cpu >= CPU_SETSIZE) {
+                fprintf(stderr, "Invalid CPU number for -C: %s\n", optarg);
+                return 1;
+            }
+            reactor_cpu = (int)cpu;
+            break;
+        }
+        case 'g':
+            mcast_group = optarg;
+            break;
+        case 'i':
+            mcast_iface = optarg;
+            break;
+        case 'w':
+            ws_port = atoi(optarg);
+            break;
+        case 'f':
+            filter_path = optarg;
+            break;
+        case 'L':
+            fifo_lanes = 1;
+            break;
+        case 'F':
+            fanout_threads = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-u unix_socket_path] [-r msgs_per_sec] [-b burst] [-p presence_max_clients]\n"
+                            "       [-A accepts_per_wakeup] [-H max_pending_logins] [-d defer_accept_secs]\n"
+                            "       [-m mailbox_dir] [-M mail_expiry_days] [-t trace_file] [-T msgtrace_one_in]\n"
+                            "       [-S busy_poll_usecs] [-C event_loop_cpu] [-g multicast_group] [-i multicast_iface_addr]\n"
+                            "       [-w websocket_port] [-f filter_patterns_file] [-L] [-F fanout_helpers]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (accept_batch < 1) accept_batch = 1;
+    outq_set_fifo(fifo_lanes);
+    if (max_handshakes < 1) max_handshakes = 1;
+    if (max_handshakes > MAX_HANDSHAKES) max_handshakes = MAX_HANDSHAKES;
+    if (mail_dir) {
+        if (mail_days < 1) mail_days = 1;
+        if (mailbox_open(&mail, mail_dir, (time_t)mail_days * 24 * 3600, MAILBOX_MAX_BYTES) < 0) {
+            perror("Mailbox directory");
+            exit(EXIT_FAILURE);
+        }
+        mail_enabled = 1;
+    }
+    if (reactor_cpu >= 0 && sched_pin_reactor(reactor_cpu) < 0) {
+        if (errno == EINVAL) {
+            fprintf(stderr, "CPU %d is not available to this process\n", reactor_cpu);
+        } else {
+            perror("CPU pinning");
+        }
+        exit(EXIT_FAILURE);
+    }
+    fanout_start(fanout_threads);   // after pinning, so the helpers stay off the event loop's CPU
+    if (mcast_group && mcast_sender_open(&mcast, mcast_group, MCAST_PORT, mcast_iface) < 0) {
+        perror("Multicast group");
+        exit(EXIT_FAILURE);
+    }
+    if (filter_path) {
+        struct stat st;
+        if (stat(filter_path, &st) < 0 || !(content_filter = filter_load(filter_path))) {
+            perror("Content filter");
+            exit(EXIT_FAILURE);
+        }
+        filter_mtime = st.st_mtim;
+        printf("Content filter: ");
+        filter_print_info(content_filter, stdout);
+        printf("\n");
+    }
+    if (trace_path && trace_open(trace_path) < 0) {
+        perror("Trace file");
+        exit(EXIT_FAILURE);
+    }
+    raise_fd_limit();
     signal(SIGINT, handle_sigint);
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGUSR1, handle_sigusr1);
+    signal(SIGUSR2, handle_sigusr2);
+    signal(SIGHUP, handle_sighup);
     struct sockaddr_in address, broadcast_addr;
     int master_socket = setup_tcp_server(&address);
+    int local_socket = local_path ? setup_shm_listener(local_path) : -1;
+    int ws_socket = ws_port > 0 ? setup_ws_listener(ws_port) : -1;
     int discovery_socket = setup_udp_discovery(&broadcast_addr);
-    server_loop(master_socket, discovery_socket, &address, &broadcast_addr);
+    server_loop(master_socket, local_socket, ws_socket, discovery_socket, &address, &broadcast_addr);
+    shutdown_clients();
+    close(epoll_fd);
+    if (local_path) unlink(local_path);
+    trace_close();
     printf("Server exited.\n");
     return 0;
-} 
\ No newline at end of file
+}
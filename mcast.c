@@ -0,0 +1,240 @@
+/**
+ * @file mcast.c
+ * @brief Multicast delivery and repair implementation.
+ */
+#include "mcast.h"
+#include "pool.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define RECEIVE_BUFFER (4 * 1024 * 1024)
+
+static void put_be64(unsigned char *p, uint64_t v) {
+    for (int i = 7; i >= 0; i--, v >>= 8) p[i] = (unsigned char)v;
+}
+
+static uint64_t get_be64(const unsigned char *p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) v = v << 8 | p[i];
+    return v;
+}
+
+int mcast_sender_open(mcast_sender_t *m, const char *group, int port, const char *iface) {
+    memset(m, 0, sizeof(*m));
+    m->next_seq = 1;
+    m->oldest = 1;
+    m->sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (m->sock < 0) return -1;
+    m->group.sin_family = AF_INET;
+    m->group.sin_port = htons(port);
+    if (inet_pton(AF_INET, group, &m->group.sin_addr) != 1 || !IN_MULTICAST(ntohl(m->group.sin_addr.s_addr))) {
+        close(m->sock);
+        errno = EINVAL;
+        m->sock = -1;
+        return -1;
+    }
+    unsigned char ttl = 1, loop = 1;
+    setsockopt(m->sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+    setsockopt(m->sock, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+    if (iface) {
+        struct in_addr addr;
+        int rc = inet_pton(AF_INET, iface, &addr) == 1 ? setsockopt(m->sock, IPPROTO_IP, IP_MULTICAST_IF, &addr, sizeof(addr)) : (errno = EINVAL, -1);
+        if (rc < 0) {
+            close(m->sock);
+            m->sock = -1;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void evict_oldest(mcast_sender_t *m) {
+    mcast_entry_t *e = &m->history[m->oldest % MCAST_HISTORY];
+    if (e->seq == m->oldest) {
+        m->history_bytes -= e->len;
+        pool_free(e->data, e->len);
+        e->seq = 0;
+    }
+    m->oldest++;
+}
+
+uint64_t mcast_send(mcast_sender_t *m, uint64_t sender, const struct iovec *iov, int iovcnt) {
+    size_t len = 0;
+    for (int i = 0; i < iovcnt; i++) len += iov[i].iov_len;
+    uint64_t seq = m->next_seq++;
+    while (m->oldest < seq && (seq - m->oldest >= MCAST_HISTORY || m->history_bytes + len > MCAST_HISTORY_BYTES)) {
+        evict_oldest(m);
+    }
+    mcast_entry_t *e = &m->history[seq % MCAST_HISTORY];
+    e->data = pool_alloc(len > 0 ? len : 1);
+    if (e->data) {
+        size_t off = 0;
+        for (int i = 0; i < iovcnt; i++) {
+            memcpy(e->data + off, iov[i].iov_base, iov[i].iov_len);
+            off += iov[i].iov_len;
+        }
+        e->seq = seq;
+        e->sender = sender;
+        e->len = len;
+        m->history_bytes += len;
+    }
+    if (m->oldest == seq && !e->data) m->oldest++;
+    // Oversized messages are left for receivers to fetch with a NACK
+    if (m->sock < 0 || len + MCAST_HEADER > MCAST_MAX_DATAGRAM) return seq;
+    unsigned char header[MCAST_HEADER];
+    memcpy(header, MCAST_MAGIC, 4);
+    put_be64(header + 4, seq);
+    put_be64(header + 12, sender);
+    struct iovec out[MESSAGE_MAX_IOV + 3];
+    int cnt = 0;
+    out[cnt].iov_base = header;
+    out[cnt++].iov_len = MCAST_HEADER;
+    for (int i = 0; i < iovcnt && cnt < (int)(sizeof(out) / sizeof(out[0])); i++) out[cnt++] = iov[i];
+    struct msghdr msg = {.msg_name = &m->group, .msg_namelen = sizeof(m->group), .msg_iov = out, .msg_iovlen = cnt};
+    if (sendmsg(m->sock, &msg, 0) >= 0) m->datagrams++;
+    return seq;
+}
+
+typedef void (*repair_emit_fn)(void *ctx, const struct iovec *iov, int iovcnt);
+
+// Walk a repair range, handing each LOST line and REPAIR frame to emit (NULL only counts)
+static void repair_walk(mcast_sender_t *m, uint64_t first, uint64_t last, repair_emit_fn emit, void *ctx) {
+    uint64_t lost_from = 0;
+    char line[96];
+    for (uint64_t seq = first; seq <= last; seq++) {
+        mcast_entry_t *e = &m->history[seq % MCAST_HISTORY];
+        if (seq < m->oldest || e->seq != seq) {
+            if (!lost_from) lost_from = seq;
+            m->lost++;
+            continue;
+        }
+        if (lost_from && emit) {
+            struct iovec iov = {line, snprintf(line, sizeof(line), "LOST %llu %llu\n", (unsigned long long)lost_from, (unsigned long long)seq - 1)};
+            emit(ctx, &iov, 1);
+        }
+        lost_from = 0;
+        if (emit) {
+            int n = snprintf(line, sizeof(line), "REPAIR %llu %llu %zu\n", (unsigned long long)seq, (unsigned long long)e->sender, e->len);
+            struct iovec iov[2] = {{line, n}, {e->data, e->len}};
+            emit(ctx, iov, 2);
+        }
+        m->repaired++;
+    }
+    if (lost_from && emit) {
+        struct iovec iov = {line, snprintf(line, sizeof(line), "LOST %llu %llu\n", (unsigned long long)lost_from, (unsigned long long)last)};
+        emit(ctx, &iov, 1);
+    }
+}
+
+static void emit_to_client(void *ctx, const struct iovec *iov, int iovcnt) {
+    client_sendv_lane(ctx, OUTQ_BULK, iov, iovcnt);
+}
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+    int failed;
+} repair_batch_t;
+
+static void emit_to_batch(void *ctx, const struct iovec *iov, int iovcnt) {
+    repair_batch_t *b = ctx;
+    for (int i = 0; i < iovcnt && !b->failed; i++) {
+        if (b->len + iov[i].iov_len > b->cap) {
+            size_t cap = b->cap ? b->cap : 64 * 1024;
+            while (cap < b->len + iov[i].iov_len) cap *= 2;
+            char *grown = realloc(b->data, cap);
+            if (!grown) {
+                b->failed = 1;
+                break;
+            }
+            b->data = grown;
+            b->cap = cap;
+        }
+        memcpy(b->data + b->len, iov[i].iov_base, iov[i].iov_len);
+        b->len += iov[i].iov_len;
+    }
+}
+
+void mcast_repair(mcast_sender_t *m, client_t *client, uint64_t first, uint64_t last) {
+    if (first == 0) first = 1;
+    if (last >= m->next_seq) last = m->next_seq - 1;
+    if (last >= first && last - first >= MCAST_NACK_MAX) last = first + MCAST_NACK_MAX - 1;
+    if (!client->zlib || last < first) {
+        repair_walk(m, first, last, emit_to_client, client);
+        return;
+    }
+    // Sequence numbers are never reused, so the answer only changes when the range's start is evicted
+    uint64_t key[3] = {first, last, m->oldest > first ? m->oldest : first};
+    const zframe_t *z = zframe_cache_get(&m->repair_cache, key);
+    if (z) {
+        repair_walk(m, first, last, NULL, NULL);
+        client_send_zframe(client, OUTQ_BULK, z);
+        return;
+    }
+    repair_batch_t batch = {0};
+    repair_walk(m, first, last, emit_to_batch, &batch);
+    zframe_t built;
+    struct iovec iov = {batch.data, batch.len};
+    if (batch.failed) {
+        uint64_t repaired = m->repaired, lost = m->lost;   // already counted by the first walk
+        repair_walk(m, first, last, emit_to_client, client);
+        m->repaired = repaired;
+        m->lost = lost;
+    } else if (zframe_build(&built, &iov, 1) == 0) {
+        client_send_zframe(client, OUTQ_BULK, zframe_cache_put(&m->repair_cache, key, &built));
+    } else {
+        // Too small or incompressible: send it as it is, and build again next time
+        client_send_lane(client, OUTQ_BULK, batch.data, batch.len);
+    }
+    free(batch.data);
+}
+
+void mcast_print_stats(const mcast_sender_t *m, FILE *out) {
+    fprintf(out, "multicast: next seq %llu, %llu datagrams, %llu repaired, %llu lost, %zu bytes retained, "
+                 "repair cache %llu hits / %llu misses\n",
+            (unsigned long long)m->next_seq, (unsigned long long)m->datagrams, (unsigned long long)m->repaired,
+            (unsigned long long)m->lost, m->history_bytes, (unsigned long long)m->repair_cache.hits,
+            (unsigned long long)m->repair_cache.misses);
+}
+
+int mcast_join(const char *group, int port, const char *iface) {
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) return -1;
+    int one = 1, rcvbuf = RECEIVE_BUFFER;
+    // Several receivers on one host each get a copy
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    struct ip_mreq mreq;
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 || inet_pton(AF_INET, group, &mreq.imr_multiaddr) != 1) {
+        close(sock);
+        return -1;
+    }
+    mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+    if (iface && inet_pton(AF_INET, iface, &mreq.imr_interface) != 1) {
+        close(sock);
+        return -1;
+    }
+    if (setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+int mcast_parse(const char *buf, size_t len, mcast_datagram_t *d) {
+    if (len < MCAST_HEADER || memcmp(buf, MCAST_MAGIC, 4) != 0) return -1;
+    d->seq = get_be64((const unsigned char *)buf + 4);
+    d->sender = get_be64((const unsigned char *)buf + 12);
+    d->data = buf + MCAST_HEADER;
+    d->len = len - MCAST_HEADER;
+    return 0;
+}
@@ -0,0 +1,134 @@
+/**
+ * @file mcast.h
+ * @brief Sequenced multicast delivery of room messages with TCP repair.
+ *
+ * Clients that send "/multicast on" stop receiving room messages over TCP.
+ * The server instead sends each message once, as a UDP datagram to a
+ * multicast group, so its cost no longer grows with the number of
+ * recipients. Every datagram carries a sequence number:
+ *
+ *     "CHM1" | seq (8 bytes, big endian) | sender connection (8 bytes) | message
+ *
+ * A receiver that sees a gap asks for the missing range over its TCP
+ * connection with "/nack <first> <last>". The server answers from the
+ * messages it still retains:
+ *
+ *     REPAIR <seq> <sender> <len>\n<len bytes>
+ *     LOST <first> <last>\n        (no longer retained)
+ *
+ * Ranges reaching past the newest message are answered up to it, so a
+ * receiver that has gone quiet can probe for lost trailing messages.
+ * Messages too large for one datagram are only retained, so receivers
+ * fetch them through the same repair path.
+ */
+#ifndef MCAST_H
+#define MCAST_H
+
+#include "chat.h"
+#include <netinet/in.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/uio.h>
+
+#define MCAST_PORT 8890
+#define MCAST_CMD "/multicast"
+#define NACK_CMD "/nack"
+#define MCAST_MAGIC "CHM1"
+#define MCAST_HEADER 20
+#define MCAST_MAX_DATAGRAM 65000
+#define MCAST_HISTORY 8192
+#define MCAST_HISTORY_BYTES (8 * 1024 * 1024)
+#define MCAST_NACK_MAX 1024
+
+/**
+ * @brief A retained message.
+ */
+typedef struct {
+    uint64_t seq;          /**< Sequence number, 0 if the entry is empty. */
+    uint64_t sender;       /**< Sender's connection number. */
+    size_t len;            /**< Message length. */
+    char *data;            /**< Message bytes, from the pool. */
+} mcast_entry_t;
+
+/**
+ * @brief Server-side multicast state.
+ */
+typedef struct {
+    int sock;                               /**< UDP socket, -1 when multicast is off. */
+    struct sockaddr_in group;               /**< Group address and port. */
+    uint64_t next_seq;                      /**< Sequence number of the next message. */
+    mcast_entry_t history[MCAST_HISTORY];   /**< Recent messages, indexed by seq % MCAST_HISTORY. */
+    size_t history_bytes;                   /**< Bytes retained. */
+    uint64_t oldest;                        /**< Oldest retained sequence number. */
+    uint64_t datagrams;                     /**< Datagrams sent. */
+    uint64_t repaired;                      /**< Messages resent over TCP. */
+    uint64_t lost;                          /**< Requested messages that were no longer retained. */
+    zframe_cache_t repair_cache;            /**< Compressed answers to recent NACKs, for zlib clients. */
+} mcast_sender_t;
+
+/**
+ * @brief One datagram as seen by a receiver.
+ */
+typedef struct {
+    uint64_t seq;          /**< Sequence number. */
+    uint64_t sender;       /**< Sender's connection number. */
+    const char *data;      /**< Message bytes, inside the datagram. */
+    size_t len;            /**< Message length. */
+} mcast_datagram_t;
+
+/**
+ * @brief Open the sending socket.
+ * @param m State to initialize.
+ * @param group Multicast group address, e.g. "239.255.88.1".
+ * @param port Group port.
+ * @param iface Address of the interface to send on, or NULL for the default route.
+ * @return 0 on success, -1 on error (errno set).
+ */
+int mcast_sender_open(mcast_sender_t *m, const char *group, int port, const char *iface);
+
+/**
+ * @brief Retain a room message and send it to the group.
+ * @param m Sender state.
+ * @param sender Sender's connection number.
+ * @param iov Message buffers.
+ * @param iovcnt Number of buffers.
+ * @return The message's sequence number.
+ */
+uint64_t mcast_send(mcast_sender_t *m, uint64_t sender, const struct iovec *iov, int iovcnt);
+
+/**
+ * @brief Answer "/nack <first> <last>" over a client's TCP connection.
+ * @param m Sender state.
+ * @param client Client that asked.
+ * @param first First missing sequence number.
+ * @param last Last missing sequence number; at most MCAST_NACK_MAX are answered.
+ */
+void mcast_repair(mcast_sender_t *m, client_t *client, uint64_t first, uint64_t last);
+
+/**
+ * @brief Print the sender's counters.
+ * @param m Sender state.
+ * @param out Output stream.
+ */
+void mcast_print_stats(const mcast_sender_t *m, FILE *out);
+
+/**
+ * @brief Join a group as a receiver.
+ * @param group Multicast group address.
+ * @param port Group port.
+ * @param iface Address of the interface to join on, or NULL for any.
+ * @return Bound UDP socket, or -1 on error (errno set).
+ */
+int mcast_join(const char *group, int port, const char *iface);
+
+/**
+ * @brief Decode a received datagram.
+ * @param buf Datagram bytes.
+ * @param len Datagram length.
+ * @param d Filled with the decoded fields.
+ * @return 0 on success, -1 if it is not a chat datagram.
+ */
+int mcast_parse(const char *buf, size_t len, mcast_datagram_t *d);
+
+#endif // MCAST_H
@@ -0,0 +1,365 @@
+/**
+ * @file mcast_bench.c
+ * @brief Check multicast room delivery on loopback and compare it with TCP fan-out.
+ *
+ * Runs ./chat_server twice with the same receivers and messages: once
+ * delivering room messages over each receiver's TCP connection, and once
+ * with "-g" so receivers opt into the multicast group. In the multicast run
+ * every receiver drops a share of the datagrams on purpose and fetches them
+ * back with "/nack", the way a client on a lossy LAN would. Each run checks
+ * that every receiver got every message exactly once, in order, and reports
+ * the server's CPU time and loopback traffic per message.
+ *
+ * Usage:
+ * ./mcast_bench [receivers] [messages] [drop_percent]
+ */
+#include "mcast.h"
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TCP_PORT 8888
+#define PROMPT_LEN 16
+#define GROUP "239.255.88.1"
+#define IFACE "127.0.0.1"
+#define RX_BUFFER 65536
+#define MAX_RECEIVERS 200
+#define IDLE_PROBE_MS 50
+#define GIVE_UP_MS 5000
+
+typedef struct {
+    int tcp;
+    int udp;                 /**< Group socket, -1 in the TCP run. */
+    uint64_t id;             /**< Own connection number, to skip own datagrams. */
+    uint64_t base;           /**< First sequence number after opting in. */
+    uint64_t next_seq;       /**< Next datagram to deliver, relative to base. */
+    uint64_t highest;        /**< Highest datagram seen so far + 1, relative to base. */
+    struct iovec *held;      /**< Datagrams that arrived ahead of a gap, by relative seq. */
+    uint64_t next;           /**< Number of the next "m <n>" line expected. */
+    char rx[RX_BUFFER];
+    size_t rx_len;
+    int errors;
+    uint64_t dropped;        /**< Datagrams thrown away on purpose. */
+    uint64_t repaired;       /**< Messages that came back over TCP. */
+    uint64_t nacks;
+} receiver_t;
+
+static pid_t server_pid = 0;
+static receiver_t receivers[MAX_RECEIVERS];
+static int num_receivers;
+static int num_messages;
+static int drop_percent;
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// CPU seconds used so far by a process, from /proc/<pid>/stat
+static double process_cpu(pid_t pid) {
+    char path[64], buf[1024];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE *f = fopen(path, "r");
+    if (!f) return 0;
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+    char *p = strrchr(buf, ')');
+    unsigned long utime = 0, stime = 0;
+    if (p) sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime);
+    return (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+static unsigned long long loopback_bytes(void) {
+    unsigned long long bytes = 0;
+    FILE *f = fopen("/sys/class/net/lo/statistics/tx_bytes", "r");
+    if (f) {
+        if (fscanf(f, "%llu", &bytes) != 1) bytes = 0;
+        fclose(f);
+    }
+    return bytes;
+}
+
+static void start_server(char **server_args) {
+    server_pid = fork();
+    if (server_pid == 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDOUT_FILENO);
+        execv("./chat_server", server_args);
+        perror("Failed to start server");
+        exit(1);
+    } else if (server_pid < 0) {
+        perror("Fork failed");
+        exit(1);
+    }
+    sleep(1);
+}
+
+static void stop_server(void) {
+    if (server_pid > 0) {
+        kill(server_pid, SIGINT);
+        waitpid(server_pid, NULL, 0);
+        server_pid = 0;
+    }
+}
+
+static int tcp_login(const char *username) {
+    struct sockaddr_in addr;
+    char buf[64];
+    int one = 1;
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(TCP_PORT);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("connect");
+        exit(1);
+    }
+    recv(sock, buf, PROMPT_LEN, MSG_WAITALL);
+    send(sock, username, strlen(username), 0);
+    recv(sock, buf, PROMPT_LEN, MSG_WAITALL);
+    send(sock, "secret", 6, 0);
+    return sock;
+}
+
+// Check the next chat lines in order; the server may merge back-to-back sends into one message
+static void deliver(receiver_t *r, const char *data, size_t len) {
+    const char *end = data + len;
+    while (data < end) {
+        const char *nl = memchr(data, '\n', end - data);
+        size_t line_len = nl ? (size_t)(nl - data) : (size_t)(end - data);
+        char line[64];
+        unsigned long long n;
+        if (line_len >= sizeof(line)) line_len = sizeof(line) - 1;
+        memcpy(line, data, line_len);
+        line[line_len] = '\0';
+        const char *text = strncmp(line, "mc_tx: ", 7) == 0 ? line + 7 : line;
+        if (sscanf(text, "m %llu", &n) != 1 || n != r->next) {
+            r->errors++;
+        } else {
+            r->next++;
+        }
+        data += line_len + 1;
+    }
+}
+
+// Hold datagram i until everything before it has been delivered
+static void arrive(receiver_t *r, uint64_t i, const char *data, size_t len) {
+    if (i < r->next_seq || i >= (uint64_t)num_messages || r->held[i].iov_base) return;  // duplicate
+    if (i + 1 > r->highest) r->highest = i + 1;
+    r->held[i].iov_base = malloc(len);
+    r->held[i].iov_len = len;
+    memcpy(r->held[i].iov_base, data, len);
+    while (r->next_seq < (uint64_t)num_messages && r->held[r->next_seq].iov_base) {
+        struct iovec *h = &r->held[r->next_seq++];
+        deliver(r, h->iov_base, h->iov_len);
+        free(h->iov_base);
+    }
+}
+
+static void send_nack(receiver_t *r, uint64_t first, uint64_t last) {
+    char cmd[80];
+    int n = snprintf(cmd, sizeof(cmd), "/nack %llu %llu\n", (unsigned long long)(r->base + first),
+                     (unsigned long long)(r->base + last));
+    send(r->tcp, cmd, n, 0);
+    r->nacks++;
+}
+
+// Consume complete lines (and REPAIR bodies) from a receiver's TCP stream
+static void parse_tcp(receiver_t *r) {
+    size_t off = 0;
+    while (off < r->rx_len) {
+        char *line = r->rx + off;
+        char *nl = memchr(line, '\n', r->rx_len - off);
+        if (!nl) break;
+        size_t line_len = nl - line + 1;
+        unsigned long long seq, sender, a, b, id;
+        size_t body;
+        char group[32];
+        int port;
+        if (sscanf(line, "REPAIR %llu %llu %zu", &seq, &sender, &body) == 3) {
+            if (off + line_len + body > r->rx_len) break;
+            if (sender != r->id) arrive(r, seq - r->base, nl + 1, body);
+            r->repaired++;
+            line_len += body;
+        } else if (sscanf(line, "LOST %llu %llu", &a, &b) == 2) {
+            r->errors += b - a + 1;
+        } else if (sscanf(line, "MCAST %31s %d %llu %llu", group, &port, &seq, &id) == 4) {
+            r->base = seq;
+            r->id = id;
+        } else if (strncmp(line, "mc_tx: ", 7) == 0 || strncmp(line, "m ", 2) == 0) {
+            // Room messages come over TCP only in the TCP run
+            if (r->udp >= 0) {
+                r->errors++;
+            } else {
+                deliver(r, line, line_len);
+            }
+        }
+        off += line_len;
+    }
+    memmove(r->rx, r->rx + off, r->rx_len - off);
+    r->rx_len -= off;
+}
+
+static void read_tcp(receiver_t *r) {
+    ssize_t n;
+    while (r->rx_len < RX_BUFFER && (n = recv(r->tcp, r->rx + r->rx_len, RX_BUFFER - r->rx_len, MSG_DONTWAIT)) > 0) {
+        r->rx_len += n;
+        parse_tcp(r);
+    }
+}
+
+static void read_udp(receiver_t *r) {
+    char buf[MCAST_MAX_DATAGRAM];
+    ssize_t n;
+    while ((n = recv(r->udp, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+        mcast_datagram_t d;
+        if (mcast_parse(buf, n, &d) < 0 || d.sender == r->id || d.seq < r->base) continue;
+        if (rand() % 100 < drop_percent) {
+            r->dropped++;
+            continue;
+        }
+        uint64_t i = d.seq - r->base;
+        // Everything between the highest message seen and this one went missing
+        if (i > r->highest) send_nack(r, r->highest, i - 1);
+        arrive(r, i, d.data, d.len);
+    }
+}
+
+// Read whatever is waiting; returns the number of receivers that still miss messages
+static int pump(int timeout_ms) {
+    struct pollfd pfds[2 * MAX_RECEIVERS];
+    int n = 0;
+    for (int i = 0; i < num_receivers; i++) {
+        pfds[n++] = (struct pollfd){receivers[i].tcp, POLLIN, 0};
+        if (receivers[i].udp >= 0) pfds[n++] = (struct pollfd){receivers[i].udp, POLLIN, 0};
+    }
+    poll(pfds, n, timeout_ms);
+    int incomplete = 0;
+    for (int i = 0; i < num_receivers; i++) {
+        read_tcp(&receivers[i]);
+        if (receivers[i].udp >= 0) read_udp(&receivers[i]);
+        if (receivers[i].next < (uint64_t)num_messages) incomplete++;
+    }
+    return incomplete;
+}
+
+static void drain(int fd) {
+    char buf[4096];
+    while (recv(fd, buf, sizeof(buf), MSG_DONTWAIT) > 0) {
+    }
+}
+
+static void run(const char *label, int multicast) {
+    char name[32];
+    char *tcp_args[] = {"chat_server", NULL};
+    char *mcast_args[] = {"chat_server", "-g", GROUP, "-i", IFACE, NULL};
+    start_server(multicast ? mcast_args : tcp_args);
+    for (int i = 0; i < num_receivers; i++) {
+        receiver_t *r = &receivers[i];
+        memset(r, 0, sizeof(*r));
+        r->udp = -1;
+        r->held = calloc(num_messages, sizeof(struct iovec));
+        snprintf(name, sizeof(name), "mc_rx%d", i);
+        r->tcp = tcp_login(name);
+    }
+    int sender = tcp_login("mc_tx");
+    usleep(300000);
+    for (int i = 0; i < num_receivers; i++) drain(receivers[i].tcp);
+    if (multicast) {
+        for (int i = 0; i < num_receivers; i++) {
+            receiver_t *r = &receivers[i];
+            r->udp = mcast_join(GROUP, MCAST_PORT, IFACE);
+            if (r->udp < 0) {
+                perror("mcast_join");
+                exit(1);
+            }
+            send(r->tcp, "/multicast on\n", 14, 0);
+        }
+        double deadline = now_ms() + 2000;
+        for (int i = 0; i < num_receivers; i++) {
+            while (receivers[i].base == 0 && now_ms() < deadline) pump(10);
+            if (receivers[i].base == 0) {
+                fprintf(stderr, "receiver %d got no MCAST reply\n", i);
+                exit(1);
+            }
+        }
+    }
+    drain(sender);
+
+    unsigned long long lo_start = loopback_bytes();
+    double cpu_start = process_cpu(server_pid), start = now_ms();
+    char buf[64];
+    for (int i = 0; i < num_messages; i++) {
+        int len = snprintf(buf, sizeof(buf), "m %d\n", i);
+        send(sender, buf, len, 0);
+        usleep(100);
+        if (i % 32 == 31) pump(0);
+    }
+    // Receivers that went quiet ask for anything after the last message they saw
+    double last_progress = now_ms();
+    uint64_t delivered = 0;
+    while (now_ms() - last_progress < GIVE_UP_MS) {
+        if (pump(IDLE_PROBE_MS) == 0) break;
+        uint64_t total = 0;
+        for (int i = 0; i < num_receivers; i++) {
+            receiver_t *r = &receivers[i];
+            total += r->next;
+            if (r->udp >= 0 && r->next < (uint64_t)num_messages) send_nack(r, r->next_seq, r->next_seq + MCAST_NACK_MAX - 1);
+        }
+        if (total != delivered) last_progress = now_ms();
+        delivered = total;
+    }
+    double elapsed = now_ms() - start;
+    double cpu = process_cpu(server_pid) - cpu_start;
+    unsigned long long lo = loopback_bytes() - lo_start;
+
+    int complete = 0, errors = 0;
+    uint64_t dropped = 0, repaired = 0, nacks = 0;
+    for (int i = 0; i < num_receivers; i++) {
+        receiver_t *r = &receivers[i];
+        if (r->next == (uint64_t)num_messages && r->errors == 0) complete++;
+        errors += r->errors;
+        dropped += r->dropped;
+        repaired += r->repaired;
+        nacks += r->nacks;
+        close(r->tcp);
+        if (r->udp >= 0) close(r->udp);
+        for (uint64_t j = r->next_seq; j < (uint64_t)num_messages; j++) free(r->held[j].iov_base);
+        free(r->held);
+    }
+    close(sender);
+    stop_server();
+    printf("%-9s %d/%d receivers complete, %d errors, %.0f ms; server cpu %.2f us/msg, loopback %.0f bytes/msg\n",
+           label, complete, num_receivers, errors, elapsed, cpu * 1e6 / num_messages, (double)lo / num_messages);
+    if (multicast) {
+        printf("          %llu datagrams dropped on purpose, %llu repaired over TCP with %llu NACKs\n",
+               (unsigned long long)dropped, (unsigned long long)repaired, (unsigned long long)nacks);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    num_receivers = argc > 1 ? atoi(argv[1]) : 20;
+    num_messages = argc > 2 ? atoi(argv[2]) : 5000;
+    drop_percent = argc > 3 ? atoi(argv[3]) : 5;
+    if (num_receivers < 1) num_receivers = 1;
+    if (num_receivers > MAX_RECEIVERS) num_receivers = MAX_RECEIVERS;
+    if (num_messages < 1) num_messages = 1;
+    signal(SIGPIPE, SIG_IGN);
+    srand(1);
+    printf("%d receivers, %d messages, %d%% of datagrams dropped\n", num_receivers, num_messages, drop_percent);
+    run("tcp", 0);
+    run("multicast", 1);
+    return 0;
+}
@@ -0,0 +1,112 @@
+/**
+ * @file msgtrace.c
+ * @brief Per-message latency tracing implementation.
+ *
+ * Each event carries a sequence number that its writer sets last; a dump
+ * running on another thread skips events whose sequence number changed
+ * while it was copying them.
+ */
+#include "msgtrace.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct {
+    _Atomic uint64_t seq;     /**< Ring position + 1 once written, 0 while being written. */
+    uint64_t msg;
+    int64_t start_ns;
+    int64_t end_ns;
+    int32_t stage;
+    int32_t arg;
+} msgtrace_event_t;
+
+typedef struct msgtrace_buf {
+    struct msgtrace_buf *next;
+    int tid;
+    _Atomic uint64_t head;
+    msgtrace_event_t events[MSGTRACE_RING];
+} msgtrace_buf_t;
+
+int msgtrace_rate = 0;
+__thread msgtrace_ctx_t msgtrace_ctx;
+
+static _Atomic(msgtrace_buf_t *) buffers = NULL;
+static atomic_int next_tid = 0;
+static _Atomic uint64_t next_msg = 0;
+static __thread msgtrace_buf_t *local_buf;
+static __thread int countdown;
+
+static const char *stage_names[] = {"recv", "parse", "send", "fanout", "queued"};
+
+void msgtrace_set_rate(int one_in) {
+    msgtrace_rate = one_in > 0 ? one_in : 0;
+}
+
+int64_t msgtrace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void msgtrace_begin_slow(int64_t start_ns) {
+    if (--countdown > 0) return;
+    countdown = msgtrace_rate;
+    msgtrace_ctx.id = atomic_fetch_add_explicit(&next_msg, 1, memory_order_relaxed) + 1;
+    msgtrace_ctx.mark_ns = start_ns;
+}
+
+// Allocate this thread's ring on first use and publish it for dumps
+static msgtrace_buf_t *thread_buf(void) {
+    msgtrace_buf_t *b = calloc(1, sizeof(msgtrace_buf_t));
+    if (!b) return NULL;
+    b->tid = atomic_fetch_add(&next_tid, 1) + 1;
+    b->next = atomic_load(&buffers);
+    while (!atomic_compare_exchange_weak(&buffers, &b->next, b)) {
+    }
+    return b;
+}
+
+void msgtrace_span(uint64_t msg, int stage, int64_t start_ns, int64_t end_ns, int arg) {
+    if (!local_buf && !(local_buf = thread_buf())) return;
+    uint64_t pos = atomic_load_explicit(&local_buf->head, memory_order_relaxed);
+    msgtrace_event_t *e = &local_buf->events[pos % MSGTRACE_RING];
+    atomic_store_explicit(&e->seq, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    e->msg = msg;
+    e->start_ns = start_ns;
+    e->end_ns = end_ns;
+    e->stage = stage;
+    e->arg = arg;
+    atomic_store_explicit(&e->seq, pos + 1, memory_order_release);
+    atomic_store_explicit(&local_buf->head, pos + 1, memory_order_release);
+}
+
+long msgtrace_dump(const char *path) {
+    FILE *out = fopen(path, "w");
+    if (!out) return -1;
+    long written = 0;
+    int pid = getpid();
+    fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    for (msgtrace_buf_t *b = atomic_load(&buffers); b; b = b->next) {
+        uint64_t head = atomic_load_explicit(&b->head, memory_order_acquire);
+        uint64_t first = head > MSGTRACE_RING ? head - MSGTRACE_RING : 0;
+        for (uint64_t pos = first; pos < head; pos++) {
+            msgtrace_event_t *e = &b->events[pos % MSGTRACE_RING];
+            if (atomic_load_explicit(&e->seq, memory_order_acquire) != pos + 1) continue;
+            msgtrace_event_t copy = {0, e->msg, e->start_ns, e->end_ns, e->stage, e->arg};
+            atomic_thread_fence(memory_order_acquire);
+            if (atomic_load_explicit(&e->seq, memory_order_relaxed) != pos + 1) continue;
+            if (copy.stage < 0 || copy.stage > MSGTRACE_QUEUED) continue;
+            fprintf(out, "%s{\"name\":\"%s\",\"cat\":\"msg\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+                         "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"msg\":%llu,\"slot\":%d}}",
+                    written ? ",\n" : "", stage_names[copy.stage], pid, b->tid, copy.start_ns / 1e3,
+                    (copy.end_ns - copy.start_ns) / 1e3, (unsigned long long)copy.msg, copy.arg);
+            written++;
+        }
+    }
+    fprintf(out, "\n]}\n");
+    if (fclose(out) != 0) return -1;
+    return written;
+}
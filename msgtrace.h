@@ -0,0 +1,111 @@
+/**
+ * @file msgtrace.h
+ * @brief Sampled per-message latency tracing.
+ *
+ * One message in N is followed through the server and timed in stages:
+ *
+ *     recv    reading it off the socket or shared-memory ring
+ *     parse   validation, command detection and framing
+ *     send    one per recipient, from handing it to the transport until it
+ *             is written or, when the socket is backed up, queued
+ *     fanout  the whole delivery loop
+ *     queued  one per frame the socket did not take at once, from queuing
+ *             until outq_flush() writes its last byte
+ *
+ * Spans go to a per-thread ring buffer that only its thread writes, so
+ * recording takes no locks. msgtrace_dump() writes every thread's ring as
+ * Chrome trace-event JSON (load it in chrome://tracing or Perfetto).
+ * With sampling off, each hook costs one test of a thread-local variable.
+ */
+#ifndef MSGTRACE_H
+#define MSGTRACE_H
+
+#include <stdint.h>
+
+#define MSGTRACE_RING 65536
+
+enum { MSGTRACE_RECV, MSGTRACE_PARSE, MSGTRACE_SEND, MSGTRACE_FANOUT, MSGTRACE_QUEUED };
+
+/**
+ * @brief The sampled message the current thread is working on.
+ */
+typedef struct {
+    uint64_t id;           /**< Message number, 0 if the current message is not sampled. */
+    int64_t mark_ns;       /**< End of the previous stage. */
+    uint64_t send_id;      /**< Message of the traced send in progress, 0 if none; stamped on queued frames. */
+    int send_slot;         /**< Recipient of that send. */
+} msgtrace_ctx_t;
+
+extern int msgtrace_rate;
+extern __thread msgtrace_ctx_t msgtrace_ctx;
+
+/**
+ * @brief Set the sampling rate.
+ * @param one_in Trace one message in this many; 0 turns tracing off.
+ */
+void msgtrace_set_rate(int one_in);
+
+/**
+ * @brief Read the monotonic clock in nanoseconds.
+ */
+int64_t msgtrace_now(void);
+
+/**
+ * @brief Record a span for the sampled message.
+ * @param msg Message number.
+ * @param stage MSGTRACE_* stage.
+ * @param start_ns Span start.
+ * @param end_ns Span end.
+ * @param arg Client slot the span concerns.
+ */
+void msgtrace_span(uint64_t msg, int stage, int64_t start_ns, int64_t end_ns, int arg);
+
+/**
+ * @brief Decide whether a message that was just received is sampled.
+ * @param start_ns When its receive started.
+ */
+void msgtrace_begin_slow(int64_t start_ns);
+
+/**
+ * @brief Timestamp taken before a receive, 0 when tracing is off.
+ */
+static inline int64_t msgtrace_recv_start(void) {
+    return msgtrace_rate ? msgtrace_now() : 0;
+}
+
+/**
+ * @brief Start following a received message if it is sampled.
+ * @param start_ns Value from msgtrace_recv_start().
+ */
+static inline void msgtrace_begin(int64_t start_ns) {
+    if (start_ns) msgtrace_begin_slow(start_ns);
+}
+
+/**
+ * @brief End the current stage of the sampled message, if any.
+ * @param stage MSGTRACE_* stage that just finished.
+ * @param arg Client slot the stage concerns.
+ */
+static inline void msgtrace_stage(int stage, int arg) {
+    if (msgtrace_ctx.id) {
+        int64_t now = msgtrace_now();
+        msgtrace_span(msgtrace_ctx.id, stage, msgtrace_ctx.mark_ns, now, arg);
+        msgtrace_ctx.mark_ns = now;
+    }
+}
+
+/**
+ * @brief Stop following the current message.
+ */
+static inline void msgtrace_end(void) {
+    msgtrace_ctx.id = 0;
+}
+
+/**
+ * @brief Write all recorded spans as Chrome trace-event JSON.
+ * @param path Output file.
+ * @return Number of spans written, or -1 on error (errno set).
+ */
+long msgtrace_dump(const char *path);
+
+#endif // MSGTRACE_H
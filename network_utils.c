@@ -16,5 +16,9 @@ void get_client_address(int sockfd, char *addr_buf) {
         strcpy(addr_buf, "unknown");
         return;
     }
-    sprintf(addr_buf, "%s:%d", inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
+    format_address(&addr, addr_buf);
+}
+
+void format_address(const struct sockaddr_in *addr, char *addr_buf) {
+    sprintf(addr_buf, "%s:%d", inet_ntoa(addr->sin_addr), ntohs(addr->sin_port));
 } 
\ No newline at end of file
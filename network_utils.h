@@ -7,6 +7,8 @@
 #ifndef NETWORK_UTILS_H
 #define NETWORK_UTILS_H
 
+#include <netinet/in.h>
+
 /**
  * @brief Get the client address as a string.
  * @param sockfd Socket file descriptor.
@@ -14,4 +16,11 @@
  */
 void get_client_address(int sockfd, char *addr_buf);
 
+/**
+ * @brief Format an IPv4 address as "ip:port".
+ * @param addr Address to format.
+ * @param addr_buf Buffer to store the address string (at least 22 bytes).
+ */
+void format_address(const struct sockaddr_in *addr, char *addr_buf);
+
 #endif // NETWORK_UTILS_H 
\ No newline at end of file
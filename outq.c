@@ -0,0 +1,136 @@
+/**
+ * @file outq.c
+ * @brief Outbound queue implementation.
+ */
+#include "outq.h"
+#include "msgtrace.h"
+#include "pool.h"
+#include <errno.h>
+#include <string.h>
+
+static int fifo_mode = 0;
+
+void outq_set_fifo(int on) {
+    fifo_mode = on;
+}
+
+outq_t *outq_create(void) {
+    return pool_calloc(sizeof(outq_t));
+}
+
+static void free_frame(out_frame_t *f) {
+    pool_free(f, sizeof(out_frame_t) + f->len);
+}
+
+// A frame is written out: close its span if it was traced
+static void frame_done(out_frame_t *f) {
+    if (f->trace_id) msgtrace_span(f->trace_id, MSGTRACE_QUEUED, f->queued_ns, msgtrace_now(), f->trace_slot);
+    free_frame(f);
+}
+
+void outq_free(outq_t *q) {
+    if (!q) return;
+    if (q->current) free_frame(q->current);
+    for (int lane = 0; lane < OUTQ_LANES; lane++) {
+        for (out_frame_t *f = q->head[lane], *next; f; f = next) {
+            next = f->next;
+            free_frame(f);
+        }
+    }
+    pool_free(q, sizeof(outq_t));
+}
+
+int outq_push(outq_t *q, int lane, const struct iovec *iov, int iovcnt, size_t skip) {
+    size_t len = 0;
+    for (int i = 0; i < iovcnt; i++) len += iov[i].iov_len;
+    int started = skip > 0;
+    len -= skip;
+    // A frame already partly on the wire must be finished whatever the backlog
+    size_t limit = lane == OUTQ_CONTROL ? OUTQ_MAX_BYTES + OUTQ_CONTROL_HEADROOM : OUTQ_MAX_BYTES;
+    if (!started && q->bytes + len > limit) {
+        q->overflow = 1;
+        return -1;
+    }
+    out_frame_t *f = pool_alloc(sizeof(out_frame_t) + len);
+    if (!f) return -1;
+    f->next = NULL;
+    f->len = (uint32_t)len;
+    f->trace_id = msgtrace_ctx.send_id;
+    f->trace_slot = msgtrace_ctx.send_slot;
+    f->queued_ns = f->trace_id ? msgtrace_now() : 0;
+    size_t off = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        size_t from = skip < iov[i].iov_len ? skip : iov[i].iov_len;
+        memcpy(f->data + off, (const char *)iov[i].iov_base + from, iov[i].iov_len - from);
+        off += iov[i].iov_len - from;
+        skip -= from;
+    }
+    q->bytes += len;
+    if (started) {
+        q->current = f;
+        q->sent = 0;
+        return 0;
+    }
+    if (fifo_mode) lane = OUTQ_CHAT;
+    if (q->tail[lane]) {
+        q->tail[lane]->next = f;
+    } else {
+        q->head[lane] = f;
+    }
+    q->tail[lane] = f;
+    return 0;
+}
+
+ssize_t outq_flush(outq_t *q, int fd, outq_write_fn write_fn) {
+    ssize_t total = 0;
+    while (q->bytes > 0) {
+        // The current frame, then whole frames in lane order: the order they are due in
+        struct iovec iov[OUTQ_BATCH_IOV];
+        size_t batch = 0;
+        int cnt = 0;
+        if (q->current) {
+            iov[cnt].iov_base = q->current->data + q->sent;
+            iov[cnt].iov_len = q->current->len - q->sent;
+            batch += iov[cnt++].iov_len;
+        }
+        for (int lane = 0; lane < OUTQ_LANES; lane++) {
+            for (out_frame_t *f = q->head[lane]; f && cnt < OUTQ_BATCH_IOV; f = f->next) {
+                iov[cnt].iov_base = f->data;
+                iov[cnt].iov_len = f->len;
+                batch += iov[cnt++].iov_len;
+            }
+        }
+        ssize_t n = write_fn(fd, iov, cnt);
+        if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? total : -1;
+        total += n;
+        q->bytes -= n;
+        size_t left = n;
+        if (q->current) {
+            size_t rest = q->current->len - q->sent;
+            if (left < rest) {
+                q->sent += left;
+                return total;
+            }
+            left -= rest;
+            frame_done(q->current);
+            q->current = NULL;
+            q->sent = 0;
+        }
+        for (int lane = 0; lane < OUTQ_LANES && left > 0; lane++) {
+            while (q->head[lane] && left > 0) {
+                out_frame_t *f = q->head[lane];
+                q->head[lane] = f->next;
+                if (!f->next) q->tail[lane] = NULL;
+                if (left < f->len) {
+                    q->current = f;
+                    q->sent = left;
+                    return total;
+                }
+                left -= f->len;
+                frame_done(f);
+            }
+        }
+        if ((size_t)n < batch) break;
+    }
+    return total;
+}
@@ -0,0 +1,112 @@
+/**
+ * @file outq.h
+ * @brief Per-connection outbound queues with priority lanes.
+ *
+ * Writes to a client go straight to its socket while the socket keeps up.
+ * Whatever the socket does not take is copied into the connection's queue
+ * and written when epoll reports the socket writable. The queue has three
+ * lanes, drained strictly in order:
+ *
+ *     OUTQ_CONTROL   server notices: presence, errors, kicks, heartbeats
+ *     OUTQ_CHAT      interactive traffic: room and direct messages, replies
+ *     OUTQ_BULK      history and replay: mailbox catch-up, multicast repair
+ *
+ * Lanes are only switched at frame boundaries: each send is one frame, and a
+ * frame that is partly written always finishes before the next one starts,
+ * so a control notice can overtake queued bulk data without splitting a
+ * line or a WebSocket frame.
+ *
+ * The queue and its frames are pooled and released as soon as the backlog
+ * is written, so an idle connection holds none of it.
+ */
+#ifndef OUTQ_H
+#define OUTQ_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#define OUTQ_LANES 3
+#define OUTQ_MAX_BYTES (16 * 1024 * 1024)
+#define OUTQ_CONTROL_HEADROOM (1024 * 1024)
+#define OUTQ_BATCH_IOV 64
+
+enum { OUTQ_CONTROL, OUTQ_CHAT, OUTQ_BULK };
+
+/**
+ * @brief One queued frame.
+ */
+typedef struct out_frame {
+    struct out_frame *next;   /**< Next frame in the same lane. */
+    uint32_t len;             /**< Bytes in data. */
+    int32_t trace_slot;       /**< Recipient slot for the queued span, see msgtrace.h. */
+    uint64_t trace_id;        /**< Sampled message this frame carries, 0 if none. */
+    int64_t queued_ns;        /**< When it was queued, if traced. */
+    char data[];
+} out_frame_t;
+
+/**
+ * @brief Outbound backlog of one connection.
+ */
+typedef struct outq {
+    out_frame_t *head[OUTQ_LANES];  /**< Oldest frame of each lane. */
+    out_frame_t *tail[OUTQ_LANES];  /**< Newest frame of each lane. */
+    out_frame_t *current;           /**< Frame partly written, finished before any lane is picked. */
+    size_t sent;                    /**< Bytes of current already written. */
+    size_t bytes;                   /**< Bytes waiting, current included. */
+    int overflow;                   /**< A frame was refused because the queue was full. */
+} outq_t;
+
+/**
+ * @brief Signature of the function that writes to the socket (see chat_send_fn).
+ */
+typedef ssize_t (*outq_write_fn)(int fd, const struct iovec *iov, int iovcnt);
+
+/**
+ * @brief Use one FIFO for every lane, for comparison with priority lanes.
+ * @param on Non-zero to disable the lanes.
+ */
+void outq_set_fifo(int on);
+
+/**
+ * @brief Allocate an empty queue.
+ * @return New queue, or NULL if out of memory.
+ */
+outq_t *outq_create(void);
+
+/**
+ * @brief Release a queue and every frame still in it.
+ * @param q Queue (NULL is ignored).
+ */
+void outq_free(outq_t *q);
+
+/**
+ * @brief Copy a frame into a lane.
+ *
+ * A frame whose first skip bytes were already written becomes the current
+ * frame, ahead of every lane. Lanes other than OUTQ_CONTROL refuse frames
+ * once OUTQ_MAX_BYTES are waiting; OUTQ_CONTROL may go OUTQ_CONTROL_HEADROOM
+ * past that, so notices still get through a full queue, and then refuses
+ * too. A refused frame sets overflow. A frame queued during a
+ * traced send records a "queued" span once it is fully written.
+ *
+ * @param q Queue.
+ * @param lane OUTQ_* lane.
+ * @param iov Frame bytes.
+ * @param iovcnt Number of buffers.
+ * @param skip Bytes at the start of the frame that are already on the wire.
+ * @return 0, or -1 if the frame was refused or out of memory.
+ */
+int outq_push(outq_t *q, int lane, const struct iovec *iov, int iovcnt, size_t skip);
+
+/**
+ * @brief Write as much of the backlog as the socket takes, highest lane first.
+ * @param q Queue.
+ * @param fd Socket.
+ * @param write_fn Function that writes to the socket.
+ * @return Bytes written, or -1 on a socket error other than EAGAIN.
+ */
+ssize_t outq_flush(outq_t *q, int fd, outq_write_fn write_fn);
+
+#endif // OUTQ_H
@@ -0,0 +1,351 @@
+/**
+ * @file pool.c
+ * @brief Size-classed slab pool implementation.
+ */
+#include "pool.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SLAB_MIN_BYTES (64 * 1024)
+#define SLAB_MIN_OBJECTS 8
+#define CACHE_MAX 64
+
+_Static_assert(sizeof(buf_seg_t) == BUF_SEG_SIZE, "buffer segment must fill its size class");
+
+static const size_t class_sizes[POOL_NUM_CLASSES] = {64, 256, 1024, 4096, 16384, POOL_MAX_SIZE};
+
+typedef struct free_obj {
+    struct free_obj *next;
+} free_obj_t;
+
+// Per-thread cache of free objects for one class
+typedef struct {
+    free_obj_t *head;
+    int count;
+} thread_cache_t;
+
+// Per-thread counters for one class; only the owning thread writes them
+typedef struct {
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t alloc_bytes;
+    uint64_t free_bytes;
+    uint64_t cache_hits;
+    uint64_t depot_hits;
+} thread_counters_t;
+
+typedef struct thread_state {
+    thread_cache_t caches[POOL_NUM_CLASSES];
+    thread_counters_t counters[POOL_NUM_CLASSES + 1];
+    struct thread_state *next;
+    int registered;
+} thread_state_t;
+
+// Shared depot for one class (index POOL_NUM_CLASSES is oversized)
+typedef struct {
+    pthread_mutex_t lock;
+    free_obj_t *depot;
+    _Atomic uint64_t slabs;
+} pool_class_t;
+
+static pool_class_t classes[POOL_NUM_CLASSES + 1] = {
+    [0 ... POOL_NUM_CLASSES] = {.lock = PTHREAD_MUTEX_INITIALIZER},
+};
+
+// Every live thread that used the pool, so statistics can be summed
+static pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static thread_state_t *threads = NULL;
+static thread_counters_t retired[POOL_NUM_CLASSES + 1];
+static pthread_key_t exit_key;
+static pthread_once_t exit_key_once = PTHREAD_ONCE_INIT;
+
+static __thread thread_state_t self;
+
+// Thread exit: hand cached objects to the depots and keep the counters
+static void thread_exit(void *arg) {
+    thread_state_t *ts = arg;
+    for (int ci = 0; ci < POOL_NUM_CLASSES; ci++) {
+        thread_cache_t *tc = &ts->caches[ci];
+        if (!tc->head) continue;
+        free_obj_t *last = tc->head;
+        while (last->next) last = last->next;
+        pthread_mutex_lock(&classes[ci].lock);
+        last->next = classes[ci].depot;
+        classes[ci].depot = tc->head;
+        pthread_mutex_unlock(&classes[ci].lock);
+        tc->head = NULL;
+        tc->count = 0;
+    }
+    pthread_mutex_lock(&threads_lock);
+    for (thread_state_t **pp = &threads; *pp; pp = &(*pp)->next) {
+        if (*pp == ts) {
+            *pp = ts->next;
+            break;
+        }
+    }
+    for (int i = 0; i <= POOL_NUM_CLASSES; i++) {
+        retired[i].allocs += ts->counters[i].allocs;
+        retired[i].frees += ts->counters[i].frees;
+        retired[i].alloc_bytes += ts->counters[i].alloc_bytes;
+        retired[i].free_bytes += ts->counters[i].free_bytes;
+        retired[i].cache_hits += ts->counters[i].cache_hits;
+        retired[i].depot_hits += ts->counters[i].depot_hits;
+    }
+    pthread_mutex_unlock(&threads_lock);
+}
+
+static void exit_key_init(void) {
+    pthread_key_create(&exit_key, thread_exit);
+}
+
+static thread_state_t *thread_state(void) {
+    if (!self.registered) {
+        self.registered = 1;
+        pthread_once(&exit_key_once, exit_key_init);
+        pthread_setspecific(exit_key, &self);
+        pthread_mutex_lock(&threads_lock);
+        self.next = threads;
+        threads = &self;
+        pthread_mutex_unlock(&threads_lock);
+    }
+    return &self;
+}
+
+static int class_index(size_t size) {
+    for (int i = 0; i < POOL_NUM_CLASSES; i++) {
+        if (size <= class_sizes[i]) return i;
+    }
+    return POOL_NUM_CLASSES;
+}
+
+// Refill a thread cache with half its capacity, from the depot or a new slab
+static int cache_refill(int ci) {
+    pool_class_t *pc = &classes[ci];
+    thread_cache_t *tc = &self.caches[ci];
+    size_t size = class_sizes[ci];
+    pthread_mutex_lock(&pc->lock);
+    while (pc->depot && tc->count < CACHE_MAX / 2) {
+        free_obj_t *obj = pc->depot;
+        pc->depot = obj->next;
+        obj->next = tc->head;
+        tc->head = obj;
+        tc->count++;
+    }
+    pthread_mutex_unlock(&pc->lock);
+    if (tc->count > 0) return 1;
+
+    size_t nobjs = SLAB_MIN_BYTES / size;
+    if (nobjs < SLAB_MIN_OBJECTS) nobjs = SLAB_MIN_OBJECTS;
+    char *slab = malloc(nobjs * size);
+    if (!slab) return -1;
+    atomic_fetch_add_explicit(&pc->slabs, 1, memory_order_relaxed);
+    // Objects beyond what the cache holds go straight to the depot
+    free_obj_t *extra = NULL;
+    for (size_t i = 0; i < nobjs; i++) {
+        free_obj_t *obj = (free_obj_t *)(slab + i * size);
+        if (tc->count < CACHE_MAX / 2) {
+            obj->next = tc->head;
+            tc->head = obj;
+            tc->count++;
+        } else {
+            obj->next = extra;
+            extra = obj;
+        }
+    }
+    if (extra) {
+        free_obj_t *last = extra;
+        while (last->next) last = last->next;
+        pthread_mutex_lock(&pc->lock);
+        last->next = pc->depot;
+        pc->depot = extra;
+        pthread_mutex_unlock(&pc->lock);
+    }
+    return 0;
+}
+
+// Move half of a full thread cache to the depot
+static void cache_flush(int ci) {
+    pool_class_t *pc = &classes[ci];
+    thread_cache_t *tc = &self.caches[ci];
+    free_obj_t *first = tc->head, *last = first;
+    for (int i = 1; i < CACHE_MAX / 2; i++) last = last->next;
+    tc->head = last->next;
+    tc->count -= CACHE_MAX / 2;
+    pthread_mutex_lock(&pc->lock);
+    last->next = pc->depot;
+    pc->depot = first;
+    pthread_mutex_unlock(&pc->lock);
+}
+
+void *pool_alloc(size_t size) {
+    int ci = class_index(size);
+    thread_state_t *ts = thread_state();
+    thread_counters_t *tcnt = &ts->counters[ci];
+    void *ptr;
+    if (ci == POOL_NUM_CLASSES) {
+        ptr = malloc(size);
+        if (!ptr) return NULL;
+    } else {
+        thread_cache_t *tc = &ts->caches[ci];
+        if (tc->head) {
+            tcnt->cache_hits++;
+        } else {
+            int rc = cache_refill(ci);
+            if (rc < 0) return NULL;
+            if (rc > 0) tcnt->depot_hits++;
+        }
+        free_obj_t *obj = tc->head;
+        tc->head = obj->next;
+        tc->count--;
+        ptr = obj;
+        size = class_sizes[ci];
+    }
+    tcnt->allocs++;
+    tcnt->alloc_bytes += size;
+    return ptr;
+}
+
+void *pool_calloc(size_t size) {
+    void *ptr = pool_alloc(size);
+    if (ptr) memset(ptr, 0, size);
+    return ptr;
+}
+
+void pool_free(void *ptr, size_t size) {
+    if (!ptr) return;
+    int ci = class_index(size);
+    thread_state_t *ts = thread_state();
+    if (ci == POOL_NUM_CLASSES) {
+        free(ptr);
+    } else {
+        thread_cache_t *tc = &ts->caches[ci];
+        if (tc->count >= CACHE_MAX) cache_flush(ci);
+        free_obj_t *obj = ptr;
+        obj->next = tc->head;
+        tc->head = obj;
+        tc->count++;
+        size = class_sizes[ci];
+    }
+    ts->counters[ci].frees++;
+    ts->counters[ci].free_bytes += size;
+}
+
+void pool_get_stats(pool_class_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats) * (POOL_NUM_CLASSES + 1));
+    pthread_mutex_lock(&threads_lock);
+    for (thread_state_t *ts = threads; ; ts = ts->next) {
+        for (int i = 0; i <= POOL_NUM_CLASSES; i++) {
+            thread_counters_t *c = ts ? &ts->counters[i] : &retired[i];
+            // Objects may be freed by another thread, so only the sums are meaningful
+            stats[i].live += c->allocs - c->frees;
+            stats[i].live_bytes += c->alloc_bytes - c->free_bytes;
+            stats[i].allocs += c->allocs;
+            stats[i].cache_hits += c->cache_hits;
+            stats[i].depot_hits += c->depot_hits;
+        }
+        if (!ts) break;
+    }
+    pthread_mutex_unlock(&threads_lock);
+    for (int i = 0; i <= POOL_NUM_CLASSES; i++) {
+        stats[i].size = i < POOL_NUM_CLASSES ? class_sizes[i] : 0;
+        stats[i].slabs = atomic_load(&classes[i].slabs);
+    }
+}
+
+void pool_print_stats(FILE *out) {
+    pool_class_stats_t stats[POOL_NUM_CLASSES + 1];
+    pool_get_stats(stats);
+    fprintf(out, "%-8s %10s %12s %12s %8s %8s %8s\n", "class", "live", "live_bytes", "allocs", "cache%", "depot%", "slabs");
+    for (int i = 0; i <= POOL_NUM_CLASSES; i++) {
+        pool_class_stats_t *s = &stats[i];
+        double total = s->allocs ? (double)s->allocs : 1.0;
+        char name[24];
+        if (s->size) {
+            snprintf(name, sizeof(name), "%zu", s->size);
+        } else {
+            snprintf(name, sizeof(name), "large");
+        }
+        fprintf(out, "%-8s %10llu %12llu %12llu %7.1f%% %7.1f%% %8llu\n", name,
+                (unsigned long long)s->live, (unsigned long long)s->live_bytes, (unsigned long long)s->allocs,
+                100.0 * s->cache_hits / total, 100.0 * s->depot_hits / total, (unsigned long long)s->slabs);
+    }
+}
+
+char *buf_chain_reserve(buf_chain_t *chain, size_t *avail) {
+    if (!chain->tail || chain->tail->len == sizeof(chain->tail->data)) {
+        buf_seg_t *seg = pool_alloc(sizeof(buf_seg_t));
+        if (!seg) return NULL;
+        seg->next = NULL;
+        seg->len = 0;
+        if (chain->tail) {
+            chain->tail->next = seg;
+        } else {
+            chain->head = seg;
+        }
+        chain->tail = seg;
+        chain->nsegs++;
+    }
+    *avail = sizeof(chain->tail->data) - chain->tail->len;
+    return chain->tail->data + chain->tail->len;
+}
+
+void buf_chain_commit(buf_chain_t *chain, size_t len) {
+    chain->tail->len += len;
+    chain->len += len;
+}
+
+int buf_chain_append(buf_chain_t *chain, const void *data, size_t len) {
+    const char *p = data;
+    while (len > 0) {
+        size_t avail;
+        char *dst = buf_chain_reserve(chain, &avail);
+        if (!dst) return -1;
+        size_t n = len < avail ? len : avail;
+        memcpy(dst, p, n);
+        buf_chain_commit(chain, n);
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int buf_chain_split(buf_chain_t *chain, size_t at, buf_chain_t *rest) {
+    buf_seg_t *seg = chain->head;
+    size_t off = at;
+    int nsegs = 1;
+    while (seg && off > seg->len) {
+        off -= seg->len;
+        seg = seg->next;
+        nsegs++;
+    }
+    if (!seg || at == chain->len) return 0;
+    for (buf_seg_t *s = seg; s; s = s->next) {
+        size_t from = s == seg ? off : 0;
+        if (buf_chain_append(rest, s->data + from, s->len - from) < 0) {
+            buf_chain_free(rest);
+            return -1;
+        }
+    }
+    for (buf_seg_t *s = seg->next, *next; s; s = next) {
+        next = s->next;
+        pool_free(s, sizeof(buf_seg_t));
+    }
+    seg->next = NULL;
+    seg->len = off;
+    chain->tail = seg;
+    chain->nsegs = nsegs;
+    chain->len = at;
+    return 0;
+}
+
+void buf_chain_free(buf_chain_t *chain) {
+    buf_seg_t *seg = chain->head;
+    while (seg) {
+        buf_seg_t *next = seg->next;
+        pool_free(seg, sizeof(buf_seg_t));
+        seg = next;
+    }
+    memset(chain, 0, sizeof(*chain));
+}
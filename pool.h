@@ -0,0 +1,134 @@
+/**
+ * @file pool.h
+ * @brief Size-classed slab pools for connection state and message buffers.
+ *
+ * Objects are carved from large slabs and recycled through a per-thread
+ * cache, falling back to a shared depot, so steady-state traffic does not
+ * touch malloc. Requests larger than the biggest class go to malloc.
+ * Frees must pass the size that was allocated. Counters are kept per thread
+ * and summed when statistics are read.
+ *
+ * Also provides chained buffer segments, so payloads larger than one segment
+ * can be received and sent (with writev) without being made contiguous.
+ */
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#define POOL_NUM_CLASSES 6
+#define POOL_MAX_SIZE 65536
+#define BUF_SEG_SIZE 4096
+
+/**
+ * @brief Counters for one size class (or for oversized allocations).
+ */
+typedef struct {
+    size_t size;             /**< Object size of the class, 0 for oversized. */
+    uint64_t live;           /**< Objects currently allocated. */
+    uint64_t live_bytes;     /**< Bytes currently allocated. */
+    uint64_t allocs;         /**< Total allocations. */
+    uint64_t cache_hits;     /**< Allocations served by the thread cache. */
+    uint64_t depot_hits;     /**< Allocations served by the shared depot. */
+    uint64_t slabs;          /**< Slabs carved for this class. */
+} pool_class_stats_t;
+
+/**
+ * @brief A buffer segment; segments are linked into a buf_chain_t.
+ */
+typedef struct buf_seg {
+    struct buf_seg *next;    /**< Next segment, NULL at the tail. */
+    uint32_t len;            /**< Bytes used in data[]. */
+    char data[BUF_SEG_SIZE - sizeof(struct buf_seg *) - sizeof(uint32_t) - 4];
+} buf_seg_t;
+
+/**
+ * @brief A payload stored as a list of pooled segments.
+ */
+typedef struct {
+    buf_seg_t *head;         /**< First segment. */
+    buf_seg_t *tail;         /**< Last segment. */
+    size_t len;              /**< Total payload bytes. */
+    int nsegs;               /**< Number of segments. */
+} buf_chain_t;
+
+/**
+ * @brief Allocate an object from the pool of the smallest fitting class.
+ * @param size Requested size in bytes.
+ * @return Pointer to uninitialized memory, or NULL if out of memory.
+ */
+void *pool_alloc(size_t size);
+
+/**
+ * @brief Allocate a zeroed object from the pool.
+ * @param size Requested size in bytes.
+ * @return Pointer to zeroed memory, or NULL if out of memory.
+ */
+void *pool_calloc(size_t size);
+
+/**
+ * @brief Return an object to its pool.
+ * @param ptr Object from pool_alloc() (NULL is ignored).
+ * @param size The size passed to pool_alloc().
+ */
+void pool_free(void *ptr, size_t size);
+
+/**
+ * @brief Snapshot allocator statistics.
+ * @param stats Array of POOL_NUM_CLASSES + 1 entries; the last one covers
+ *              oversized allocations.
+ */
+void pool_get_stats(pool_class_stats_t *stats);
+
+/**
+ * @brief Print allocator statistics in a human-readable table.
+ * @param out Output stream.
+ */
+void pool_print_stats(FILE *out);
+
+/**
+ * @brief Append bytes to a chain, adding segments as needed.
+ * @param chain Buffer chain (zero-initialized for an empty chain).
+ * @param data Bytes to append.
+ * @param len Number of bytes.
+ * @return 0 on success, -1 if out of memory.
+ */
+int buf_chain_append(buf_chain_t *chain, const void *data, size_t len);
+
+/**
+ * @brief Make sure the chain has free space at its tail and return it.
+ * @param chain Buffer chain.
+ * @param avail Set to the number of free bytes at the tail.
+ * @return Pointer to the free space, or NULL if out of memory.
+ */
+char *buf_chain_reserve(buf_chain_t *chain, size_t *avail);
+
+/**
+ * @brief Record that bytes were written into space from buf_chain_reserve().
+ * @param chain Buffer chain.
+ * @param len Number of bytes written.
+ */
+void buf_chain_commit(buf_chain_t *chain, size_t len);
+
+/**
+ * @brief Move everything after the first at bytes of a chain to another chain.
+ *
+ * The moved bytes are copied into fresh segments; the segments they came
+ * from are released once empty.
+ *
+ * @param chain Chain to cut; left holding its first at bytes.
+ * @param at Bytes to keep, at most chain->len.
+ * @param rest Empty chain that receives the remainder.
+ * @return 0 on success, -1 if out of memory (chain is then unchanged).
+ */
+int buf_chain_split(buf_chain_t *chain, size_t at, buf_chain_t *rest);
+
+/**
+ * @brief Release all segments of a chain and reset it to empty.
+ * @param chain Buffer chain.
+ */
+void buf_chain_free(buf_chain_t *chain);
+
+#endif // POOL_H
@@ -0,0 +1,137 @@
+/**
+ * @file presence.c
+ * @brief Coalesced presence notification implementation.
+ */
+#include "presence.h"
+#include "pool.h"
+#include <ctype.h>
+#include <string.h>
+
+// Copy a display name so it stays one space-free token in a frame
+static void copy_name(char *dst, const char *name) {
+    size_t n = 0;
+    for (; name[n] && n < USERNAME_MAX_LEN - 1; n++) {
+        dst[n] = isspace((unsigned char)name[n]) ? '_' : name[n];
+    }
+    while (n > 0 && dst[n - 1] == '_' && isspace((unsigned char)name[n - 1])) n--;
+    dst[n] = '\0';
+    if (n == 0) strcpy(dst, "client");
+}
+
+// Remove one occurrence of name from a list; returns 1 if it was there
+static int cancel_name(char (*list)[USERNAME_MAX_LEN], int *count, const char *name) {
+    for (int i = 0; i < *count; i++) {
+        if (strcmp(list[i], name) == 0) {
+            (*count)--;
+            if (i != *count) memcpy(list[i], list[*count], USERNAME_MAX_LEN);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void presence_joined(presence_t *p, client_t *client) {
+    char name[USERNAME_MAX_LEN];
+    copy_name(name, client_display_name(client));
+    client->presence_synced = 0;
+    p->new_clients++;
+    if (!cancel_name(p->left, &p->num_left, name) && p->num_joined < MAX_CLIENTS) {
+        memcpy(p->joined[p->num_joined++], name, USERNAME_MAX_LEN);
+    }
+}
+
+void presence_left(presence_t *p, const client_t *client) {
+    char name[USERNAME_MAX_LEN];
+    copy_name(name, client_display_name(client));
+    if (!client->presence_synced && p->new_clients > 0) p->new_clients--;
+    if (!cancel_name(p->joined, &p->num_joined, name) && p->num_left < MAX_CLIENTS) {
+        memcpy(p->left[p->num_left++], name, USERNAME_MAX_LEN);
+    }
+}
+
+int presence_pending(const presence_t *p) {
+    return p->num_joined > 0 || p->num_left > 0 || p->new_clients > 0;
+}
+
+// Append " <sign><name>" to buf, starting a new "<keyword>" line when full
+static void append_name(char *buf, size_t *len, size_t *line_start, const char *keyword, const char *sign, const char *name) {
+    size_t need = 1 + strlen(sign) + strlen(name);
+    if (*len > *line_start && *len - *line_start + need + 1 > PRESENCE_LINE_MAX) {
+        buf[(*len)++] = '\n';
+        *line_start = *len;
+    }
+    if (*len == *line_start) {
+        memcpy(buf + *len, keyword, strlen(keyword));
+        *len += strlen(keyword);
+    }
+    buf[(*len)++] = ' ';
+    memcpy(buf + *len, sign, strlen(sign));
+    *len += strlen(sign);
+    memcpy(buf + *len, name, strlen(name));
+    *len += strlen(name);
+}
+
+// Room for count names of up to USERNAME_MAX_LEN - 1 bytes; every line holds at least 16 of them
+static size_t names_size(int count) {
+    return (size_t)count * (USERNAME_MAX_LEN + 1) + (count / 16 + 1) * 16;
+}
+
+static size_t finish_lines(char *buf, size_t len, size_t line_start) {
+    if (len > line_start) buf[len++] = '\n';
+    return len;
+}
+
+// Deltas go in the control lane, unless bulk output (a snapshot) is still queued that they must not overtake
+static int delta_lane(const client_t *c) {
+    return c->outq && c->outq->head[OUTQ_BULK] ? OUTQ_BULK : OUTQ_CONTROL;
+}
+
+int presence_flush(presence_t *p, client_table_t *table, int max_fanout) {
+    char *delta = NULL, *snapshot = NULL;
+    size_t delta_len = 0, snapshot_len = 0, line_start = 0;
+    size_t delta_cap = names_size(p->num_joined + p->num_left), snapshot_cap = names_size(table->num_clients);
+    if ((p->num_joined > 0 || p->num_left > 0) && (max_fanout == 0 || table->num_clients <= max_fanout)) {
+        delta = pool_alloc(delta_cap);
+        if (delta) {
+            for (int i = 0; i < p->num_joined; i++) append_name(delta, &delta_len, &line_start, "PRESENCE", "+", p->joined[i]);
+            for (int i = 0; i < p->num_left; i++) append_name(delta, &delta_len, &line_start, "PRESENCE", "-", p->left[i]);
+            delta_len = finish_lines(delta, delta_len, line_start);
+        }
+    }
+    if (p->new_clients > 0) {
+        snapshot = pool_alloc(snapshot_cap);
+        if (snapshot) {
+            char name[USERNAME_MAX_LEN];
+            line_start = 0;
+            for (int j = 0; j < table->end; j++) {
+                if (table->clients[j].fd <= 0) continue;
+                copy_name(name, client_display_name(&table->clients[j]));
+                append_name(snapshot, &snapshot_len, &line_start, "ONLINE", "", name);
+            }
+            snapshot_len = finish_lines(snapshot, snapshot_len, line_start);
+        }
+    }
+    int sent = 0, waiting = 0;
+    for (int j = 0; j < table->end; j++) {
+        client_t *c = &table->clients[j];
+        if (c->fd <= 0) continue;
+        if (!c->presence_synced) {
+            if (c->in_transfer || !snapshot) {
+                waiting++;
+                continue;
+            }
+            client_send_lane(c, OUTQ_BULK, snapshot, snapshot_len);
+            c->presence_synced = 1;
+            sent++;
+        } else if (delta_len > 0 && !c->in_transfer) {
+            client_send_lane(c, delta_lane(c), delta, delta_len);
+            sent++;
+        }
+    }
+    p->num_joined = 0;
+    p->num_left = 0;
+    p->new_clients = waiting;
+    pool_free(delta, delta_cap);
+    pool_free(snapshot, snapshot_cap);
+    return sent;
+}
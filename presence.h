@@ -0,0 +1,79 @@
+/**
+ * @file presence.h
+ * @brief Coalesced presence (join/leave) notifications.
+ *
+ * Joins and leaves are collected for one tick and then delivered as one
+ * delta frame per client, instead of one line per event to every client:
+ *
+ *     PRESENCE +alice +bob -carol
+ *
+ * A join and a leave of the same name within a tick cancel out, so a client
+ * that reconnects quickly produces no traffic at all. Clients that joined
+ * during the tick receive a full snapshot instead of the delta:
+ *
+ *     ONLINE alice bob carol dave
+ *
+ * Long lists are split over several lines of at most PRESENCE_LINE_MAX bytes.
+ * Deltas travel in the control lane; a snapshot, which can run to megabytes,
+ * travels in the bulk lane under its cap, and a client's deltas follow it
+ * there until it is written.
+ */
+#ifndef PRESENCE_H
+#define PRESENCE_H
+
+#include "chat.h"
+
+#define PRESENCE_TICK_US 100000LL
+#define PRESENCE_LINE_MAX 1024
+
+/**
+ * @brief Presence changes collected during the current tick.
+ */
+typedef struct {
+    char joined[MAX_CLIENTS][USERNAME_MAX_LEN];  /**< Names that came online. */
+    char left[MAX_CLIENTS][USERNAME_MAX_LEN];    /**< Names that went offline. */
+    int num_joined;                              /**< Entries in joined. */
+    int num_left;                                /**< Entries in left. */
+    int new_clients;                             /**< Clients waiting for a snapshot. */
+} presence_t;
+
+/**
+ * @brief Record that a client came online.
+ *
+ * The client's slot must already be in the table; it receives a snapshot
+ * at the next flush.
+ *
+ * @param p Presence state.
+ * @param client Client that joined.
+ */
+void presence_joined(presence_t *p, client_t *client);
+
+/**
+ * @brief Record that a client went offline (call before removing it).
+ * @param p Presence state.
+ * @param client Client that left.
+ */
+void presence_left(presence_t *p, const client_t *client);
+
+/**
+ * @brief Check whether a flush has anything to deliver.
+ * @param p Presence state.
+ * @return Non-zero if there are pending changes or snapshots.
+ */
+int presence_pending(const presence_t *p);
+
+/**
+ * @brief Deliver the pending changes and snapshots, then start a new tick.
+ *
+ * Clients busy with a file transfer keep their pending snapshot until a
+ * later flush.
+ *
+ * @param p Presence state.
+ * @param table Client table.
+ * @param max_fanout Skip delta frames when more than this many clients are
+ *                   connected (0 = never skip). Snapshots are always sent.
+ * @return Number of clients that received a frame.
+ */
+int presence_flush(presence_t *p, client_table_t *table, int max_fanout);
+
+#endif // PRESENCE_H
@@ -0,0 +1,230 @@
+/**
+ * @file protocol_test.c
+ * @brief Protocol checks against ./chat_server.
+ *
+ * Starts ./chat_server, then runs each check in turn with its own users
+ * logged in over loopback TCP. A check writes to the server the way a
+ * misbehaving or unlucky client would (lines split across writes, and so
+ * on) and looks at what the other users received. Prints one line per
+ * check and exits non-zero if any failed.
+ *
+ * Usage:
+ * ./protocol_test [-- chat_server options...]
+ */
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TCP_PORT 8888
+#define PROMPT_LEN 16
+#define SETTLE_MS 300
+#define INBOX_SIZE 65536
+#define PING_BATCH 256
+#define PING_FLOOD_BYTES (64 * 1024 * 1024)
+
+/**
+ * @brief A logged-in test user and everything it has received since the last drain.
+ */
+typedef struct {
+    int fd;
+    char inbox[INBOX_SIZE];
+    size_t len;
+} user_t;
+
+static pid_t server_pid = 0;
+
+static void start_server(char **server_args) {
+    server_pid = fork();
+    if (server_pid == 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDOUT_FILENO);
+        execv("./chat_server", server_args);
+        perror("Failed to start server");
+        exit(1);
+    } else if (server_pid < 0) {
+        perror("Fork failed");
+        exit(1);
+    }
+    sleep(1);
+}
+
+static void stop_server(void) {
+    if (server_pid > 0) {
+        kill(server_pid, SIGINT);
+        waitpid(server_pid, NULL, 0);
+        server_pid = 0;
+    }
+}
+
+// Log in and wait for the ONLINE snapshot; the name is sent without a newline, as the client does
+static int login(user_t *u, const char *name) {
+    char buf[PROMPT_LEN];
+    struct sockaddr_in addr = {0};
+    struct timeval tv = {2, 0};
+    int one = 1;
+    memset(u, 0, sizeof(*u));
+    u->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (u->fd < 0) return -1;
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(TCP_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    setsockopt(u->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    setsockopt(u->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    if (connect(u->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) return -1;
+    if (recv(u->fd, buf, PROMPT_LEN, MSG_WAITALL) != PROMPT_LEN) return -1;
+    send(u->fd, name, strlen(name), 0);
+    if (recv(u->fd, buf, PROMPT_LEN, MSG_WAITALL) != PROMPT_LEN) return -1;
+    send(u->fd, "secret", 6, 0);
+    char c;
+    do {
+        if (recv(u->fd, &c, 1, 0) != 1) return -1;
+    } while (c != '\n');
+    return 0;
+}
+
+static void logout(user_t *u) {
+    if (u->fd > 0) close(u->fd);
+    u->fd = -1;
+}
+
+static void say(user_t *u, const char *text) {
+    send(u->fd, text, strlen(text), MSG_NOSIGNAL);
+}
+
+// Collect whatever arrives within ms milliseconds, replacing the inbox; 0 if the server hung up
+static int drain(user_t *u, int ms) {
+    struct pollfd pfd = {u->fd, POLLIN, 0};
+    int open = 1;
+    u->len = 0;
+    while (poll(&pfd, 1, ms) > 0) {
+        ssize_t n = recv(u->fd, u->inbox + u->len, sizeof(u->inbox) - 1 - u->len, MSG_DONTWAIT);
+        if (n <= 0) {
+            open = n < 0 && (errno == EAGAIN || errno == EINTR);
+            if (!open) break;
+            continue;
+        }
+        u->len += n;
+        if (u->len == sizeof(u->inbox) - 1) u->len = 0;
+    }
+    u->inbox[u->len] = '\0';
+    return open;
+}
+
+static int got(const user_t *u, const char *text) {
+    return strstr(u->inbox, text) != NULL;
+}
+
+// A "/msg" line split across two writes is one direct message, and none of it reaches the room
+static int check_split_lines(void) {
+    user_t alice, bob, carol;
+    if (login(&alice, "alice") < 0 || login(&bob, "bob") < 0 || login(&carol, "carol") < 0) return 0;
+    drain(&alice, SETTLE_MS);
+    say(&alice, "first line\n");
+    drain(&carol, SETTLE_MS);
+    int ok = got(&carol, "alice: first line\n");
+    say(&alice, "/msg bob sec");
+    usleep(100000);
+    say(&alice, "ret\nsecond ");
+    usleep(100000);
+    say(&alice, "line\n");
+    drain(&bob, SETTLE_MS);
+    drain(&carol, 0);
+    ok = ok && got(&bob, "DM alice: secret\n") && got(&carol, "alice: second line\n") && !got(&carol, "secret") &&
+         !got(&carol, "alice: ret") && !got(&carol, "alice: /msg");
+    logout(&alice);
+    logout(&bob);
+    logout(&carol);
+    return ok;
+}
+
+// The interactive client sends no newlines: each write is a message
+static int check_unterminated(void) {
+    user_t dave, erin;
+    if (login(&dave, "dave") < 0 || login(&erin, "erin") < 0) return 0;
+    drain(&dave, SETTLE_MS);
+    say(&dave, "no newline here");
+    drain(&erin, SETTLE_MS);
+    int ok = got(&erin, "dave: no newline here\n");
+    say(&dave, "and another");
+    drain(&erin, SETTLE_MS);
+    ok = ok && got(&erin, "dave: and another\n");
+    logout(&dave);
+    logout(&erin);
+    return ok;
+}
+
+// Each /ping line gets exactly one PONG, whatever its token looks like
+static int check_ping(void) {
+    user_t gina;
+    if (login(&gina, "gina") < 0) return 0;
+    drain(&gina, SETTLE_MS);
+    say(&gina, "/ping a b c\n/ping 42\n");
+    drain(&gina, SETTLE_MS);
+    int ok = strcmp(gina.inbox, "PONG a b c\nPONG 42\n") == 0;
+    logout(&gina);
+    return ok;
+}
+
+// A client that sends /ping after /ping and never reads the PONGs is disconnected, not buffered forever
+static int check_control_cap(void) {
+    user_t frank;
+    if (login(&frank, "frank") < 0) return 0;
+    struct timeval tv = {5, 0};
+    setsockopt(frank.fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    char batch[PING_BATCH * 80];
+    size_t len = 0;
+    for (int i = 0; i < PING_BATCH; i++) {
+        len += snprintf(batch + len, sizeof(batch) - len, "/ping %064d\n", i);
+    }
+    int kicked = 0;
+    for (size_t sent = 0; sent < PING_FLOOD_BYTES;) {
+        ssize_t n = send(frank.fd, batch, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            kicked = errno == EPIPE || errno == ECONNRESET;
+            break;
+        }
+        sent += n;
+    }
+    logout(&frank);
+    return kicked;
+}
+
+static const struct {
+    const char *name;
+    int (*fn)(void);
+} checks[] = {
+    {"split /msg line", check_split_lines},
+    {"input without newlines", check_unterminated},
+    {"one PONG per /ping", check_ping},
+    {"unread PONGs are capped", check_control_cap},
+};
+
+int main(int argc, char *argv[]) {
+    signal(SIGPIPE, SIG_IGN);
+    char *server_args[32] = {"chat_server"};
+    for (int i = 1, k = 1; i < argc && k < 31; i++) {
+        if (strcmp(argv[i], "--") != 0) server_args[k++] = argv[i];
+    }
+    start_server(server_args);
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(checks) / sizeof(checks[0]); i++) {
+        int ok = checks[i].fn();
+        printf("%-40s %s\n", checks[i].name, ok ? "ok" : "FAIL");
+        failed += !ok;
+    }
+    stop_server();
+    printf("protocol: %zu of %zu checks passed\n", sizeof(checks) / sizeof(checks[0]) - failed,
+           sizeof(checks) / sizeof(checks[0]));
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,316 @@
+/**
+ * @file scan.c
+ * @brief Single-pass text scanning implementation.
+ *
+ * The AVX2 path validates UTF-8 entirely with vector lookups (the
+ * Keiser-Lemire method: three 16-entry tables classify each byte pair, and a
+ * carry check covers the third and fourth bytes of longer characters). The
+ * SSE2 path only vectorizes runs of ASCII and steps through other blocks one
+ * character at a time. Kernels see whole characters only; scan_update()
+ * holds back an unfinished character at the end of a chunk.
+ */
+#include "scan.h"
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#endif
+
+// Returns nonzero if p[0..n) is not clean
+typedef int (*scan_kernel_fn)(const uint8_t *p, size_t n);
+
+static scan_kernel_fn kernel = NULL;
+static const char *kernel_name = "scalar";
+
+static inline int forbidden_ascii(uint8_t c) {
+    return (c < 0x20 && c != '\n' && c != '\r' && c != '\t') || c == 0x7f;
+}
+
+// Length of the character a lead byte starts, 1 for ASCII and invalid leads
+static inline int utf8_len(uint8_t c) {
+    if (c >= 0xC2 && c <= 0xDF) return 2;
+    if (c >= 0xE0 && c <= 0xEF) return 3;
+    if (c >= 0xF0 && c <= 0xF4) return 4;
+    return 1;
+}
+
+// Check the character at p[i]; returns the index after it, or 0 if it is bad
+static inline size_t scalar_step(const uint8_t *p, size_t n, size_t i) {
+    uint8_t c = p[i];
+    if (c < 0x80) return forbidden_ascii(c) ? 0 : i + 1;
+    int len = utf8_len(c);
+    if (len == 1 || i + len > n) return 0;
+    // Second byte ranges rule out overlong forms, surrogates and values above U+10FFFF
+    uint8_t lo = 0x80, hi = 0xBF;
+    if (c == 0xE0) lo = 0xA0;
+    else if (c == 0xED) hi = 0x9F;
+    else if (c == 0xF0) lo = 0x90;
+    else if (c == 0xF4) hi = 0x8F;
+    else if (c == 0xC2) lo = 0xA0;   // U+0080..U+009F are C1 controls
+    if (p[i + 1] < lo || p[i + 1] > hi) return 0;
+    for (int k = 2; k < len; k++) {
+        if ((p[i + k] & 0xC0) != 0x80) return 0;
+    }
+    return i + len;
+}
+
+static int scan_scalar(const uint8_t *p, size_t n) {
+    size_t i = 0;
+    while (i < n) {
+        i = scalar_step(p, n, i);
+        if (i == 0) return 1;
+    }
+    return 0;
+}
+
+#ifdef SCAN_X86
+
+static int scan_sse2(const uint8_t *p, size_t n) {
+    const __m128i lf = _mm_set1_epi8('\n');
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i del = _mm_set1_epi8(0x7f);
+    const __m128i c1f = _mm_set1_epi8(0x1f);
+    size_t i = 0;
+    while (i + 16 <= n) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        if (_mm_movemask_epi8(v) == 0) {
+            __m128i is_lf = _mm_cmpeq_epi8(v, lf);
+            __m128i ctrl = _mm_cmpeq_epi8(_mm_max_epu8(v, c1f), c1f);
+            __m128i allowed = _mm_or_si128(is_lf, _mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, tab)));
+            __m128i bad = _mm_or_si128(_mm_andnot_si128(allowed, ctrl), _mm_cmpeq_epi8(v, del));
+            if (_mm_movemask_epi8(bad)) return 1;
+            i += 16;
+            continue;
+        }
+        size_t end = i + 16;
+        while (i < end) {
+            i = scalar_step(p, n, i);
+            if (i == 0) return 1;
+        }
+    }
+    while (i < n) {
+        i = scalar_step(p, n, i);
+        if (i == 0) return 1;
+    }
+    return 0;
+}
+
+#define AVX2 __attribute__((target("avx2")))
+
+// Bytes of the previous block shifted in front of this one by n positions
+#define PREV(input, prev_input, n) \
+    _mm256_alignr_epi8((input), _mm256_permute2x128_si256((prev_input), (input), 0x21), 16 - (n))
+
+#define TOO_SHORT (1 << 0)
+#define TOO_LONG (1 << 1)
+#define OVERLONG_3 (1 << 2)
+#define TOO_LARGE (1 << 3)
+#define SURROGATE (1 << 4)
+#define OVERLONG_2 (1 << 5)
+#define TOO_LARGE_1000 (1 << 6)
+#define OVERLONG_4 (1 << 6)
+#define TWO_CONTS (1 << 7)
+#define CARRY (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+#define TABLE16(...) _mm256_setr_epi8(__VA_ARGS__, __VA_ARGS__)
+
+AVX2 static inline __m256i high_nibbles(__m256i v) {
+    return _mm256_and_si256(_mm256_srli_epi16(v, 4), _mm256_set1_epi8(0x0f));
+}
+
+// Errors visible from a byte and the one before it
+AVX2 static inline __m256i special_cases(__m256i input, __m256i prev1) {
+    const __m256i byte_1_high_table = TABLE16(
+        TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+        TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+        TOO_SHORT | OVERLONG_2,
+        TOO_SHORT,
+        TOO_SHORT | OVERLONG_3 | SURROGATE,
+        TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4);
+    const __m256i byte_1_low_table = TABLE16(
+        CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+        CARRY | OVERLONG_2,
+        CARRY, CARRY,
+        CARRY | TOO_LARGE,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000);
+    const __m256i byte_2_high_table = TABLE16(
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT);
+    __m256i byte_1_high = _mm256_shuffle_epi8(byte_1_high_table, high_nibbles(prev1));
+    __m256i byte_1_low = _mm256_shuffle_epi8(byte_1_low_table, _mm256_and_si256(prev1, _mm256_set1_epi8(0x0f)));
+    __m256i byte_2_high = _mm256_shuffle_epi8(byte_2_high_table, high_nibbles(input));
+    return _mm256_and_si256(_mm256_and_si256(byte_1_high, byte_1_low), byte_2_high);
+}
+
+// Third and fourth bytes of long characters must be continuations, and nothing else may be
+AVX2 static inline __m256i multibyte_lengths(__m256i input, __m256i prev_input, __m256i sc) {
+    __m256i prev2 = PREV(input, prev_input, 2);
+    __m256i prev3 = PREV(input, prev_input, 3);
+    __m256i is_third = _mm256_subs_epu8(prev2, _mm256_set1_epi8((char)(0xe0 - 0x80)));
+    __m256i is_fourth = _mm256_subs_epu8(prev3, _mm256_set1_epi8((char)(0xf0 - 0x80)));
+    __m256i must23 = _mm256_and_si256(_mm256_or_si256(is_third, is_fourth), _mm256_set1_epi8((char)0x80));
+    return _mm256_xor_si256(must23, sc);
+}
+
+// Nonzero where a character starting near the end of the block runs past it
+AVX2 static inline __m256i incomplete(__m256i input) {
+    const __m256i max_value = _mm256_setr_epi8(
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        (char)(0xf0 - 1), (char)(0xe0 - 1), (char)(0xc0 - 1));
+    return _mm256_subs_epu8(input, max_value);
+}
+
+AVX2 static int scan_avx2(const uint8_t *p, size_t n) {
+    const __m256i lf = _mm256_set1_epi8('\n');
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i del = _mm256_set1_epi8(0x7f);
+    const __m256i c1f = _mm256_set1_epi8(0x1f);
+    const __m256i c2 = _mm256_set1_epi8((char)0xc2);
+    const __m256i c9f = _mm256_set1_epi8((char)0x9f);
+    __m256i error = _mm256_setzero_si256();
+    __m256i prev_input = _mm256_setzero_si256();
+    __m256i prev_incomplete = _mm256_setzero_si256();
+    uint8_t last[32];
+    size_t i = 0;
+    while (i < n) {
+        __m256i v;
+        if (i + 32 <= n) {
+            v = _mm256_loadu_si256((const __m256i *)(p + i));
+        } else {
+            // Pad the final partial block with spaces, which are always clean
+            memset(last, ' ', sizeof(last));
+            memcpy(last, p + i, n - i);
+            v = _mm256_loadu_si256((const __m256i *)last);
+        }
+        __m256i is_lf = _mm256_cmpeq_epi8(v, lf);
+        __m256i ctrl = _mm256_cmpeq_epi8(_mm256_max_epu8(v, c1f), c1f);
+        __m256i allowed = _mm256_or_si256(is_lf, _mm256_or_si256(_mm256_cmpeq_epi8(v, cr), _mm256_cmpeq_epi8(v, tab)));
+        error = _mm256_or_si256(error, _mm256_andnot_si256(allowed, ctrl));
+        error = _mm256_or_si256(error, _mm256_cmpeq_epi8(v, del));
+        if (_mm256_movemask_epi8(v) == 0) {
+            error = _mm256_or_si256(error, prev_incomplete);
+            prev_incomplete = _mm256_setzero_si256();
+        } else {
+            __m256i prev1 = PREV(v, prev_input, 1);
+            __m256i sc = special_cases(v, prev1);
+            error = _mm256_or_si256(error, multibyte_lengths(v, prev_input, sc));
+            // C2 80..C2 9F encode the C1 controls
+            __m256i c1 = _mm256_and_si256(_mm256_cmpeq_epi8(prev1, c2), _mm256_cmpeq_epi8(_mm256_min_epu8(v, c9f), v));
+            error = _mm256_or_si256(error, c1);
+            prev_incomplete = incomplete(v);
+        }
+        prev_input = v;
+        if (!_mm256_testz_si256(error, error)) return 1;
+        i += 32;
+    }
+    error = _mm256_or_si256(error, prev_incomplete);
+    return !_mm256_testz_si256(error, error);
+}
+
+#endif // SCAN_X86
+
+int scan_select(const char *name) {
+    if (name == NULL) {
+#ifdef SCAN_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) return scan_select("avx2");
+        return scan_select("sse2");
+#else
+        return scan_select("scalar");
+#endif
+    }
+    if (strcmp(name, "scalar") == 0) {
+        kernel = scan_scalar;
+        kernel_name = "scalar";
+        return 0;
+    }
+#ifdef SCAN_X86
+    if (strcmp(name, "sse2") == 0) {
+        kernel = scan_sse2;
+        kernel_name = "sse2";
+        return 0;
+    }
+    if (strcmp(name, "avx2") == 0) {
+        __builtin_cpu_init();
+        if (!__builtin_cpu_supports("avx2")) return -1;
+        kernel = scan_avx2;
+        kernel_name = "avx2";
+        return 0;
+    }
+#endif
+    return -1;
+}
+
+const char *scan_impl_name(void) {
+    if (!kernel) scan_select(NULL);
+    return kernel_name;
+}
+
+void scan_init(scan_state_t *st) {
+    memset(st, 0, sizeof(*st));
+    if (!kernel) scan_select(NULL);
+}
+
+void scan_update(scan_state_t *st, const char *buf, size_t len) {
+    const uint8_t *p = (const uint8_t *)buf;
+    if (st->invalid) return;
+    if (st->tail_len > 0) {
+        // Finish the character left over from the previous chunk
+        int need = utf8_len(st->tail[0]);
+        while (st->tail_len < need && len > 0) {
+            st->tail[st->tail_len++] = *p++;
+            len--;
+        }
+        if (st->tail_len < need) return;
+        st->invalid = scan_scalar(st->tail, need);
+        st->tail_len = 0;
+        if (st->invalid) return;
+    }
+    size_t cut = len;
+    for (size_t k = 1; k <= 3 && k <= len; k++) {
+        uint8_t c = p[len - k];
+        if (c < 0x80) break;
+        if (c >= 0xC0) {
+            if ((size_t)utf8_len(c) > k) cut = len - k;
+            break;
+        }
+    }
+    if (kernel(p, cut)) {
+        st->invalid = 1;
+        return;
+    }
+    memcpy(st->tail, p + cut, len - cut);
+    st->tail_len = len - cut;
+}
+
+int scan_finish(scan_state_t *st) {
+    if (st->tail_len > 0) st->invalid = 1;
+    return !st->invalid;
+}
+
+int scan_message(const struct iovec *iov, int iovcnt) {
+    scan_state_t st;
+    scan_init(&st);
+    for (int i = 0; i < iovcnt && !st.invalid; i++) {
+        scan_update(&st, iov[i].iov_base, iov[i].iov_len);
+    }
+    return scan_finish(&st);
+}
@@ -0,0 +1,71 @@
+/**
+ * @file scan.h
+ * @brief Single-pass scanning of received chat text.
+ *
+ * One pass over each received chunk validates UTF-8 and flags control
+ * characters (C0 other than tab, CR and LF, DEL, and the C1 range), so
+ * malformed input can be refused before it is fanned out.
+ *
+ * The scan runs with AVX2 or SSE2 vectors when the CPU has them and falls
+ * back to a scalar loop otherwise; the choice is made once at run time.
+ * A multi-byte character split across chunks is carried over in the state.
+ */
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+/**
+ * @brief Running state of a scan over one message.
+ */
+typedef struct {
+    int invalid;           /**< Malformed UTF-8 or a forbidden control character was seen. */
+    int tail_len;          /**< Bytes of an unfinished character carried to the next chunk. */
+    uint8_t tail[4];       /**< Those bytes. */
+} scan_state_t;
+
+/**
+ * @brief Start a scan.
+ * @param st State to reset.
+ */
+void scan_init(scan_state_t *st);
+
+/**
+ * @brief Scan the next chunk of a message.
+ * @param st Scan state.
+ * @param buf Chunk bytes.
+ * @param len Chunk length.
+ */
+void scan_update(scan_state_t *st, const char *buf, size_t len);
+
+/**
+ * @brief End a scan.
+ * @param st Scan state.
+ * @return 1 if the whole message was clean, 0 otherwise.
+ */
+int scan_finish(scan_state_t *st);
+
+/**
+ * @brief Scan a message spread over several buffers.
+ * @param iov Message buffers.
+ * @param iovcnt Number of buffers.
+ * @return 1 if the message is valid UTF-8 without forbidden control characters.
+ */
+int scan_message(const struct iovec *iov, int iovcnt);
+
+/**
+ * @brief Choose the implementation used by later scans.
+ * @param name "avx2", "sse2", "scalar", or NULL for the best the CPU supports.
+ * @return 0 on success, -1 if the CPU or build does not support it.
+ */
+int scan_select(const char *name);
+
+/**
+ * @brief Name of the implementation currently in use.
+ * @return "avx2", "sse2" or "scalar".
+ */
+const char *scan_impl_name(void);
+
+#endif // SCAN_H
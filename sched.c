@@ -0,0 +1,73 @@
+/**
+ * @file sched.c
+ * @brief Fair read scheduling helpers implementation.
+ */
+#define _GNU_SOURCE
+#include "sched.h"
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+
+static cpu_set_t helper_cpus;
+static int reactor_pinned = 0;
+
+void ready_queue_push(ready_queue_t *q, int slot) {
+    if (q->queued[slot]) return;
+    q->slots[(q->head + q->count) % MAX_CLIENTS] = slot;
+    q->count++;
+    q->queued[slot] = 1;
+}
+
+int ready_queue_pop(ready_queue_t *q) {
+    if (q->count == 0) return -1;
+    int slot = q->slots[q->head];
+    q->head = (q->head + 1) % MAX_CLIENTS;
+    q->count--;
+    q->queued[slot] = 0;
+    return slot;
+}
+
+int64_t sched_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int64_t rate_limit_wait(int64_t tat, int64_t now, int rate, int burst) {
+    if (rate <= 0) return 0;
+    int64_t interval = 1000000 / rate;
+    int64_t allowed_at = tat - (int64_t)(burst > 1 ? burst - 1 : 0) * interval;
+    return allowed_at > now ? allowed_at - now : 0;
+}
+
+void rate_limit_charge(int64_t *tat, int64_t now, int rate) {
+    if (rate <= 0) return;
+    *tat = (*tat > now ? *tat : now) + 1000000 / rate;
+}
+
+int sched_pin_reactor(int cpu) {
+    cpu_set_t all, one;
+    if (sched_getaffinity(0, sizeof(all), &all) < 0) return -1;
+    if (cpu < 0 || cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, &all)) {
+        errno = EINVAL;
+        return -1;
+    }
+    CPU_ZERO(&one);
+    CPU_SET(cpu, &one);
+    if (sched_setaffinity(0, sizeof(one), &one) < 0) return -1;
+    helper_cpus = all;
+    CPU_CLR(cpu, &helper_cpus);
+    // With a single CPU the helpers have to share it
+    if (CPU_COUNT(&helper_cpus) == 0) helper_cpus = one;
+    reactor_pinned = 1;
+    return 0;
+}
+
+void sched_helper_attr(pthread_attr_t *attr) {
+    // Signal handlers only set flags for the event loop; keep them on its thread
+    sigset_t all;
+    sigfillset(&all);
+    pthread_attr_setsigmask_np(attr, &all);
+    if (reactor_pinned) pthread_attr_setaffinity_np(attr, sizeof(helper_cpus), &helper_cpus);
+}
@@ -0,0 +1,90 @@
+/**
+ * @file sched.h
+ * @brief Fair read scheduling helpers for the chat server.
+ *
+ * Provides a FIFO of client slots with pending input, so each loop iteration
+ * serves only ready connections in round-robin order, a per-client rate
+ * limiter, and CPU placement for the event loop and its helper threads.
+ */
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include "chat.h"
+
+#define READ_BUDGET_MSGS 8
+#define READ_BUDGET_BYTES (16 * 1024)
+
+/**
+ * @brief Round-robin queue of client slots waiting to be served.
+ */
+typedef struct {
+    int slots[MAX_CLIENTS];             /**< Circular buffer of slot indices. */
+    int head;                           /**< Index of the oldest entry. */
+    int count;                          /**< Number of queued slots. */
+    unsigned char queued[MAX_CLIENTS];  /**< Non-zero if the slot is in the queue. */
+} ready_queue_t;
+
+/**
+ * @brief Append a slot to the queue unless it is already queued.
+ * @param q Ready queue.
+ * @param slot Client slot index.
+ */
+void ready_queue_push(ready_queue_t *q, int slot);
+
+/**
+ * @brief Remove the oldest slot from the queue.
+ * @param q Ready queue.
+ * @return Slot index, or -1 if the queue is empty.
+ */
+int ready_queue_pop(ready_queue_t *q);
+
+/**
+ * @brief Monotonic clock in microseconds.
+ */
+int64_t sched_now_us(void);
+
+/**
+ * @brief Token-bucket rate limit check (GCRA form, one timestamp per client).
+ *
+ * Allows @p rate messages per second with bursts of up to @p burst messages.
+ * A rate of 0 disables limiting. Does not consume a token; call
+ * rate_limit_charge() once a message has actually been processed.
+ *
+ * @param tat Per-client theoretical arrival time, initially 0.
+ * @param now Current time from sched_now_us().
+ * @param rate Sustained messages per second.
+ * @param burst Maximum burst size.
+ * @return 0 if a message may be processed now, otherwise the number of
+ *         microseconds until one may.
+ */
+int64_t rate_limit_wait(int64_t tat, int64_t now, int rate, int burst);
+
+/**
+ * @brief Consume one token after a message was processed.
+ * @param tat Per-client theoretical arrival time.
+ * @param now Current time from sched_now_us().
+ * @param rate Sustained messages per second (0 disables limiting).
+ */
+void rate_limit_charge(int64_t *tat, int64_t now, int rate);
+
+/**
+ * @brief Pin the calling thread (the event loop) to one CPU.
+ *
+ * Helper threads started afterwards with sched_helper_attr() run on the
+ * remaining CPUs of the process, so they never preempt the event loop.
+ *
+ * @param cpu CPU number.
+ * @return 0 on success, -1 on error (errno set; EINVAL if @p cpu is not one
+ *         the process may run on).
+ */
+int sched_pin_reactor(int cpu);
+
+/**
+ * @brief Keep a helper thread off the event loop's CPU, if it is pinned, and block all signals in it.
+ * @param attr Attributes the thread will be created with.
+ */
+void sched_helper_attr(pthread_attr_t *attr);
+
+#endif // SCHED_H
@@ -0,0 +1,607 @@
+/**
+ * @file search.c
+ * @brief Chat history index and search worker implementation.
+ */
+#define _GNU_SOURCE
+#include "search.h"
+#include "auth.h"
+#include "pool.h"
+#include "sched.h"
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#define TERM_MAX 32
+#define MIN_TERM_LEN 2
+#define QUERY_MAX_TERMS 8
+#define RESULT_TEXT_MAX 160
+#define RESULT_MAX_BYTES 8192
+
+typedef struct {
+    char term[TERM_MAX];    // empty when the bucket is free
+    uint8_t *postings;      // varint deltas of ascending sequence numbers
+    uint32_t len;
+    uint32_t cap;
+    uint64_t last_seq;      // last sequence number appended, base of the next delta
+    uint32_t count;
+} term_t;
+
+typedef struct {
+    uint64_t seq;
+    time_t when;
+    char user[USERNAME_MAX_LEN];
+    char *text;
+    uint32_t len;
+} hist_msg_t;
+
+struct search_index {
+    hist_msg_t *ring;       // message seq lives at ring[seq % max_msgs]
+    size_t max_msgs;
+    size_t max_bytes;
+    uint64_t next_seq;
+    uint64_t oldest_seq;
+    size_t history_bytes;
+    term_t *terms;          // open-addressing hash table
+    size_t term_cap;
+    size_t num_terms;
+    size_t posting_bytes;
+    uint64_t compacted_at;  // oldest_seq when postings were last trimmed
+    uint64_t queries;
+};
+
+/* --- Encoding helpers --- */
+
+static size_t put_varint(uint8_t *p, uint64_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        p[n++] = (uint8_t)v | 0x80;
+        v >>= 7;
+    }
+    p[n++] = (uint8_t)v;
+    return n;
+}
+
+static uint64_t get_varint(const uint8_t **p) {
+    uint64_t v = 0;
+    int shift = 0;
+    while (**p & 0x80) {
+        v |= (uint64_t)(*(*p)++ & 0x7f) << shift;
+        shift += 7;
+    }
+    v |= (uint64_t)*(*p)++ << shift;
+    return v;
+}
+
+static uint64_t hash_term(const char *term) {
+    uint64_t h = 1469598103934665603ULL;
+    for (; *term; term++) h = (h ^ (unsigned char)*term) * 1099511628211ULL;
+    return h;
+}
+
+/*
+ * Copy the next word of text into term (lowercased, truncated to TERM_MAX - 1)
+ * and advance *p past it. Bytes >= 0x80 count as word characters so UTF-8
+ * words stay whole. Returns the term length, 0 at the end of the text.
+ */
+static size_t next_token(const char **p, const char *end, char *term) {
+    const unsigned char *s = (const unsigned char *)*p;
+    const unsigned char *e = (const unsigned char *)end;
+    while (s < e && !isalnum(*s) && *s < 0x80) s++;
+    size_t n = 0;
+    while (s < e && (isalnum(*s) || *s >= 0x80)) {
+        if (n < TERM_MAX - 1) term[n++] = (char)tolower(*s);
+        s++;
+    }
+    term[n] = '\0';
+    *p = (const char *)s;
+    return n;
+}
+
+/* --- Index --- */
+
+static term_t *find_term(search_index_t *idx, const char *term) {
+    size_t mask = idx->term_cap - 1;
+    for (size_t i = hash_term(term) & mask;; i = (i + 1) & mask) {
+        term_t *t = &idx->terms[i];
+        if (t->term[0] == '\0' || strcmp(t->term, term) == 0) return t;
+    }
+}
+
+static int grow_terms(search_index_t *idx, size_t new_cap) {
+    term_t *old = idx->terms;
+    size_t old_cap = idx->term_cap;
+    term_t *terms = calloc(new_cap, sizeof(term_t));
+    if (!terms) return -1;
+    idx->terms = terms;
+    idx->term_cap = new_cap;
+    for (size_t i = 0; i < old_cap; i++) {
+        if (old[i].term[0]) *find_term(idx, old[i].term) = old[i];
+    }
+    free(old);
+    return 0;
+}
+
+static void posting_append(search_index_t *idx, const char *term, uint64_t seq) {
+    if ((idx->num_terms + 1) * 2 > idx->term_cap && grow_terms(idx, idx->term_cap * 2) < 0) return;
+    term_t *t = find_term(idx, term);
+    if (t->term[0] == '\0') {
+        strcpy(t->term, term);
+        idx->num_terms++;
+    } else if (t->last_seq == seq) {
+        return;  // word repeated within one message
+    }
+    if (t->len + 10 > t->cap) {
+        uint32_t cap = t->cap ? t->cap * 2 : 16;
+        uint8_t *grown = realloc(t->postings, cap);
+        if (!grown) return;
+        idx->posting_bytes += cap - t->cap;
+        t->postings = grown;
+        t->cap = cap;
+    }
+    t->len += put_varint(t->postings + t->len, seq - t->last_seq);
+    t->last_seq = seq;
+    t->count++;
+}
+
+/*
+ * Decode a posting list, keeping entries that are still in history.
+ * Returns the number of entries written to out (sized for t->count).
+ */
+static size_t posting_decode(const search_index_t *idx, const term_t *t, uint64_t *out) {
+    const uint8_t *p = t->postings, *end = t->postings + t->len;
+    uint64_t seq = 0;
+    size_t n = 0;
+    while (p < end) {
+        seq += get_varint(&p);
+        if (seq >= idx->oldest_seq) out[n++] = seq;
+    }
+    return n;
+}
+
+/*
+ * Drop postings of evicted messages and terms left without postings, then
+ * rebuild the hash table for the remaining terms.
+ */
+static void compact(search_index_t *idx) {
+    size_t live_terms = 0;
+    idx->posting_bytes = 0;
+    for (size_t i = 0; i < idx->term_cap; i++) {
+        term_t *t = &idx->terms[i];
+        if (t->term[0] == '\0') continue;
+        uint64_t *seqs = malloc(t->count * sizeof(uint64_t));
+        size_t n = seqs ? posting_decode(idx, t, seqs) : t->count;
+        if (seqs && n < t->count) {
+            uint32_t len = 0, cap = 0;
+            uint8_t *buf = n ? malloc(n * 10) : NULL;
+            uint64_t prev = 0;
+            for (size_t k = 0; buf && k < n; k++) {
+                len += put_varint(buf + len, seqs[k] - prev);
+                prev = seqs[k];
+            }
+            if (buf) {
+                // Keep a little room so the next append does not reallocate
+                cap = len + 16;
+                uint8_t *shrunk = realloc(buf, cap);
+                if (shrunk) buf = shrunk;
+            }
+            if (n == 0 || buf) {
+                free(t->postings);
+                t->postings = buf;
+                t->len = len;
+                t->cap = cap;
+                t->count = n;
+            }
+        }
+        free(seqs);
+        if (t->count == 0) {
+            free(t->postings);
+            memset(t, 0, sizeof(*t));
+        } else {
+            idx->posting_bytes += t->cap;
+            live_terms++;
+        }
+    }
+    idx->num_terms = live_terms;
+    size_t cap = 1024;
+    while (cap < live_terms * 2) cap *= 2;
+    grow_terms(idx, cap);
+    idx->compacted_at = idx->oldest_seq;
+}
+
+search_index_t *search_index_create(size_t max_msgs, size_t max_bytes) {
+    search_index_t *idx = calloc(1, sizeof(*idx));
+    if (!idx) return NULL;
+    idx->ring = calloc(max_msgs, sizeof(hist_msg_t));
+    idx->terms = calloc(1024, sizeof(term_t));
+    if (!idx->ring || !idx->terms) {
+        free(idx->ring);
+        free(idx->terms);
+        free(idx);
+        return NULL;
+    }
+    idx->term_cap = 1024;
+    idx->max_msgs = max_msgs;
+    idx->max_bytes = max_bytes;
+    idx->next_seq = 1;
+    idx->oldest_seq = 1;
+    idx->compacted_at = 1;
+    return idx;
+}
+
+static void evict_oldest(search_index_t *idx) {
+    hist_msg_t *m = &idx->ring[idx->oldest_seq % idx->max_msgs];
+    idx->history_bytes -= m->len;
+    free(m->text);
+    m->text = NULL;
+    m->len = 0;
+    idx->oldest_seq++;
+}
+
+void search_index_add(search_index_t *idx, const char *user, const char *text, size_t len, time_t when) {
+    if (len > SEARCH_TEXT_MAX) len = SEARCH_TEXT_MAX;
+    while (idx->oldest_seq < idx->next_seq &&
+           (idx->next_seq - idx->oldest_seq >= idx->max_msgs || idx->history_bytes + len > idx->max_bytes)) {
+        evict_oldest(idx);
+    }
+    char *copy = malloc(len ? len : 1);
+    if (!copy) return;
+    memcpy(copy, text, len);
+    uint64_t seq = idx->next_seq++;
+    hist_msg_t *m = &idx->ring[seq % idx->max_msgs];
+    m->seq = seq;
+    m->when = when;
+    m->text = copy;
+    m->len = len;
+    snprintf(m->user, sizeof(m->user), "%s", user);
+    for (size_t n = strlen(m->user); n > 0 && isspace((unsigned char)m->user[n - 1]); n--) m->user[n - 1] = '\0';
+    idx->history_bytes += len;
+
+    char term[TERM_MAX];
+    const char *p = copy, *end = copy + len;
+    size_t n;
+    while ((n = next_token(&p, end, term)) > 0) {
+        if (n >= MIN_TERM_LEN) posting_append(idx, term, seq);
+    }
+    // Trim postings once a quarter of the history has turned over
+    if (idx->oldest_seq - idx->compacted_at >= idx->max_msgs / 4) compact(idx);
+}
+
+static size_t format_match(const hist_msg_t *m, char *out, size_t out_len) {
+    char stamp[32];
+    struct tm tm;
+    localtime_r(&m->when, &tm);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M", &tm);
+    char text[RESULT_TEXT_MAX + 4];
+    size_t n = m->len < RESULT_TEXT_MAX ? m->len : RESULT_TEXT_MAX;
+    for (size_t i = 0; i < n; i++) text[i] = iscntrl((unsigned char)m->text[i]) ? ' ' : m->text[i];
+    while (n > 0 && text[n - 1] == ' ') n--;
+    if (m->len > RESULT_TEXT_MAX) {
+        memcpy(text + n, "...", 3);
+        n += 3;
+    }
+    text[n] = '\0';
+    int len = snprintf(out, out_len, "[%s] %s: %s\n", stamp, m->user, text);
+    if (len < 0) return 0;
+    return (size_t)len < out_len ? (size_t)len : out_len - 1;
+}
+
+size_t search_index_query(search_index_t *idx, const char *query, char *out, size_t out_len) {
+    char terms[QUERY_MAX_TERMS][TERM_MAX];
+    char user[USERNAME_MAX_LEN] = "";
+    int num_terms = 0;
+    idx->queries++;
+
+    // Split on whitespace first so "from:" filters keep their punctuation
+    const char *q = query, *qend = query + strlen(query);
+    while (q < qend) {
+        while (q < qend && isspace((unsigned char)*q)) q++;
+        const char *word = q;
+        while (q < qend && !isspace((unsigned char)*q)) q++;
+        if (q - word > 5 && strncmp(word, "from:", 5) == 0) {
+            snprintf(user, sizeof(user), "%.*s", (int)(q - word - 5), word + 5);
+            continue;
+        }
+        const char *p = word;
+        char term[TERM_MAX];
+        size_t n;
+        while ((n = next_token(&p, q, term)) > 0) {
+            if (n >= MIN_TERM_LEN && num_terms < QUERY_MAX_TERMS) strcpy(terms[num_terms++], term);
+        }
+    }
+    if (num_terms == 0 && user[0] == '\0') {
+        int n = snprintf(out, out_len, "SEARCH usage: " SEARCH_CMD " [from:<user>] word...\n");
+        return n < 0 ? 0 : (size_t)n < out_len ? (size_t)n : out_len - 1;
+    }
+
+    // Intersect the posting lists, starting from the rarest term
+    uint64_t *matches = NULL;
+    size_t num_matches = 0;
+    if (num_terms > 0) {
+        term_t *found[QUERY_MAX_TERMS];
+        for (int i = 0; i < num_terms; i++) {
+            found[i] = find_term(idx, terms[i]);
+            if (found[i]->term[0] == '\0') {
+                num_terms = -1;
+                break;
+            }
+            for (int j = i; j > 0 && found[j]->count < found[j - 1]->count; j--) {
+                term_t *tmp = found[j];
+                found[j] = found[j - 1];
+                found[j - 1] = tmp;
+            }
+        }
+        if (num_terms > 0 && (matches = malloc(found[0]->count * sizeof(uint64_t))) != NULL) {
+            num_matches = posting_decode(idx, found[0], matches);
+            for (int i = 1; i < num_terms && num_matches > 0; i++) {
+                uint64_t *other = malloc(found[i]->count * sizeof(uint64_t));
+                if (!other) {
+                    num_matches = 0;
+                    break;
+                }
+                size_t n = posting_decode(idx, found[i], other), a = 0, b = 0, kept = 0;
+                while (a < num_matches && b < n) {
+                    if (matches[a] < other[b]) {
+                        a++;
+                    } else if (matches[a] > other[b]) {
+                        b++;
+                    } else {
+                        matches[kept++] = matches[a++];
+                        b++;
+                    }
+                }
+                num_matches = kept;
+                free(other);
+            }
+        }
+    }
+
+    // Walk candidates newest first; without words every retained message is one
+    char lines[RESULT_MAX_BYTES];
+    size_t lines_len = 0;
+    int total = 0, shown = 0;
+    size_t candidates = num_terms > 0 ? num_matches : num_terms == 0 ? idx->next_seq - idx->oldest_seq : 0;
+    for (size_t k = candidates; k > 0; k--) {
+        uint64_t seq = num_terms > 0 ? matches[k - 1] : idx->oldest_seq + k - 1;
+        const hist_msg_t *m = &idx->ring[seq % idx->max_msgs];
+        if (user[0] && strcmp(m->user, user) != 0) continue;
+        total++;
+        if (shown < SEARCH_MAX_RESULTS) {
+            lines_len += format_match(m, lines + lines_len, sizeof(lines) - lines_len);
+            shown++;
+        }
+    }
+    free(matches);
+
+    char shown_query[128];
+    snprintf(shown_query, sizeof(shown_query), "%s", query);
+    for (char *c = shown_query; *c; c++) {
+        if (iscntrl((unsigned char)*c)) *c = ' ';
+    }
+    int n = snprintf(out, out_len, "SEARCH %d match%s for '%s'%s\n", total, total == 1 ? "" : "es", shown_query,
+                     total > shown ? ", newest shown" : "");
+    if (n < 0) return 0;
+    size_t len = (size_t)n < out_len ? (size_t)n : out_len - 1;
+    if (lines_len > out_len - 1 - len) lines_len = out_len - 1 - len;
+    memcpy(out + len, lines, lines_len);
+    out[len + lines_len] = '\0';
+    return len + lines_len;
+}
+
+void search_index_stats(const search_index_t *idx, search_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+    stats->messages = idx->next_seq - idx->oldest_seq;
+    stats->history_bytes = idx->history_bytes;
+    stats->terms = idx->num_terms;
+    stats->posting_bytes = idx->posting_bytes;
+    stats->queries = idx->queries;
+}
+
+void search_index_destroy(search_index_t *idx) {
+    while (idx->oldest_seq < idx->next_seq) evict_oldest(idx);
+    for (size_t i = 0; i < idx->term_cap; i++) free(idx->terms[i].postings);
+    free(idx->terms);
+    free(idx->ring);
+    free(idx);
+}
+
+/* --- Worker thread --- */
+
+typedef struct search_job {
+    struct search_job *next;
+    size_t size;                 // allocation size, for pool_free()
+    int slot;                    // client to answer, -1 for a message to index
+    uint64_t client_id;
+    time_t when;
+    char user[USERNAME_MAX_LEN];
+    size_t len;
+    char text[];
+} search_job_t;
+
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static search_job_t *queue_head = NULL, *queue_tail = NULL;
+static int queue_len = 0;
+static int worker_idle = 0;
+static uint64_t dropped = 0;
+static search_stats_t worker_stats;    // refreshed by the worker after each batch
+
+static pthread_mutex_t done_lock = PTHREAD_MUTEX_INITIALIZER;
+static search_result_t *done_list = NULL;
+static int done_efd = -1;
+
+static void finish_query(search_index_t *idx, search_job_t *job) {
+    char out[RESULT_MAX_BYTES];
+    size_t len = search_index_query(idx, job->text, out, sizeof(out));
+    search_result_t *r = pool_alloc(sizeof(*r) + len);
+    if (!r) return;
+    r->slot = job->slot;
+    r->client_id = job->client_id;
+    r->len = len;
+    memcpy(r->text, out, len);
+    pthread_mutex_lock(&done_lock);
+    r->next = done_list;
+    done_list = r;
+    pthread_mutex_unlock(&done_lock);
+    uint64_t one = 1;
+    if (write(done_efd, &one, sizeof(one)) < 0) {
+        perror("eventfd write");
+    }
+}
+
+static void *search_worker(void *arg) {
+    search_index_t *idx = arg;
+    // Index and answer queries only with CPU time the event loop leaves over
+    struct sched_param param = {0};
+    if (pthread_setschedparam(pthread_self(), SCHED_IDLE, &param) != 0) {
+        fprintf(stderr, "search: SCHED_IDLE not available, worker runs at normal priority\n");
+    }
+    for (;;) {
+        pthread_mutex_lock(&queue_lock);
+        while (!queue_head) {
+            worker_idle = 1;
+            pthread_cond_wait(&queue_cond, &queue_lock);
+        }
+        worker_idle = 0;
+        search_job_t *job = queue_head;
+        queue_head = queue_tail = NULL;
+        queue_len = 0;
+        pthread_mutex_unlock(&queue_lock);
+
+        while (job) {
+            search_job_t *next = job->next;
+            if (job->slot < 0) {
+                search_index_add(idx, job->user, job->text, job->len, job->when);
+            } else {
+                finish_query(idx, job);
+            }
+            pool_free(job, job->size);
+            job = next;
+        }
+        search_stats_t stats;
+        search_index_stats(idx, &stats);
+        pthread_mutex_lock(&queue_lock);
+        stats.dropped = dropped;
+        worker_stats = stats;
+        pthread_mutex_unlock(&queue_lock);
+    }
+    return NULL;
+}
+
+int search_start(void) {
+    search_index_t *idx = search_index_create(SEARCH_HISTORY_MSGS, SEARCH_HISTORY_BYTES);
+    done_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (!idx || done_efd < 0) {
+        perror("search setup");
+        exit(EXIT_FAILURE);
+    }
+    pthread_t tid;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    sched_helper_attr(&attr);
+    if (pthread_create(&tid, &attr, search_worker, idx) != 0) {
+        perror("pthread_create");
+        exit(EXIT_FAILURE);
+    }
+    pthread_attr_destroy(&attr);
+    return done_efd;
+}
+
+static int submit(search_job_t *job) {
+    pthread_mutex_lock(&queue_lock);
+    if (queue_len >= SEARCH_QUEUE_MAX) {
+        dropped++;
+        pthread_mutex_unlock(&queue_lock);
+        pool_free(job, job->size);
+        return -1;
+    }
+    job->next = NULL;
+    if (queue_tail) {
+        queue_tail->next = job;
+    } else {
+        queue_head = job;
+    }
+    queue_tail = job;
+    queue_len++;
+    if (worker_idle) {
+        worker_idle = 0;
+        pthread_cond_signal(&queue_cond);
+    }
+    pthread_mutex_unlock(&queue_lock);
+    return 0;
+}
+
+static search_job_t *new_job(size_t len) {
+    size_t size = sizeof(search_job_t) + len + 1;
+    search_job_t *job = pool_alloc(size);
+    if (!job) return NULL;
+    job->size = size;
+    job->len = len;
+    job->text[len] = '\0';
+    return job;
+}
+
+int search_submit_message(const char *user, const struct iovec *payload, int payload_cnt) {
+    size_t len = 0;
+    for (int i = 0; i < payload_cnt; i++) len += payload[i].iov_len;
+    if (len > SEARCH_TEXT_MAX) len = SEARCH_TEXT_MAX;
+    search_job_t *job = new_job(len);
+    if (!job) return -1;
+    job->slot = -1;
+    job->when = time(NULL);
+    snprintf(job->user, sizeof(job->user), "%s", user);
+    size_t off = 0;
+    for (int i = 0; i < payload_cnt && off < len; i++) {
+        size_t n = payload[i].iov_len < len - off ? payload[i].iov_len : len - off;
+        memcpy(job->text + off, payload[i].iov_base, n);
+        off += n;
+    }
+    return submit(job);
+}
+
+int search_submit_query(int slot, uint64_t client_id, const char *query, size_t len) {
+    search_job_t *job = new_job(len);
+    if (!job) return -1;
+    job->slot = slot;
+    job->client_id = client_id;
+    memcpy(job->text, query, len);
+    return submit(job);
+}
+
+search_result_t *search_reap(void) {
+    uint64_t count;
+    if (read(done_efd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        perror("eventfd read");
+    }
+    pthread_mutex_lock(&done_lock);
+    search_result_t *r = done_list;
+    done_list = NULL;
+    pthread_mutex_unlock(&done_lock);
+    // Results were pushed newest first; hand them out in the order asked
+    search_result_t *ordered = NULL;
+    while (r) {
+        search_result_t *next = r->next;
+        r->next = ordered;
+        ordered = r;
+        r = next;
+    }
+    return ordered;
+}
+
+void search_result_free(search_result_t *result) {
+    pool_free(result, sizeof(*result) + result->len);
+}
+
+void search_print_stats(FILE *out) {
+    pthread_mutex_lock(&queue_lock);
+    search_stats_t s = worker_stats;
+    pthread_mutex_unlock(&queue_lock);
+    fprintf(out, "search: messages %llu history_bytes %llu terms %llu posting_bytes %llu queries %llu dropped %llu\n",
+            (unsigned long long)s.messages, (unsigned long long)s.history_bytes, (unsigned long long)s.terms,
+            (unsigned long long)s.posting_bytes, (unsigned long long)s.queries, (unsigned long long)s.dropped);
+}
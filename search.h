@@ -0,0 +1,145 @@
+/**
+ * @file search.h
+ * @brief Full-text search over recent chat history.
+ *
+ * Messages are kept in a bounded history ring and indexed as they are
+ * appended: each term maps to a posting list of message sequence numbers,
+ * stored as varint-encoded deltas. When old messages fall out of the ring,
+ * their postings are trimmed, so the index never outlives the history.
+ *
+ * The server runs the index on a worker thread. The event loop only queues
+ * messages and queries; results come back through an eventfd, so a slow
+ * query never delays fan-out.
+ *
+ * Query syntax: "/search [from:<user>] word...". All words must appear in a
+ * message (case-insensitive, whole words); newest matches come first.
+ */
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/uio.h>
+#include <time.h>
+
+#define SEARCH_CMD "/search"
+#define SEARCH_HISTORY_MSGS 16384
+#define SEARCH_HISTORY_BYTES (8 * 1024 * 1024)
+#define SEARCH_MAX_RESULTS 20
+#define SEARCH_QUEUE_MAX 4096
+#define SEARCH_TEXT_MAX 4096
+
+/**
+ * @brief History ring plus inverted index; not thread-safe on its own.
+ */
+typedef struct search_index search_index_t;
+
+/**
+ * @brief Index memory counters.
+ */
+typedef struct {
+    uint64_t messages;        /**< Messages currently retained. */
+    uint64_t history_bytes;   /**< Text bytes currently retained. */
+    uint64_t terms;           /**< Distinct terms in the index. */
+    uint64_t posting_bytes;   /**< Encoded posting list bytes. */
+    uint64_t queries;         /**< Queries answered. */
+    uint64_t dropped;         /**< Messages or queries refused because the queue was full. */
+} search_stats_t;
+
+/**
+ * @brief A query answer on its way back to the event loop.
+ */
+typedef struct search_result {
+    struct search_result *next;   /**< Link in the completed list. */
+    int slot;                     /**< Client slot that asked. */
+    uint64_t client_id;           /**< Connection number that asked. */
+    size_t len;                   /**< Reply length. */
+    char text[];                  /**< Reply lines. */
+} search_result_t;
+
+/**
+ * @brief Create an empty index.
+ * @param max_msgs Messages kept in history.
+ * @param max_bytes Text bytes kept in history.
+ * @return New index, or NULL if out of memory.
+ */
+search_index_t *search_index_create(size_t max_msgs, size_t max_bytes);
+
+/**
+ * @brief Append a message to history and index its words.
+ * @param idx Index.
+ * @param user Sender's name.
+ * @param text Message text.
+ * @param len Text length.
+ * @param when Time the message was sent.
+ */
+void search_index_add(search_index_t *idx, const char *user, const char *text, size_t len, time_t when);
+
+/**
+ * @brief Answer a query.
+ * @param idx Index.
+ * @param query Query text after the command word.
+ * @param out Buffer for the reply lines.
+ * @param out_len Size of @p out.
+ * @return Length of the reply.
+ */
+size_t search_index_query(search_index_t *idx, const char *query, char *out, size_t out_len);
+
+/**
+ * @brief Read the index's memory counters.
+ * @param idx Index.
+ * @param stats Filled with the counters.
+ */
+void search_index_stats(const search_index_t *idx, search_stats_t *stats);
+
+/**
+ * @brief Free an index and its history.
+ * @param idx Index.
+ */
+void search_index_destroy(search_index_t *idx);
+
+/**
+ * @brief Start the search worker thread.
+ * @return Eventfd that becomes readable when query results are ready.
+ */
+int search_start(void);
+
+/**
+ * @brief Queue a relayed message for indexing.
+ * @param user Sender's name.
+ * @param payload Message bytes.
+ * @param payload_cnt Number of buffers.
+ * @return 0 on success, -1 if the queue is full and the message was skipped.
+ */
+int search_submit_message(const char *user, const struct iovec *payload, int payload_cnt);
+
+/**
+ * @brief Queue a query.
+ * @param slot Client slot to answer.
+ * @param client_id Connection number of that client.
+ * @param query Query text after the command word.
+ * @param len Query length.
+ * @return 0 on success, -1 if the queue is full.
+ */
+int search_submit_query(int slot, uint64_t client_id, const char *query, size_t len);
+
+/**
+ * @brief Take all finished query results.
+ * @return List linked through next, or NULL.
+ */
+search_result_t *search_reap(void);
+
+/**
+ * @brief Free a result from search_reap().
+ * @param result Result.
+ */
+void search_result_free(search_result_t *result);
+
+/**
+ * @brief Print the worker's index counters.
+ * @param out Output stream.
+ */
+void search_print_stats(FILE *out);
+
+#endif // SEARCH_H
@@ -117,12 +117,13 @@ int accept_new_client(int master_socket, struct sockaddr_in *address, int *clien
     return new_socket;
 }
 
-// Handle TCP messages from clients
-void handle_client_messages(int *client_socket, int *num_clients) {
+// Handle TCP messages from clients that select() reported readable
+void handle_client_messages(int *client_socket, int *num_clients, fd_set *readfds, int start) {
     char buffer[BUFFER_SIZE + 1];
-    for (int i = 0; i < MAX_CLIENTS; i++) {
+    for (int k = 0; k < MAX_CLIENTS; k++) {
+        int i = (start + k) % MAX_CLIENTS;
         int sd = client_socket[i];
-        if (sd > 0) {
+        if (sd > 0 && FD_ISSET(sd, readfds)) {
             int valread = recv(sd, buffer, BUFFER_SIZE, MSG_DONTWAIT);
             if (valread == 0) {
                 char client_addr[30];
@@ -166,9 +167,9 @@ void broadcast_discovery(int discovery_socket, struct sockaddr_in *broadcast_add
 void server_loop(int master_socket, int discovery_socket, struct sockaddr_in *address, struct sockaddr_in *broadcast_addr) {
     int client_socket[MAX_CLIENTS] = {0};
     int num_clients = 0;
+    int start = 0;
     fd_set readfds;
     struct timeval timeout;
-    int addrlen = sizeof(*address);
     puts("Waiting for connections ...");
     while (1) {
         FD_ZERO(&readfds);
@@ -188,14 +189,13 @@ void server_loop(int master_socket, int discovery_socket, struct sockaddr_in *ad
         if ((activity < 0) && (errno != EINTR)) {
             printf("select error");
         }
-        if (FD_ISSET(master_socket, &readfds)) {
+        if (activity > 0 && FD_ISSET(master_socket, &readfds)) {
             accept_new_client(master_socket, address, client_socket, &num_clients);
         }
-        for (int i = 0; i < MAX_CLIENTS; i++) {
-            int sd = client_socket[i];
-            if (sd > 0 && FD_ISSET(sd, &readfds)) {
-                handle_client_messages(client_socket, &num_clients);
-            }
+        if (activity > 0) {
+            // One read per ready client per pass, starting one slot further each time
+            handle_client_messages(client_socket, &num_clients, &readfds, start);
+            start = (start + 1) % MAX_CLIENTS;
         }
         if (activity == 0) {
             broadcast_discovery(discovery_socket, broadcast_addr);
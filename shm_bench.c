@@ -0,0 +1,197 @@
+/**
+ * @file shm_bench.c
+ * @brief Compare loopback TCP and the shared-memory transport end to end.
+ *
+ * Starts ./chat_server with a local socket, logs in two clients over each
+ * transport and bounces a message between them through the server. Reports
+ * one-way latency percentiles and CPU time (server and clients) per message.
+ *
+ * Usage:
+ * ./shm_bench [round_trips]
+ */
+#include "shm_transport.h"
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TCP_PORT 8888
+#define LOCAL_PATH "/tmp/chat_shm_bench.sock"
+#define BUFFER_SIZE 1024
+
+static pid_t server_pid = 0;
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// CPU seconds used so far by a process, from /proc/<pid>/stat
+static double process_cpu(pid_t pid) {
+    char path[64], buf[1024];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE *f = fopen(path, "r");
+    if (!f) return 0;
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+    char *p = strrchr(buf, ')');
+    unsigned long utime = 0, stime = 0;
+    if (p) sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime);
+    return (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+static double self_cpu(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+static void start_server(void) {
+    server_pid = fork();
+    if (server_pid == 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDOUT_FILENO);
+        execl("./chat_server", "chat_server", "-u", LOCAL_PATH, NULL);
+        perror("Failed to start server");
+        exit(1);
+    } else if (server_pid < 0) {
+        perror("Fork failed");
+        exit(1);
+    }
+    sleep(1);
+}
+
+static void stop_server(void) {
+    if (server_pid > 0) {
+        kill(server_pid, SIGINT);
+        waitpid(server_pid, NULL, 0);
+        server_pid = 0;
+    }
+}
+
+static int tcp_login(const char *username) {
+    struct sockaddr_in addr;
+    char buf[64];
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(TCP_PORT);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("connect");
+        exit(1);
+    }
+    recv(sock, buf, 16, MSG_WAITALL);
+    send(sock, username, strlen(username), 0);
+    recv(sock, buf, 16, MSG_WAITALL);
+    send(sock, "secret", 6, 0);
+    return sock;
+}
+
+static void tcp_drain(int sock) {
+    char buf[BUFFER_SIZE];
+    struct pollfd pfd = {sock, POLLIN, 0};
+    while (poll(&pfd, 1, 200) > 0 && recv(sock, buf, sizeof(buf), 0) > 0) {
+    }
+}
+
+// Blocking receive of one frame from a shared-memory session
+static size_t shm_recv_wait(shm_conn_t *conn, char *buf, size_t cap) {
+    for (;;) {
+        ssize_t len = shm_conn_recv(conn, buf, cap);
+        if (len < 0) {
+            perror("shm_conn_recv");
+            exit(EXIT_FAILURE);
+        }
+        if (len > 0) return len;
+        if (shm_conn_prepare_wait(conn)) {
+            struct pollfd pfd = {conn->rx_efd, POLLIN, 0};
+            poll(&pfd, 1, 1000);
+        }
+    }
+}
+
+static void shm_drain(shm_conn_t *conn) {
+    char buf[BUFFER_SIZE];
+    usleep(200000);
+    while (shm_conn_recv(conn, buf, sizeof(buf)) > 0) {
+    }
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void report(const char *name, double *samples, int n, double server_cpu, double client_cpu) {
+    qsort(samples, n, sizeof(double), cmp_double);
+    printf("%-6s p50 %7.1f us  p99 %7.1f us  server cpu %6.2f us/msg  client cpu %6.2f us/msg\n",
+           name, samples[n / 2], samples[(int)(n * 0.99)],
+           server_cpu * 1e6 / (2.0 * n), client_cpu * 1e6 / (2.0 * n));
+}
+
+static void bench_tcp(int rounds, double *samples) {
+    int a = tcp_login("tcp_a");
+    int b = tcp_login("tcp_b");
+    tcp_drain(a);
+    tcp_drain(b);
+    char buf[BUFFER_SIZE];
+    double server_start = process_cpu(server_pid), client_start = self_cpu();
+    for (int i = 0; i < rounds; i++) {
+        double t0 = now_us();
+        send(a, "ping\n", 5, 0);
+        recv(b, buf, sizeof(buf), 0);
+        send(b, "pong\n", 5, 0);
+        recv(a, buf, sizeof(buf), 0);
+        samples[i] = (now_us() - t0) / 2;
+    }
+    report("tcp", samples, rounds, process_cpu(server_pid) - server_start, self_cpu() - client_start);
+    close(a);
+    close(b);
+}
+
+static void bench_shm(int rounds, double *samples) {
+    shm_conn_t *a = shm_conn_connect(LOCAL_PATH, "shm_a", "secret");
+    shm_conn_t *b = shm_conn_connect(LOCAL_PATH, "shm_b", "secret");
+    if (!a || !b) {
+        fprintf(stderr, "shared-memory login failed\n");
+        return;
+    }
+    shm_drain(a);
+    shm_drain(b);
+    char buf[BUFFER_SIZE];
+    double server_start = process_cpu(server_pid), client_start = self_cpu();
+    for (int i = 0; i < rounds; i++) {
+        double t0 = now_us();
+        shm_conn_send(a, "ping\n", 5);
+        shm_recv_wait(b, buf, sizeof(buf));
+        shm_conn_send(b, "pong\n", 5);
+        shm_recv_wait(a, buf, sizeof(buf));
+        samples[i] = (now_us() - t0) / 2;
+    }
+    report("shm", samples, rounds, process_cpu(server_pid) - server_start, self_cpu() - client_start);
+    shm_conn_close(a);
+    shm_conn_close(b);
+}
+
+int main(int argc, char *argv[]) {
+    int rounds = 20000;
+    if (argc > 1) rounds = atoi(argv[1]);
+    if (rounds < 1) rounds = 1;
+    double *samples = malloc(sizeof(double) * rounds);
+    start_server();
+    bench_tcp(rounds, samples);
+    bench_shm(rounds, samples);
+    stop_server();
+    free(samples);
+    return 0;
+}
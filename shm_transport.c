@@ -0,0 +1,289 @@
+/**
+ * @file shm_transport.c
+ * @brief Shared-memory ring transport implementation.
+ */
+#define _GNU_SOURCE
+#include "shm_transport.h"
+#include "auth.h"
+#include "pool.h"
+#include <errno.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define SHM_MAGIC "SHM1"
+
+/*
+ * Frames are stored as a 4-byte length followed by the payload and may wrap
+ * around the end of data[]. head and tail are free-running counters; the
+ * producer owns head, the consumer owns tail. waiting is set by the consumer
+ * before it sleeps and cleared by whichever side notices it first.
+ */
+struct shm_ring {
+    alignas(64) _Atomic uint32_t head;
+    alignas(64) _Atomic uint32_t tail;
+    alignas(64) _Atomic uint32_t waiting;
+    alignas(64) char data[SHM_RING_SIZE];
+};
+
+static void ring_copy_in(shm_ring_t *r, uint32_t pos, const void *src, uint32_t len) {
+    uint32_t off = pos % SHM_RING_SIZE;
+    uint32_t first = SHM_RING_SIZE - off < len ? SHM_RING_SIZE - off : len;
+    memcpy(r->data + off, src, first);
+    memcpy(r->data, (const char *)src + first, len - first);
+}
+
+static void ring_copy_out(shm_ring_t *r, uint32_t pos, void *dst, uint32_t len) {
+    uint32_t off = pos % SHM_RING_SIZE;
+    uint32_t first = SHM_RING_SIZE - off < len ? SHM_RING_SIZE - off : len;
+    memcpy(dst, r->data + off, first);
+    memcpy((char *)dst + first, r->data, len - first);
+}
+
+// Returns 1 if the consumer asked to be woken up, 0 if not, -1 if full
+static int ring_push(shm_ring_t *r, const struct iovec *iov, int iovcnt) {
+    uint32_t len = 0;
+    for (int i = 0; i < iovcnt; i++) len += iov[i].iov_len;
+    uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+    if (SHM_RING_SIZE - (head - tail) < sizeof(uint32_t) + len) return -1;
+    ring_copy_in(r, head, &len, sizeof(len));
+    uint32_t pos = head + sizeof(len);
+    for (int i = 0; i < iovcnt; i++) {
+        ring_copy_in(r, pos, iov[i].iov_base, iov[i].iov_len);
+        pos += iov[i].iov_len;
+    }
+    atomic_store_explicit(&r->head, head + sizeof(len) + len, memory_order_release);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&r->waiting, memory_order_relaxed) &&
+        atomic_exchange_explicit(&r->waiting, 0, memory_order_acq_rel)) {
+        return 1;
+    }
+    return 0;
+}
+
+// Returns the frame length, 0 if empty, -1 if head or the length cannot be right
+static ssize_t ring_pop(shm_ring_t *r, void *buf, size_t cap) {
+    uint32_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+    if (head == tail) return 0;
+    uint32_t used = head - tail;
+    if (used > SHM_RING_SIZE || used < sizeof(uint32_t)) return -1;
+    uint32_t len;
+    ring_copy_out(r, tail, &len, sizeof(len));
+    if (len > used - sizeof(len)) return -1;
+    ring_copy_out(r, tail + sizeof(len), buf, len < cap ? len : (uint32_t)cap);
+    atomic_store_explicit(&r->tail, tail + sizeof(len) + len, memory_order_release);
+    return len < cap ? (ssize_t)len : (ssize_t)cap;
+}
+
+static shm_conn_t *conn_map(int sock, int memfd, int efd_to_server, int efd_to_client, int server_side) {
+    size_t map_len = 2 * sizeof(shm_ring_t);
+    void *map = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+    shm_conn_t *conn = pool_calloc(sizeof(*conn));
+    if (!conn) {
+        munmap(map, map_len);
+        return NULL;
+    }
+    shm_ring_t *to_server = map;
+    shm_ring_t *to_client = to_server + 1;
+    conn->sock = sock;
+    conn->map = map;
+    conn->map_len = map_len;
+    conn->rx = server_side ? to_server : to_client;
+    conn->tx = server_side ? to_client : to_server;
+    conn->rx_efd = server_side ? efd_to_server : efd_to_client;
+    conn->tx_efd = server_side ? efd_to_client : efd_to_server;
+    return conn;
+}
+
+int setup_shm_listener(const char *path) {
+    struct sockaddr_un addr;
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0) {
+        perror("Unix socket failed");
+        exit(EXIT_FAILURE);
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    unlink(path);
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("Unix bind failed");
+        exit(EXIT_FAILURE);
+    }
+    if (listen(sock, 64) < 0) {
+        perror("Unix listen");
+        exit(EXIT_FAILURE);
+    }
+    printf("Local shared-memory clients accepted on %s\n", path);
+    return sock;
+}
+
+shm_conn_t *shm_conn_offer(int sock) {
+    int memfd = memfd_create("chat-shm", MFD_CLOEXEC);
+    if (memfd < 0) {
+        perror("memfd_create");
+        return NULL;
+    }
+    int efd_to_server = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    int efd_to_client = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    shm_conn_t *conn = NULL;
+    if (efd_to_server < 0 || efd_to_client < 0 || ftruncate(memfd, 2 * sizeof(shm_ring_t)) < 0) {
+        perror("shm setup");
+        goto fail;
+    }
+    conn = conn_map(sock, memfd, efd_to_server, efd_to_client, 1);
+    if (!conn) goto fail;
+    // Both sides start out idle, so the first frame in either ring signals
+    atomic_store(&conn->rx->waiting, 1);
+    atomic_store(&conn->tx->waiting, 1);
+
+    char hello[8];
+    uint32_t ring_size = SHM_RING_SIZE;
+    memcpy(hello, SHM_MAGIC, 4);
+    memcpy(hello + 4, &ring_size, sizeof(ring_size));
+    int fds[3] = {memfd, efd_to_server, efd_to_client};
+    char control[CMSG_SPACE(sizeof(fds))];
+    struct iovec iov = {hello, sizeof(hello)};
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    if (sendmsg(sock, &msg, MSG_NOSIGNAL) != sizeof(hello)) {
+        perror("sendmsg SCM_RIGHTS");
+        munmap(conn->map, conn->map_len);
+        pool_free(conn, sizeof(*conn));
+        conn = NULL;
+        goto fail;
+    }
+    close(memfd);
+    return conn;
+
+fail:
+    if (efd_to_server >= 0) close(efd_to_server);
+    if (efd_to_client >= 0) close(efd_to_client);
+    close(memfd);
+    return NULL;
+}
+
+// Read one login prompt, which always ends in ": "
+static int read_prompt(int sock) {
+    char c, prev = 0;
+    while (recv(sock, &c, 1, 0) == 1) {
+        if (prev == ':' && c == ' ') return 0;
+        prev = c;
+    }
+    return -1;
+}
+
+shm_conn_t *shm_conn_connect(const char *path, const char *username, const char *password) {
+    struct sockaddr_un addr;
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0) return NULL;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) goto fail;
+
+    if (read_prompt(sock) < 0) goto fail;
+    send(sock, username, strnlen(username, USERNAME_MAX_LEN - 1), 0);
+    if (read_prompt(sock) < 0) goto fail;
+    send(sock, password, strnlen(password, PASSWORD_MAX_LEN - 1), 0);
+
+    char hello[8];
+    int fds[3];
+    char control[CMSG_SPACE(sizeof(fds))];
+    struct iovec iov = {hello, sizeof(hello)};
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != sizeof(hello) || memcmp(hello, SHM_MAGIC, 4) != 0) goto fail;
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) goto fail;
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    uint32_t ring_size;
+    memcpy(&ring_size, hello + 4, sizeof(ring_size));
+    shm_conn_t *conn = ring_size == SHM_RING_SIZE ? conn_map(sock, fds[0], fds[1], fds[2], 0) : NULL;
+    close(fds[0]);
+    if (!conn) {
+        close(fds[1]);
+        close(fds[2]);
+        goto fail;
+    }
+    return conn;
+
+fail:
+    close(sock);
+    return NULL;
+}
+
+void shm_conn_close(shm_conn_t *conn) {
+    munmap(conn->map, conn->map_len);
+    close(conn->rx_efd);
+    close(conn->tx_efd);
+    close(conn->sock);
+    pool_free(conn, sizeof(*conn));
+}
+
+ssize_t shm_conn_send(shm_conn_t *conn, const void *buf, size_t len) {
+    struct iovec iov = {(void *)buf, len};
+    return shm_conn_sendv(conn, &iov, 1);
+}
+
+ssize_t shm_conn_sendv(shm_conn_t *conn, const struct iovec *iov, int iovcnt) {
+    int rc = ring_push(conn->tx, iov, iovcnt);
+    if (rc < 0) {
+        conn->dropped++;
+        errno = EAGAIN;
+        return -1;
+    }
+    if (rc > 0) {
+        uint64_t one = 1;
+        if (write(conn->tx_efd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            perror("eventfd write");
+        }
+    }
+    ssize_t len = 0;
+    for (int i = 0; i < iovcnt; i++) len += iov[i].iov_len;
+    return len;
+}
+
+ssize_t shm_conn_recv(shm_conn_t *conn, void *buf, size_t cap) {
+    ssize_t len = ring_pop(conn->rx, buf, cap);
+    if (len < 0) errno = EPROTO;
+    return len;
+}
+
+int shm_conn_prepare_wait(shm_conn_t *conn) {
+    uint64_t count;
+    if (read(conn->rx_efd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        perror("eventfd read");
+    }
+    atomic_store(&conn->rx->waiting, 1);
+    if (atomic_load(&conn->rx->head) != atomic_load_explicit(&conn->rx->tail, memory_order_relaxed)) {
+        atomic_store(&conn->rx->waiting, 0);
+        return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,119 @@
+/**
+ * @file shm_transport.h
+ * @brief Shared-memory ring transport for clients on the same host.
+ *
+ * A local client connects over a Unix domain socket and logs in with the
+ * usual prompts. The server then passes it a memfd holding two
+ * single-producer/single-consumer rings (one per direction) and two eventfds
+ * via SCM_RIGHTS. From then on chat frames travel through shared memory; an
+ * eventfd is only written when the consumer of a ring has drained it and
+ * declared that it is going to sleep, so a busy stream needs no syscalls.
+ *
+ * The Unix socket stays open for the lifetime of the session and is used to
+ * detect disconnects.
+ */
+#ifndef SHM_TRANSPORT_H
+#define SHM_TRANSPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#define SHM_RING_SIZE (256 * 1024)
+
+typedef struct shm_ring shm_ring_t;
+
+/**
+ * @brief One side of a shared-memory session.
+ */
+typedef struct {
+    int sock;          /**< Unix domain socket used for setup and hangup detection. */
+    int rx_efd;        /**< Eventfd signalled when rx has data after being drained. */
+    int tx_efd;        /**< Eventfd to signal the peer when tx goes non-empty. */
+    shm_ring_t *rx;    /**< Ring this side consumes. */
+    shm_ring_t *tx;    /**< Ring this side produces into. */
+    void *map;         /**< Base of the shared mapping. */
+    size_t map_len;    /**< Length of the shared mapping. */
+    uint64_t dropped;  /**< Frames refused because tx was full. */
+} shm_conn_t;
+
+/**
+ * @brief Create the Unix domain socket that local clients connect to.
+ * @param path Filesystem path of the socket (an existing file is replaced).
+ * @return Listening socket file descriptor.
+ */
+int setup_shm_listener(const char *path);
+
+/**
+ * @brief Set up shared memory for an accepted, authenticated local client.
+ *
+ * Creates the memfd and eventfds and hands them to the client.
+ *
+ * @param sock Accepted Unix domain socket.
+ * @return New session (server side), or NULL on failure.
+ */
+shm_conn_t *shm_conn_offer(int sock);
+
+/**
+ * @brief Connect to a server's local socket, log in and map the rings.
+ * @param path Filesystem path of the server's Unix domain socket.
+ * @param username Username to log in with.
+ * @param password Password to log in with.
+ * @return New session (client side), or NULL on failure.
+ */
+shm_conn_t *shm_conn_connect(const char *path, const char *username, const char *password);
+
+/**
+ * @brief Unmap and close everything belonging to a session.
+ * @param conn Session to destroy.
+ */
+void shm_conn_close(shm_conn_t *conn);
+
+/**
+ * @brief Queue one frame for the peer.
+ * @param conn Session.
+ * @param buf Frame bytes.
+ * @param len Frame length.
+ * @return len on success, -1 with errno set to EAGAIN if the ring is full.
+ */
+ssize_t shm_conn_send(shm_conn_t *conn, const void *buf, size_t len);
+
+/**
+ * @brief Queue one frame gathered from several buffers.
+ * @param conn Session.
+ * @param iov Buffers making up the frame.
+ * @param iovcnt Number of buffers.
+ * @return Frame length on success, -1 with errno set to EAGAIN if the ring is
+ *         full; the frame is then counted in conn->dropped.
+ */
+ssize_t shm_conn_sendv(shm_conn_t *conn, const struct iovec *iov, int iovcnt);
+
+/**
+ * @brief Take the next frame from the peer without blocking.
+ *
+ * Frames longer than cap are truncated. The ring lives in memory the peer
+ * can write, so a frame header that does not fit in what the peer has
+ * published is refused and the session should be dropped.
+ *
+ * @param conn Session.
+ * @param buf Buffer for the frame.
+ * @param cap Size of the buffer.
+ * @return Frame length, 0 if the ring is empty, or -1 with errno set to
+ *         EPROTO if the ring is corrupt.
+ */
+ssize_t shm_conn_recv(shm_conn_t *conn, void *buf, size_t cap);
+
+/**
+ * @brief Prepare to sleep on rx_efd once shm_conn_recv() returned 0.
+ *
+ * Consumes any pending eventfd count and tells the peer to signal on its
+ * next frame.
+ *
+ * @param conn Session.
+ * @return 1 if the ring is still empty and it is safe to wait on rx_efd, 0 if
+ *         data arrived meanwhile.
+ */
+int shm_conn_prepare_wait(shm_conn_t *conn);
+
+#endif // SHM_TRANSPORT_H
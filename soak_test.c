@@ -0,0 +1,531 @@
+/**
+ * @file soak_test.c
+ * @brief Long-running soak test: churn load against ./chat_server and watch for leaks and drift.
+ *
+ * Starts ./chat_server with offline mailboxes and a content filter in a
+ * scratch directory, then keeps a population of simulated users churning
+ * for the whole run. Each one connects, logs in under one of a pool of
+ * recurring names, sends a random number of room messages of random size
+ * (16 bytes to 16 KB), direct messages (to online and offline users),
+ * searches and filtered words, then disconnects. Some give up halfway
+ * through the login. A separate probe client stays connected and sends
+ * "/ping" every 50 ms; its round trip is the latency sample.
+ *
+ * Every interval the server's RSS and open file descriptors are read from
+ * /proc and printed with the probe's p50/p99. At the end the load stops and
+ * the test fails if:
+ *  - the server exited;
+ *  - open descriptors did not return to where they were before any client
+ *    connected;
+ *  - RSS kept growing after the warm-up (-w, default 60 s) by more than -R KB
+ *    per minute;
+ *  - p99 latency in the last third of the run exceeds the first third by
+ *    more than -L percent (and by at least 2 ms).
+ *
+ * Usage:
+ * ./soak_test [-d seconds] [-i interval_secs] [-c clients] [-w warmup_secs] [-R rss_kb_per_min] [-L latency_drift_pct]
+ *             [-- chat_server options...]
+ */
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TCP_PORT 8888
+#define MAX_USERS 1024
+#define MAX_INTERVALS 100000
+#define MAX_PINGS 4096
+#define PROMPT_LEN 16
+#define PING_INTERVAL_US 50000.0
+#define LATENCY_FLOOR_US 2000.0
+#define SETTLE_SECS 3
+#define BANNED_WORD "soakbanned"
+
+enum { CONNECTING, WAIT_USER_PROMPT, WAIT_PASS_PROMPT, WAIT_ONLINE, ACTIVE };
+
+/**
+ * @brief One simulated user.
+ */
+typedef struct {
+    int fd;             /**< Socket, -1 between sessions. */
+    int state;
+    int prompt_bytes;   /**< Login prompt bytes received so far. */
+    int actions_left;   /**< Messages to send before leaving. */
+    int quit_at;        /**< Leave at this state instead (abandoned login), or -1. */
+    int name;           /**< Index into the name pool. */
+    double next_us;     /**< When the next action is due. */
+} user_t;
+
+/**
+ * @brief One sampling interval.
+ */
+typedef struct {
+    double t;           /**< Seconds since the load started. */
+    long rss_kb, fds;
+    double p50_us, p99_us;
+    int pings;
+} sample_t;
+
+static pid_t server_pid = 0;
+static user_t users[MAX_USERS];
+static sample_t samples[MAX_INTERVALS];
+static double pings[MAX_PINGS];
+static int num_pings = 0;
+static unsigned long long sessions = 0, abandoned = 0, messages = 0, bytes_sent = 0;
+static int epfd;
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void start_server(char **server_args) {
+    server_pid = fork();
+    if (server_pid == 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDOUT_FILENO);
+        execv("./chat_server", server_args);
+        perror("Failed to start server");
+        exit(1);
+    } else if (server_pid < 0) {
+        perror("Fork failed");
+        exit(1);
+    }
+    sleep(1);
+}
+
+static int server_alive(void) {
+    return server_pid > 0 && waitpid(server_pid, NULL, WNOHANG) == 0;
+}
+
+static void stop_server(void) {
+    if (server_pid > 0) {
+        kill(server_pid, SIGINT);
+        waitpid(server_pid, NULL, 0);
+        server_pid = 0;
+    }
+}
+
+static long rss_kb(pid_t pid) {
+    char path[64], line[256];
+    long kb = -1;
+    snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "VmRSS: %ld", &kb) == 1) break;
+    }
+    fclose(f);
+    return kb;
+}
+
+static long open_fds(pid_t pid) {
+    char path[64];
+    long n = 0;
+    snprintf(path, sizeof(path), "/proc/%d/fd", (int)pid);
+    DIR *d = opendir(path);
+    if (!d) return -1;
+    for (struct dirent *e; (e = readdir(d));) {
+        if (e->d_name[0] != '.') n++;
+    }
+    closedir(d);
+    return n;
+}
+
+static int tcp_connect(void) {
+    struct sockaddr_in addr = {0};
+    int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (sock < 0) return -1;
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(TCP_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+static double rand_unit(void) {
+    return rand() / (RAND_MAX + 1.0);
+}
+
+// Message size between 16 bytes and 16 KB, most of them short
+static size_t rand_size(void) {
+    return (size_t)(16 << (int)(rand_unit() * 11)) + rand() % 16;
+}
+
+static void end_session(int i) {
+    user_t *u = &users[i];
+    if (u->fd >= 0) {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, u->fd, NULL);
+        close(u->fd);
+    }
+    u->fd = -1;
+    // Come back a little later as someone from the pool
+    u->next_us = now_us() + rand_unit() * 200000;
+}
+
+static void start_session(int i, int num_names) {
+    user_t *u = &users[i];
+    u->fd = tcp_connect();
+    u->state = CONNECTING;
+    u->prompt_bytes = 0;
+    u->name = rand() % num_names;
+    u->actions_left = 1 + rand() % 50;
+    double r = rand_unit();
+    u->quit_at = r < 0.03 ? WAIT_USER_PROMPT : r < 0.06 ? WAIT_PASS_PROMPT : -1;
+    if (u->fd < 0) {
+        end_session(i);
+        return;
+    }
+    struct epoll_event ev = {.events = EPOLLIN, .data.u32 = i};
+    epoll_ctl(epfd, EPOLL_CTL_ADD, u->fd, &ev);
+    u->state = WAIT_USER_PROMPT;
+    sessions++;
+}
+
+static void send_text(user_t *u, const char *text, size_t len) {
+    ssize_t n = send(u->fd, text, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (n > 0) bytes_sent += n;
+    messages++;
+}
+
+// One message from an active user: room message, direct message, search or filtered word
+static void user_action(int i, int num_names) {
+    static char buf[16400];
+    user_t *u = &users[i];
+    double r = rand_unit();
+    int len;
+    if (r < 0.70) {
+        size_t size = rand_size();
+        memset(buf, 'a' + rand() % 26, size);
+        buf[size - 1] = '\n';
+        len = (int)size;
+    } else if (r < 0.85) {
+        len = snprintf(buf, sizeof(buf), "/msg soak%d soak test direct message\n", rand() % num_names);
+    } else if (r < 0.95) {
+        len = snprintf(buf, sizeof(buf), "/search %c%c\n", 'a' + rand() % 26, 'a' + rand() % 26);
+    } else {
+        len = snprintf(buf, sizeof(buf), "this line has a %s word\n", BANNED_WORD);
+    }
+    send_text(u, buf, len);
+    if (--u->actions_left <= 0) {
+        end_session(i);
+    } else {
+        u->next_us = now_us() + rand_unit() * 100000;
+    }
+}
+
+// Read what a user has been sent and advance its login
+static void user_input(int i) {
+    static char buf[65536];
+    user_t *u = &users[i];
+    ssize_t r;
+    while ((r = recv(u->fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+        if (u->state == ACTIVE) continue;
+        if (u->state == WAIT_ONLINE) {
+            u->state = ACTIVE;
+            u->next_us = now_us();
+            continue;
+        }
+        u->prompt_bytes += r;
+        if (u->state == WAIT_USER_PROMPT && u->prompt_bytes >= PROMPT_LEN) {
+            if (u->quit_at == WAIT_USER_PROMPT) {
+                abandoned++;
+                end_session(i);
+                return;
+            }
+            char name[32];
+            int len = snprintf(name, sizeof(name), "soak%d", u->name);
+            send(u->fd, name, len, MSG_NOSIGNAL);
+            u->state = WAIT_PASS_PROMPT;
+        }
+        if (u->state == WAIT_PASS_PROMPT && u->prompt_bytes >= 2 * PROMPT_LEN) {
+            if (u->quit_at == WAIT_PASS_PROMPT) {
+                abandoned++;
+                end_session(i);
+                return;
+            }
+            send(u->fd, "secret", 6, MSG_NOSIGNAL);
+            u->state = WAIT_ONLINE;
+        }
+    }
+    if (r == 0 || (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) end_session(i);
+}
+
+/**
+ * @brief The latency probe: a logged-in client that pings and picks PONG lines out of its stream.
+ */
+typedef struct {
+    int fd;
+    int at_line_start;
+    char pong[32];
+    int pong_len;       /**< Bytes of a PONG line collected, -1 when not in one. */
+} probe_t;
+
+static int probe_login(probe_t *p) {
+    char buf[256];
+    p->fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(TCP_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int one = 1;
+    if (p->fd < 0) return -1;
+    setsockopt(p->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(p->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) return -1;
+    if (recv(p->fd, buf, PROMPT_LEN, MSG_WAITALL) != PROMPT_LEN) return -1;
+    send(p->fd, "probe", 5, 0);
+    if (recv(p->fd, buf, PROMPT_LEN, MSG_WAITALL) != PROMPT_LEN) return -1;
+    send(p->fd, "secret", 6, 0);
+    if (recv(p->fd, buf, sizeof(buf), 0) <= 0) return -1;
+    fcntl(p->fd, F_SETFL, O_NONBLOCK);
+    p->at_line_start = 1;
+    p->pong_len = -1;
+    return 0;
+}
+
+static int probe_input(probe_t *p) {
+    static char buf[65536];
+    ssize_t r;
+    while ((r = recv(p->fd, buf, sizeof(buf), 0)) > 0) {
+        double arrived = now_us();
+        for (ssize_t i = 0; i < r; i++) {
+            char ch = buf[i];
+            if (p->pong_len >= 0) {
+                if (ch == '\n') {
+                    p->pong[p->pong_len] = '\0';
+                    if (num_pings < MAX_PINGS) pings[num_pings++] = arrived - atof(p->pong + 5);
+                    p->pong_len = -1;
+                } else if (p->pong_len < (int)sizeof(p->pong) - 1) {
+                    p->pong[p->pong_len++] = ch;
+                }
+                if (p->pong_len > 0 && p->pong_len <= 5 && memcmp(p->pong, "PONG ", p->pong_len) != 0) p->pong_len = -1;
+            } else if (p->at_line_start && ch == 'P') {
+                p->pong_len = 0;
+                p->pong[p->pong_len++] = ch;
+            }
+            p->at_line_start = ch == '\n';
+        }
+    }
+    return r == 0 || (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK) ? -1 : 0;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void take_sample(sample_t *s, double t) {
+    s->t = t;
+    s->rss_kb = rss_kb(server_pid);
+    s->fds = open_fds(server_pid);
+    s->pings = num_pings;
+    s->p50_us = s->p99_us = 0;
+    if (num_pings > 0) {
+        qsort(pings, num_pings, sizeof(double), cmp_double);
+        s->p50_us = pings[num_pings / 2];
+        s->p99_us = pings[num_pings * 99 / 100];
+    }
+    num_pings = 0;
+    printf("%7.0f s  rss %7ld KB  fds %5ld  ping p50 %7.2f ms  p99 %7.2f ms  sessions %llu  messages %llu\n", t,
+           s->rss_kb, s->fds, s->p50_us / 1000, s->p99_us / 1000, sessions, messages);
+    fflush(stdout);
+}
+
+// Least-squares slope of RSS in KB per minute over samples [from, to)
+static double rss_slope(int from, int to) {
+    double n = to - from, st = 0, sr = 0, stt = 0, str = 0;
+    for (int i = from; i < to; i++) {
+        double t = samples[i].t / 60;
+        st += t;
+        sr += samples[i].rss_kb;
+        stt += t * t;
+        str += t * samples[i].rss_kb;
+    }
+    double den = n * stt - st * st;
+    return n < 2 || den == 0 ? 0 : (n * str - st * sr) / den;
+}
+
+static double mean_p99(int from, int to) {
+    double sum = 0;
+    int n = 0;
+    for (int i = from; i < to; i++) {
+        if (samples[i].pings == 0) continue;
+        sum += samples[i].p99_us;
+        n++;
+    }
+    return n ? sum / n : 0;
+}
+
+int main(int argc, char *argv[]) {
+    double duration = 600, interval = 10, warmup = 60, rss_limit = 1024, drift_pct = 100;
+    int num_users = 64, opt;
+    while ((opt = getopt(argc, argv, "d:i:c:w:R:L:")) != -1) {
+        switch (opt) {
+        case 'd':
+            duration = atof(optarg);
+            break;
+        case 'i':
+            interval = atof(optarg);
+            break;
+        case 'c':
+            num_users = atoi(optarg);
+            break;
+        case 'w':
+            warmup = atof(optarg);
+            break;
+        case 'R':
+            rss_limit = atof(optarg);
+            break;
+        case 'L':
+            drift_pct = atof(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-d seconds] [-i interval_secs] [-c clients] [-w warmup_secs] [-R rss_kb_per_min] [-L latency_drift_pct]"
+                            " [-- chat_server options...]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (num_users < 1) num_users = 1;
+    if (num_users > MAX_USERS) num_users = MAX_USERS;
+    if (interval <= 0) interval = 1;
+    int num_names = num_users * 2;
+    signal(SIGPIPE, SIG_IGN);
+    srand(1);
+
+    // Scratch directory for the mailboxes and the filter's pattern file
+    char dir[] = "/tmp/soak-XXXXXX", mail_dir[64], patterns[64];
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    snprintf(mail_dir, sizeof(mail_dir), "%s/mail", dir);
+    snprintf(patterns, sizeof(patterns), "%s/patterns", dir);
+    mkdir(mail_dir, 0700);
+    FILE *pf = fopen(patterns, "w");
+    if (!pf) {
+        perror(patterns);
+        return 1;
+    }
+    fprintf(pf, "drop %s\nmask soakmasked\n", BANNED_WORD);
+    fclose(pf);
+    char *server_args[32] = {"chat_server", "-m", mail_dir, "-f", patterns};
+    for (int i = optind, k = 5; i < argc && k < 31; i++) server_args[k++] = argv[i];
+
+    start_server(server_args);
+    long base_fds = open_fds(server_pid);
+    printf("soak: %d clients for %.0f s, sampling every %.0f s; server started with %ld fds\n", num_users, duration,
+           interval, base_fds);
+    probe_t probe;
+    if (probe_login(&probe) < 0) {
+        perror("probe login");
+        stop_server();
+        return 1;
+    }
+    epfd = epoll_create1(0);
+    for (int i = 0; i < num_users; i++) {
+        users[i].fd = -1;
+        users[i].next_us = 0;
+    }
+
+    struct epoll_event events[256];
+    int num_samples = 0, failed = 0;
+    double start = now_us(), next_sample = start + interval * 1e6, last_ping = 0;
+    while (now_us() - start < duration * 1e6) {
+        double now = now_us();
+        if (now - last_ping >= PING_INTERVAL_US) {
+            char cmd[64];
+            int n = snprintf(cmd, sizeof(cmd), "/ping %.0f\n", now);
+            send(probe.fd, cmd, n, MSG_NOSIGNAL);
+            last_ping = now;
+        }
+        for (int i = 0; i < num_users; i++) {
+            user_t *u = &users[i];
+            if (u->fd < 0 && now >= u->next_us) {
+                start_session(i, num_names);
+            } else if (u->fd >= 0 && u->state == ACTIVE && now >= u->next_us) {
+                user_action(i, num_names);
+            }
+        }
+        if (probe_input(&probe) < 0) {
+            printf("FAIL: the probe client was disconnected\n");
+            failed = 1;
+            break;
+        }
+        int n = epoll_wait(epfd, events, 256, 1);
+        for (int k = 0; k < n; k++) user_input((int)events[k].data.u32);
+        if (now_us() >= next_sample) {
+            if (!server_alive()) {
+                printf("FAIL: the server exited\n");
+                failed = 1;
+                break;
+            }
+            if (num_samples < MAX_INTERVALS) take_sample(&samples[num_samples++], (now_us() - start) / 1e6);
+            next_sample += interval * 1e6;
+        }
+    }
+
+    // Stop the load and let the server clean up after everyone
+    for (int i = 0; i < num_users; i++) {
+        if (users[i].fd >= 0) end_session(i);
+    }
+    close(probe.fd);
+    sleep(SETTLE_SECS);
+    if (!failed && !server_alive()) {
+        printf("FAIL: the server exited\n");
+        failed = 1;
+    }
+    if (!failed) {
+        long end_fds = open_fds(server_pid);
+        long end_rss = rss_kb(server_pid);
+        printf("after the load: %ld fds (%ld at start), rss %ld KB; %llu sessions, %llu abandoned logins, "
+               "%llu messages, %.1f MB sent\n", end_fds, base_fds, end_rss, sessions, abandoned, messages,
+               bytes_sent / 1e6);
+        if (end_fds > base_fds) {
+            printf("FAIL: %ld file descriptors leaked\n", end_fds - base_fds);
+            failed = 1;
+        }
+        int warm = 0;
+        while (warm < num_samples && samples[warm].t < warmup) warm++;
+        if (num_samples - warm >= 3) {
+            double slope = rss_slope(warm, num_samples);
+            printf("rss trend after warm-up: %+.0f KB/min (limit %.0f)\n", slope, rss_limit);
+            if (slope > rss_limit) {
+                printf("FAIL: server memory keeps growing\n");
+                failed = 1;
+            }
+            int third = (num_samples - warm) / 3;
+            double early = mean_p99(warm, warm + third), late = mean_p99(num_samples - third, num_samples);
+            printf("ping p99: %.2f ms early, %.2f ms late (limit +%.0f%%)\n", early / 1000, late / 1000, drift_pct);
+            if (late > early * (1 + drift_pct / 100) && late - early > LATENCY_FLOOR_US) {
+                printf("FAIL: latency drifted upwards\n");
+                failed = 1;
+            }
+        } else {
+            printf("too few samples for trends; run longer or sample more often\n");
+        }
+    }
+    stop_server();
+    close(epfd);
+    char cmd[128];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+    if (system(cmd) != 0) fprintf(stderr, "could not remove %s\n", dir);
+    printf("%s\n", failed ? "SOAK FAILED" : "soak passed");
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,170 @@
+/**
+ * @file storm_bench.c
+ * @brief Measure how quickly the server settles after a mass reconnect.
+ *
+ * Starts ./chat_server, logs in a population of clients, then drops every
+ * connection at once and immediately reconnects them all, as happens after
+ * a network blip. Reports the time until every client is logged in again
+ * and no more traffic arrives (time to steady state), and how many bytes
+ * and lines of presence traffic the storm produced.
+ *
+ * Usage:
+ * ./storm_bench [clients] [chat_server options...]
+ */
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TCP_PORT 8888
+#define MAX_BOTS 490
+#define PROMPT_LEN 16
+#define QUIET_MS 500
+
+enum { WAIT_USER_PROMPT, WAIT_PASS_PROMPT, ONLINE };
+
+typedef struct {
+    int fd;
+    int state;
+    size_t prompt_bytes;
+} bot_t;
+
+static pid_t server_pid = 0;
+static bot_t bots[MAX_BOTS];
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void start_server(char **server_args) {
+    server_pid = fork();
+    if (server_pid == 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDOUT_FILENO);
+        execv("./chat_server", server_args);
+        perror("Failed to start server");
+        exit(1);
+    } else if (server_pid < 0) {
+        perror("Fork failed");
+        exit(1);
+    }
+    sleep(1);
+}
+
+static void stop_server(void) {
+    if (server_pid > 0) {
+        kill(server_pid, SIGINT);
+        waitpid(server_pid, NULL, 0);
+        server_pid = 0;
+    }
+}
+
+static void connect_bot(int epfd, int i) {
+    struct sockaddr_in addr;
+    bot_t *b = &bots[i];
+    b->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    b->state = WAIT_USER_PROMPT;
+    b->prompt_bytes = 0;
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(TCP_PORT);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    if (connect(b->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS) {
+        perror("connect");
+        exit(1);
+    }
+    struct epoll_event ev = {.events = EPOLLIN, .data.u32 = i};
+    epoll_ctl(epfd, EPOLL_CTL_ADD, b->fd, &ev);
+}
+
+/*
+ * Answer login prompts and drain traffic until every bot is online and the
+ * server has been quiet for QUIET_MS. Returns the time of the last event.
+ */
+static double run_until_quiet(int epfd, int num_bots, size_t *bytes, size_t *lines) {
+    struct epoll_event events[64];
+    char buf[65536];
+    double last_event = now_ms();
+    int online = 0;
+    for (int i = 0; i < num_bots; i++) {
+        if (bots[i].state == ONLINE) online++;
+    }
+    for (;;) {
+        int n = epoll_wait(epfd, events, 64, 50);
+        double now = now_ms();
+        if (n == 0 && online == num_bots && now - last_event >= QUIET_MS) break;
+        if (n == 0 && now - last_event >= 30000) {
+            fprintf(stderr, "no progress for 30 s (%d/%d online)\n", online, num_bots);
+            break;
+        }
+        for (int k = 0; k < n; k++) {
+            bot_t *b = &bots[events[k].data.u32];
+            ssize_t r = recv(b->fd, buf, sizeof(buf), 0);
+            if (r <= 0) continue;
+            last_event = now;
+            if (b->state != ONLINE) {
+                b->prompt_bytes += r;
+                if (b->state == WAIT_USER_PROMPT && b->prompt_bytes >= PROMPT_LEN) {
+                    char name[32];
+                    int len = snprintf(name, sizeof(name), "bot%d", (int)(b - bots));
+                    send(b->fd, name, len, 0);
+                    b->state = WAIT_PASS_PROMPT;
+                } else if (b->state == WAIT_PASS_PROMPT && b->prompt_bytes >= 2 * PROMPT_LEN) {
+                    send(b->fd, "secret", 6, 0);
+                    b->state = ONLINE;
+                    online++;
+                    // Anything past the prompt is already chat traffic
+                    r = b->prompt_bytes - 2 * PROMPT_LEN;
+                    if (r == 0) continue;
+                } else {
+                    continue;
+                }
+            }
+            *bytes += r;
+            for (ssize_t j = 0; j < r; j++) {
+                if (buf[j] == '\n') (*lines)++;
+            }
+        }
+    }
+    return last_event;
+}
+
+int main(int argc, char *argv[]) {
+    int num_bots = argc > 1 ? atoi(argv[1]) : 240;
+    if (num_bots < 1) num_bots = 1;
+    if (num_bots > MAX_BOTS) num_bots = MAX_BOTS;
+    char *server_args[16] = {"chat_server"};
+    for (int i = 2; i < argc && i < 15; i++) server_args[i - 1] = argv[i];
+    signal(SIGPIPE, SIG_IGN);
+
+    start_server(server_args);
+    int epfd = epoll_create1(0);
+    size_t bytes = 0, lines = 0;
+    double start = now_ms();
+    for (int i = 0; i < num_bots; i++) connect_bot(epfd, i);
+    double end = run_until_quiet(epfd, num_bots, &bytes, &lines);
+    printf("initial login of %d clients: %.0f ms, %zu bytes / %zu lines\n", num_bots, end - start, bytes, lines);
+
+    // Network blip: every connection drops and immediately comes back
+    bytes = lines = 0;
+    start = now_ms();
+    for (int i = 0; i < num_bots; i++) close(bots[i].fd);
+    for (int i = 0; i < num_bots; i++) connect_bot(epfd, i);
+    end = run_until_quiet(epfd, num_bots, &bytes, &lines);
+    printf("reconnect storm of %d clients: %.0f ms to steady state, %zu bytes / %zu lines\n",
+           num_bots, end - start, bytes, lines);
+
+    for (int i = 0; i < num_bots; i++) close(bots[i].fd);
+    close(epfd);
+    stop_server();
+    return 0;
+}
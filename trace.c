@@ -0,0 +1,101 @@
+/**
+ * @file trace.c
+ * @brief Traffic trace writer and loader.
+ */
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TRACE_BUFFER_SIZE (256 * 1024)
+
+static FILE *trace_file = NULL;
+static int64_t last_us = -1;
+
+static void put_varint(uint8_t **p, uint64_t v) {
+    while (v >= 0x80) {
+        *(*p)++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *(*p)++ = (uint8_t)v;
+}
+
+static int get_varint(FILE *f, uint64_t *v) {
+    *v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int c = getc(f);
+        if (c == EOF) return -1;
+        *v |= (uint64_t)(c & 0x7f) << shift;
+        if (!(c & 0x80)) return 0;
+    }
+    return -1;
+}
+
+int trace_open(const char *path) {
+    trace_file = fopen(path, "wb");
+    if (!trace_file) return -1;
+    setvbuf(trace_file, NULL, _IOFBF, TRACE_BUFFER_SIZE);
+    fwrite(TRACE_MAGIC, 1, strlen(TRACE_MAGIC), trace_file);
+    last_us = -1;
+    return 0;
+}
+
+int trace_enabled(void) {
+    return trace_file != NULL;
+}
+
+void trace_record(int kind, int64_t now_us, uint64_t conn, size_t size) {
+    if (!trace_file) return;
+    uint8_t rec[32], *p = rec;
+    if (last_us < 0 || now_us < last_us) last_us = now_us;
+    *p++ = (uint8_t)kind;
+    put_varint(&p, (uint64_t)(now_us - last_us));
+    put_varint(&p, conn);
+    if (kind >= TRACE_MESSAGE) put_varint(&p, size);
+    last_us = now_us;
+    fwrite(rec, 1, p - rec, trace_file);
+}
+
+void trace_flush(void) {
+    if (trace_file) fflush(trace_file);
+}
+
+void trace_close(void) {
+    if (trace_file) fclose(trace_file);
+    trace_file = NULL;
+}
+
+long trace_load(const char *path, trace_event_t **events) {
+    char magic[8];
+    *events = NULL;
+    FILE *f = fopen(path, "rb");
+    if (!f) return -1;
+    if (fread(magic, 1, sizeof(magic), f) != sizeof(magic) || memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0) {
+        fclose(f);
+        return -1;
+    }
+    long n = 0, cap = 0;
+    int64_t t = 0;
+    int kind;
+    // A truncated last record (e.g. the server was killed) just ends the trace
+    while ((kind = getc(f)) != EOF) {
+        uint64_t dt, conn, size = 0;
+        if (kind < TRACE_CONNECT || kind > TRACE_DIRECT) break;
+        if (get_varint(f, &dt) < 0 || get_varint(f, &conn) < 0) break;
+        if (kind >= TRACE_MESSAGE && get_varint(f, &size) < 0) break;
+        if (n == cap) {
+            cap = cap ? cap * 2 : 4096;
+            trace_event_t *grown = realloc(*events, cap * sizeof(trace_event_t));
+            if (!grown) break;
+            *events = grown;
+        }
+        t += dt;
+        (*events)[n].kind = kind;
+        (*events)[n].time_us = t;
+        (*events)[n].conn = conn;
+        (*events)[n].size = (uint32_t)size;
+        n++;
+    }
+    fclose(f);
+    return n;
+}
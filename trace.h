@@ -0,0 +1,80 @@
+/**
+ * @file trace.h
+ * @brief Anonymized capture of inbound traffic, and reading it back.
+ *
+ * A trace records when connections log in and leave and when they send
+ * something, with the size and kind of each message but none of its text
+ * or any usernames. Connections are identified by the server's connection
+ * number. The chat server only has one room, so no room is recorded.
+ *
+ * File format: the 8-byte magic "CHATTRC1", then one record per event:
+ * a kind byte followed by LEB128 varints for the microseconds since the
+ * previous event, the connection number and, for messages, the size.
+ */
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TRACE_MAGIC "CHATTRC1"
+
+enum {
+    TRACE_CONNECT = 1,     /**< Connection logged in. */
+    TRACE_DISCONNECT,      /**< Connection went away. */
+    TRACE_MESSAGE,         /**< Chat message to the room. */
+    TRACE_SEARCH,          /**< "/search" query. */
+    TRACE_DIRECT,          /**< "/msg" direct message. */
+};
+
+/**
+ * @brief One event read from a trace.
+ */
+typedef struct {
+    int kind;              /**< One of the TRACE_* kinds. */
+    int64_t time_us;       /**< Microseconds since the first event. */
+    uint64_t conn;         /**< Connection number. */
+    uint32_t size;         /**< Message size in bytes, 0 for connects and disconnects. */
+} trace_event_t;
+
+/**
+ * @brief Start writing a trace (server side).
+ * @param path Output file, truncated.
+ * @return 0 on success, -1 on error (errno set).
+ */
+int trace_open(const char *path);
+
+/**
+ * @brief Check whether a trace is being written.
+ * @return Non-zero while recording.
+ */
+int trace_enabled(void);
+
+/**
+ * @brief Append an event to the trace; does nothing when not recording.
+ * @param kind TRACE_* kind.
+ * @param now_us Current monotonic time in microseconds.
+ * @param conn Connection number.
+ * @param size Message size, 0 for connects and disconnects.
+ */
+void trace_record(int kind, int64_t now_us, uint64_t conn, size_t size);
+
+/**
+ * @brief Flush buffered events to disk.
+ */
+void trace_flush(void);
+
+/**
+ * @brief Flush and close the trace.
+ */
+void trace_close(void);
+
+/**
+ * @brief Load a whole trace.
+ * @param path Trace file.
+ * @param events Receives a malloc'd array of events to pass to free().
+ * @return Number of events, or -1 if the file cannot be read or is not a trace.
+ */
+long trace_load(const char *path, trace_event_t **events);
+
+#endif // TRACE_H
@@ -0,0 +1,272 @@
+/**
+ * @file trace_replay.c
+ * @brief Re-drive a recorded traffic trace against a chat server.
+ *
+ * Loads a trace written by "chat_server -t <file>" and replays it: every
+ * recorded connection logs in as "r<n>", sends messages of the recorded
+ * sizes and kinds (text is filler, since traces hold none) and hangs up,
+ * all at the recorded times divided by the speed factor, or back to back
+ * with "max". Connections are spread over a few threads, each serving its
+ * share with one epoll set and draining whatever the server sends back.
+ * The run ends once the server has been quiet for 200 ms; the reported time
+ * runs up to the last byte sent or received, so it includes fan-out.
+ *
+ * Usage:
+ * ./trace_replay <trace> [speed|max] [threads] [host] [port]
+ */
+#include "trace.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_THREADS 64
+#define PROMPT_LEN 16
+#define MAX_SIZE 65536
+#define DRAIN_US 200000
+
+typedef struct {
+    int id;
+    int epfd;
+    uint64_t events, connects, failed, messages, skipped;
+    uint64_t bytes_sent, bytes_received;
+    double max_lag_us;
+    double last_activity_us;
+} worker_t;
+
+static trace_event_t *events;
+static long num_events;
+static long num_conns;
+static int *conn_fds;
+static int num_threads = 4;
+static double speed = 1.0;   // 0 = as fast as possible
+static struct sockaddr_in server_addr;
+static double start_us;
+static pthread_barrier_t start_barrier;
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Renumber connections 0..num_conns-1 so they can index conn_fds
+static void densify_connections(void) {
+    uint64_t *ids = malloc(num_events * sizeof(uint64_t));
+    for (long i = 0; i < num_events; i++) ids[i] = events[i].conn;
+    qsort(ids, num_events, sizeof(uint64_t), cmp_u64);
+    num_conns = 0;
+    for (long i = 0; i < num_events; i++) {
+        if (num_conns == 0 || ids[num_conns - 1] != ids[i]) ids[num_conns++] = ids[i];
+    }
+    for (long i = 0; i < num_events; i++) {
+        uint64_t *hit = bsearch(&events[i].conn, ids, num_conns, sizeof(uint64_t), cmp_u64);
+        events[i].conn = hit - ids;
+    }
+    free(ids);
+}
+
+static void drain(worker_t *w, int timeout_ms) {
+    struct epoll_event ev[64];
+    char buf[65536];
+    int n = epoll_wait(w->epfd, ev, 64, timeout_ms);
+    for (int k = 0; k < n; k++) {
+        int fd = ev[k].data.fd;
+        ssize_t r;
+        while ((r = recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+            w->bytes_received += r;
+            w->last_activity_us = now_us();
+        }
+        if (r == 0) epoll_ctl(w->epfd, EPOLL_CTL_DEL, fd, NULL);
+    }
+}
+
+static int login(uint64_t conn) {
+    char buf[64];
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    struct timeval tv = {5, 0};
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    if (connect(sock, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+        close(sock);
+        return -1;
+    }
+    int len = snprintf(buf, sizeof(buf), "r%llu", (unsigned long long)conn);
+    if (recv(sock, buf + 32, PROMPT_LEN, MSG_WAITALL) != PROMPT_LEN || send(sock, buf, len, MSG_NOSIGNAL) != len ||
+        recv(sock, buf + 32, PROMPT_LEN, MSG_WAITALL) != PROMPT_LEN || send(sock, "replay", 6, MSG_NOSIGNAL) != 6) {
+        close(sock);
+        return -1;
+    }
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+    return sock;
+}
+
+// Send without blocking the thread's other connections
+static int send_all(worker_t *w, int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0 && errno != EAGAIN && errno != EINTR) return -1;
+        if (n <= 0) {
+            drain(w, 1);
+            continue;
+        }
+        w->bytes_sent += n;
+        w->last_activity_us = now_us();
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Build a message of exactly size bytes (at least the command) ending in '\n'
+static size_t make_message(char *buf, const trace_event_t *e) {
+    size_t size = e->size < 2 ? 2 : e->size > MAX_SIZE ? MAX_SIZE : e->size;
+    int len;
+    if (e->kind == TRACE_SEARCH) {
+        len = snprintf(buf, MAX_SIZE, "/search replay");
+    } else if (e->kind == TRACE_DIRECT) {
+        len = snprintf(buf, MAX_SIZE, "/msg r%llu ", (unsigned long long)((e->conn + 1) % num_conns));
+    } else {
+        len = snprintf(buf, MAX_SIZE, "replay");
+    }
+    if ((size_t)len + 1 > size) size = len + 1;
+    memset(buf + len, 'x', size - len - 1);
+    if (e->kind == TRACE_SEARCH) memset(buf + len, ' ', size - len - 1);
+    buf[size - 1] = '\n';
+    return size;
+}
+
+static void *replay_thread(void *arg) {
+    worker_t *w = arg;
+    static __thread char msg[MAX_SIZE];
+    w->epfd = epoll_create1(0);
+    pthread_barrier_wait(&start_barrier);
+    for (long i = 0; i < num_events; i++) {
+        const trace_event_t *e = &events[i];
+        if ((long)(e->conn % num_threads) != w->id) continue;
+        if (speed > 0) {
+            double due = start_us + e->time_us / speed;
+            double now;
+            while ((now = now_us()) < due) drain(w, (int)((due - now) / 1000));
+            if (now - due > w->max_lag_us) w->max_lag_us = now - due;
+        }
+        int *fd = &conn_fds[e->conn];
+        w->events++;
+        if (e->kind == TRACE_CONNECT) {
+            if (*fd > 0) close(*fd);
+            *fd = login(e->conn);
+            if (*fd < 0) {
+                w->failed++;
+                *fd = 0;
+                continue;
+            }
+            struct epoll_event ev = {.events = EPOLLIN, .data.fd = *fd};
+            epoll_ctl(w->epfd, EPOLL_CTL_ADD, *fd, &ev);
+            w->connects++;
+        } else if (e->kind == TRACE_DISCONNECT) {
+            if (*fd > 0) close(*fd);
+            *fd = 0;
+        } else if (*fd > 0) {
+            size_t len = make_message(msg, e);
+            if (send_all(w, *fd, msg, len) < 0) {
+                close(*fd);
+                *fd = 0;
+                w->skipped++;
+            } else {
+                w->messages++;
+            }
+        } else {
+            w->skipped++;
+        }
+        if (speed == 0 && (w->events & 63) == 0) drain(w, 0);
+    }
+    // Keep reading until the server has gone quiet
+    w->last_activity_us = now_us();
+    while (now_us() - w->last_activity_us < DRAIN_US) drain(w, 10);
+    for (long c = w->id; c < num_conns; c += num_threads) {
+        if (conn_fds[c] > 0) close(conn_fds[c]);
+    }
+    close(w->epfd);
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <trace> [speed|max] [threads] [host] [port]\n", argv[0]);
+        return 1;
+    }
+    if (argc > 2) speed = strcmp(argv[2], "max") == 0 ? 0 : atof(argv[2]);
+    if (argc > 3) num_threads = atoi(argv[3]);
+    if (num_threads < 1) num_threads = 1;
+    if (num_threads > MAX_THREADS) num_threads = MAX_THREADS;
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = inet_addr(argc > 4 ? argv[4] : "127.0.0.1");
+    server_addr.sin_port = htons(argc > 5 ? atoi(argv[5]) : 8888);
+    signal(SIGPIPE, SIG_IGN);
+
+    num_events = trace_load(argv[1], &events);
+    if (num_events < 0) {
+        fprintf(stderr, "%s: not a readable trace\n", argv[1]);
+        return 1;
+    }
+    if (num_events == 0) {
+        printf("empty trace\n");
+        return 0;
+    }
+    densify_connections();
+    conn_fds = calloc(num_conns, sizeof(int));
+    double span = events[num_events - 1].time_us / 1e6;
+    printf("trace: %ld events, %ld connections over %.2f s; replaying at %s with %d threads\n", num_events, num_conns,
+           span, speed > 0 ? argv[2] : "max speed", num_threads);
+
+    pthread_t threads[MAX_THREADS];
+    worker_t workers[MAX_THREADS];
+    pthread_barrier_init(&start_barrier, NULL, num_threads + 1);
+    memset(workers, 0, sizeof(workers));
+    for (int t = 0; t < num_threads; t++) {
+        workers[t].id = t;
+        pthread_create(&threads[t], NULL, replay_thread, &workers[t]);
+    }
+    start_us = now_us();
+    pthread_barrier_wait(&start_barrier);
+    worker_t total = {0};
+    for (int t = 0; t < num_threads; t++) {
+        pthread_join(threads[t], NULL);
+        total.events += workers[t].events;
+        total.connects += workers[t].connects;
+        total.failed += workers[t].failed;
+        total.messages += workers[t].messages;
+        total.skipped += workers[t].skipped;
+        total.bytes_sent += workers[t].bytes_sent;
+        total.bytes_received += workers[t].bytes_received;
+        if (workers[t].max_lag_us > total.max_lag_us) total.max_lag_us = workers[t].max_lag_us;
+        if (workers[t].last_activity_us > total.last_activity_us) total.last_activity_us = workers[t].last_activity_us;
+    }
+    double elapsed = (total.last_activity_us - start_us) / 1e6;
+    printf("replayed %llu events in %.2f s (%.1fx the trace): %llu logins (%llu failed), %llu messages (%llu skipped)\n",
+           (unsigned long long)total.events, elapsed, elapsed > 0 ? span / elapsed : 0,
+           (unsigned long long)total.connects, (unsigned long long)total.failed,
+           (unsigned long long)total.messages, (unsigned long long)total.skipped);
+    printf("%.0f msgs/s, %.2f MB sent, %.2f MB received", elapsed > 0 ? total.messages / elapsed : 0,
+           total.bytes_sent / 1e6, total.bytes_received / 1e6);
+    if (speed > 0) printf(", max lag behind schedule %.1f ms", total.max_lag_us / 1e3);
+    printf("\n");
+    free(conn_fds);
+    free(events);
+    return 0;
+}
@@ -0,0 +1,252 @@
+/**
+ * @file transfer.c
+ * @brief Streaming file transfer relay implementation.
+ */
+#define _GNU_SOURCE
+#include "transfer.h"
+#include "pool.h"
+#include "sched.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PIPE_CHUNK (64 * 1024)
+
+static int done_efd = -1;
+static pthread_mutex_t done_lock = PTHREAD_MUTEX_INITIALIZER;
+static transfer_t *done_list = NULL;
+static int next_id = 1;
+
+static int64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int transfer_init(void) {
+    done_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (done_efd < 0) {
+        perror("eventfd");
+        exit(EXIT_FAILURE);
+    }
+    return done_efd;
+}
+
+int transfer_parse_command(const char *line, size_t len, size_t *size, char *name, size_t name_len) {
+    size_t cmd_len = strlen(TRANSFER_CMD);
+    if (len <= cmd_len || memcmp(line, TRANSFER_CMD, cmd_len) != 0) return -1;
+    const char *nl = memchr(line, '\n', len);
+    if (!nl) return -1;
+    char buf[128];
+    size_t n = nl - line;
+    if (n >= sizeof(buf)) return -1;
+    memcpy(buf, line, n);
+    buf[n] = '\0';
+    if (n > 0 && buf[n - 1] == '\r') buf[n - 1] = '\0';
+    unsigned long long bytes;
+    char fname[64];
+    if (sscanf(buf + cmd_len, "%llu %63s", &bytes, fname) != 2 || bytes == 0) return -1;
+    *size = bytes;
+    snprintf(name, name_len, "%s", fname);
+    return (int)(n + 1);
+}
+
+transfer_t *transfer_create(int sender_fd, int sender_slot, const char *from, const char *name, size_t size) {
+    transfer_t *t = pool_calloc(sizeof(*t));
+    if (!t) return NULL;
+    t->id = next_id++;
+    t->sender_fd = sender_fd;
+    t->sender_slot = sender_slot;
+    t->size = size;
+    snprintf(t->header, sizeof(t->header), "FILE %d %s %zu %s\n", t->id, from, size, name);
+    return t;
+}
+
+int transfer_add_peer(transfer_t *t, int fd, int slot) {
+    if (t->num_peers >= TRANSFER_MAX_RECIPIENTS) return -1;
+    transfer_peer_t *p = &t->peers[t->num_peers];
+    if (pipe2(p->pipe, O_CLOEXEC | O_NONBLOCK) < 0) {
+        perror("pipe2");
+        return -1;
+    }
+    p->fd = fd;
+    p->slot = slot;
+    p->pending = 0;
+    p->dropped = 0;
+    t->num_peers++;
+    return 0;
+}
+
+static void drop_peer(transfer_peer_t *p) {
+    p->dropped = 1;
+    p->pending = 0;
+}
+
+// Write a small buffer to a non-blocking socket, giving up at the deadline
+static int write_all(int fd, const char *buf, size_t len, int64_t deadline) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n > 0) {
+            buf += n;
+            len -= n;
+            continue;
+        }
+        if (n < 0 && errno != EAGAIN && errno != EINTR) return -1;
+        int64_t left = deadline - now_ms();
+        struct pollfd pfd = {fd, POLLOUT, 0};
+        if (left <= 0 || poll(&pfd, 1, (int)left) == 0) return -1;
+    }
+    return 0;
+}
+
+/*
+ * Push every recipient's pipe into its socket until all pipes are empty.
+ * Recipients that make no room before the deadline are dropped.
+ */
+static void drain_peers(transfer_t *t, int64_t deadline) {
+    struct pollfd pfds[TRANSFER_MAX_RECIPIENTS];
+    int idx[TRANSFER_MAX_RECIPIENTS];
+    for (;;) {
+        int waiting = 0;
+        for (int i = 0; i < t->num_peers; i++) {
+            transfer_peer_t *p = &t->peers[i];
+            while (!p->dropped && p->pending > 0) {
+                ssize_t n = splice(p->pipe[0], NULL, p->fd, NULL, p->pending, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+                if (n > 0) {
+                    p->pending -= n;
+                } else if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+                    break;
+                } else {
+                    drop_peer(p);
+                }
+            }
+            if (!p->dropped && p->pending > 0) {
+                pfds[waiting].fd = p->fd;
+                pfds[waiting].events = POLLOUT;
+                idx[waiting++] = i;
+            }
+        }
+        if (waiting == 0) return;
+        int64_t left = deadline - now_ms();
+        if (left <= 0 || poll(pfds, waiting, (int)left) == 0) {
+            for (int k = 0; k < waiting; k++) drop_peer(&t->peers[idx[k]]);
+            return;
+        }
+    }
+}
+
+static void relay(transfer_t *t) {
+    int in_pipe[2];
+    int devnull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (devnull < 0 || pipe2(in_pipe, O_CLOEXEC) < 0) {
+        perror("transfer setup");
+        if (devnull >= 0) close(devnull);
+        t->sender_failed = 1;
+        for (int i = 0; i < t->num_peers; i++) drop_peer(&t->peers[i]);
+        return;
+    }
+    // Client sockets are non-blocking already; every write below has a deadline
+    for (int i = 0; i < t->num_peers; i++) {
+        transfer_peer_t *p = &t->peers[i];
+        int64_t deadline = now_ms() + TRANSFER_STALL_MS;
+        if (write_all(p->fd, t->header, strlen(t->header), deadline) < 0 ||
+            write_all(p->fd, t->leftover, t->leftover_len, deadline) < 0) {
+            drop_peer(p);
+        }
+    }
+    t->relayed = t->leftover_len;
+
+    while (t->relayed < t->size) {
+        size_t want = t->size - t->relayed;
+        if (want > PIPE_CHUNK) want = PIPE_CHUNK;
+        struct pollfd pfd = {t->sender_fd, POLLIN, 0};
+        if (poll(&pfd, 1, TRANSFER_STALL_MS) <= 0) {
+            t->sender_failed = 1;
+            break;
+        }
+        ssize_t n = splice(t->sender_fd, NULL, in_pipe[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (n < 0 && (errno == EAGAIN || errno == EINTR)) continue;
+        if (n <= 0) {
+            t->sender_failed = 1;
+            break;
+        }
+        // Every pipe is empty here, so a tee of one pipe's worth always fits
+        for (int i = 0; i < t->num_peers; i++) {
+            transfer_peer_t *p = &t->peers[i];
+            if (p->dropped) continue;
+            ssize_t copied = tee(in_pipe[0], p->pipe[1], n, SPLICE_F_NONBLOCK);
+            if (copied != n) {
+                drop_peer(p);
+                continue;
+            }
+            p->pending = n;
+        }
+        if (splice(in_pipe[0], NULL, devnull, NULL, n, SPLICE_F_MOVE) != n) {
+            t->sender_failed = 1;
+            break;
+        }
+        t->relayed += n;
+        drain_peers(t, now_ms() + TRANSFER_STALL_MS);
+    }
+    // A recipient that got a short payload can no longer parse the stream
+    if (t->sender_failed) {
+        for (int i = 0; i < t->num_peers; i++) drop_peer(&t->peers[i]);
+    }
+    close(in_pipe[0]);
+    close(in_pipe[1]);
+    close(devnull);
+}
+
+static void *relay_thread(void *arg) {
+    transfer_t *t = arg;
+    relay(t);
+    pthread_mutex_lock(&done_lock);
+    t->next = done_list;
+    done_list = t;
+    pthread_mutex_unlock(&done_lock);
+    uint64_t one = 1;
+    if (write(done_efd, &one, sizeof(one)) < 0) {
+        perror("eventfd write");
+    }
+    return NULL;
+}
+
+int transfer_start(transfer_t *t) {
+    pthread_t tid;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    sched_helper_attr(&attr);
+    int rc = pthread_create(&tid, &attr, relay_thread, t);
+    pthread_attr_destroy(&attr);
+    return rc == 0 ? 0 : -1;
+}
+
+transfer_t *transfer_reap(void) {
+    uint64_t count;
+    if (read(done_efd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        perror("eventfd read");
+    }
+    pthread_mutex_lock(&done_lock);
+    transfer_t *t = done_list;
+    done_list = NULL;
+    pthread_mutex_unlock(&done_lock);
+    return t;
+}
+
+void transfer_free(transfer_t *t) {
+    for (int i = 0; i < t->num_peers; i++) {
+        close(t->peers[i].pipe[0]);
+        close(t->peers[i].pipe[1]);
+    }
+    pool_free(t->leftover, t->leftover_len);
+    pool_free(t, sizeof(*t));
+}
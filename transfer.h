@@ -0,0 +1,113 @@
+/**
+ * @file transfer.h
+ * @brief Streaming file transfer relayed through pipes with splice/tee.
+ *
+ * A client announces a transfer with "/sendfile <bytes> <name>" and, after
+ * the server answers "READY <id>", streams the raw bytes. A relay thread
+ * moves them from the sender's socket into a pipe, tee()s the pipe into one
+ * pipe per recipient and splices those into the recipients' sockets, so the
+ * payload is never copied into user space. Recipients receive a
+ * "FILE <id> <from> <bytes> <name>" line followed by the raw bytes.
+ *
+ * Flow control: a chunk is only released from the sender's pipe once every
+ * recipient has drained its previous chunk. A recipient that cannot accept
+ * data for TRANSFER_STALL_MS is cut off, so one slow reader cannot pin the
+ * sender's buffers indefinitely.
+ */
+#ifndef TRANSFER_H
+#define TRANSFER_H
+
+#include <stddef.h>
+
+#define TRANSFER_MAX_RECIPIENTS 500
+#define TRANSFER_STALL_MS 10000
+#define TRANSFER_CMD "/sendfile "
+
+/**
+ * @brief One participant in a transfer.
+ */
+typedef struct {
+    int fd;          /**< Socket. */
+    int slot;        /**< Client slot in the server's table. */
+    int pipe[2];     /**< Recipient pipe (read end, write end). */
+    size_t pending;  /**< Bytes teed into the pipe but not yet sent. */
+    int dropped;     /**< Set if the recipient stalled or failed. */
+} transfer_peer_t;
+
+/**
+ * @brief State of one transfer, owned by its relay thread until it completes.
+ */
+typedef struct transfer {
+    int id;                         /**< Transfer identifier. */
+    int sender_fd;                  /**< Sender's socket. */
+    int sender_slot;                /**< Sender's client slot. */
+    int sender_failed;              /**< Set if the sender hung up or stalled mid-stream. */
+    size_t size;                    /**< Total payload bytes. */
+    size_t relayed;                 /**< Payload bytes taken from the sender. */
+    char header[160];               /**< Line sent to recipients before the payload. */
+    char *leftover;                 /**< Payload bytes already read by the server. */
+    size_t leftover_len;            /**< Number of leftover bytes. */
+    int num_peers;                  /**< Number of recipients. */
+    int skipped;                    /**< Recipients left out: past TRANSFER_MAX_RECIPIENTS, or no pipe. */
+    transfer_peer_t peers[TRANSFER_MAX_RECIPIENTS]; /**< Recipients. */
+    struct transfer *next;          /**< Link in the completed list. */
+} transfer_t;
+
+/**
+ * @brief Initialize the transfer module.
+ * @return Eventfd that becomes readable when a transfer completes.
+ */
+int transfer_init(void);
+
+/**
+ * @brief Parse a "/sendfile <bytes> <name>" command.
+ * @param line Command text (need not be NUL-terminated).
+ * @param len Length of the command text.
+ * @param size Set to the announced payload size.
+ * @param name Buffer for the file name.
+ * @param name_len Size of the name buffer.
+ * @return Length of the command line including its newline, or -1 if @p line
+ *         is not a complete, valid command.
+ */
+int transfer_parse_command(const char *line, size_t len, size_t *size, char *name, size_t name_len);
+
+/**
+ * @brief Create a transfer; fill in peers and leftover, then call transfer_start().
+ * @param sender_fd Sender's socket.
+ * @param sender_slot Sender's client slot.
+ * @param from Sender's display name.
+ * @param name File name.
+ * @param size Payload size.
+ * @return New transfer, or NULL if out of memory.
+ */
+transfer_t *transfer_create(int sender_fd, int sender_slot, const char *from, const char *name, size_t size);
+
+/**
+ * @brief Add a recipient to a transfer that has not started yet.
+ * @param t Transfer.
+ * @param fd Recipient socket.
+ * @param slot Recipient client slot.
+ * @return 0 on success, -1 if the recipient could not be added.
+ */
+int transfer_add_peer(transfer_t *t, int fd, int slot);
+
+/**
+ * @brief Hand the transfer to a relay thread.
+ * @param t Transfer.
+ * @return 0 on success, -1 if the thread could not be started.
+ */
+int transfer_start(transfer_t *t);
+
+/**
+ * @brief Take all completed transfers off the completed list.
+ * @return List of completed transfers linked through next, or NULL.
+ */
+transfer_t *transfer_reap(void);
+
+/**
+ * @brief Release a transfer's pipes and memory.
+ * @param t Transfer.
+ */
+void transfer_free(transfer_t *t);
+
+#endif // TRANSFER_H
@@ -0,0 +1,189 @@
+/**
+ * @file transfer_bench.c
+ * @brief Measure relay throughput of the splice-based file transfer.
+ *
+ * Starts ./chat_server, logs in a number of receivers and one sender, and
+ * streams a payload of the given size through a "/sendfile" transfer.
+ * Reports the time until every receiver has the full payload and the
+ * resulting throughput per receiver and in aggregate.
+ *
+ * Usage:
+ * ./transfer_bench [megabytes] [receivers]
+ */
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TCP_PORT 8888
+#define MAX_RECEIVERS 64
+#define CHUNK (1024 * 1024)
+
+static pid_t server_pid = 0;
+static size_t payload_size;
+
+typedef struct {
+    int sock;
+    size_t received;
+    double done_at;
+} receiver_t;
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void start_server(void) {
+    server_pid = fork();
+    if (server_pid == 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDOUT_FILENO);
+        execl("./chat_server", "chat_server", NULL);
+        perror("Failed to start server");
+        exit(1);
+    } else if (server_pid < 0) {
+        perror("Fork failed");
+        exit(1);
+    }
+    sleep(1);
+}
+
+static void stop_server(void) {
+    if (server_pid > 0) {
+        kill(server_pid, SIGINT);
+        waitpid(server_pid, NULL, 0);
+        server_pid = 0;
+    }
+}
+
+static int tcp_login(const char *username) {
+    struct sockaddr_in addr;
+    char buf[64];
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(TCP_PORT);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("connect");
+        exit(1);
+    }
+    recv(sock, buf, 16, MSG_WAITALL);
+    send(sock, username, strlen(username), 0);
+    recv(sock, buf, 16, MSG_WAITALL);
+    send(sock, "secret", 6, 0);
+    usleep(20000);
+    return sock;
+}
+
+// Skip chat lines until the FILE header, then count payload bytes
+static void *receiver_thread(void *arg) {
+    receiver_t *r = arg;
+    char *buf = malloc(CHUNK);
+    size_t have = 0;
+    int in_payload = 0;
+    for (;;) {
+        ssize_t n = recv(r->sock, buf + have, CHUNK - have, 0);
+        if (n <= 0) break;
+        if (in_payload) {
+            r->received += n;
+        } else {
+            have += n;
+            char *line = buf;
+            char *nl;
+            while (!in_payload && (nl = memchr(line, '\n', buf + have - line)) != NULL) {
+                if (strncmp(line, "FILE ", 5) == 0) {
+                    in_payload = 1;
+                    r->received = buf + have - (nl + 1);
+                }
+                line = nl + 1;
+            }
+            if (!in_payload) {
+                have = buf + have - line;
+                memmove(buf, line, have);
+            }
+        }
+        if (in_payload && r->received >= payload_size) break;
+    }
+    r->done_at = now_s();
+    free(buf);
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    size_t megabytes = argc > 1 ? strtoul(argv[1], NULL, 10) : 256;
+    int num_receivers = argc > 2 ? atoi(argv[2]) : 4;
+    if (num_receivers < 1) num_receivers = 1;
+    if (num_receivers > MAX_RECEIVERS) num_receivers = MAX_RECEIVERS;
+    payload_size = megabytes * 1024 * 1024;
+    signal(SIGPIPE, SIG_IGN);
+
+    start_server();
+    receiver_t receivers[MAX_RECEIVERS];
+    pthread_t threads[MAX_RECEIVERS];
+    for (int i = 0; i < num_receivers; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "recv%d", i);
+        receivers[i].sock = tcp_login(name);
+        receivers[i].received = 0;
+    }
+    int sender = tcp_login("sender");
+    usleep(200000);
+    for (int i = 0; i < num_receivers; i++) {
+        pthread_create(&threads[i], NULL, receiver_thread, &receivers[i]);
+    }
+
+    char cmd[128], reply[256];
+    snprintf(cmd, sizeof(cmd), "/sendfile %zu bench.bin\n", payload_size);
+    // Drain the presence notices so the READY reply is easy to spot
+    usleep(200000);
+    while (recv(sender, reply, sizeof(reply), MSG_DONTWAIT) > 0) {
+    }
+    send(sender, cmd, strlen(cmd), 0);
+    ssize_t n = recv(sender, reply, sizeof(reply) - 1, 0);
+    if (n <= 0 || strncmp(reply, "READY", 5) != 0) {
+        fprintf(stderr, "server did not accept the transfer\n");
+        stop_server();
+        return 1;
+    }
+
+    char *chunk = malloc(CHUNK);
+    memset(chunk, 'x', CHUNK);
+    double start = now_s();
+    for (size_t sent = 0; sent < payload_size;) {
+        size_t len = payload_size - sent < CHUNK ? payload_size - sent : CHUNK;
+        ssize_t w = send(sender, chunk, len, 0);
+        if (w <= 0) {
+            perror("send");
+            break;
+        }
+        sent += w;
+    }
+    double sent_at = now_s();
+    for (int i = 0; i < num_receivers; i++) pthread_join(threads[i], NULL);
+    double end = start;
+    int complete = 0;
+    for (int i = 0; i < num_receivers; i++) {
+        if (receivers[i].done_at > end) end = receivers[i].done_at;
+        if (receivers[i].received >= payload_size) complete++;
+    }
+    n = recv(sender, reply, sizeof(reply) - 1, 0);
+    reply[n > 0 ? n : 0] = '\0';
+
+    double mb = (double)payload_size / (1024 * 1024);
+    printf("payload %.0f MB to %d receivers (%d complete)\n", mb, num_receivers, complete);
+    printf("sender finished in %.2f s, last receiver in %.2f s\n", sent_at - start, end - start);
+    printf("throughput: %.0f MB/s per receiver, %.0f MB/s aggregate egress\n",
+           mb / (end - start), mb * num_receivers / (end - start));
+    printf("server: %s", reply);
+    free(chunk);
+    stop_server();
+    return complete == num_receivers ? 0 : 1;
+}
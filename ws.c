@@ -0,0 +1,411 @@
+/**
+ * @file ws.c
+ * @brief WebSocket transport implementation.
+ */
+#define _GNU_SOURCE
+#include "ws.h"
+#include "chat.h"
+#include "pool.h"
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define WS_REQUEST_MAX 4096
+// Largest frame a client may send: 14-byte masked header plus a full message
+#define WS_RX_SIZE (MAX_MESSAGE_SIZE + 14)
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+enum { CLOSE_NORMAL = 1000, CLOSE_PROTOCOL = 1002, CLOSE_TOO_BIG = 1009 };
+
+/* --- SHA-1 (FIPS 180-1), only used for the upgrade handshake --- */
+
+static uint32_t rol(uint32_t x, int n) {
+    return x << n | x >> (32 - n);
+}
+
+static void sha1_block(uint32_t h[5], const unsigned char *p) {
+    uint32_t w[80];
+    for (int i = 0; i < 16; i++) w[i] = (uint32_t)p[4 * i] << 24 | p[4 * i + 1] << 16 | p[4 * i + 2] << 8 | p[4 * i + 3];
+    for (int i = 16; i < 80; i++) w[i] = rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (int i = 0; i < 80; i++) {
+        uint32_t f, k;
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5A827999;
+        } else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ED9EBA1;
+        } else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8F1BBCDC;
+        } else {
+            f = b ^ c ^ d;
+            k = 0xCA62C1D6;
+        }
+        uint32_t t = rol(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = rol(b, 30);
+        b = a;
+        a = t;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+}
+
+void ws_sha1(const void *data, size_t len, unsigned char out[20]) {
+    uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    const unsigned char *p = data;
+    size_t left = len;
+    for (; left >= 64; p += 64, left -= 64) sha1_block(h, p);
+    // Final block(s): the rest, 0x80, zeros and the bit length
+    unsigned char tail[128] = {0};
+    memcpy(tail, p, left);
+    tail[left] = 0x80;
+    size_t tail_len = left < 56 ? 64 : 128;
+    uint64_t bits = (uint64_t)len * 8;
+    for (int i = 0; i < 8; i++) tail[tail_len - 1 - i] = (unsigned char)(bits >> (8 * i));
+    for (size_t off = 0; off < tail_len; off += 64) sha1_block(h, tail + off);
+    for (int i = 0; i < 5; i++) {
+        out[4 * i] = h[i] >> 24;
+        out[4 * i + 1] = h[i] >> 16;
+        out[4 * i + 2] = h[i] >> 8;
+        out[4 * i + 3] = h[i];
+    }
+}
+
+size_t ws_base64(const unsigned char *in, size_t len, char *out) {
+    static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t n = 0;
+    for (size_t i = 0; i < len; i += 3) {
+        uint32_t v = (uint32_t)in[i] << 16;
+        if (i + 1 < len) v |= in[i + 1] << 8;
+        if (i + 2 < len) v |= in[i + 2];
+        out[n++] = digits[v >> 18 & 63];
+        out[n++] = digits[v >> 12 & 63];
+        out[n++] = i + 1 < len ? digits[v >> 6 & 63] : '=';
+        out[n++] = i + 2 < len ? digits[v & 63] : '=';
+    }
+    out[n] = '\0';
+    return n;
+}
+
+void ws_accept_key(const char *key, size_t key_len, char out[29]) {
+    char buf[128 + sizeof(WS_GUID)];
+    unsigned char digest[20];
+    if (key_len > 128) key_len = 128;
+    memcpy(buf, key, key_len);
+    memcpy(buf + key_len, WS_GUID, strlen(WS_GUID));
+    ws_sha1(buf, key_len + strlen(WS_GUID), digest);
+    ws_base64(digest, sizeof(digest), out);
+}
+
+int setup_ws_listener(int port) {
+    int opt = 1;
+    struct sockaddr_in address = {0};
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) {
+        perror("WebSocket socket failed");
+        exit(EXIT_FAILURE);
+    }
+    if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
+        perror("WebSocket setsockopt");
+        exit(EXIT_FAILURE);
+    }
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY;
+    address.sin_port = htons(port);
+    if (bind(sock, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        perror("WebSocket bind failed");
+        exit(EXIT_FAILURE);
+    }
+    if (listen(sock, LISTEN_BACKLOG) < 0) {
+        perror("WebSocket listen");
+        exit(EXIT_FAILURE);
+    }
+    printf("WebSocket clients accepted on TCP port %d\n", port);
+    return sock;
+}
+
+size_t ws_frame_header(unsigned char *hdr, int opcode, size_t len) {
+    hdr[0] = 0x80 | opcode;
+    if (len < 126) {
+        hdr[1] = len;
+        return 2;
+    }
+    if (len <= 0xFFFF) {
+        hdr[1] = 126;
+        hdr[2] = len >> 8;
+        hdr[3] = len;
+        return 4;
+    }
+    hdr[1] = 127;
+    for (int i = 0; i < 8; i++) hdr[9 - i] = (unsigned char)((uint64_t)len >> (8 * i));
+    return 10;
+}
+
+int ws_frame_iov(struct iovec *out, unsigned char *hdr, const struct iovec *iov, int iovcnt) {
+    size_t len = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        len += iov[i].iov_len;
+        out[i + 1] = iov[i];
+    }
+    out[0].iov_base = hdr;
+    out[0].iov_len = ws_frame_header(hdr, WS_OP_TEXT, len);
+    return iovcnt + 1;
+}
+
+static ws_control_fn control_fn = NULL;
+
+void ws_set_control_fn(ws_control_fn fn) {
+    control_fn = fn;
+}
+
+static void send_frame(ws_conn_t *ws, int fd, int opcode, const void *data, size_t len) {
+    unsigned char hdr[WS_HEADER_MAX];
+    struct iovec iov[2] = {{hdr, ws_frame_header(hdr, opcode, len)}, {(void *)data, len}};
+    if (ws->owner && control_fn) {
+        control_fn(ws->owner, iov, 2);
+        return;
+    }
+    struct msghdr msg = {.msg_iov = iov, .msg_iovlen = 2};
+    sendmsg(fd, &msg, MSG_NOSIGNAL);
+}
+
+static void send_close(ws_conn_t *ws, int fd, int code) {
+    unsigned char payload[2] = {code >> 8, code & 0xFF};
+    send_frame(ws, fd, WS_OP_CLOSE, payload, sizeof(payload));
+}
+
+static void consume(ws_conn_t *ws, size_t n) {
+    ws->rx_len -= n;
+    if (ws->rx_len > 0) {
+        memmove(ws->rx, ws->rx + n, ws->rx_len);
+    } else {
+        pool_free(ws->rx, WS_RX_SIZE);
+        ws->rx = NULL;
+    }
+}
+
+// Read more input into rx; returns bytes read, 0 on hangup, -1 with errno set
+static ssize_t fill(ws_conn_t *ws, int fd, size_t limit) {
+    if (!ws->rx && !(ws->rx = pool_alloc(WS_RX_SIZE))) return -1;
+    if (ws->rx_len >= limit) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    ssize_t n = recv(fd, ws->rx + ws->rx_len, limit - ws->rx_len, MSG_DONTWAIT);
+    if (n > 0) {
+        ws->rx_len += n;
+    } else if (ws->rx_len == 0) {
+        pool_free(ws->rx, WS_RX_SIZE);
+        ws->rx = NULL;
+    }
+    return n;
+}
+
+/**
+ * @brief Decode one frame at the start of rx and unmask its payload in place.
+ * @return Frame length, 0 if it is not complete yet, or -CLOSE_* on a protocol error.
+ */
+static long parse_frame(ws_conn_t *ws, int *fin, int *opcode, char **payload, size_t *len) {
+    unsigned char *p = (unsigned char *)ws->rx;
+    size_t have = ws->rx_len, hdr = 2;
+    if (have < 2) return 0;
+    *fin = p[0] & 0x80;
+    *opcode = p[0] & 0x0F;
+    if ((p[0] & 0x70) || !(p[1] & 0x80)) return -CLOSE_PROTOCOL;  // reserved bits, or not masked
+    uint64_t n = p[1] & 0x7F;
+    if (n == 126) {
+        if (have < 4) return 0;
+        n = (uint64_t)p[2] << 8 | p[3];
+        hdr = 4;
+    } else if (n == 127) {
+        if (have < 10) return 0;
+        n = 0;
+        for (int i = 0; i < 8; i++) n = n << 8 | p[2 + i];
+        hdr = 10;
+    }
+    if (*opcode >= WS_OP_CLOSE && (!*fin || n > 125)) return -CLOSE_PROTOCOL;
+    if (n > MAX_MESSAGE_SIZE) return -CLOSE_TOO_BIG;
+    if (have < hdr + 4 + n) return 0;
+    unsigned char *mask = p + hdr, *data = p + hdr + 4;
+    for (uint64_t i = 0; i < n; i++) data[i] ^= mask[i & 3];
+    *payload = (char *)data;
+    *len = n;
+    return (long)(hdr + 4 + n);
+}
+
+int ws_recv(ws_conn_t *ws, int fd, char *out, size_t cap, size_t *len) {
+    for (;;) {
+        int fin, opcode;
+        char *payload;
+        size_t n;
+        long frame = ws->rx ? parse_frame(ws, &fin, &opcode, &payload, &n) : 0;
+        if (frame < 0) {
+            send_close(ws, fd, (int)-frame);
+            return WS_CLOSED;
+        }
+        if (frame == 0) {
+            ssize_t got = fill(ws, fd, WS_RX_SIZE);
+            if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return WS_AGAIN;
+            if (got <= 0) return WS_CLOSED;
+            continue;
+        }
+        int rc = -1;
+        switch (opcode) {
+        case WS_OP_PING:
+            send_frame(ws, fd, WS_OP_PONG, payload, n);
+            *len = 0;
+            rc = WS_CONTROL;
+            break;
+        case WS_OP_PONG:
+            *len = 0;
+            rc = WS_CONTROL;
+            break;
+        case WS_OP_CLOSE:
+            send_close(ws, fd, CLOSE_NORMAL);
+            rc = WS_CLOSED;
+            break;
+        case WS_OP_TEXT:
+        case WS_OP_BINARY:
+        case WS_OP_CONTINUATION:
+            if ((opcode == WS_OP_CONTINUATION) != (ws->msg != NULL)) {
+                send_close(ws, fd, CLOSE_PROTOCOL);
+                rc = WS_CLOSED;
+            } else if (ws->msg_len + n > cap || ws->msg_len + n > MAX_MESSAGE_SIZE) {
+                send_close(ws, fd, CLOSE_TOO_BIG);
+                rc = WS_CLOSED;
+            } else if (fin && !ws->msg) {
+                memcpy(out, payload, n);
+                *len = n;
+                rc = WS_MESSAGE;
+            } else {
+                if (!ws->msg && !(ws->msg = pool_alloc(MAX_MESSAGE_SIZE))) {
+                    rc = WS_CLOSED;
+                    break;
+                }
+                memcpy(ws->msg + ws->msg_len, payload, n);
+                ws->msg_len += n;
+                if (fin) {
+                    memcpy(out, ws->msg, ws->msg_len);
+                    *len = ws->msg_len;
+                    pool_free(ws->msg, MAX_MESSAGE_SIZE);
+                    ws->msg = NULL;
+                    ws->msg_len = 0;
+                    rc = WS_MESSAGE;
+                }
+            }
+            break;
+        default:
+            send_close(ws, fd, CLOSE_PROTOCOL);
+            rc = WS_CLOSED;
+        }
+        consume(ws, frame);
+        if (rc >= 0) return rc;
+    }
+}
+
+ws_conn_t *ws_session_begin(auth_session_t *session, int sockfd) {
+    session->fd = sockfd;
+    session->awaiting_password = 0;
+    session->username[0] = '\0';
+    session->caps = 0;
+    return calloc(1, sizeof(ws_conn_t));
+}
+
+// Find a header's value in an HTTP request
+static const char *header_value(const char *req, const char *name, size_t *len) {
+    size_t name_len = strlen(name);
+    for (const char *line = strstr(req, "\r\n"); line; line = strstr(line, "\r\n")) {
+        line += 2;
+        if (strncasecmp(line, name, name_len) == 0 && line[name_len] == ':') {
+            const char *v = line + name_len + 1;
+            while (*v == ' ' || *v == '\t') v++;
+            const char *end = strstr(v, "\r\n");
+            while (end > v && (end[-1] == ' ' || end[-1] == '\t')) end--;
+            *len = end - v;
+            return v;
+        }
+    }
+    return NULL;
+}
+
+// Answer the HTTP upgrade request once it is complete
+static int answer_upgrade(ws_conn_t *ws, int fd) {
+    for (;;) {
+        char *end = ws->rx ? memmem(ws->rx, ws->rx_len, "\r\n\r\n", 4) : NULL;
+        if (end) break;
+        ssize_t n = fill(ws, fd, WS_REQUEST_MAX);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return AUTH_PENDING;
+        if (n <= 0) return AUTH_FAILED;
+    }
+    size_t req_len = (char *)memmem(ws->rx, ws->rx_len, "\r\n\r\n", 4) - ws->rx + 4;
+    char req[WS_REQUEST_MAX + 1];
+    memcpy(req, ws->rx, req_len);
+    req[req_len] = '\0';
+    consume(ws, req_len);
+    size_t upgrade_len, key_len, version_len;
+    const char *upgrade = header_value(req, "Upgrade", &upgrade_len);
+    const char *key = header_value(req, "Sec-WebSocket-Key", &key_len);
+    const char *version = header_value(req, "Sec-WebSocket-Version", &version_len);
+    if (strncmp(req, "GET ", 4) != 0 || !upgrade || upgrade_len != 9 || strncasecmp(upgrade, "websocket", 9) != 0 ||
+        !key || !version || version_len != 2 || strncmp(version, "13", 2) != 0) {
+        const char *bad = "HTTP/1.1 400 Bad Request\r\nSec-WebSocket-Version: 13\r\nContent-Length: 0\r\n\r\n";
+        send(fd, bad, strlen(bad), MSG_NOSIGNAL);
+        return AUTH_FAILED;
+    }
+    char accept[29], reply[256];
+    const char *prompt = "Enter username: ";
+    ws_accept_key(key, key_len, accept);
+    int n = snprintf(reply, sizeof(reply),
+                     "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                     "Sec-WebSocket-Accept: %s\r\n\r\n", accept);
+    n += ws_frame_header((unsigned char *)reply + n, WS_OP_TEXT, strlen(prompt));
+    memcpy(reply + n, prompt, strlen(prompt));
+    n += strlen(prompt);
+    // A fresh socket always has room for the reply
+    if (send(fd, reply, n, MSG_NOSIGNAL) != n) return AUTH_FAILED;
+    ws->upgraded = 1;
+    return AUTH_OK;
+}
+
+int ws_session_step(auth_session_t *session, ws_conn_t *ws) {
+    if (!ws->upgraded) {
+        int rc = answer_upgrade(ws, session->fd);
+        if (rc != AUTH_OK) return rc;
+    }
+    for (;;) {
+        char buf[USERNAME_MAX_LEN + PASSWORD_MAX_LEN + 32];
+        size_t len;
+        int rc = ws_recv(ws, session->fd, buf, sizeof(buf) - 1, &len);
+        if (rc == WS_AGAIN) return AUTH_PENDING;
+        if (rc == WS_CLOSED) return AUTH_FAILED;
+        if (session->awaiting_password) {
+            // For now, always succeed
+            return AUTH_OK;
+        }
+        while (len > 0 && (buf[len - 1] == '\n' || buf[len - 1] == '\r')) len--;
+        buf[len] = '\0';
+        auth_set_username(session, buf);
+        const char *ask_pass = "Enter password: ";
+        send_frame(ws, session->fd, WS_OP_TEXT, ask_pass, strlen(ask_pass));
+        session->awaiting_password = 1;
+    }
+}
+
+void ws_conn_free(ws_conn_t *ws) {
+    if (!ws) return;
+    pool_free(ws->rx, WS_RX_SIZE);
+    pool_free(ws->msg, MAX_MESSAGE_SIZE);
+    free(ws);
+}
@@ -0,0 +1,160 @@
+/**
+ * @file ws.h
+ * @brief WebSocket (RFC 6455) transport so browsers can join the chat.
+ *
+ * A browser opens ws://host:<port>/ and the server answers the HTTP upgrade
+ * itself. After that the exchange is the same as over raw TCP, one text
+ * frame per line: the "Enter username: " and "Enter password: " prompts,
+ * then chat messages both ways. The server answers pings with pongs and
+ * close frames with a close frame. Fragmented messages are reassembled.
+ *
+ * Frames sent by the server are never masked, so the header of a frame only
+ * depends on its length and one encoded frame can go to every WebSocket
+ * recipient of a broadcast.
+ */
+#ifndef WS_H
+#define WS_H
+
+#include "auth.h"
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#define WS_HEADER_MAX 10
+
+enum { WS_OP_CONTINUATION = 0, WS_OP_TEXT = 1, WS_OP_BINARY = 2, WS_OP_CLOSE = 8, WS_OP_PING = 9, WS_OP_PONG = 10 };
+
+/**
+ * @brief Result of ws_recv().
+ */
+enum { WS_MESSAGE, WS_CONTROL, WS_AGAIN, WS_CLOSED };
+
+/**
+ * @brief State of one WebSocket connection.
+ *
+ * Input buffers are only held while a frame or message is incomplete, so an
+ * idle connection costs just this struct.
+ */
+typedef struct ws_conn {
+    int upgraded;          /**< HTTP upgrade has been answered. */
+    char *rx;              /**< Input not parsed yet (pooled), NULL when empty. */
+    size_t rx_len;         /**< Bytes in rx. */
+    char *msg;             /**< Fragments of a message in progress (pooled), or NULL. */
+    size_t msg_len;        /**< Bytes in msg. */
+    void *owner;           /**< Set once logged in: control frames go to the control function. */
+} ws_conn_t;
+
+/**
+ * @brief Function that sends a pong or close frame for a logged-in connection.
+ * @param owner ws_conn_t.owner of the connection.
+ * @param iov Encoded frame.
+ * @param iovcnt Number of buffers.
+ */
+typedef void (*ws_control_fn)(void *owner, const struct iovec *iov, int iovcnt);
+
+/**
+ * @brief Route control frames of connections that have an owner through a function.
+ *
+ * Connections without an owner (still logging in) write them to the socket.
+ *
+ * @param fn Control frame function.
+ */
+void ws_set_control_fn(ws_control_fn fn);
+
+/**
+ * @brief Compute a SHA-1 digest.
+ * @param data Input bytes.
+ * @param len Input length.
+ * @param out 20-byte digest.
+ */
+void ws_sha1(const void *data, size_t len, unsigned char out[20]);
+
+/**
+ * @brief Base64-encode bytes.
+ * @param in Input bytes.
+ * @param len Input length.
+ * @param out Output, room for 4 * ((len + 2) / 3) + 1 bytes; NUL-terminated.
+ * @return Encoded length.
+ */
+size_t ws_base64(const unsigned char *in, size_t len, char *out);
+
+/**
+ * @brief Sec-WebSocket-Accept value for a Sec-WebSocket-Key.
+ * @param key Key sent by the client.
+ * @param key_len Key length.
+ * @param out 29 bytes: 28 characters and a NUL.
+ */
+void ws_accept_key(const char *key, size_t key_len, char out[29]);
+
+/**
+ * @brief Create the TCP socket that WebSocket clients connect to.
+ * @param port TCP port.
+ * @return Listening socket file descriptor.
+ */
+int setup_ws_listener(int port);
+
+/**
+ * @brief Start a login over WebSocket; nothing is sent until the upgrade request arrives.
+ * @param session Session to initialize.
+ * @param sockfd Non-blocking client socket.
+ * @return New connection state, or NULL if out of memory.
+ */
+ws_conn_t *ws_session_begin(auth_session_t *session, int sockfd);
+
+/**
+ * @brief Advance a WebSocket login with whatever input the socket has.
+ *
+ * Answers the upgrade request, then prompts for a username and a password,
+ * each arriving as a text frame.
+ *
+ * @param session Session from ws_session_begin().
+ * @param ws Connection state from ws_session_begin().
+ * @return AUTH_PENDING, AUTH_OK or AUTH_FAILED, as for auth_session_step().
+ */
+int ws_session_step(auth_session_t *session, ws_conn_t *ws);
+
+/**
+ * @brief Release a connection's state. Does not close the socket.
+ * @param ws Connection state (NULL is ignored).
+ */
+void ws_conn_free(ws_conn_t *ws);
+
+/**
+ * @brief Encode the header of an unmasked frame.
+ * @param hdr Output, WS_HEADER_MAX bytes.
+ * @param opcode WS_OP_* opcode.
+ * @param len Payload length.
+ * @return Header length.
+ */
+size_t ws_frame_header(unsigned char *hdr, int opcode, size_t len);
+
+/**
+ * @brief Describe a text frame carrying a message as an iovec, without copying it.
+ * @param out Output vector with room for iovcnt + 1 entries.
+ * @param hdr Scratch buffer of WS_HEADER_MAX bytes for the header.
+ * @param iov Message buffers.
+ * @param iovcnt Number of buffers.
+ * @return Number of entries used in out.
+ */
+int ws_frame_iov(struct iovec *out, unsigned char *hdr, const struct iovec *iov, int iovcnt);
+
+/**
+ * @brief Read the next complete message from a WebSocket client.
+ *
+ * Reads the socket until a data message is complete, a ping or pong has
+ * been handled, or the socket has no more input. Returning after each
+ * control frame lets the caller count it against the client's read budget
+ * and rate limit, so a flood of pings cannot hold the event loop.
+ *
+ * @param ws Connection state.
+ * @param fd Client socket.
+ * @param out Receives the message payload.
+ * @param cap Size of out; longer messages close the connection.
+ * @param len Receives the payload length.
+ * @return WS_MESSAGE, WS_CONTROL after a ping (answered) or pong, WS_AGAIN
+ *         when the socket ran dry first, or WS_CLOSED
+ *         on a close frame, hangup or protocol error.
+ */
+int ws_recv(ws_conn_t *ws, int fd, char *out, size_t cap, size_t *len);
+
+#endif // WS_H
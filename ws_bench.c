@@ -0,0 +1,330 @@
+/**
+ * @file ws_bench.c
+ * @brief Connection and message throughput for a mixed TCP / WebSocket population.
+ *
+ * Starts ./chat_server with a WebSocket listener, logs in the given number
+ * of clients (every other one over WebSocket by default) and reports the
+ * login rate and how many were admitted. A few of the clients then send
+ * messages in rounds while every client reads, and the benchmark reports
+ * messages and deliveries per second, checks that every client received
+ * every message, and shows the server's CPU time per message.
+ *
+ * Usage:
+ * ./ws_bench [clients] [websocket_percent] [messages_per_sender] [senders]
+ */
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TCP_PORT 8888
+#define WS_PORT 8080
+#define PROMPT_LEN 16
+#define MAX_BENCH_CLIENTS 1024
+#define RX_BUFFER 65536
+#define QUIET_MS 2000
+
+typedef struct {
+    int fd;
+    int ws;
+    char rx[RX_BUFFER];
+    size_t rx_len;
+    long received;         /**< Chat lines received during the message phase. */
+} bench_client_t;
+
+static pid_t server_pid = 0;
+static bench_client_t clients[MAX_BENCH_CLIENTS];
+static int num_clients;
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// CPU seconds used so far by a process, from /proc/<pid>/stat
+static double process_cpu(pid_t pid) {
+    char path[64], buf[1024];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE *f = fopen(path, "r");
+    if (!f) return 0;
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+    char *p = strrchr(buf, ')');
+    unsigned long utime = 0, stime = 0;
+    if (p) sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime);
+    return (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+static void start_server(void) {
+    server_pid = fork();
+    if (server_pid == 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDOUT_FILENO);
+        execl("./chat_server", "chat_server", "-w", "8080", "-H", "512", NULL);
+        perror("Failed to start server");
+        exit(1);
+    } else if (server_pid < 0) {
+        perror("Fork failed");
+        exit(1);
+    }
+    sleep(1);
+}
+
+static void stop_server(void) {
+    if (server_pid > 0) {
+        kill(server_pid, SIGINT);
+        waitpid(server_pid, NULL, 0);
+        server_pid = 0;
+    }
+}
+
+static int connect_to(int port) {
+    struct sockaddr_in addr;
+    int one = 1;
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("connect");
+        exit(1);
+    }
+    return sock;
+}
+
+// Send one masked text frame, as a browser would
+static void ws_send(int fd, const char *data, size_t len) {
+    unsigned char frame[16 + 256];
+    size_t h = 0;
+    frame[h++] = 0x81;
+    if (len < 126) {
+        frame[h++] = 0x80 | len;
+    } else {
+        frame[h++] = 0x80 | 126;
+        frame[h++] = len >> 8;
+        frame[h++] = len;
+    }
+    unsigned char mask[4] = {0x12, 0x34, 0x56, 0x78};
+    memcpy(frame + h, mask, 4);
+    h += 4;
+    for (size_t i = 0; i < len && h < sizeof(frame); i++) frame[h++] = data[i] ^ mask[i & 3];
+    send(fd, frame, h, 0);
+}
+
+// Read one whole frame with blocking reads; returns payload length or -1
+static int ws_read_frame(int fd, char *payload, size_t cap) {
+    unsigned char hdr[10];
+    if (recv(fd, hdr, 2, MSG_WAITALL) != 2) return -1;
+    size_t len = hdr[1] & 0x7F;
+    if (len == 126) {
+        if (recv(fd, hdr + 2, 2, MSG_WAITALL) != 2) return -1;
+        len = hdr[2] << 8 | hdr[3];
+    } else if (len == 127) {
+        return -1;
+    }
+    if (len > cap || recv(fd, payload, len, MSG_WAITALL) != (ssize_t)len) return -1;
+    return (int)len;
+}
+
+static int ws_login(const char *username) {
+    char buf[512];
+    int sock = connect_to(WS_PORT);
+    const char *req = "GET / HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                      "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n";
+    send(sock, req, strlen(req), 0);
+    // Read the response byte by byte so no frame bytes are swallowed
+    size_t n = 0;
+    while (n < sizeof(buf) - 1 && (n < 4 || memcmp(buf + n - 4, "\r\n\r\n", 4) != 0)) {
+        if (recv(sock, buf + n, 1, 0) != 1) break;
+        n++;
+    }
+    buf[n] = '\0';
+    if (strncmp(buf, "HTTP/1.1 101", 12) != 0 || !strstr(buf, "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=")) {
+        close(sock);
+        return -1;
+    }
+    if (ws_read_frame(sock, buf, sizeof(buf)) != PROMPT_LEN) {
+        close(sock);
+        return -1;
+    }
+    ws_send(sock, username, strlen(username));
+    ws_read_frame(sock, buf, sizeof(buf));
+    ws_send(sock, "secret", 6);
+    return sock;
+}
+
+static int tcp_login(const char *username) {
+    char buf[64];
+    int sock = connect_to(TCP_PORT);
+    if (recv(sock, buf, PROMPT_LEN, MSG_WAITALL) != PROMPT_LEN || memcmp(buf, "Enter", 5) != 0) {
+        close(sock);
+        return -1;
+    }
+    send(sock, username, strlen(username), 0);
+    recv(sock, buf, PROMPT_LEN, MSG_WAITALL);
+    send(sock, "secret", 6, 0);
+    return sock;
+}
+
+// Count the chat lines in a payload, skipping presence updates
+static long count_lines(const char *p, size_t len) {
+    long lines = 0;
+    const char *end = p + len;
+    while (p < end) {
+        const char *nl = memchr(p, '\n', end - p);
+        if (!nl) break;
+        if (strncmp(p, "PRESENCE", 8) != 0 && strncmp(p, "ONLINE", 6) != 0) lines++;
+        p = nl + 1;
+    }
+    return lines;
+}
+
+static void read_client(bench_client_t *c) {
+    ssize_t n;
+    while ((n = recv(c->fd, c->rx + c->rx_len, RX_BUFFER - c->rx_len, MSG_DONTWAIT)) > 0) {
+        c->rx_len += n;
+        size_t off = 0;
+        if (!c->ws) {
+            // Only whole lines
+            char *last = memrchr(c->rx, '\n', c->rx_len);
+            off = last ? (size_t)(last - c->rx + 1) : 0;
+            c->received += count_lines(c->rx, off);
+        } else {
+            for (;;) {
+                unsigned char *h = (unsigned char *)c->rx + off;
+                size_t have = c->rx_len - off, hdr = 2, len;
+                if (have < 2) break;
+                len = h[1] & 0x7F;
+                if (len == 126) {
+                    if (have < 4) break;
+                    len = h[2] << 8 | h[3];
+                    hdr = 4;
+                }
+                if (have < hdr + len) break;
+                if ((h[0] & 0x0F) == 1) c->received += count_lines((char *)h + hdr, len);
+                off += hdr + len;
+            }
+        }
+        memmove(c->rx, c->rx + off, c->rx_len - off);
+        c->rx_len -= off;
+    }
+}
+
+static void pump(int timeout_ms) {
+    struct pollfd pfds[MAX_BENCH_CLIENTS];
+    for (int i = 0; i < num_clients; i++) pfds[i] = (struct pollfd){clients[i].fd, POLLIN, 0};
+    poll(pfds, num_clients, timeout_ms);
+    for (int i = 0; i < num_clients; i++) {
+        if (pfds[i].revents) read_client(&clients[i]);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int wanted = argc > 1 ? atoi(argv[1]) : 400;
+    int ws_percent = argc > 2 ? atoi(argv[2]) : 50;
+    int per_sender = argc > 3 ? atoi(argv[3]) : 200;
+    int senders = argc > 4 ? atoi(argv[4]) : 4;
+    if (wanted < 2) wanted = 2;
+    if (wanted > MAX_BENCH_CLIENTS) wanted = MAX_BENCH_CLIENTS;
+    if (senders < 1) senders = 1;
+    signal(SIGPIPE, SIG_IGN);
+    start_server();
+
+    // Login phase: spread WebSocket clients evenly through the population
+    int tcp_count = 0, ws_count = 0, refused = 0;
+    double start = now_ms();
+    for (int i = 0; i < wanted; i++) {
+        char name[32];
+        int ws = (i + 1) * ws_percent / 100 != i * ws_percent / 100;
+        snprintf(name, sizeof(name), "%s%d", ws ? "w" : "t", i);
+        int fd = ws ? ws_login(name) : tcp_login(name);
+        if (fd < 0) {
+            refused++;
+            continue;
+        }
+        clients[num_clients].fd = fd;
+        clients[num_clients++].ws = ws;
+        if (ws) {
+            ws_count++;
+        } else {
+            tcp_count++;
+        }
+    }
+    double login_ms = now_ms() - start;
+    printf("logins: %d TCP + %d WebSocket admitted, %d refused, %.0f logins/s\n", tcp_count, ws_count, refused,
+           wanted * 1000.0 / login_ms);
+    if (senders > num_clients - 1) senders = num_clients - 1;
+    for (int i = 0; i < num_clients; i++) fcntl(clients[i].fd, F_SETFL, O_NONBLOCK);
+    double settle = now_ms() + 500;
+    while (now_ms() < settle) pump(50);
+    for (int i = 0; i < num_clients; i++) clients[i].received = 0;
+
+    // Message phase: each sender sends one message per round. The next round
+    // starts once the last client has the previous one, so a raw TCP read
+    // never picks up several messages that would then go out as one.
+    const char *line = "the quick brown fox jumps over the lazy dog, 0123456789\n";
+    bench_client_t *probe = &clients[num_clients - 1];
+    double cpu_start = process_cpu(server_pid);
+    start = now_ms();
+    for (int m = 0; m < per_sender; m++) {
+        for (int s = 0; s < senders; s++) {
+            bench_client_t *c = &clients[s];
+            if (c->ws) {
+                ws_send(c->fd, line, strlen(line) - 1);
+            } else {
+                send(c->fd, line, strlen(line), 0);
+            }
+        }
+        double deadline = now_ms() + QUIET_MS;
+        while (probe->received < (long)(m + 1) * senders && now_ms() < deadline) pump(10);
+    }
+    long expected = (long)senders * per_sender;
+    double last_progress = now_ms(), done_ms = start;
+    long total = -1;
+    while (now_ms() - last_progress < QUIET_MS) {
+        pump(20);
+        long sum = 0;
+        int complete = 1;
+        for (int i = 0; i < num_clients; i++) {
+            sum += clients[i].received;
+            if (clients[i].received < expected - (i < senders ? per_sender : 0)) complete = 0;
+        }
+        if (sum != total) {
+            total = sum;
+            last_progress = done_ms = now_ms();
+        }
+        if (complete) break;
+    }
+    double elapsed = done_ms - start;
+    double cpu = process_cpu(server_pid) - cpu_start;
+    int complete_tcp = 0, complete_ws = 0;
+    for (int i = 0; i < num_clients; i++) {
+        if (clients[i].received == expected - (i < senders ? per_sender : 0)) {
+            if (clients[i].ws) {
+                complete_ws++;
+            } else {
+                complete_tcp++;
+            }
+        }
+    }
+    printf("messages: %ld from %d senders in %.0f ms = %.0f msgs/s, %.0f deliveries/s; server cpu %.1f us/msg\n", expected,
+           senders, elapsed, expected * 1000.0 / elapsed, total * 1000.0 / elapsed, cpu * 1e6 / expected);
+    printf("complete: %d/%d TCP, %d/%d WebSocket clients got every message\n", complete_tcp, tcp_count, complete_ws,
+           ws_count);
+    for (int i = 0; i < num_clients; i++) close(clients[i].fd);
+    stop_server();
+    return complete_tcp == tcp_count && complete_ws == ws_count ? 0 : 1;
+}
@@ -0,0 +1,109 @@
+/**
+ * @file zframe.h
+ * @brief zlib-compressed frames for clients that ask for them at login.
+ *
+ * A client that sends its username as "<name> +zlib" is answered with
+ * "COMPRESS zlib" after login, and from then on may receive, in place
+ * of a run of ordinary protocol bytes, a frame
+ *
+ *     ZLIB <raw_len> <zlib_len>\n<zlib_len bytes of zlib data>
+ *
+ * that inflates to exactly the raw_len bytes it replaces: whole lines and
+ * whole REPAIR/FILE frames, never part of one. Mailbox catch-up, search
+ * results and multicast repairs are sent this way once they reach
+ * ZFRAME_MIN_BYTES, and room messages once they reach ZFRAME_LIVE_MIN.
+ * Each batch is compressed once however many clients it goes to, and
+ * repair batches are cached so that receivers asking for the same range
+ * get the same compressed bytes.
+ */
+#ifndef ZFRAME_H
+#define ZFRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/uio.h>
+
+#define ZFRAME_CAP_TOKEN "+zlib"
+#define ZFRAME_ACK "COMPRESS zlib\n"   // server's answer when it will send ZLIB frames
+#define ZFRAME_MIN_BYTES 512
+#define ZFRAME_LIVE_MIN 4096
+#define ZFRAME_LEVEL 1   // 4-5x faster than 6 for about 12% more bytes: it runs on the event loop
+#define ZFRAME_HEADER_MAX 48
+#define ZFRAME_CACHE_SLOTS 8
+
+/**
+ * @brief A compressed frame, header included, ready to send.
+ */
+typedef struct {
+    char *data;        /**< "ZLIB ..." header followed by the compressed bytes. */
+    size_t len;        /**< Bytes in data. */
+    size_t cap;        /**< Size of the allocation. */
+    size_t raw_len;    /**< Bytes the frame inflates to. */
+} zframe_t;
+
+/**
+ * @brief A few compressed batches, looked up by a caller-defined key.
+ */
+typedef struct {
+    struct {
+        uint64_t key[3];
+        zframe_t frame;    /**< frame.data is NULL when the slot is empty. */
+        uint64_t used;     /**< Clock value of the last lookup, for LRU eviction. */
+    } slots[ZFRAME_CACHE_SLOTS];
+    uint64_t clock;
+    uint64_t hits;
+    uint64_t misses;
+} zframe_cache_t;
+
+/**
+ * @brief Compress a batch into a frame.
+ * @param z Frame to fill; released with zframe_free().
+ * @param iov Batch bytes.
+ * @param iovcnt Number of buffers.
+ * @return 0, or -1 if out of memory or if compression would not make the batch smaller.
+ */
+int zframe_build(zframe_t *z, const struct iovec *iov, int iovcnt);
+
+/**
+ * @brief Release a frame's buffer.
+ * @param z Frame (an empty one is ignored).
+ */
+void zframe_free(zframe_t *z);
+
+/**
+ * @brief Count a frame as sent to one client. Safe to call from any thread.
+ * @param z Frame that was sent.
+ */
+void zframe_sent(const zframe_t *z);
+
+/**
+ * @brief Look up a cached frame.
+ * @param c Cache.
+ * @param key Key the frame was stored under.
+ * @return The frame, or NULL on a miss.
+ */
+const zframe_t *zframe_cache_get(zframe_cache_t *c, const uint64_t key[3]);
+
+/**
+ * @brief Store a frame, evicting the least recently used one if the cache is full.
+ * @param c Cache.
+ * @param key Key to store it under.
+ * @param z Frame; the cache takes ownership of its buffer.
+ * @return The cached frame.
+ */
+const zframe_t *zframe_cache_put(zframe_cache_t *c, const uint64_t key[3], zframe_t *z);
+
+/**
+ * @brief Release every frame in a cache.
+ * @param c Cache.
+ */
+void zframe_cache_clear(zframe_cache_t *c);
+
+/**
+ * @brief Print compression counters: batches, ratio, CPU time and bytes saved on the wire.
+ * @param out Output stream.
+ */
+void zframe_print_stats(FILE *out);
+
+#endif // ZFRAME_H